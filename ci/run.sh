@@ -15,6 +15,10 @@ if [[ -n "${RUST_ENABLED:-}" ]]; then
   cmake_cmd+=( -DHAVE_RUST=yes -DRUST_VERBOSE_BUILD=yes )
 fi
 
+if [[ -n "${PROFILE_ENABLED:-}" ]]; then
+  cmake_cmd+=( -DHAVE_PROFILE=yes )
+fi
+
 export RUST_BACKTRACE=full
 export CTEST_OUTPUT_ON_FAILURE=1
 
@@ -17,6 +17,10 @@
 
 /*
  * buf: a buffer base for contiguous buffers that can be pooled together
+ *
+ * Buffers come in size classes, each twice as large as the previous one and
+ * starting at buf_init_size. Every class has its own pool, so a buffer grown
+ * by dbuf goes back to the pool of its size rather than being freed.
  */
 
 #pragma once
@@ -40,7 +44,8 @@ extern "C" {
 /*          name            type                default             description */
 #define BUF_OPTION(ACTION)                                                                       \
     ACTION( buf_init_size,  OPTION_TYPE_UINT,   BUF_DEFAULT_SIZE,   "init buf size incl header" )\
-    ACTION( buf_poolsize,   OPTION_TYPE_UINT,   BUF_POOLSIZE,       "buf pool size"             )
+    ACTION( buf_poolsize,   OPTION_TYPE_UINT,   BUF_POOLSIZE,       "buf pool size per class"   )\
+    ACTION( buf_nclass,     OPTION_TYPE_UINT,   BUF_DEFAULT_NCLASS, "# buf size classes"        )
 
 typedef struct {
     BUF_OPTION(OPTION_DECLARE)
@@ -62,22 +67,35 @@ typedef struct {
     BUF_METRIC(METRIC_DECLARE)
 } buf_metrics_st;
 
+/* kept for each size class and named buf_<size>_<suffix>, e.g. buf_16k_curr */
+/*          suffix  type            description */
+#define BUF_CLASS_METRIC(ACTION)                            \
+    ACTION( curr,   METRIC_GAUGE,   "# buf allocated"      )\
+    ACTION( active, METRIC_GAUGE,   "# buf in use/borrowed")
+
+#define BUF_CLASS_METRIC_COUNT(_suffix, _type, _description) + 1
+#define BUF_CLASS_NMETRIC (0 BUF_CLASS_METRIC(BUF_CLASS_METRIC_COUNT))
+
 struct buf {
     STAILQ_ENTRY(buf) next;     /* next buf in pool */
     char              *rpos;    /* read marker */
     char              *wpos;    /* write marker */
     char              *end;     /* end of buffer */
     bool              free;     /* is this buf free? */
+    bool              borrowed; /* is this buf borrowed from a pool? */
     char              begin[];  /* beginning of buffer */
 };
 
 #define BUF_HDR_SIZE       offsetof(struct buf, begin)
 #define BUF_DEFAULT_SIZE   16 * KiB
 #define BUF_POOLSIZE       0    /* unlimited */
+#define BUF_DEFAULT_NCLASS 9    /* with 16KiB default size, up to 4 MiB */
+#define BUF_NCLASS_MAX     16
 
 STAILQ_HEAD(buf_sqh, buf); /* corresponding header type for the STAILQ */
 
 extern uint32_t buf_init_size;
+extern uint32_t buf_nclass;
 extern buf_metrics_st *buf_metrics;
 
 #define BUF_INIT_SIZE (16 * KiB)
@@ -101,6 +119,17 @@ void buf_return(struct buf **buf);
 struct buf *buf_create(void);
 void buf_destroy(struct buf **buf);
 
+/*
+ * Move data into a buffer of the given size, keeping read/write offsets. A
+ * borrowed buffer is swapped with one borrowed from the pool of that size
+ * class, and the old one goes back to the pool of its own class. A created
+ * buffer never enters a pool, so it is resized in place with realloc.
+ */
+rstatus_i buf_move(struct buf **buf, uint32_t size);
+
+/* Metrics of all size classes, BUF_CLASS_NMETRIC per class */
+struct metric *buf_class_metrics(unsigned int *nmetric);
+
 /* Size of data that has yet to be read */
 static inline uint32_t
 buf_rsize(const struct buf *buf)
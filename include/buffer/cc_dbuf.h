@@ -55,7 +55,10 @@ typedef struct {
 void dbuf_setup(dbuf_options_st *options, dbuf_metrics_st *metrics);
 void dbuf_teardown(void);
 
-/* Buffer resizing functions */
+/*
+ * Buffer resizing functions, which move data into a buf of another size class
+ * (see cc_buf.h). A buf cannot grow beyond the largest size class.
+ */
 rstatus_i dbuf_double(struct buf **buf); /* 2x size, slightly >2x capacity */
 /* shrink to initial size or content size, whichever is larger */
 rstatus_i dbuf_shrink(struct buf **buf);
@@ -28,17 +28,30 @@ extern "C" {
 #include <stdint.h>
 #include <stddef.h>
 
-#define NELEM_DELTA 16
+#define NELEM_DELTA         0           /* no cap on growth */
+#define ARRAY_GROWTH_FACTOR 2.0
+#define ARRAY_MREMAP_SIZE   (1024 * 1024)
 
-
-/*          name                type                default           description */
-#define ARRAY_OPTION(ACTION)                                                                              \
-    ACTION( array_nelem_delta,  OPTION_TYPE_UINT,   NELEM_DELTA,      "max nelem delta during expansion" )
+/*
+ * Growth policy: a full array grows to nalloc * array_growth_factor elements,
+ * but by no more than array_nelem_delta elements if that is not 0, so pushing
+ * N elements copies O(N) bytes overall unless a cap is set. Once the data
+ * reaches array_mremap_size bytes, it moves to an mmap'd region that grows
+ * with mremap, which remaps pages instead of copying them (Linux; elsewhere
+ * this falls back to copying).
+ */
+/*          name                    type                default                 description */
+#define ARRAY_OPTION(ACTION)                                                                                            \
+    ACTION( array_nelem_delta,      OPTION_TYPE_UINT,   NELEM_DELTA,            "max nelem delta during expansion, 0: no cap")\
+    ACTION( array_growth_factor,    OPTION_TYPE_FPN,    ARRAY_GROWTH_FACTOR,    "nalloc growth factor during expansion"     )\
+    ACTION( array_mremap_size,      OPTION_TYPE_UINT,   ARRAY_MREMAP_SIZE,      "data size to grow with mremap, 0: never"   )
 
 typedef struct {
     ARRAY_OPTION(OPTION_DECLARE)
 } array_options_st;
 
+struct arena;
+
 typedef int (*array_compare_fn)(const void *, const void *);
 typedef rstatus_i (*array_each_fn)(void *, void *);
 
@@ -47,6 +60,8 @@ struct array {
     uint32_t nalloc;    /* # allocated element */
     uint32_t nelem;     /* # element */
     uint8_t  *data;     /* elements */
+    struct arena *arena; /* where data comes from, NULL for the heap */
+    size_t   nmap;      /* bytes mapped for data, 0 if it is not mmap'd */
 };
 
 
@@ -82,6 +97,8 @@ array_reset(struct array *arr)
     arr->nalloc = 0;
     arr->nelem = 0;
     arr->data = NULL;
+    arr->arena = NULL;
+    arr->nmap = 0;
 }
 
 /* initialize arry of given size parameters and allocated data memory */
@@ -92,6 +109,8 @@ array_data_assign(struct array *arr, uint32_t nalloc, size_t size, void *data)
     arr->nalloc = nalloc;
     arr->nelem = 0;
     arr->data = data;
+    arr->arena = NULL;
+    arr->nmap = 0;
 }
 
 /**
@@ -135,7 +154,20 @@ void array_data_destroy(struct array *arr);
 rstatus_i array_create(struct array **arr, uint32_t nalloc, size_t size);
 void array_destroy(struct array **arr);
 
+/*
+ * same as above with memory taken from an arena, including later expansion;
+ * destroying such an array is optional, the memory goes with the arena
+ */
+rstatus_i array_data_create_arena(struct array *arr, uint32_t nalloc, size_t size, struct arena *arena);
+rstatus_i array_create_arena(struct array **arr, uint32_t nalloc, size_t size, struct arena *arena);
+
 void *array_push(struct array *arr);
+/* make room for at least n more elements without changing nelem */
+rstatus_i array_reserve(struct array *arr, uint32_t n);
+/* add n elements in place, returns the first one for the caller to fill */
+void *array_push_n(struct array *arr, uint32_t n);
+/* copy n elements from elem to the end of the array */
+rstatus_i array_append(struct array *arr, const void *elem, uint32_t n);
 void *array_pop(struct array *arr);
 void array_sort(struct array *arr, array_compare_fn compare);
 uint32_t array_each(struct array *arr, array_each_fn func, void *arg, err_i *err);
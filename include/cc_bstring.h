@@ -29,6 +29,8 @@ extern "C" {
 #include <stdlib.h>
 #include <string.h>
 
+#define BSTRING_DELIM_MAX 16 /* delimiters bstring_find_any/token can take */
+
 /* TODO(yao): separate byte string related functionalities into cc_bstring */
 struct bstring {
     uint32_t len;   /* string length */
@@ -55,89 +57,198 @@ rstatus_i bstring_duplicate(struct bstring *dst, const struct bstring *src);
 rstatus_i bstring_copy(struct bstring *dst, const char *src, uint32_t srclen);
 int bstring_compare(const struct bstring *s1, const struct bstring *s2);
 
+/* header and data come from a single allocation */
 struct bstring *bstring_alloc(uint32_t size);
 void bstring_free(struct bstring **bstring);
 
-/* efficient implementation of string comparion of short strings */
+/*
+ * the same with memory from an arena (see cc_mm.h), which is released with
+ * the arena; such strings must not be passed to bstring_deinit/bstring_free
+ */
+struct arena;
+rstatus_i bstring_copy_arena(struct bstring *dst, const char *src, uint32_t srclen, struct arena *arena);
+rstatus_i bstring_duplicate_arena(struct bstring *dst, const struct bstring *src, struct arena *arena);
+struct bstring *bstring_alloc_arena(uint32_t size, struct arena *arena);
+
+/*
+ * Small-string-optimized byte string: strings of up to BSTRING_SSO_CAP bytes
+ * are stored inside the 24-byte struct itself, longer ones on the heap, so
+ * copying or duplicating a short key (the common case) allocates nothing.
+ * The last byte tells the two apart: for an inline string it holds the
+ * inline space left (BSTRING_SSO_CAP - len, 0..23), for a heap string it is
+ * BSTRING_SSO_HEAP. bstring_sso_bstr() gives a struct bstring view for use
+ * with the rest of the API.
+ */
+#define BSTRING_SSO_SIZE    24
+#define BSTRING_SSO_CAP     (BSTRING_SSO_SIZE - 1)
+#define BSTRING_SSO_HEAP    ((uint8_t)0xff)
+
+struct bstring_sso {
+    union {
+        struct {
+            char        *data;
+            uint32_t    len;
+        } heap;
+        char            buf[BSTRING_SSO_SIZE];
+    } u;
+};
+
+static inline bool
+bstring_sso_inline(const struct bstring_sso *str)
+{
+    return (uint8_t)str->u.buf[BSTRING_SSO_CAP] != BSTRING_SSO_HEAP;
+}
+
+static inline uint32_t
+bstring_sso_len(const struct bstring_sso *str)
+{
+    return bstring_sso_inline(str) ?
+        BSTRING_SSO_CAP - (uint8_t)str->u.buf[BSTRING_SSO_CAP] :
+        str->u.heap.len;
+}
+
+static inline char *
+bstring_sso_data(struct bstring_sso *str)
+{
+    return bstring_sso_inline(str) ? str->u.buf : str->u.heap.data;
+}
+
+static inline struct bstring
+bstring_sso_bstr(struct bstring_sso *str)
+{
+    return (struct bstring){ bstring_sso_len(str), bstring_sso_data(str) };
+}
+
+void bstring_sso_init(struct bstring_sso *str);
+void bstring_sso_deinit(struct bstring_sso *str);
+/* dst must be empty (initialized or deinitialized) */
+rstatus_i bstring_sso_copy(struct bstring_sso *dst, const char *src, uint32_t srclen);
+rstatus_i bstring_sso_duplicate(struct bstring_sso *dst, const struct bstring_sso *src);
+int bstring_sso_compare(const struct bstring_sso *s1, const struct bstring_sso *s2);
+
+/*
+ * unaligned loads in native byte order; memcpy of a constant size compiles to
+ * a single move on platforms that allow unaligned access
+ */
+static inline uint16_t
+cc_load16(const void *p)
+{
+    uint16_t v;
+
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+static inline uint32_t
+cc_load32(const void *p)
+{
+    uint32_t v;
+
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+static inline uint64_t
+cc_load64(const void *p)
+{
+    uint64_t v;
+
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+/*
+ * efficient implementation of string comparion of short strings: m must have
+ * at least as many readable bytes as are compared.
+ *
+ * On little-endian machines, bytes are compared 2, 4 or 8 at a time against
+ * a word assembled from the constants at compile time, which takes about half
+ * the cycles of comparing them one by one; the generic version below is used
+ * everywhere else.
+ */
 #define str2cmp(m, c0, c1)                                                     \
     (m[0] == c0 && m[1] == c1)
 
 #define str3cmp(m, c0, c1, c2)                                                 \
     (m[0] == c0 && m[1] == c1 && m[2] == c2)
 
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+
+#define _strword16(c0, c1)                                                     \
+    ((uint16_t)((uint8_t)(c1) << 8 | (uint8_t)(c0)))
+
+#define _strword32(c0, c1, c2, c3)                                             \
+    ((uint32_t)(uint8_t)(c3) << 24 | (uint32_t)(uint8_t)(c2) << 16 |           \
+        (uint32_t)(uint8_t)(c1) << 8 | (uint32_t)(uint8_t)(c0))
+
+#define _strword64(c0, c1, c2, c3, c4, c5, c6, c7)                             \
+    ((uint64_t)_strword32(c4, c5, c6, c7) << 32 | _strword32(c0, c1, c2, c3))
+
 #define str4cmp(m, c0, c1, c2, c3)                                             \
-    ((m[0] << 24 | m[1] << 16 | m[2] << 8 | m[3]) ==                           \
-        ((c0 << 24) | (c1 << 16) | (c2 << 8) | c3))
+    (cc_load32(m) == _strword32(c0, c1, c2, c3))
 
 #define str5cmp(m, c0, c1, c2, c3, c4)                                         \
     (str4cmp(m, c0, c1, c2, c3) && (m[4] == c4))
 
 #define str6cmp(m, c0, c1, c2, c3, c4, c5)                                     \
-    (str5cmp(m, c0, c1, c2, c3, c4) && m[5] == c5)
+    (str4cmp(m, c0, c1, c2, c3) &&                                             \
+        cc_load16((m) + 4) == _strword16(c4, c5))
 
 #define str7cmp(m, c0, c1, c2, c3, c4, c5, c6)                                 \
-    (str6cmp(m, c0, c1, c2, c3, c4, c5) && m[6] == c6)
+    (str6cmp(m, c0, c1, c2, c3, c4, c5) && (m[6] == c6))
 
 #define str8cmp(m, c0, c1, c2, c3, c4, c5, c6, c7)                             \
-    (str4cmp(m, c0, c1, c2, c3) &&                                             \
-        (m[4] << 24 | m[5] << 16 | m[6] << 8 | m[7]) ==                        \
-        ((c4 << 24) | (c5 << 16) | (c6 << 8) | c7))
+    (cc_load64(m) == _strword64(c0, c1, c2, c3, c4, c5, c6, c7))
 
 #define str9cmp(m, c0, c1, c2, c3, c4, c5, c6, c7, c8)                         \
     (str8cmp(m, c0, c1, c2, c3, c4, c5, c6, c7) && m[8] == c8)
 
 #define str10cmp(m, c0, c1, c2, c3, c4, c5, c6, c7, c8, c9)                    \
-    (str9cmp(m, c0, c1, c2, c3, c4, c5, c6, c7, c8) && m[9] == c9)
+    (str8cmp(m, c0, c1, c2, c3, c4, c5, c6, c7) &&                             \
+        cc_load16((m) + 8) == _strword16(c8, c9))
 
 #define str11cmp(m, c0, c1, c2, c3, c4, c5, c6, c7, c8, c9, c10)               \
-    (str10cmp(m, c0, c1, c2, c3, c4, c5, c6, c7, c8, c9) && m[10] == c10)
+    (str10cmp(m, c0, c1, c2, c3, c4, c5, c6, c7, c8, c9) && (m[10] == c10))
 
 #define str12cmp(m, c0, c1, c2, c3, c4, c5, c6, c7, c8, c9, c10, c11)          \
     (str8cmp(m, c0, c1, c2, c3, c4, c5, c6, c7) &&                             \
-        (m[8] << 24 | m[9] << 16 | m[10] << 8 | m[11]) ==                      \
-        ((c8 << 24) | (c9 << 16) | (c10 << 8) | c11))
+        cc_load32((m) + 8) == _strword32(c8, c9, c10, c11))
 
-/* below is a more efficient implementation for little-endian only, it takes
- * about 50% the cycles compared to the generic implementation above in the
- * extreme cases (e.g. string length being multiples of 4), however, our
- * profiling showed that string comparison does not contribute meaningfully to
- * overall processing cost, both events and hashes are far more notable, and
- * therefore we can choose the generic implementation until profiling results
- * indicate otherwise.
- */
+#else
 
-/*
 #define str4cmp(m, c0, c1, c2, c3)                                             \
-    (*(uint32_t *) m == ((c3 << 24) | (c2 << 16) | (c1 << 8) | c0))
+    ((m[0] << 24 | m[1] << 16 | m[2] << 8 | m[3]) ==                           \
+        ((c0 << 24) | (c1 << 16) | (c2 << 8) | c3))
 
 #define str5cmp(m, c0, c1, c2, c3, c4)                                         \
     (str4cmp(m, c0, c1, c2, c3) && (m[4] == c4))
 
 #define str6cmp(m, c0, c1, c2, c3, c4, c5)                                     \
-    (str4cmp(m, c0, c1, c2, c3) &&                                             \
-        (((uint32_t *) m)[1] & 0xffff) == ((c5 << 8) | c4))
+    (str5cmp(m, c0, c1, c2, c3, c4) && m[5] == c5)
 
 #define str7cmp(m, c0, c1, c2, c3, c4, c5, c6)                                 \
-    (str6cmp(m, c0, c1, c2, c3, c4, c5) && (m[6] == c6))
+    (str6cmp(m, c0, c1, c2, c3, c4, c5) && m[6] == c6)
 
 #define str8cmp(m, c0, c1, c2, c3, c4, c5, c6, c7)                             \
     (str4cmp(m, c0, c1, c2, c3) &&                                             \
-        (((uint32_t *) m)[1] == ((c7 << 24) | (c6 << 16) | (c5 << 8) | c4)))
+        (m[4] << 24 | m[5] << 16 | m[6] << 8 | m[7]) ==                        \
+        ((c4 << 24) | (c5 << 16) | (c6 << 8) | c7))
 
 #define str9cmp(m, c0, c1, c2, c3, c4, c5, c6, c7, c8)                         \
     (str8cmp(m, c0, c1, c2, c3, c4, c5, c6, c7) && m[8] == c8)
 
 #define str10cmp(m, c0, c1, c2, c3, c4, c5, c6, c7, c8, c9)                    \
-    (str8cmp(m, c0, c1, c2, c3, c4, c5, c6, c7) &&                             \
-        (((uint32_t *) m)[2] & 0xffff) == ((c9 << 8) | c8))
+    (str9cmp(m, c0, c1, c2, c3, c4, c5, c6, c7, c8) && m[9] == c9)
 
 #define str11cmp(m, c0, c1, c2, c3, c4, c5, c6, c7, c8, c9, c10)               \
-    (str10cmp(m, c0, c1, c2, c3, c4, c5, c6, c7, c8, c9) && (m[10] == c10))
+    (str10cmp(m, c0, c1, c2, c3, c4, c5, c6, c7, c8, c9) && m[10] == c10)
 
 #define str12cmp(m, c0, c1, c2, c3, c4, c5, c6, c7, c8, c9, c10, c11)          \
     (str8cmp(m, c0, c1, c2, c3, c4, c5, c6, c7) &&                             \
-        (((uint32_t *) m)[2] == ((c11 << 24) | (c10 << 16) | (c9 << 8) | c8)))
-*/
+        (m[8] << 24 | m[9] << 16 | m[10] << 8 | m[11]) ==                      \
+        ((c8 << 24) | (c9 << 16) | (c10 << 8) | c11))
+
+#endif
 
 /*
  * Wrapper around common routines for manipulating C character strings
@@ -168,6 +279,59 @@ void bstring_free(struct bstring **bstring);
     bcmp((char *)(_s1), (char *)(_s2), (size_t)(_n))
 
 
+/*
+ * returns true if str starts with prefix; compares 8 bytes at a time, which
+ * beats memcmp's call overhead on the short prefixes protocol parsers match
+ */
+static inline bool
+bstring_prefix(const struct bstring *str, const struct bstring *prefix)
+{
+    const char *p = str->data, *q = prefix->data;
+    uint32_t n = prefix->len;
+
+    if (str->len < n) {
+        return false;
+    }
+
+    for (; n >= 8; n -= 8, p += 8, q += 8) {
+        if (cc_load64(p) != cc_load64(q)) {
+            return false;
+        }
+    }
+    if (n >= 4) {
+        if (cc_load32(p) != cc_load32(q)) {
+            return false;
+        }
+        n -= 4, p += 4, q += 4;
+    }
+    for (; n > 0; n--, p++, q++) {
+        if (*p != *q) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+/*
+ * search primitives for parsers, vectorized with SSE2/AVX2 where available;
+ * each returns a pointer into str->data, or NULL if there is no match
+ */
+/* first c in str */
+char *bstring_find_char(const struct bstring *str, char c);
+/* the '\r' of the first "\r\n" in str */
+char *bstring_find_crlf(const struct bstring *str);
+/* first byte of str that is any of the ndelim delimiters */
+char *bstring_find_any(const struct bstring *str, const char *delim, uint32_t ndelim);
+
+/*
+ * splits the next token off str: token is set to the bytes before the first
+ * delimiter (all of str if there is none), str to the bytes after it. Like
+ * strsep, adjacent delimiters yield empty tokens. Returns false, leaving
+ * token untouched, once str is empty.
+ */
+bool bstring_token(struct bstring *token, struct bstring *str, const char *delim, uint32_t ndelim);
+
 /* bstring to uint conversion */
 rstatus_i bstring_atou64(uint64_t *u64, struct bstring *str);
 rstatus_i bstring_atoi64(int64_t *i64, struct bstring *str);
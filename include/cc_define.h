@@ -51,6 +51,18 @@ extern "C" {
 # define CC_ACCEPT4 1
 #endif
 
+#ifdef HAVE_EVENTFD
+# define CC_EVENTFD 1
+#endif
+
+#ifdef HAVE_ZEROCOPY
+# define CC_ZEROCOPY 1
+#endif
+
+#ifdef HAVE_SPLICE
+# define CC_SPLICE 1
+#endif
+
 #ifdef HAVE_DEBUG_MM
 #define CC_DEBUG_MM 1
 #endif
@@ -59,6 +71,10 @@ extern "C" {
 #define CC_ITT 1
 #endif
 
+#ifdef HAVE_PROFILE
+#define CC_PROFILE 1
+#endif
+
 #define CC_OK        0
 #define CC_ERROR    -1
 
@@ -23,6 +23,7 @@ extern "C" {
 
 #include <cc_define.h>
 #include <cc_metric.h>
+#include <cc_option.h>
 
 #include <inttypes.h>
 
@@ -30,12 +31,25 @@ extern "C" {
 #define EVENT_WRITE 0x00ff00
 #define EVENT_ERR   0xff0000
 
+#define EVENT_BUSY_POLL 0 /* no busy polling */
+
+/*          name                type                default             description */
+#define EVENT_OPTION(ACTION)                                                                    \
+    ACTION( event_busy_poll,    OPTION_TYPE_UINT,   EVENT_BUSY_POLL,    "busy poll budget usec" )
+
+typedef struct {
+    EVENT_OPTION(OPTION_DECLARE)
+} event_options_st;
+
 /*          name                type            description */
 #define EVENT_METRIC(ACTION)                                            \
     ACTION( event_total,        METRIC_COUNTER, "# events returned"    )\
     ACTION( event_loop,         METRIC_COUNTER, "# event loop returns" )\
     ACTION( event_read,         METRIC_COUNTER, "# reads registered"   )\
-    ACTION( event_write,        METRIC_COUNTER, "# writes registered"  )
+    ACTION( event_write,        METRIC_COUNTER, "# writes registered"  )\
+    ACTION( event_spin,         METRIC_COUNTER, "# polls while spinning")\
+    ACTION( event_spin_hit,     METRIC_COUNTER, "# waits served by spin")\
+    ACTION( event_spin_block,   METRIC_COUNTER, "# waits blocked after spin")
 
 typedef struct {
     EVENT_METRIC(METRIC_DECLARE)
@@ -45,7 +59,7 @@ typedef void (*event_cb_fn)(void *, uint32_t);  /* event callback */
 
 struct event_base;
 
-void event_setup(event_metrics_st *metrics);
+void event_setup(event_options_st *options, event_metrics_st *metrics);
 void event_teardown(void);
 
 /* event base */
@@ -70,6 +84,19 @@ int event_del(struct event_base *evb, int fd);
 /* event wait */
 int event_wait(struct event_base *evb, int timeout);
 
+/*
+ * busy poll: when budget (in usec) is non-zero, event_wait first polls with a
+ * zero timeout until events arrive or the budget runs out, and only then
+ * blocks for what is left of its timeout. This trades a core for lower wakeup
+ * latency, and pairs well with tcp_busy_poll on the sockets being watched.
+ * New event bases start with the event_busy_poll option as their budget.
+ *
+ * Besides the module-wide event_spin_* metrics, each event base counts waits
+ * served by spinning versus blocking, which is read with event_base_spin_stats.
+ */
+void event_base_busy_poll(struct event_base *evb, uint32_t budget);
+void event_base_spin_stats(struct event_base *evb, uint64_t *nhit, uint64_t *nblock);
+
 #ifdef __cplusplus
 }
 #endif
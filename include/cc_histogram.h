@@ -6,6 +6,7 @@ extern "C" {
 
 #include <pthread.h>
 #include <stdbool.h>
+#include <stddef.h>
 #include <stdint.h>
 
 typedef enum histo_rstatus {
@@ -14,8 +15,16 @@ typedef enum histo_rstatus {
     HISTO_EUNDERFLOW = -2,
     HISTO_EEMPTY     = -3,
     HISTO_EORDER     = -4,
+    HISTO_EFORMAT    = -5, /* malformed serialized histogram */
+    HISTO_EMISMATCH  = -6, /* histograms configured with different m, r, n */
 } histo_rstatus_e;
 
+/* buckets are summarized in blocks of HISTO_BLOCK_SIZE, which allows percentile
+ * lookup to skip over whole blocks instead of visiting every bucket
+ */
+#define HISTO_BLOCK_SHIFT   6
+#define HISTO_BLOCK_SIZE    (1 << HISTO_BLOCK_SHIFT)
+
 struct percentile_profile
 {
     uint8_t cap;       /* number of percentiles that can be lookedup at once */
@@ -26,75 +35,186 @@ struct percentile_profile
     uint64_t max;      /* max value */
 };
 
-struct histo_u32
-{
-    /* the following variables are configurable */
-    uint32_t m;
-    uint32_t r;
-    uint32_t n;
-
-    /* the following variables are computed from those above */
-    uint64_t M; /* Minimum Resolution: 2^m */
-    uint64_t R; /* Minimum Resolution Range: 2^r - 1 */
-    uint64_t N; /* Maximum Value: 2^n - 1 */
-    uint64_t G; /* Grouping Factor: 2^(r-m-1) */
-    uint64_t nbucket;  /* total number of buckets: (n-r+2)*G */
-
-    /* we are treating integer operations as atomic (under relaxed constraint
-     * and when there's only one writer), this is true on x86
-     */
-    uint64_t nrecord;  /* total number of records */
-    uint32_t *buckets; /* buckets where counts are kept as uint32_t */
-
-    /* these are only used for producer/consumer style access */
-    // pthread_spinlock_t lock;
-};
-
-/* APIs */
-struct histo_u32 *histo_u32_create(uint32_t m, uint32_t r, uint32_t n);
-void histo_u32_destroy(struct histo_u32 **h);
-
 struct percentile_profile *percentile_profile_create(uint8_t cap);
 void percentile_profile_destroy(struct percentile_profile **pp);
 histo_rstatus_e percentile_profile_set(struct percentile_profile *pp, const double *percentile, uint8_t count);
 
 static inline uint64_t
-bucket_low(const struct histo_u32 *h, uint64_t bucket)
+_bucket_low(uint32_t m, uint32_t r, uint64_t G, uint64_t bucket)
 {
-    uint64_t g = bucket >> (h->r - h->m - 1); /* bucket offset in terms of G */
-    uint64_t b = bucket - g * h->G;
+    uint64_t g = bucket >> (r - m - 1); /* bucket offset in terms of G */
+    uint64_t b = bucket - g * G;
+
+    /* first group has a different formula, whose shifts would be negative */
+    if (g == 0) {
+        return (1ULL << m) * b;
+    }
 
-    /* first group has a different formula */
-    return (g == 0) * ((1 << h->m) * b) +
-        (g > 0) * ((1 << (h->r + g - 2)) + (1 << (h->m + g - 1)) * b);
+    return (1ULL << (r + g - 2)) + (1ULL << (m + g - 1)) * b;
 }
 
 static inline uint64_t
-bucket_high(const struct histo_u32 *h, uint64_t bucket)
+_bucket_high(uint32_t m, uint32_t r, uint64_t G, uint64_t bucket)
 {
-    uint64_t g = bucket >> (h->r - h->m - 1); /* offset as multiplers of G */
-    uint64_t b = bucket - g * h->G + 1; /* the next bucket */
+    uint64_t g = bucket >> (r - m - 1); /* offset as multiplers of G */
+    uint64_t b = bucket - g * G + 1; /* the next bucket */
 
-    /* first group has a different formula */
-    return (g == 0) * ((1 << h->m) * b - 1) +
-        (g > 0) * ((1 << (h->r + g - 2)) + (1 << (h->m + g - 1)) * b - 1);
+    /* first group has a different formula, whose shifts would be negative */
+    if (g == 0) {
+        return (1ULL << m) * b - 1;
+    }
+
+    return (1ULL << (r + g - 2)) + (1ULL << (m + g - 1)) * b - 1;
 }
 
-/************************
- * Non-thread-safe APIs *
- ************************/
-void histo_u32_reset(struct histo_u32 *h);
-histo_rstatus_e histo_u32_record(struct histo_u32 *h, uint64_t value, uint32_t count);
-/* the following functions return the bucket for the percentile(s) requested.
+/* Histograms come in variants that differ in the type of bucket counters:
+ * - histo_u32: uint32_t buckets, compact and sufficient when the histogram is
+ *   reset or rotated often enough that no bucket exceeds 2^32-1 records;
+ * - histo_u64: uint64_t buckets, twice the memory but never wraps in practice.
+ *
+ * Each variant provides the same set of types and functions, generated by
+ * HISTO_DECLARE/HISTO_DEFINE with the suffix and bucket type as arguments, e.g.
+ * struct histo_u64, histo_u64_create, histo_u64_record... In the descriptions
+ * below, histo_T stands for any variant.
+ *
+ * Recording comes in two flavors, also chosen at compile time by calling one or
+ * the other:
+ * - histo_T_record: for a single writer, which is the common case;
+ * - histo_T_record_atomic: for multiple concurrent writers, buckets and counts
+ *   are updated with relaxed atomic operations. Reporting concurrently returns
+ *   a result that is consistent within the accuracy of the histogram.
+ * Both refuse to record (HISTO_EOVERFLOW) a count that would wrap a bucket.
+ *
+ * Serialization: a histogram is encoded as a version byte, followed by m, r,
+ * n, nrecord and the number of non-empty buckets, then for every non-empty
+ * bucket its distance from the previous non-empty bucket and its count. All
+ * integers are unsigned LEB128 varints, so empty buckets cost nothing and a
+ * typical latency histogram encodes in a few hundred bytes.
+ *
+ * The encoding is exact, so histograms collected from many processes can be
+ * merged and queried to get percentiles over the combined distribution. It
+ * does not depend on the bucket type either, e.g. histo_u32 collected from
+ * many processes can be merged into one histo_u64 on an aggregator.
+ *
+ * Deserialize and merge validate the whole input before touching the
+ * histogram: on error, the histogram is left unchanged. Merging fails with
+ * HISTO_EOVERFLOW if any bucket count would wrap around.
+ *
+ * A sliding window (struct histo_T_window) covers the most recent nslot
+ * intervals, each of which is kept in its own sub-histogram. Values are
+ * recorded into both the current slot and the running total, which is what
+ * percentile queries should be run against, e.g.
+ * histo_u32_report(&bucket, w->total, 99.0).
+ *
+ * The caller decides the interval by calling histo_T_window_rotate
+ * periodically, e.g. from a recurring timing wheel event. Rotation drops the
+ * oldest slot by subtracting it from the total, so the cost is proportional to
+ * the number of non-empty blocks in that slot instead of all buckets * nslot.
+ */
+#define HISTO_SERIAL_VERSION 1
+
+#define HISTO_DECLARE(_sfx, _type)                                             \
+struct histo_##_sfx                                                            \
+{                                                                              \
+    /* the following variables are configurable */                             \
+    uint32_t m;                                                                \
+    uint32_t r;                                                                \
+    uint32_t n;                                                                \
+                                                                               \
+    /* the following variables are computed from those above */                \
+    uint64_t M; /* Minimum Resolution: 2^m */                                  \
+    uint64_t R; /* Minimum Resolution Range: 2^r - 1 */                        \
+    uint64_t N; /* Maximum Value: 2^n - 1 */                                   \
+    uint64_t G; /* Grouping Factor: 2^(r-m-1) */                               \
+    uint64_t nbucket;  /* total number of buckets: (n-r+2)*G */                \
+    uint64_t nblock;   /* # summary blocks: nbucket/HISTO_BLOCK_SIZE */        \
+                                                                               \
+    /* we are treating integer operations as atomic (under relaxed constraint  \
+     * and when there's only one writer), this is true on x86                  \
+     */                                                                        \
+    uint64_t nrecord;  /* total number of records */                           \
+    _type *buckets;    /* buckets where counts are kept as _type */            \
+    uint64_t *blocks;  /* sum of counts for every HISTO_BLOCK_SIZE buckets */  \
+};                                                                             \
+                                                                               \
+struct histo_##_sfx##_window                                                   \
+{                                                                              \
+    uint32_t nslot;    /* number of intervals covered by the window */         \
+    uint32_t curr;     /* index of the slot being recorded into */             \
+    struct histo_##_sfx *total;  /* aggregate of all slots */                  \
+    struct histo_##_sfx **slot;  /* ring of per-interval sub-histograms */     \
+};                                                                             \
+                                                                               \
+/* APIs */                                                                     \
+struct histo_##_sfx *histo_##_sfx##_create(uint32_t m, uint32_t r,             \
+        uint32_t n);                                                           \
+void histo_##_sfx##_destroy(struct histo_##_sfx **h);                          \
+                                                                               \
+struct histo_##_sfx##_window *histo_##_sfx##_window_create(uint32_t m,         \
+        uint32_t r, uint32_t n, uint32_t nslot);                               \
+void histo_##_sfx##_window_destroy(struct histo_##_sfx##_window **w);          \
+                                                                               \
+static inline uint64_t                                                         \
+bucket_low_##_sfx(const struct histo_##_sfx *h, uint64_t bucket)               \
+{                                                                              \
+    return _bucket_low(h->m, h->r, h->G, bucket);                              \
+}                                                                              \
+                                                                               \
+static inline uint64_t                                                         \
+bucket_high_##_sfx(const struct histo_##_sfx *h, uint64_t bucket)              \
+{                                                                              \
+    return _bucket_high(h->m, h->r, h->G, bucket);                             \
+}                                                                              \
+                                                                               \
+/* Non-thread-safe APIs, except for histo_T_record_atomic */                   \
+void histo_##_sfx##_reset(struct histo_##_sfx *h);                             \
+histo_rstatus_e histo_##_sfx##_record(struct histo_##_sfx *h, uint64_t value,  \
+        _type count);                                                          \
+histo_rstatus_e histo_##_sfx##_record_atomic(struct histo_##_sfx *h,           \
+        uint64_t value, _type count);                                          \
+histo_rstatus_e histo_##_sfx##_report(uint64_t *bucket,                        \
+        const struct histo_##_sfx *h, double p);                               \
+histo_rstatus_e histo_##_sfx##_report_multi(struct percentile_profile *pp,     \
+        const struct histo_##_sfx *h);                                         \
+                                                                               \
+size_t histo_##_sfx##_serial_size(const struct histo_##_sfx *h);               \
+histo_rstatus_e histo_##_sfx##_serialize(uint8_t *buf, size_t nbuf,            \
+        size_t *len, const struct histo_##_sfx *h);                            \
+histo_rstatus_e histo_##_sfx##_deserialize(struct histo_##_sfx *h,             \
+        const uint8_t *buf, size_t len);                                       \
+histo_rstatus_e histo_##_sfx##_merge_serial(struct histo_##_sfx *h,            \
+        const uint8_t *buf, size_t len);                                       \
+histo_rstatus_e histo_##_sfx##_merge(struct histo_##_sfx *h,                   \
+        const struct histo_##_sfx *src);                                       \
+                                                                               \
+void histo_##_sfx##_window_reset(struct histo_##_sfx##_window *w);             \
+histo_rstatus_e histo_##_sfx##_window_record(struct histo_##_sfx##_window *w,  \
+        uint64_t value, _type count);                                          \
+void histo_##_sfx##_window_rotate(struct histo_##_sfx##_window *w);
+
+/*          suffix  bucket type */
+#define HISTO_TYPE(ACTION)          \
+    ACTION( u32,    uint32_t    )   \
+    ACTION( u64,    uint64_t    )
+
+HISTO_TYPE(HISTO_DECLARE)
+
+/* bucket_low/high predate the variants and are kept for histo_u32 */
+#define bucket_low(_h, _b)  bucket_low_u32(_h, _b)
+#define bucket_high(_h, _b) bucket_high_u32(_h, _b)
+
+/* The report functions return the bucket for the percentile(s) requested.
  * If the histogram is too sparse for the percentile specified, the next
  * (higher) non-empty bucket is returned.
  *
  * It is upon the caller to translate bucket to value(s), for example by using
  * bucket_low/high to get the value range.
+ *
+ * Lookups use the block summary to skip to the block containing the answer,
+ * and scan multiple buckets at a time within a block if built with AVX2.
+ *
+ * When using percentile_profile, min/max buckets are always updated/returned.
  */
-histo_rstatus_e histo_u32_report(uint64_t *bucket, const struct histo_u32 *h, double p);
-/* when using percentile_profile, min/max buckets are always updated/returned */
-histo_rstatus_e histo_u32_report_multi(struct percentile_profile *pp, const struct histo_u32 *h);
 
 #ifdef __cplusplus
 }
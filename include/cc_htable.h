@@ -0,0 +1,101 @@
+/*
+ * ccommon - a cache common library.
+ * Copyright (C) 2021 Twitter, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * An open-addressing hash table mapping struct bstring keys to pointers,
+ * laid out like a "Swiss table": slots come in groups of HTABLE_GROUP, and
+ * each slot has a control byte that is either empty, deleted, or 7 bits of
+ * the key's hash. A probe compares all control bytes of a group against the
+ * hash at once (SSE2 where available), so only slots whose 7 bits match get
+ * their keys compared, and a group with an empty slot ends the probe.
+ *
+ * Keys are not copied: the memory a key points to must stay valid and
+ * unchanged while the key is in the table. Values must not be NULL.
+ *
+ * When the table gets full, a table of twice the size is allocated and the
+ * entries move over incrementally: every put or delete moves a few groups
+ * until the old table is empty, while gets look in both. There is no single
+ * operation that rehashes the whole table.
+ */
+
+#pragma once
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <cc_bstring.h>
+#include <cc_define.h>
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#define HTABLE_GROUP    16  /* slots per group, one SSE2 register of ctrl */
+#define HTABLE_MIGRATE  2   /* groups moved to the new table per put/delete */
+
+typedef rstatus_i (*htable_each_fn)(const struct bstring *, void *, void *);
+
+struct htable_slot {
+    struct bstring  key;
+    void            *val;
+};
+
+struct htable_table {
+    uint8_t             *ctrl;          /* one byte per slot */
+    struct htable_slot  *slot;
+    uint32_t            ngroup;         /* power of 2 */
+    uint32_t            growth_left;    /* empty slots we may still fill */
+};
+
+struct htable {
+    struct htable_table cur;            /* all inserts go here */
+    struct htable_table old;            /* being migrated, if ctrl != NULL */
+    uint32_t            cursor;         /* next group of old to migrate */
+    uint32_t            nentry;
+};
+
+struct htable *htable_create(uint32_t nentry);
+void htable_destroy(struct htable **ht);
+
+/* insert or replace; CC_ENOMEM if the table cannot grow */
+rstatus_i htable_put(struct htable *ht, const struct bstring *key, void *val);
+/* NULL if key is absent */
+void *htable_get(const struct htable *ht, const struct bstring *key);
+/* returns the value removed, NULL if key is absent */
+void *htable_delete(struct htable *ht, const struct bstring *key);
+
+/*
+ * calls func on each entry as long as it returns CC_OK, and returns the
+ * status func failed with; the table must not be modified meanwhile
+ */
+rstatus_i htable_each(const struct htable *ht, htable_each_fn func, void *arg);
+
+static inline uint32_t
+htable_nentry(const struct htable *ht)
+{
+    return ht->nentry;
+}
+
+static inline bool
+htable_migrating(const struct htable *ht)
+{
+    return ht->old.ctrl != NULL;
+}
+
+#ifdef __cplusplus
+}
+#endif
@@ -21,9 +21,14 @@
 extern "C" {
 #endif
 
+#include <cc_debug.h>
 #include <cc_define.h>
+#include <cc_metric.h>
+#include <cc_option.h>
+#include <cc_util.h>
 
 #include <stddef.h>
+#include <stdint.h>
 
 /*
  * Memory allocation and free wrappers with debugging information.
@@ -36,7 +41,11 @@ extern "C" {
  * cc_free
  *
  * cc_mmap
+ * cc_mmap_opt
+ * cc_mremap
  * cc_munmap
+ *
+ * and a request-scoped arena allocator, see arena_create() below
  */
 #define cc_alloc(_s)                                            \
     _cc_alloc((size_t)(_s), __FILE__, __LINE__)
@@ -63,6 +72,12 @@ extern "C" {
 #define cc_mmap(_s)                                             \
     _cc_mmap((size_t)(_s), __FILE__, __LINE__)
 
+#define cc_mmap_opt(_s, _flags, _node, _pagesize)               \
+    _cc_mmap_opt((size_t)(_s), _flags, _node, _pagesize, __FILE__, __LINE__)
+
+#define cc_mremap(_p, _os, _s)                                  \
+    _cc_mremap(_p, (size_t)(_os), (size_t)(_s), __FILE__, __LINE__)
+
 #define cc_munmap(_p, _s)                                       \
     _cc_munmap(_p, (size_t)(_s), __FILE__, __LINE__)
 
@@ -76,9 +91,162 @@ void * _cc_realloc(void *ptr, size_t size, const char *name, int line);
 void * _cc_realloc_move(void *ptr, size_t size, const char *name, int line);
 void _cc_free(void *ptr, const char *name, int line);
 void * _cc_mmap(size_t size, const char *name, int line);
+/* resize a mapping, moving it if needed; the old one is intact on failure */
+void * _cc_mremap(void *p, size_t osize, size_t size, const char *name, int line);
 int _cc_munmap(void *p, size_t size, const char *name, int line);
 size_t _cc_alloc_usable_size(void *ptr, const char *name, int line);
 
+/*
+ * Flags of cc_mmap_opt, for large long-lived regions such as slabs and hash
+ * tables:
+ *
+ * CC_MMAP_HUGETLB: back the region with huge pages from the hugetlb pool
+ *   (MAP_HUGETLB) if size is a multiple of the huge page size and the pool
+ *   has enough pages; otherwise map it aligned to the huge page size and
+ *   madvise(MADV_HUGEPAGE) so transparent huge pages can be used.
+ * CC_MMAP_POPULATE: fault all pages in before returning (MAP_POPULATE, or
+ *   touching each page when it has to happen after madvise/mbind).
+ * CC_MMAP_NUMA: allocate pages from NUMA node `node' only (mbind).
+ * CC_MMAP_LOCK: lock the region in memory (mlock); subject to
+ *   RLIMIT_MEMLOCK.
+ *
+ * Failure to get huge pages is not an error; failure to bind or lock is, and
+ * returns NULL. If pagesize is not NULL, it is set to the size of the pages
+ * the region is known to be backed by: the huge page size for hugetlb, the
+ * base page size otherwise (transparent huge pages are best-effort).
+ * Regions are released with cc_munmap, using the same size.
+ */
+#define CC_MMAP_HUGETLB     0x1
+#define CC_MMAP_POPULATE    0x2
+#define CC_MMAP_NUMA        0x4
+#define CC_MMAP_LOCK        0x8
+
+void * _cc_mmap_opt(size_t size, uint32_t flags, int node, size_t *pagesize, const char *name, int line);
+size_t cc_pagesize(void);
+size_t cc_hugepagesize(void);
+
+/*
+ * Arena: a bump-pointer allocator for objects that all die together, such as
+ * everything allocated while parsing and serving one request. Allocation is
+ * usually an aligned pointer bump within the current chunk; individual
+ * objects are never freed, instead arena_reset() releases everything at once
+ * in O(1) and keeps the chunks for the next round. Chunks of destroyed arenas
+ * go to a free pool of the destroying thread (up to arena_chunk_poolsize)
+ * and are reused by its other arenas before new ones are malloc'd.
+ *
+ * Allocations larger than a quarter of a chunk get a chunk of their own,
+ * which is freed on reset rather than kept.
+ *
+ * Each thread has its own chunk pool, so arenas can be used on many threads
+ * without locking, as long as one arena is only used by one thread at a time.
+ * arena_teardown only frees the pool of the calling thread; other threads
+ * that destroy arenas free theirs with arena_thread_flush before exiting.
+ */
+
+#define ARENA_CHUNK_SIZE    (64 * KiB)
+#define ARENA_POOLSIZE      64          /* 4 MiB of free chunks by default */
+#define ARENA_ALIGN         16          /* alignment of arena_alloc() */
+
+/*          name                    type                default             description */
+#define ARENA_OPTION(ACTION)                                                                                \
+    ACTION( arena_chunk_size,       OPTION_TYPE_UINT,   ARENA_CHUNK_SIZE,   "arena chunk size"             )\
+    ACTION( arena_chunk_poolsize,   OPTION_TYPE_UINT,   ARENA_POOLSIZE,     "max # free arena chunks kept" )
+
+typedef struct {
+    ARENA_OPTION(OPTION_DECLARE)
+} arena_options_st;
+
+/*
+ * alloc metrics are updated when an arena is reset or destroyed rather than
+ * on each allocation, to keep the allocation path free of atomics
+ */
+/*          name                    type            description */
+#define ARENA_METRIC(ACTION)                                                        \
+    ACTION( arena_create,           METRIC_COUNTER, "# arenas created"             )\
+    ACTION( arena_create_ex,        METRIC_COUNTER, "# arena create errors"        )\
+    ACTION( arena_destroy,          METRIC_COUNTER, "# arenas destroyed"           )\
+    ACTION( arena_curr,             METRIC_GAUGE,   "# arenas in use"              )\
+    ACTION( arena_reset,            METRIC_COUNTER, "# arena resets"               )\
+    ACTION( arena_alloc,            METRIC_COUNTER, "# allocations from arenas"    )\
+    ACTION( arena_alloc_ex,         METRIC_COUNTER, "# arena allocation errors"    )\
+    ACTION( arena_alloc_byte,       METRIC_COUNTER, "# bytes allocated from arenas")\
+    ACTION( arena_oversize,         METRIC_COUNTER, "# allocations given a chunk"  )\
+    ACTION( arena_chunk_create,     METRIC_COUNTER, "# arena chunks malloc'd"      )\
+    ACTION( arena_chunk_destroy,    METRIC_COUNTER, "# arena chunks freed"         )\
+    ACTION( arena_chunk_reuse,      METRIC_COUNTER, "# arena chunks reused"        )\
+    ACTION( arena_chunk_curr,       METRIC_GAUGE,   "# arena chunks allocated"     )\
+    ACTION( arena_chunk_free,       METRIC_GAUGE,   "# arena chunks in free pool"  )
+
+typedef struct {
+    ARENA_METRIC(METRIC_DECLARE)
+} arena_metrics_st;
+
+struct arena_chunk {
+    struct arena_chunk  *next;
+    size_t              size;       /* usable bytes, following the header */
+};
+
+struct arena {
+    char                *pos;       /* next free byte in the current chunk */
+    char                *end;       /* end of the current chunk */
+    char                *last;      /* latest allocation, may grow in place */
+    struct arena_chunk  *used;      /* current chunk first */
+    struct arena_chunk  *used_tail;
+    struct arena_chunk  *free;      /* chunks released by reset */
+    struct arena_chunk  *large;     /* chunks of oversize allocations */
+    uint64_t            nalloc;     /* since the last reset */
+    uint64_t            nbyte;      /* since the last reset */
+};
+
+void arena_setup(arena_options_st *options, arena_metrics_st *metrics);
+void arena_teardown(void);
+/* free the chunks pooled by the calling thread */
+void arena_thread_flush(void);
+
+struct arena *arena_create(void);
+void arena_destroy(struct arena **arena);
+/* release all allocations, keeping regular chunks for reuse */
+void arena_reset(struct arena *arena);
+
+void *_arena_alloc_slow(struct arena *arena, size_t size, size_t align);
+
+/*
+ * size bytes aligned to align, a power of 2; NULL if size is 0 or out of
+ * memory. The memory stays valid until the arena is reset or destroyed.
+ */
+static inline void *
+arena_alloc_aligned(struct arena *arena, size_t size, size_t align)
+{
+    char *p;
+
+    ASSERT(align != 0 && (align & (align - 1)) == 0);
+
+    p = CC_ALIGN_PTR(arena->pos, align);
+    if (p > arena->end || size == 0 || size > (size_t)(arena->end - p)) {
+        return _arena_alloc_slow(arena, size, align);
+    }
+
+    arena->last = p;
+    arena->pos = p + size;
+    arena->nalloc++;
+    arena->nbyte += size;
+
+    return p;
+}
+
+static inline void *
+arena_alloc(struct arena *arena, size_t size)
+{
+    return arena_alloc_aligned(arena, size, ARENA_ALIGN);
+}
+
+/*
+ * resize an allocation of osize bytes made with ARENA_ALIGN; the latest
+ * allocation grows or shrinks in place when the chunk has room, anything
+ * else is copied into a new allocation
+ */
+void *arena_realloc(struct arena *arena, void *p, size_t osize, size_t size);
+
 #ifdef __cplusplus
 }
 #endif
@@ -96,6 +96,13 @@ struct pool {                                                       \
     (pool)->nused--;                                                \
 } while (0)
 
+/* an element borrowed from the pool is destroyed instead of returned */
+#define FREEPOOL_RELEASE(pool) do {                                 \
+    ASSERT((pool)->initialized);                                    \
+    ASSERT((pool)->nused > 0);                                      \
+    (pool)->nused--;                                                \
+} while (0)
+
 #ifdef __cplusplus
 }
 #endif
@@ -58,15 +58,16 @@ static const uint64_t BASE10[CC_UINT64_MAXLEN - 1] = {
     1000000000000000, 10000000000000000, 100000000000000000,
     1000000000000000000, 10000000000000000000ul};
 
+/*
+ * # decimal digits of n: the bit length of n gives log10(n) to within one
+ * (bits * 1233 >> 12 approximates bits * log10(2)), and one comparison with
+ * a power of 10 settles it
+ */
 static inline size_t
 digits(uint64_t n) {
-    size_t d = 1;
-
-    while (n >= BASE10[d]) {
-        d++;
-    }
+    size_t d = (size_t)(64 - __builtin_clzll(n | 1)) * 1233 >> 12;
 
-    return d;
+    return d + (n >= BASE10[d]);
 }
 
 #ifdef __cplusplus
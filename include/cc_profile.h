@@ -0,0 +1,149 @@
+#pragma once
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <cc_define.h>
+#include <cc_histogram.h>
+#include <cc_metric.h>
+#include <cc_option.h>
+
+#include <stdint.h>
+#include <time.h>
+
+/*
+ * profile: latency breakdown of named spans (e.g. the parse, process and write
+ * stages of a request), each recorded into its own histogram.
+ *
+ * Spans are declared in the same way as metrics:
+ *
+ *  #define REQUEST_SPAN(ACTION)                             \
+ *      ACTION( parse,      "request parsing"               )\
+ *      ACTION( process,    "request processing"            )
+ *
+ *  typedef struct {
+ *      REQUEST_SPAN(PROFILE_SPAN_DECLARE)
+ *  } request_spans_st;
+ *
+ *  request_spans_st spans = { REQUEST_SPAN(PROFILE_SPAN_INIT) };
+ *
+ * and then created with profile_span_create_all((struct profile_span *)&spans,
+ * PROFILE_SPAN_CARDINALITY(spans)). A block of code is timed with:
+ *
+ *  PROFILE_SPAN_BEGIN(spans.parse);
+ *  status = parse_req(req, buf);
+ *  PROFILE_SPAN_END(spans.parse);
+ *
+ * The pair opens and closes a block, so variables declared in between are
+ * local to it. Leaving the block with break, continue, goto or return skips
+ * recording; either way control flow is the same with and without profiling.
+ *
+ * If ccommon is built without HAVE_PROFILE, span declarations are empty and
+ * the pair is just a block, so profiling costs nothing.
+ *
+ * Time is read from the TSC on x86, which is calibrated against the monotonic
+ * clock in profile_setup; elsewhere the monotonic clock is used directly.
+ * Recording uses histo_u64_record_atomic so spans can be shared by threads.
+ *
+ * Each span has two histograms: profile_report swaps in the spare one, waits
+ * for records still in flight on the other, then reports and resets it, so a
+ * report never sees a histogram being written. Only one thread may report on
+ * a given set of spans at a time.
+ */
+
+#define PROFILE_HISTO_M 0   /* 1ns minimum resolution */
+#define PROFILE_HISTO_R 10  /* ~0.1% precision */
+#define PROFILE_HISTO_N 37  /* max latency ~137 seconds */
+
+/*          name                type                default             description */
+#define PROFILE_OPTION(ACTION)                                                                  \
+    ACTION( profile_histo_m,    OPTION_TYPE_UINT,   PROFILE_HISTO_M,    "span resolution 2^m ns"   )\
+    ACTION( profile_histo_r,    OPTION_TYPE_UINT,   PROFILE_HISTO_R,    "span precision 2^-(r-m)"  )\
+    ACTION( profile_histo_n,    OPTION_TYPE_UINT,   PROFILE_HISTO_N,    "span max latency 2^n ns"  )
+
+typedef struct {
+    PROFILE_OPTION(OPTION_DECLARE)
+} profile_options_st;
+
+/* metrics updated for every span by profile_report, latencies are in ns */
+/*          suffix  type            percentile */
+#define PROFILE_METRIC(ACTION)                  \
+    ACTION( count,  METRIC_GAUGE,   0.0     )   \
+    ACTION( p50,    METRIC_GAUGE,   50.0    )   \
+    ACTION( p90,    METRIC_GAUGE,   90.0    )   \
+    ACTION( p99,    METRIC_GAUGE,   99.0    )   \
+    ACTION( p999,   METRIC_GAUGE,   99.9    )   \
+    ACTION( max,    METRIC_GAUGE,   100.0   )
+
+#define PROFILE_METRIC_COUNT(_suffix, _type, _percentile) + 1
+#define PROFILE_NMETRIC (0 PROFILE_METRIC(PROFILE_METRIC_COUNT))
+
+struct profile_span {
+    char                *name;
+    char                *desc;
+    struct histo_u64    *histo;     /* latencies in nanoseconds */
+    struct histo_u64    *spare;     /* swapped with histo by profile_report */
+    uint32_t            epoch;      /* # swaps, its parity indexes nwriter */
+    uint32_t            nwriter[2]; /* # records in flight by epoch parity */
+    struct metric       metrics[PROFILE_NMETRIC]; /* named <name>_<suffix> */
+};
+
+#if defined CC_PROFILE && CC_PROFILE == 1
+
+#define PROFILE_SPAN_DECLARE(_name, _description)                   \
+    struct profile_span _name;
+
+#define PROFILE_SPAN_INIT(_name, _description)                      \
+    ._name = {.name = #_name, .desc = _description},
+
+#define PROFILE_SPAN_BEGIN(_span)                                   \
+    { uint64_t _profile_start = profile_tick()
+
+#define PROFILE_SPAN_END(_span)                                     \
+    profile_span_record(&(_span), profile_tick() - _profile_start); }
+
+#else
+
+#define PROFILE_SPAN_DECLARE(_name, _description)
+#define PROFILE_SPAN_INIT(_name, _description)
+#define PROFILE_SPAN_BEGIN(_span) {
+#define PROFILE_SPAN_END(_span) }
+
+#endif
+
+#define PROFILE_SPAN_CARDINALITY(_o) sizeof(_o) / sizeof(struct profile_span)
+
+/* the fastest monotonic time source available, in platform-specific ticks */
+static inline uint64_t
+profile_tick(void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+    return __builtin_ia32_rdtsc();
+#else
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+#endif
+}
+
+void profile_setup(profile_options_st *options);
+void profile_teardown(void);
+
+/* allocate/free histograms and metrics of spans */
+rstatus_i profile_span_create_all(struct profile_span spans[], unsigned int nspan);
+void profile_span_destroy_all(struct profile_span spans[], unsigned int nspan);
+
+/* record a latency measured as the difference between two profile_tick() */
+void profile_span_record(struct profile_span *span, uint64_t ntick);
+
+/* compute metrics of spans, then reset their histograms for the next interval */
+void profile_report(struct profile_span spans[], unsigned int nspan);
+/* profile_report, then dump metrics of each span as a line via stats_log */
+void profile_stats_log(struct profile_span spans[], unsigned int nspan);
+
+#ifdef __cplusplus
+}
+#endif
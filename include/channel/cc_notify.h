@@ -0,0 +1,114 @@
+/*
+ * ccommon - a cache common library.
+ * Copyright (C) 2013 Twitter, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <cc_debug.h>
+#include <cc_metric.h>
+#include <cc_ring_array.h>
+#include <channel/cc_channel.h>
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <unistd.h>
+
+/**
+ * This implements the channel interface for cross-thread wakeups.
+ *
+ * A notifier wakes up the event loop of another thread, which watches its
+ * read id for read events. It is backed by an eventfd (a single fd) where
+ * available, and by a pipe otherwise.
+ *
+ * Wakeups are coalesced: once signaled, a notifier stays pending until the
+ * consumer calls notify_drain, and signals in between cost no syscall. Payloads
+ * go through a ring_array paired with the notifier: the producer calls
+ * notify_push for each item (or ring_array_push for all items of a batch and
+ * notify_signal once), and the consumer, woken up, calls notify_drain and
+ * then pops until the ring array is empty. So handing over a batch of accepted
+ * connections to a worker costs one write and one read, not one per item.
+ *
+ * notify_drain must be called before popping, so items pushed after the last
+ * pop are always followed by another wakeup.
+ */
+
+/*          name                    type            description */
+#define NOTIFY_METRIC(ACTION)                                                       \
+    ACTION( notify_open,            METRIC_COUNTER, "# notifiers opened"           )\
+    ACTION( notify_open_ex,         METRIC_COUNTER, "# notifier open exceptions"   )\
+    ACTION( notify_close,           METRIC_COUNTER, "# notifiers closed"           )\
+    ACTION( notify_signal,          METRIC_COUNTER, "# wakeups signaled"           )\
+    ACTION( notify_signal_ex,       METRIC_COUNTER, "# wakeup signal exceptions"   )\
+    ACTION( notify_coalesce,        METRIC_COUNTER, "# signals coalesced"          )\
+    ACTION( notify_drain,           METRIC_COUNTER, "# drains attempted"           )\
+    ACTION( notify_drain_ex,        METRIC_COUNTER, "# drain exceptions"           )
+
+typedef struct {
+    NOTIFY_METRIC(METRIC_DECLARE)
+} notify_metrics_st;
+
+struct notify_conn {
+    int                     fd[2];      /* read/write fds, the same for eventfd */
+    bool                    pending;    /* signaled but not drained yet */
+
+    unsigned                state:4;    /* channel state */
+
+    err_i                   err;        /* errno */
+};
+
+void notify_setup(notify_metrics_st *metrics);
+void notify_teardown(void);
+
+struct notify_conn *notify_conn_create(void);
+void notify_conn_destroy(struct notify_conn **c);
+void notify_conn_reset(struct notify_conn *c);
+
+/* addr should always be NULL, see pipe_open */
+bool notify_open(void *addr, struct notify_conn *c);    /* channel_open_fn */
+void notify_close(struct notify_conn *c);               /* channel_term_fn */
+
+/* producer: wake up the consumer unless a wakeup is already pending */
+rstatus_i notify_signal(struct notify_conn *c);
+/* producer: push elem into arr, then signal */
+rstatus_i notify_push(struct notify_conn *c, struct ring_array *arr, const void *elem);
+
+/* consumer: clear pending wakeups, returns CC_OK, CC_EAGAIN if none or CC_ERROR */
+rstatus_i notify_drain(struct notify_conn *c);
+
+/*
+ * channel_recv_fn/channel_send_fn: send signals and recv drains, the content
+ * of buf is neither sent nor filled. They return nbyte on success.
+ */
+ssize_t notify_recv(struct notify_conn *c, void *buf, size_t nbyte);
+ssize_t notify_send(struct notify_conn *c, void *buf, size_t nbyte);
+
+static inline ch_id_i notify_read_id(struct notify_conn *c)
+{
+    return c->fd[0];
+}
+
+static inline ch_id_i notify_write_id(struct notify_conn *c)
+{
+    return c->fd[1];
+}
+
+#ifdef __cplusplus
+}
+#endif
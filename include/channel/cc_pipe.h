@@ -61,6 +61,9 @@ typedef struct {
     ACTION( pipe_send,           METRIC_COUNTER, "# send attempted"              )\
     ACTION( pipe_send_ex,        METRIC_COUNTER, "# send exceptions"             )\
     ACTION( pipe_send_byte,      METRIC_COUNTER, "# bytes sent"                  )\
+    ACTION( pipe_splice,         METRIC_COUNTER, "# splice attempted"            )\
+    ACTION( pipe_splice_ex,      METRIC_COUNTER, "# splice exceptions"           )\
+    ACTION( pipe_splice_byte,    METRIC_COUNTER, "# bytes spliced"               )\
     ACTION( pipe_flag_ex,        METRIC_COUNTER, "# pipe flag exceptions"        )
 
 typedef struct {
@@ -82,6 +85,9 @@ struct pipe_conn {
     err_i                   err;        /* errno */
 };
 
+struct array;
+struct tcp_conn;
+
 STAILQ_HEAD(pipe_conn_sqh, pipe_conn); /* corresponding header type for the STAILQ */
 
 void pipe_setup(pipe_options_st *options, pipe_metrics_st *metrics);
@@ -114,6 +120,25 @@ void pipe_close(struct pipe_conn *c);
 /* send/recv on pipe */
 ssize_t pipe_recv(struct pipe_conn *c, void *buf, size_t nbyte);
 ssize_t pipe_send(struct pipe_conn *c, void *buf, size_t nbyte);
+ssize_t pipe_recvv(struct pipe_conn *c, struct array *bufv, size_t nbyte);
+ssize_t pipe_sendv(struct pipe_conn *c, struct array *bufv, size_t nbyte);
+
+/*
+ * Moving data between a pipe and a tcp connection without copying it through
+ * userspace (Linux only): pipe_splice_send moves up to nbyte from the pipe to
+ * tcp_conn s, pipe_splice_recv moves up to nbyte from s into the pipe. Neither
+ * blocks on the pipe; whether they block on the socket depends on s.
+ *
+ * pipe_vmsplice maps the buffers in bufv (an array of struct iovec, as with
+ * pipe_sendv) into the pipe instead of copying them, so a worker can stream
+ * its buffers to the network thread, which splices them out to the socket.
+ * The buffers must be left unchanged until they have been spliced out.
+ *
+ * Without splice support these fail with CC_ERROR and err set to ENOTSUP.
+ */
+ssize_t pipe_splice_send(struct pipe_conn *c, struct tcp_conn *s, size_t nbyte);
+ssize_t pipe_splice_recv(struct pipe_conn *c, struct tcp_conn *s, size_t nbyte);
+ssize_t pipe_vmsplice(struct pipe_conn *c, struct array *bufv, size_t nbyte);
 
 static inline ch_id_i pipe_read_id(struct pipe_conn *c)
 {
@@ -40,11 +40,21 @@ extern "C" {
 
 #define TCP_BACKLOG  128
 #define TCP_POOLSIZE 0 /* unlimited */
+#define TCP_INFO_RATE 0 /* no sampling */
+#define TCP_BUSY_POLL 0 /* no busy polling */
 
 /*          name            type                default         description */
 #define TCP_OPTION(ACTION)                                                                \
     ACTION( tcp_backlog,    OPTION_TYPE_UINT,   TCP_BACKLOG,    "tcp conn backlog limit" )\
-    ACTION( tcp_poolsize,   OPTION_TYPE_UINT,   TCP_POOLSIZE,   "tcp conn pool size"     )
+    ACTION( tcp_poolsize,   OPTION_TYPE_UINT,   TCP_POOLSIZE,   "tcp conn pool size"     )\
+    ACTION( tcp_zerocopy,   OPTION_TYPE_BOOL,   false,          "enable MSG_ZEROCOPY"    )\
+    ACTION( tcp_info_rate,  OPTION_TYPE_UINT,   TCP_INFO_RATE,  "sample TCP_INFO 1 in N" )\
+    ACTION( tcp_busy_poll,  OPTION_TYPE_UINT,   TCP_BUSY_POLL,  "SO_BUSY_POLL usec"      )\
+    ACTION( tcp_nodelay,    OPTION_TYPE_BOOL,   true,           "set TCP_NODELAY"        )\
+    ACTION( tcp_keepalive,  OPTION_TYPE_BOOL,   false,          "set SO_KEEPALIVE"       )\
+    ACTION( tcp_sndbuf,     OPTION_TYPE_UINT,   0,              "SO_SNDBUF, 0: default"  )\
+    ACTION( tcp_sndbuf_max, OPTION_TYPE_BOOL,   false,          "use the max SO_SNDBUF"  )\
+    ACTION( tcp_rcvbuf,     OPTION_TYPE_UINT,   0,              "SO_RCVBUF, 0: default"  )
 
 typedef struct {
     TCP_OPTION(OPTION_DECLARE)
@@ -72,7 +82,22 @@ typedef struct {
     ACTION( tcp_recv_byte,      METRIC_COUNTER, "# bytes received"             )\
     ACTION( tcp_send,           METRIC_COUNTER, "# send attempted"             )\
     ACTION( tcp_send_ex,        METRIC_COUNTER, "# send exceptions"            )\
-    ACTION( tcp_send_byte,      METRIC_COUNTER, "# bytes sent"                 )
+    ACTION( tcp_send_byte,      METRIC_COUNTER, "# bytes sent"                 )\
+    ACTION( tcp_send_zc,        METRIC_COUNTER, "# zerocopy send attempted"    )\
+    ACTION( tcp_send_zc_byte,   METRIC_COUNTER, "# bytes sent without copy"    )\
+    ACTION( tcp_zc_complete,    METRIC_COUNTER, "# zerocopy sends completed"   )\
+    ACTION( tcp_zc_copied,      METRIC_COUNTER, "# zerocopy sends copied"      )\
+    ACTION( tcp_info_sample,    METRIC_COUNTER, "# TCP_INFO samples"           )\
+    ACTION( tcp_info_sample_ex, METRIC_COUNTER, "# TCP_INFO sample exceptions" )\
+    ACTION( tcp_retrans,        METRIC_COUNTER, "# segs retransmitted, sampled")\
+    ACTION( tcp_rtt_p50,        METRIC_GAUGE,   "p50 of sampled rtt in usec"   )\
+    ACTION( tcp_rtt_p99,        METRIC_GAUGE,   "p99 of sampled rtt in usec"   )\
+    ACTION( tcp_rtt_max,        METRIC_GAUGE,   "max of sampled rtt in usec"   )\
+    ACTION( tcp_unacked_p50,    METRIC_GAUGE,   "p50 of sampled unacked segs"  )\
+    ACTION( tcp_unacked_p99,    METRIC_GAUGE,   "p99 of sampled unacked segs"  )\
+    ACTION( tcp_unacked_max,    METRIC_GAUGE,   "max of sampled unacked segs"  )\
+    ACTION( tcp_inretrans_p99,  METRIC_GAUGE,   "p99 of sampled segs in retx"  )\
+    ACTION( tcp_inretrans_max,  METRIC_GAUGE,   "max of sampled segs in retx"  )
 
 typedef struct {
     TCP_METRIC(METRIC_DECLARE)
@@ -92,6 +117,37 @@ struct tcp_conn {
     unsigned                flags:12;       /* annotation fields */
 
     err_i                   err;            /* errno */
+
+    bool                    zerocopy;       /* SO_ZEROCOPY set? */
+    uint32_t                zc_next;        /* id of next zerocopy send */
+    uint32_t                zc_done;        /* sends before it completed */
+
+    uint32_t                total_retrans;  /* as of last TCP_INFO sample */
+};
+
+/* transport stats of a connection, a subset of Linux struct tcp_info */
+struct tcp_conn_info {
+    uint32_t                rtt;            /* smoothed rtt in usec */
+    uint32_t                rttvar;         /* rtt variance in usec */
+    uint32_t                snd_cwnd;       /* congestion window in segments */
+    uint32_t                unacked;        /* segments sent but not acked */
+    uint32_t                retrans;        /* segments being retransmitted */
+    uint32_t                total_retrans;  /* segments retransmitted ever */
+    uint32_t                rcv_space;      /* receive window in bytes */
+};
+
+/*
+ * socket options set on every new socket. The profile built from options in
+ * tcp_setup (with the max sndbuf searched for once, if asked) is applied to
+ * sockets from tcp_connect and tcp_listen. Linux copies these options from
+ * the listening socket to accepted ones, so tcp_accept applies nothing there;
+ * elsewhere it applies the profile again.
+ */
+struct tcp_profile {
+    bool                    nodelay;        /* TCP_NODELAY */
+    bool                    keepalive;      /* SO_KEEPALIVE */
+    int                     sndbuf;         /* SO_SNDBUF, 0 to leave as is */
+    int                     rcvbuf;         /* SO_RCVBUF, 0 to leave as is */
 };
 
 STAILQ_HEAD(tcp_conn_sqh, tcp_conn); /* corresponding header type for the STAILQ */
@@ -120,6 +176,8 @@ static inline ch_id_i tcp_write_id(struct tcp_conn *c)
 
 /* basic channel maintenance */
 bool tcp_connect(struct addrinfo *ai, struct tcp_conn *c);  /* channel_open_fn, client */
+/* CC_OK if connected, CC_EAGAIN if still connecting, CC_ERROR if failed */
+rstatus_i tcp_connect_finish(struct tcp_conn *c);
 bool tcp_listen(struct addrinfo *ai, struct tcp_conn *c);   /* channel_open_fn, server */
 void tcp_close(struct tcp_conn *c);                         /* channel_perm_fn */
 ssize_t tcp_recv(struct tcp_conn *c, void *buf, size_t nbyte); /* channel_recv_fn */
@@ -127,6 +185,45 @@ ssize_t tcp_send(struct tcp_conn *c, void *buf, size_t nbyte); /* channel_send_f
 ssize_t tcp_recvv(struct tcp_conn *c, struct array *bufv, size_t nbyte);
 ssize_t tcp_sendv(struct tcp_conn *c, struct array *bufv, size_t nbyte);
 
+/*
+ * Zerocopy send: with tcp_zerocopy set, accepted and connected sockets enable
+ * SO_ZEROCOPY and tcp_send_zc sends with MSG_ZEROCOPY. The kernel then reads
+ * data straight from buf after tcp_send_zc returns, so the caller must leave
+ * the memory untouched until the send completes. Each send that went out
+ * zerocopy is assigned the id c->zc_next (incremented afterwards); sends with
+ * ids before c->zc_done have completed. Completions are read from the socket
+ * error queue by tcp_reap_zc, which should be called when the socket reports
+ * an error event. Without zerocopy support, tcp_send_zc is tcp_send.
+ */
+ssize_t tcp_send_zc(struct tcp_conn *c, void *buf, size_t nbyte);
+int tcp_reap_zc(struct tcp_conn *c); /* returns # completions, or CC_ERROR */
+
+/*
+ * TCP_INFO: tcp_conn_info reads the stats of c from the kernel (Linux only).
+ * tcp_conn_sample does so for 1 in tcp_info_rate calls, recording rtt, unacked
+ * and retransmitting segments into histograms and counting retransmits; call
+ * it wherever a connection is serviced, e.g. after each request. Percentiles
+ * are published as metrics by tcp_info_report, which also starts a new
+ * interval, so it is usually called right before metrics are reported.
+ */
+rstatus_i tcp_conn_info(struct tcp_conn *c, struct tcp_conn_info *info);
+void tcp_conn_sample(struct tcp_conn *c);
+void tcp_info_report(void);
+
+/* has send with the given id completed? */
+static inline bool
+tcp_zc_complete(struct tcp_conn *c, uint32_t id)
+{
+    return (int32_t)(c->zc_done - id) > 0;
+}
+
+/* is any zerocopy send still in flight? */
+static inline bool
+tcp_zc_pending(struct tcp_conn *c)
+{
+    return c->zc_done != c->zc_next;
+}
+
 bool tcp_accept(struct tcp_conn *sc, struct tcp_conn *c);   /* channel_accept_fn */
 void tcp_reject(struct tcp_conn *sc);                       /* channel_reject_fn */
 void tcp_reject_all(struct tcp_conn *sc);                   /* channel_reject_fn */
@@ -144,7 +241,13 @@ int tcp_set_rcvbuf(int sd, int size);
 int tcp_get_sndbuf(int sd);
 int tcp_get_rcvbuf(int sd);
 int tcp_get_soerror(int sd);
+int tcp_get_nread(int sd);
+int tcp_set_zerocopy(int sd);
+int tcp_set_busy_poll(int sd, int usec);
 void tcp_maximize_sndbuf(int sd);
+int tcp_max_sndbuf(int sd); /* largest sndbuf accepted, sd is left at that size */
+int tcp_profile_apply(int sd, const struct tcp_profile *p);
+const struct tcp_profile *tcp_profile(void); /* profile in use */
 
 #ifdef __cplusplus
 }
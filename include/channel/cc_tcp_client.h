@@ -0,0 +1,100 @@
+/*
+ * ccommon - a cache common library.
+ * Copyright (C) 2013 Twitter, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <cc_define.h>
+#include <channel/cc_tcp.h>
+#include <time/cc_timer.h>
+#include <time/cc_wheel.h>
+
+#include <stdint.h>
+#include <sys/socket.h>
+
+/**
+ * A client pool keeps up to nconn persistent connections to one upstream
+ * address, so a proxy holds one pool per upstream it talks to.
+ *
+ * Connections are opened without blocking: tcp_client_pool_connect starts a
+ * connect on every idle slot and arms a deadline on the timing wheel. The
+ * caller registers the returned connections for write events, and calls
+ * tcp_client_pool_ready on the first one to complete the connect, which also
+ * disarms the deadline. A connect still in progress when the deadline fires
+ * is closed with err ETIMEDOUT.
+ *
+ * tcp_client_pool_get picks the established connection with the fewest
+ * requests outstanding (ties go round robin), and tcp_client_pool_put marks
+ * a request on it done. Closed or failed connections are reconnected by the
+ * next tcp_client_pool_connect, which tcp_client_pool_get also calls when it
+ * finds no connection to use.
+ *
+ * Connections are looked up by a linear scan, so pools are meant to be small.
+ */
+
+struct tcp_client_pool;
+
+struct tcp_client {
+    struct tcp_conn         *c;
+    struct tcp_client_pool  *pool;
+    struct timeout_event    *tev;       /* connect deadline, NULL if unarmed */
+    uint32_t                nreq;       /* # requests outstanding */
+};
+
+struct tcp_client_pool {
+    struct sockaddr_storage addr;       /* upstream address */
+    socklen_t               addrlen;
+    int                     family;
+    int                     socktype;
+    int                     protocol;
+
+    struct timing_wheel     *tw;        /* connect deadlines, may be NULL */
+    struct timeout          deadline;   /* connect deadline as an interval */
+
+    uint32_t                nconn;      /* # slots */
+    uint32_t                next;       /* where the next scan starts */
+    struct tcp_client       *client;    /* client[] */
+
+    /* some metrics of the pool */
+    uint64_t                nconnect;   /* total # connects started */
+    uint64_t                ntimeout;   /* total # connects timed out */
+    uint64_t                nfail;      /* total # connections failed */
+};
+
+struct tcp_client_pool *tcp_client_pool_create(struct addrinfo *ai, uint32_t nconn, struct timing_wheel *tw, struct timeout *deadline);
+void tcp_client_pool_destroy(struct tcp_client_pool **pool);
+
+/* start connecting idle slots, returns # connects started */
+uint32_t tcp_client_pool_connect(struct tcp_client_pool *pool);
+/* complete the connect of c, see tcp_connect_finish */
+rstatus_i tcp_client_pool_ready(struct tcp_client_pool *pool, struct tcp_conn *c);
+/* close c after an error, it will be reconnected later */
+void tcp_client_pool_close(struct tcp_client_pool *pool, struct tcp_conn *c);
+
+/* least-loaded established connection, or NULL if none */
+struct tcp_conn *tcp_client_pool_get(struct tcp_client_pool *pool);
+void tcp_client_pool_put(struct tcp_client_pool *pool, struct tcp_conn *c);
+
+/* # established connections */
+uint32_t tcp_client_pool_nactive(struct tcp_client_pool *pool);
+
+#ifdef __cplusplus
+}
+#endif
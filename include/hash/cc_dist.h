@@ -0,0 +1,104 @@
+/*
+ * ccommon - a cache common library.
+ * Copyright (C) 2021 Twitter, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+ * cc_dist maps keys onto a set of named, weighted nodes (e.g. backends of a
+ * proxy) so that few keys move when nodes come and go. Keys are hashed with
+ * hash_murmur3_128_x64, and a node is identified by the id dist_add returns.
+ *
+ * DIST_KETAMA: every node owns weight * DIST_KETAMA_POINT points on a 32-bit
+ *   continuum, kept as a sorted array; a key belongs to the node owning the
+ *   first point at or after the key's hash. Adding a node merges its points
+ *   into the continuum and removing one filters them out, both in O(points),
+ *   without rebuilding the rest.
+ * DIST_JUMP: jump consistent hash (Lamping & Veach). No memory and O(log n)
+ *   lookup, but only the most recently added node can be removed, and
+ *   weights are ignored.
+ * DIST_RENDEZVOUS: weighted highest-random-weight hashing. Any node can be
+ *   removed, moving only its keys, at O(n) per lookup.
+ */
+
+#pragma once
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <cc_array.h>
+#include <cc_bstring.h>
+#include <cc_define.h>
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#define DIST_NODE_NONE      UINT32_MAX
+#define DIST_KETAMA_POINT   160 /* points per unit of weight, multiple of 4 */
+
+typedef enum dist_type {
+    DIST_KETAMA,
+    DIST_JUMP,
+    DIST_RENDEZVOUS,
+    DIST_SENTINEL
+} dist_type_e;
+
+struct dist_node {
+    struct bstring  name;
+    uint32_t        weight;     /* 0 if the slot is free */
+    uint64_t        hash;       /* of name */
+};
+
+struct dist_point {
+    uint32_t        hash;
+    uint32_t        id;         /* node owning the point */
+};
+
+struct dist {
+    dist_type_e     type;
+    uint32_t        nnode;      /* # nodes in use */
+    bool            weighted;   /* nodes in use have different weights */
+    struct array    node;       /* struct dist_node, indexed by id */
+    struct array    point;      /* struct dist_point by hash, DIST_KETAMA */
+};
+
+struct dist *dist_create(dist_type_e type, uint32_t nnode);
+void dist_destroy(struct dist **d);
+
+/* ids of removed nodes are reused by later adds, except for DIST_JUMP */
+rstatus_i dist_add(struct dist *d, const char *name, uint32_t len, uint32_t weight, uint32_t *id);
+rstatus_i dist_remove(struct dist *d, uint32_t id);
+
+/* returns the id of the node a key belongs to, DIST_NODE_NONE if no node */
+uint32_t dist_lookup(const struct dist *d, const char *key, uint32_t len);
+
+static inline uint32_t
+dist_nnode(const struct dist *d)
+{
+    return d->nnode;
+}
+
+static inline const struct bstring *
+dist_node_name(struct dist *d, uint32_t id)
+{
+    return &((struct dist_node *)array_get(&d->node, id))->name;
+}
+
+/* jump consistent hash: bucket in [0, nbucket) for a 64-bit key hash */
+int32_t dist_jump_hash(uint64_t key, int32_t nbucket);
+
+#ifdef __cplusplus
+}
+#endif
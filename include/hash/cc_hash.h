@@ -0,0 +1,66 @@
+/*
+ * ccommon - a cache common library.
+ * Copyright (C) 2021 Twitter, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+ * cc_hash exposes XXH3 from the bundled xxhash.h (see hash/xxhash.h) behind a
+ * ccommon API, so callers neither include xxhash.h nor depend on its version.
+ * Digests are those of XXH3_64bits/XXH3_128bits with a seed, and are stable
+ * across platforms.
+ *
+ * hash_many hashes a batch of keys, e.g. all keys of a multi-get to route
+ * them to shards; it is equivalent to calling hash_xxh3_64 on each key.
+ *
+ * For data that arrives in pieces, a hash_state is fed with hash_update and
+ * yields the same digest as hashing the concatenated data at once.
+ */
+
+#pragma once
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <cc_define.h>
+
+#include <stddef.h>
+#include <stdint.h>
+
+struct hash128 {
+    uint64_t    low;
+    uint64_t    high;
+};
+
+struct hash_state;
+
+/* one-shot */
+uint64_t hash_xxh3_64(const void *key, size_t len, uint64_t seed);
+struct hash128 hash_xxh3_128(const void *key, size_t len, uint64_t seed);
+
+/* batch: out[i] = hash_xxh3_64(keys[i], lens[i], seed) for i < n */
+void hash_many(const void *const keys[], const size_t lens[], uint64_t out[], size_t n, uint64_t seed);
+
+/* streaming */
+struct hash_state *hash_state_create(uint64_t seed);
+void hash_state_destroy(struct hash_state **state);
+void hash_reset(struct hash_state *state, uint64_t seed);
+rstatus_i hash_update(struct hash_state *state, const void *data, size_t len);
+uint64_t hash_digest_64(const struct hash_state *state);
+struct hash128 hash_digest_128(const struct hash_state *state);
+
+#ifdef __cplusplus
+}
+#endif
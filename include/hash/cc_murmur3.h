@@ -33,6 +33,7 @@
 extern "C" {
 #endif
 
+#include <stddef.h>
 #include <stdint.h>
 
 
@@ -42,6 +43,13 @@ void hash_murmur3_128_x86(const void *key, int len, uint32_t seed, void *out);
 
 void hash_murmur3_128_x64(const void *key, int len, uint32_t seed, void *out);
 
+/*
+ * out[i] = hash_murmur3_32(keys[i], lens[i], seed) for i < n, with 8 or 4
+ * keys hashed in parallel SIMD lanes where the CPU supports AVX2 or SSE4.1
+ * (see cc_murmur3_many.c); results are identical to the scalar function.
+ */
+void hash_murmur3_32_many(const void *const keys[], const size_t lens[], uint32_t out[], size_t n, uint32_t seed);
+
 #ifdef __cplusplus
 }
 #endif
@@ -49,15 +49,21 @@ extern "C" {
 
 #include <cc_define.h>
 #include <cc_metric.h>
+#include <cc_util.h>
 
 #include <inttypes.h>
 #include <stdlib.h>
 
 #define BUFSOCK_POOLSIZE 0 /* unlimited */
+#define BUFSOCK_ZC_MIN   (64 * KiB)
+#define BUFSOCK_NPINNED  4
 
 /*          name                type                default             description */
-#define SOCKIO_OPTION(ACTION)                                                             \
-    ACTION( buf_sock_poolsize,  OPTION_TYPE_UINT,   BUFSOCK_POOLSIZE,   "buf_sock limit" )
+#define SOCKIO_OPTION(ACTION)                                                                         \
+    ACTION( buf_sock_poolsize,  OPTION_TYPE_UINT,   BUFSOCK_POOLSIZE,   "buf_sock limit"             )\
+    ACTION( buf_sock_lazy,      OPTION_TYPE_BOOL,   false,              "attach bufs only when busy" )\
+    ACTION( buf_sock_scratch,   OPTION_TYPE_BOOL,   false,              "recv into per-thread buf"   )\
+    ACTION( buf_sock_zc_min,    OPTION_TYPE_UINT,   BUFSOCK_ZC_MIN,     "min bytes to send zerocopy" )
 
 typedef struct {
     SOCKIO_OPTION(OPTION_DECLARE)
@@ -72,7 +78,15 @@ typedef struct {
     ACTION( buf_sock_borrow,    METRIC_COUNTER, "# buf sock borrowed"          )\
     ACTION( buf_sock_borrow_ex, METRIC_COUNTER, "# buf sock borrow exceptions" )\
     ACTION( buf_sock_return,    METRIC_COUNTER, "# buf sock returned"          )\
-    ACTION( buf_sock_active,    METRIC_GAUGE,   "# buf sock being borrowed"    )
+    ACTION( buf_sock_active,    METRIC_GAUGE,   "# buf sock being borrowed"    )\
+    ACTION( buf_sock_attach,    METRIC_COUNTER, "# bufs attached lazily"       )\
+    ACTION( buf_sock_attach_ex, METRIC_COUNTER, "# buf attach exceptions"      )\
+    ACTION( buf_sock_detach,    METRIC_COUNTER, "# bufs detached when drained" )\
+    ACTION( buf_sock_scratch,   METRIC_COUNTER, "# recv into scratch buf"      )\
+    ACTION( buf_sock_promote,   METRIC_COUNTER, "# scratch data moved to buf"  )\
+    ACTION( buf_sock_pin,       METRIC_COUNTER, "# wbufs pinned by zerocopy"   )\
+    ACTION( buf_sock_unpin,     METRIC_COUNTER, "# pinned wbufs released"      )\
+    ACTION( buf_sock_unpin_ex,  METRIC_COUNTER, "# pinned wbufs freed unreaped")
 
 typedef struct {
     SOCKIO_METRIC(METRIC_DECLARE)
@@ -91,10 +105,47 @@ struct buf_sock {
     struct tcp_conn         *ch;
     struct buf              *rbuf;
     struct buf              *wbuf;
+
+    /* zerocopy send, see notes below */
+    bool                    wbuf_pinned;    /* wbuf partially sent zerocopy */
+    struct buf              *zc_spare;      /* replaces wbuf when pinned */
+    uint32_t                npinned;
+    struct buf              *pinned[BUFSOCK_NPINNED];
+    uint32_t                pinned_id[BUFSOCK_NPINNED]; /* last send of buf */
 };
 
 STAILQ_HEAD(buf_sock_sqh, buf_sock); /* corresponding header type for the STAILQ */
 
+/*
+ * Zerocopy send: if the tcp_conn of a buf_sock has zerocopy enabled (see
+ * cc_tcp.h), buf_tcp_write sends at least buf_sock_zc_min bytes with
+ * MSG_ZEROCOPY. Once such a wbuf is drained, it is pinned in the buf_sock and
+ * replaced by a fresh buffer, so the application can keep writing responses.
+ * buf_tcp_reap, to be called on error events of the socket, releases pinned
+ * buffers whose sends have completed. Up to BUFSOCK_NPINNED buffers can be
+ * pinned, beyond which data is copied as usual.
+ *
+ * While a wbuf is partially sent with zerocopy, the sent part must not be
+ * overwritten, i.e. the wbuf should not be shifted or resized until drained.
+ * Returning or destroying a buf_sock frees pinned buffers that have not been
+ * reaped instead of recycling them, as the kernel may still send from them.
+ */
+
+/*
+ * Lazy mode (buf_sock_lazy): rbuf and wbuf of a buf_sock are NULL while it is
+ * idle. A read attaches rbuf from the buf pool, buf_sock_attach gets both
+ * buffers before composing a response, and buf_sock_detach returns whichever
+ * buffer has been drained. Application should call buf_sock_detach once it is
+ * done with a buf_sock for the current event, so idle connections hold no
+ * buffer memory.
+ *
+ * With buf_sock_scratch also set, a read on a buf_sock without rbuf lands in a
+ * per-thread scratch buffer instead. If the data is fully consumed, detaching
+ * costs nothing; if a partial request remains, detaching moves it to a buffer
+ * from the pool. The scratch buffer can only be lent to one buf_sock at a time,
+ * a read on another buf_sock moves the data of the previous one out first.
+ */
+
 void sockio_setup(sockio_options_st *options, sockio_metrics_st *metrics);
 void sockio_teardown(void);
 
@@ -106,8 +157,12 @@ void buf_sock_return(struct buf_sock **);   /* stream_put_fn */
 
 void buf_sock_reset(struct buf_sock *);
 
+rstatus_i buf_sock_attach(struct buf_sock *); /* get rbuf & wbuf if missing */
+void buf_sock_detach(struct buf_sock *);      /* return drained buffers */
+
 rstatus_i buf_tcp_read(struct buf_sock *);
 rstatus_i buf_tcp_write(struct buf_sock *);
+rstatus_i buf_tcp_reap(struct buf_sock *); /* release wbufs sent zerocopy */
 
 rstatus_i dbuf_tcp_read(struct buf_sock *); /* buf_tcp_read with
                                                doubling buffer */
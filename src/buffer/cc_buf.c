@@ -14,29 +14,79 @@
  * See the License for the specific language governing permissions and
  * limitations under the License.
  */
-
 #include <buffer/cc_buf.h>
 
 #include <cc_debug.h>
 #include <cc_mm.h>
 #include <cc_pool.h>
+#include <cc_print.h>
 
 
 #define BUF_MODULE_NAME "ccommon::buffer:buf"
 
+#define BUF_CLASS_NAMELEN 32
+
 FREEPOOL(buf_pool, bufq, buf);
-static struct buf_pool bufp;
+
+struct buf_class {
+    uint32_t        size;   /* buf size incl. header */
+    struct buf_pool pool;
+    char            name[BUF_CLASS_NMETRIC][BUF_CLASS_NAMELEN];
+};
+static struct buf_class bufc[BUF_NCLASS_MAX];
+static struct metric class_metrics[BUF_NCLASS_MAX][BUF_CLASS_NMETRIC];
+
+#define BUF_CLASS_METRIC_SUFFIX(_suffix, _type, _description) #_suffix,
+#define BUF_CLASS_METRIC_TYPE(_suffix, _type, _description)   _type,
+#define BUF_CLASS_METRIC_DESC(_suffix, _type, _description)   _description,
+
+static const char *class_suffix[BUF_CLASS_NMETRIC] =
+    { BUF_CLASS_METRIC(BUF_CLASS_METRIC_SUFFIX) };
+static const metric_type_e class_type[BUF_CLASS_NMETRIC] =
+    { BUF_CLASS_METRIC(BUF_CLASS_METRIC_TYPE) };
+static const char *class_desc[BUF_CLASS_NMETRIC] =
+    { BUF_CLASS_METRIC(BUF_CLASS_METRIC_DESC) };
+
+/* class metrics in the order of BUF_CLASS_METRIC */
+#define CLASS_CURR      0
+#define CLASS_ACTIVE    1
 
 static bool buf_init = false;
 static bool bufp_init = false;
 
 uint32_t buf_init_size = BUF_INIT_SIZE;
+uint32_t buf_nclass = 0; /* no class until setup */
 buf_metrics_st *buf_metrics = NULL;
 
+/* size class of a buf of the given size, -1 if there is none */
+static int
+_buf_class(uint32_t size)
+{
+    uint32_t i;
+
+    for (i = 0; i < buf_nclass; i++) {
+        if (bufc[i].size == size) {
+            return i;
+        }
+    }
+
+    return -1;
+}
+
+/* pools are not thread-safe, neither are the class metrics */
+static inline void
+_class_incr(int cls, int idx, int64_t delta)
+{
+    if (cls >= 0) {
+        class_metrics[cls][idx].gauge += delta;
+    }
+}
+
 static void
 buf_pool_destroy(void)
 {
     struct buf *buf, *nbuf;
+    uint32_t i;
 
     if (!bufp_init) {
         log_warn("buf pool was never created, ignoring destroy");
@@ -44,16 +94,21 @@ buf_pool_destroy(void)
         return;
     }
 
-    log_info("destroying buf pool: free %"PRIu32, bufp.nfree);
+    for (i = 0; i < buf_nclass; i++) {
+        log_info("destroying buf pool of size %"PRIu32": free %"PRIu32,
+                bufc[i].size, bufc[i].pool.nfree);
 
-    FREEPOOL_DESTROY(buf, nbuf, &bufp, next, buf_destroy);
+        FREEPOOL_DESTROY(buf, nbuf, &bufc[i].pool, next, buf_destroy);
+    }
+    buf_nclass = 0;
     bufp_init = false;
 }
 
 static void
-buf_pool_create(uint32_t max)
+buf_pool_create(uint32_t max, uint32_t nclass)
 {
     struct buf *buf;
+    uint32_t i, j;
 
     if (bufp_init) {
         log_warn("buf pool has already been created, re-creating");
@@ -61,9 +116,27 @@ buf_pool_create(uint32_t max)
         buf_pool_destroy();
     }
 
-    log_info("creating buf pool: max %"PRIu32, max);
-
-    FREEPOOL_CREATE(&bufp, max);
+    log_info("creating buf pool: max %"PRIu32" per class, %"PRIu32" classes",
+            max, nclass);
+
+    for (i = 0; i < nclass; i++) {
+        bufc[i].size = buf_init_size << i;
+        FREEPOOL_CREATE(&bufc[i].pool, max);
+
+        for (j = 0; j < BUF_CLASS_NMETRIC; j++) {
+            if (bufc[i].size % KiB == 0) {
+                cc_scnprintf(bufc[i].name[j], BUF_CLASS_NAMELEN,
+                        "buf_%"PRIu32"k_%s", bufc[i].size / KiB,
+                        class_suffix[j]);
+            } else {
+                cc_scnprintf(bufc[i].name[j], BUF_CLASS_NAMELEN,
+                        "buf_%"PRIu32"_%s", bufc[i].size, class_suffix[j]);
+            }
+            class_metrics[i][j] = (struct metric){.name = bufc[i].name[j],
+                .desc = (char *)class_desc[j], .type = class_type[j]};
+        }
+    }
+    buf_nclass = nclass;
     bufp_init = true;
 
     /**
@@ -71,32 +144,90 @@ buf_pool_create(uint32_t max)
      * whether we want an option where memory is capped but
      * not preallocated is a question for future exploration.
      * So far I see no point of that.
+     *
+     * Only the smallest class is preallocated, larger buffers are rarely
+     * needed by all connections at once.
      */
 
-    FREEPOOL_PREALLOC(buf, &bufp, max, next, buf_create);
-    if (bufp.nfree < max) {
+    FREEPOOL_PREALLOC(buf, &bufc[0].pool, max, next, buf_create);
+    if (bufc[0].pool.nfree < max) {
         log_crit("cannot preallocate buf pool, OOM. abort");
         exit(EXIT_FAILURE);
     }
 }
 
-struct buf *
-buf_borrow(void)
+static struct buf *
+_buf_create(uint32_t size)
+{
+    struct buf *buf = (struct buf *)cc_alloc(size);
+
+    if (buf == NULL) {
+        log_info("buf creation failed due to OOM");
+        INCR(buf_metrics, buf_create_ex);
+
+        return NULL;
+    }
+
+    buf->end = (char *)buf + size;
+    buf->borrowed = false;
+    buf_reset(buf);
+    INCR(buf_metrics, buf_create);
+    INCR(buf_metrics, buf_curr);
+    INCR_N(buf_metrics, buf_memory, size);
+    _class_incr(_buf_class(size), CLASS_CURR, 1);
+
+    log_verb("created buf %p capacity %"PRIu32, buf, buf_capacity(buf));
+
+    return buf;
+}
+
+static struct buf *
+_buf_borrow(int cls)
 {
     struct buf *buf;
 
-    FREEPOOL_BORROW(buf, &bufp, next, buf_create);
+    /* the class size is needed by the create callback of FREEPOOL_BORROW */
+#define _buf_create_class() _buf_create(bufc[cls].size)
+    FREEPOOL_BORROW(buf, &bufc[cls].pool, next, _buf_create_class);
+#undef _buf_create_class
 
     if (buf == NULL) {
+        return NULL;
+    }
+
+    buf_reset(buf);
+    buf->borrowed = true;
+    INCR(buf_metrics, buf_active);
+    _class_incr(cls, CLASS_ACTIVE, 1);
+
+    return buf;
+}
+
+static void
+_buf_return(struct buf *buf, int cls)
+{
+    ASSERT(buf->borrowed);
+
+    buf->free = true;
+    buf->borrowed = false;
+    FREEPOOL_RETURN(buf, &bufc[cls].pool, next);
+    DECR(buf_metrics, buf_active);
+    _class_incr(cls, CLASS_ACTIVE, -1);
+}
+
+struct buf *
+buf_borrow(void)
+{
+    struct buf *buf;
+
+    if (!bufp_init || (buf = _buf_borrow(0)) == NULL) {
         log_warn("borrow buf failed, OOM or over limit");
         INCR(buf_metrics, buf_borrow_ex);
 
         return NULL;
     }
 
-    buf_reset(buf);
     INCR(buf_metrics, buf_borrow);
-    INCR(buf_metrics, buf_active);
 
     log_verb("borrow buf %p", buf);
 
@@ -107,6 +238,7 @@ void
 buf_return(struct buf **buf)
 {
     struct buf *elm;
+    int cls;
 
     if (buf == NULL || (elm = *buf) == NULL || elm->free) {
         return;
@@ -117,54 +249,138 @@ buf_return(struct buf **buf)
 
     log_verb("return buf %p", elm);
 
-    elm->free = true;
-    FREEPOOL_RETURN(elm, &bufp, next);
+    cls = _buf_class(buf_size(elm));
+    if (cls < 0 || !elm->borrowed) { /* not from any pool */
+        buf_destroy(buf);
+    } else {
+        _buf_return(elm, cls);
+        *buf = NULL;
+    }
 
-    *buf = NULL;
     INCR(buf_metrics, buf_return);
-    DECR(buf_metrics, buf_active);
 }
 
 struct buf *
 buf_create(void)
 {
-    struct buf *buf = (struct buf *)cc_alloc(buf_init_size);
-
-    if (buf == NULL) {
-        log_info("buf creation failed due to OOM");
-        INCR(buf_metrics, buf_create_ex);
-
-        return NULL;
-    }
-
-    buf->end = (char *)buf + buf_init_size;
-    buf_reset(buf);
-    INCR(buf_metrics, buf_create);
-    INCR(buf_metrics, buf_curr);
-    INCR_N(buf_metrics, buf_memory, buf_init_size);
-
-    log_verb("created buf %p capacity %"PRIu32, buf, buf_capacity(buf));
-
-    return buf;
+    return _buf_create(buf_init_size);
 }
 
 void
 buf_destroy(struct buf **buf)
 {
     uint32_t cap;
+    int cls;
 
     if (buf == NULL || *buf == NULL) {
         return;
     }
 
     cap = buf_size(*buf);
+    cls = _buf_class(cap);
     log_verb("destroy buf %p size %"PRIu32, *buf, cap);
 
+    /* a borrowed buf destroyed in place is no longer counted as in use */
+    if ((*buf)->borrowed && cls >= 0) {
+        FREEPOOL_RELEASE(&bufc[cls].pool);
+        DECR(buf_metrics, buf_active);
+        _class_incr(cls, CLASS_ACTIVE, -1);
+    }
+
     cc_free(*buf);
     *buf = NULL;
     INCR(buf_metrics, buf_destroy);
     DECR(buf_metrics, buf_curr);
     DECR_N(buf_metrics, buf_memory, cap);
+    _class_incr(cls, CLASS_CURR, -1);
+}
+
+static rstatus_i
+_buf_realloc(struct buf **buf, uint32_t size)
+{
+    struct buf *nbuf;
+    uint32_t osize, roffset, woffset;
+
+    osize = buf_size(*buf);
+    roffset = (*buf)->rpos - (*buf)->begin;
+    woffset = (*buf)->wpos - (*buf)->begin;
+
+    nbuf = cc_realloc(*buf, size);
+    if (nbuf == NULL) { /* realloc failed, but *buf is still valid */
+        return CC_ENOMEM;
+    }
+
+    log_verb("buf %p of size %"PRIu32" resized to %p of size %"PRIu32, *buf,
+            osize, nbuf, size);
+
+    /* end, rpos, wpos need to be adjusted for the new address of buf */
+    nbuf->end = (char *)nbuf + size;
+    nbuf->rpos = nbuf->begin + roffset;
+    nbuf->wpos = nbuf->begin + woffset;
+    *buf = nbuf;
+    DECR_N(buf_metrics, buf_memory, osize);
+    INCR_N(buf_metrics, buf_memory, size);
+    _class_incr(_buf_class(osize), CLASS_CURR, -1);
+    _class_incr(_buf_class(size), CLASS_CURR, 1);
+
+    return CC_OK;
+}
+
+rstatus_i
+buf_move(struct buf **buf, uint32_t size)
+{
+    struct buf *obuf = *buf, *nbuf;
+    uint32_t roffset, woffset;
+    int ocls, ncls;
+
+    roffset = obuf->rpos - obuf->begin;
+    woffset = obuf->wpos - obuf->begin;
+    if (woffset > size - BUF_HDR_SIZE) {
+        return CC_ERROR;
+    }
+
+    /* unpooled bufs never enter a pool, so they are resized in place */
+    if (!obuf->borrowed) {
+        return _buf_realloc(buf, size);
+    }
+
+    ncls = _buf_class(size);
+    if (ncls < 0) {
+        log_debug("no buf size class of size %"PRIu32, size);
+
+        return CC_ERROR;
+    }
+
+    nbuf = _buf_borrow(ncls);
+    if (nbuf == NULL) {
+        return CC_ENOMEM;
+    }
+
+    log_verb("buf %p of size %"PRIu32" moved to %p of size %"PRIu32, obuf,
+            buf_size(obuf), nbuf, size);
+
+    cc_memcpy(nbuf->begin + roffset, obuf->rpos, woffset - roffset);
+    nbuf->rpos = nbuf->begin + roffset;
+    nbuf->wpos = nbuf->begin + woffset;
+    *buf = nbuf;
+
+    /* the old buf goes back to the pool of its own class */
+    ocls = _buf_class(buf_size(obuf));
+    if (ocls >= 0) {
+        _buf_return(obuf, ocls);
+    } else {
+        buf_destroy(&obuf);
+    }
+
+    return CC_OK;
+}
+
+struct metric *
+buf_class_metrics(unsigned int *nmetric)
+{
+    *nmetric = buf_nclass * BUF_CLASS_NMETRIC;
+
+    return &class_metrics[0][0];
 }
 
 void
@@ -172,6 +388,7 @@ buf_setup(buf_options_st *options, buf_metrics_st *metrics)
 {
     log_info("setting up the %s module", BUF_MODULE_NAME);
     uint32_t max = BUF_POOLSIZE;
+    uint32_t nclass = BUF_DEFAULT_NCLASS;
 
     if (buf_init) {
         log_warn("%s was already setup, overwriting", BUF_MODULE_NAME);
@@ -182,9 +399,16 @@ buf_setup(buf_options_st *options, buf_metrics_st *metrics)
     if (options != NULL) {
         buf_init_size = option_uint(&options->buf_init_size);
         max = option_uint(&options->buf_poolsize);
+        nclass = option_uint(&options->buf_nclass);
+    }
+
+    if (nclass < 1 || nclass > BUF_NCLASS_MAX ||
+            ((uint64_t)buf_init_size << (nclass - 1)) > UINT32_MAX) {
+        log_crit("invalid number of buf size classes %"PRIu32, nclass);
+        exit(EXIT_FAILURE);
     }
 
-    buf_pool_create(max);
+    buf_pool_create(max, nclass);
 
     buf_init = true;
 }
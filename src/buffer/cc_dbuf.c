@@ -2,8 +2,8 @@
 
 #include <cc_bstring.h>
 #include <cc_debug.h>
-#include <cc_mm.h>
 
+#include <inttypes.h>
 #include <stddef.h>
 
 #define DBUF_MODULE_NAME "ccommon::buffer::dbuf"
@@ -27,11 +27,21 @@ dbuf_setup(dbuf_options_st *options, dbuf_metrics_st *metrics)
     dbuf_metrics = metrics;
 
     if (options != NULL) {
-        /* TODO(yao): validate input */
         max_power = option_uint(&options->dbuf_max_power);
-        max_size = buf_init_size << max_power;
     }
 
+    /*
+     * borrowed bufs only grow within the size classes of the buf module; if
+     * buf is not set up yet, moves beyond the classes fail at resize instead
+     */
+    if (buf_nclass > 0 && max_power > buf_nclass - 1) {
+        log_warn("dbuf max power %"PRIu8" needs %"PRIu32" buf size classes, "
+                "%"PRIu32" set up, clamped", max_power, max_power + 1,
+                buf_nclass);
+        max_power = buf_nclass - 1;
+    }
+    max_size = buf_init_size << max_power;
+
     dbuf_init = true;
 }
 
@@ -50,34 +60,12 @@ dbuf_teardown(void)
 static rstatus_i
 _dbuf_resize(struct buf **buf, uint32_t nsize)
 {
-    struct buf *nbuf;
-    uint32_t osize, roffset, woffset;
-
     if (nsize > max_size) {
         return CC_ERROR;
     }
 
-    osize = buf_size(*buf);
-    roffset = (*buf)->rpos - (*buf)->begin;
-    woffset = (*buf)->wpos - (*buf)->begin;
-
-    nbuf = cc_realloc(*buf, nsize);
-    if (nbuf == NULL) { /* realloc failed, but *buf is still valid */
-        return CC_ENOMEM;
-    }
-
-    log_verb("buf %p of size %"PRIu32" resized to %p of size %"PRIu32, *buf,
-            osize, nbuf, nsize);
-
-    /* end, rpos, wpos need to be adjusted for the new address of buf */
-    nbuf->end = (char *)nbuf + nsize;
-    nbuf->rpos = nbuf->begin + roffset;
-    nbuf->wpos = nbuf->begin + woffset;
-    *buf = nbuf;
-    DECR_N(buf_metrics, buf_memory, osize);
-    INCR_N(buf_metrics, buf_memory, nsize);
-
-    return CC_OK;
+    /* data is moved to a buf of the new size class, no realloc involved */
+    return buf_move(buf, nsize);
 }
 
 rstatus_i
@@ -141,8 +129,8 @@ dbuf_shrink(struct buf **buf)
 
     if (nsize != buf_size(*buf)) {
         /*
-         * realloc is not guaranteed to succeed even on trim, but in the case
-         * that it fails, original buf will still be valid.
+         * a smaller buf is not guaranteed to be available, but in the case
+         * that it is not, original buf will still be valid.
          */
         status = _dbuf_resize(buf, nsize);
 
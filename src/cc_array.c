@@ -21,6 +21,8 @@
 #include <cc_define.h>
 #include <cc_mm.h>
 
+#include <inttypes.h>
+
 #include <stddef.h>
 #include <stdint.h>
 #include <stdlib.h>
@@ -29,6 +31,8 @@
 
 static bool array_init = false;
 static uint32_t max_nelem_delta = NELEM_DELTA;
+static double growth_factor = ARRAY_GROWTH_FACTOR;
+static size_t mremap_size = ARRAY_MREMAP_SIZE;
 
 /**
  * set up array and allocate data buffer in array
@@ -49,15 +53,48 @@ array_data_create(struct array *arr, uint32_t nalloc, size_t size)
     arr->nelem = 0;
     arr->size = size;
     arr->nalloc = nalloc;
+    arr->arena = NULL;
+    arr->nmap = 0;
+
+    return CC_OK;
+}
+
+rstatus_i
+array_data_create_arena(struct array *arr, uint32_t nalloc, size_t size,
+        struct arena *arena)
+{
+    ASSERT(nalloc != 0 && size != 0);
+    ASSERT(arena != NULL);
+
+    arr->data = arena_alloc(arena, nalloc * size);
+    if (arr->data == NULL) {
+        log_info("array data creation failed due to OOM");
+
+        return CC_ENOMEM;
+    }
+
+    arr->nelem = 0;
+    arr->size = size;
+    arr->nalloc = nalloc;
+    arr->arena = arena;
+    arr->nmap = 0;
 
     return CC_OK;
 }
 
-/* free data buffer in array */
+/* free data buffer in array, arena memory is left to the arena */
 void
 array_data_destroy(struct array *arr)
 {
-    if (arr->data != NULL) {
+    if (arr->data == NULL || arr->arena != NULL) {
+        return;
+    }
+
+    if (arr->nmap != 0) {
+        cc_munmap(arr->data, arr->nmap);
+        arr->data = NULL;
+        arr->nmap = 0;
+    } else {
         cc_free(arr->data);
     }
 }
@@ -89,6 +126,30 @@ array_create(struct array **arr, uint32_t nalloc, size_t size)
     return CC_OK;
 }
 
+rstatus_i
+array_create_arena(struct array **arr, uint32_t nalloc, size_t size,
+        struct arena *arena)
+{
+    rstatus_i ret;
+
+    ASSERT(nalloc != 0 && size != 0);
+
+    *arr = arena_alloc(arena, sizeof(**arr));
+    if (*arr == NULL) {
+        log_info("array creation failed due to OOM");
+
+        return CC_ENOMEM;
+    }
+
+    ret = array_data_create_arena(*arr, nalloc, size, arena);
+    if (ret != CC_OK) {
+        *arr = NULL; /* the header is reclaimed with the arena */
+        return ret;
+    }
+
+    return CC_OK;
+}
+
 /**
  * free an array and its data buffer
  * require the address of array as argument to avoid dangling pointer
@@ -100,37 +161,87 @@ array_destroy(struct array **arr)
         return;
     }
 
-    array_data_destroy(*arr);
-    cc_free(*arr);
+    if ((*arr)->arena == NULL) {
+        array_data_destroy(*arr);
+        cc_free(*arr);
+    }
     *arr = NULL;
 }
 
-/*
- * expands the array by:
- * 1) doubling, if nelem is less than max_nelem_delta;
- * 2) adding max_nenem_delta elements
- */
+/* nalloc after one step of growth from the current one, see cc_array.h */
+static uint64_t
+_array_grow_nalloc(const struct array *arr)
+{
+    uint64_t nalloc = arr->nalloc, grown;
+
+    grown = (uint64_t)(nalloc * growth_factor);
+    if (grown <= nalloc) {
+        grown = nalloc + 1;
+    }
+    if (max_nelem_delta != 0 && grown - nalloc > max_nelem_delta) {
+        grown = nalloc + max_nelem_delta;
+    }
+
+    return grown;
+}
+
+/* move data to a mapping of nbyte rounded up to pages, or grow the mapping */
+static rstatus_i
+_array_expand_mmap(struct array *arr, size_t nbyte)
+{
+    void *data;
+
+    nbyte = CC_ALIGN(nbyte, cc_pagesize());
+    if (arr->nmap != 0) {
+        data = cc_mremap(arr->data, arr->nmap, nbyte);
+        if (data == NULL) {
+            return CC_ERROR;
+        }
+    } else {
+        data = cc_mmap(nbyte);
+        if (data == NULL) {
+            return CC_ERROR;
+        }
+        cc_memcpy(data, arr->data, arr->nelem * arr->size);
+        cc_free(arr->data);
+    }
+
+    arr->data = data;
+    arr->nmap = nbyte;
+    /* the page rounding is free capacity */
+    arr->nalloc = (uint32_t)MIN(nbyte / arr->size, UINT32_MAX);
+
+    return CC_OK;
+}
+
+/* grows the data buffer to hold at least nalloc elements */
 static rstatus_i
-_array_expand(struct array *arr)
+_array_expand(struct array *arr, uint64_t nalloc)
 {
     void *data;
-    uint32_t nelem;
     size_t nbyte;
 
-    nelem = arr->nalloc;
-    if (arr->nalloc >= max_nelem_delta) {
-        nelem += max_nelem_delta;
+    if (nalloc > UINT32_MAX) {
+        log_info("array cannot grow beyond %" PRIu32 " elements", UINT32_MAX);
+        return CC_ERROR;
+    }
+
+    nbyte = nalloc * arr->size;
+    if (arr->arena != NULL) {
+        /* grows in place if nothing was allocated from the arena since */
+        data = arena_realloc(arr->arena, arr->data, arr->nalloc * arr->size,
+                nbyte);
+    } else if (arr->nmap != 0 || (mremap_size != 0 && nbyte >= mremap_size)) {
+        return _array_expand_mmap(arr, nbyte);
     } else {
-        nelem *= 2;
+        data = cc_realloc(arr->data, nbyte);
     }
-    nbyte = nelem * arr->size;
-    data = cc_realloc(arr->data, nbyte);
     if (data == NULL) {
         return CC_ERROR;
     }
 
     arr->data = data;
-    arr->nalloc = nelem;
+    arr->nalloc = (uint32_t)nalloc;
     return CC_OK;
 }
 
@@ -146,7 +257,7 @@ array_push(struct array *arr)
 
     if (arr->nelem == arr->nalloc) {
         /* the array is full; expand the data buffer */
-        status = _array_expand(arr);
+        status = _array_expand(arr, _array_grow_nalloc(arr));
         if (status != CC_OK) {
             return NULL;
         }
@@ -157,6 +268,57 @@ array_push(struct array *arr)
     return array_last(arr);
 }
 
+/*
+ * grows by the growth policy, or straight to what is needed if that is more,
+ * so a series of reserves still grows geometrically
+ */
+rstatus_i
+array_reserve(struct array *arr, uint32_t n)
+{
+    uint64_t need = (uint64_t)arr->nelem + n;
+
+    if (need <= arr->nalloc) {
+        return CC_OK;
+    }
+
+    return _array_expand(arr, MAX(need, _array_grow_nalloc(arr)));
+}
+
+void *
+array_push_n(struct array *arr, uint32_t n)
+{
+    void *elem;
+
+    ASSERT(n != 0);
+
+    if (array_reserve(arr, n) != CC_OK) {
+        return NULL;
+    }
+
+    elem = arr->data + arr->size * arr->nelem;
+    arr->nelem += n;
+
+    return elem;
+}
+
+rstatus_i
+array_append(struct array *arr, const void *elem, uint32_t n)
+{
+    void *dst;
+
+    if (n == 0) {
+        return CC_OK;
+    }
+
+    dst = array_push_n(arr, n);
+    if (dst == NULL) {
+        return CC_ENOMEM;
+    }
+    cc_memcpy(dst, elem, arr->size * n);
+
+    return CC_OK;
+}
+
 /* pop the last element */
 void *
 array_pop(struct array *arr)
@@ -216,6 +378,13 @@ void array_setup(array_options_st *options)
 
     if (options != NULL) {
         max_nelem_delta = option_uint(&options->array_nelem_delta);
+        growth_factor = option_fpn(&options->array_growth_factor);
+        mremap_size = option_uint(&options->array_mremap_size);
+    }
+    if (growth_factor <= 1.0) {
+        log_warn("array growth factor %f invalid, using %f", growth_factor,
+                ARRAY_GROWTH_FACTOR);
+        growth_factor = ARRAY_GROWTH_FACTOR;
     }
 
     array_init = true;
@@ -20,7 +20,12 @@
 #include <cc_debug.h>
 #include <cc_mm.h>
 
-#include <ctype.h>
+
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__) && \
+    defined(__SSE2__)
+#define BSTRING_SIMD 1
+#include <immintrin.h>
+#endif
 
 /*
  * Byte string (struct bstring) is a sequence of unsigned char
@@ -109,18 +114,95 @@ bstring_compare(const struct bstring *s1, const struct bstring *s2)
      * so we can use 256 to indicate a length difference in case it's useful
      */
     if (s1->len != s2->len) {
-        return s1->len - s2->len > 0 ? 256 : -256;
+        return s1->len > s2->len ? 256 : -256;
     }
 
     return cc_bcmp(s1->data, s2->data, s1->len);
 }
 
+/*
+ * Digits are parsed 8 at a time on little-endian machines: 8 bytes are loaded
+ * as a word (first character in the lowest byte), checked to all be ASCII
+ * digits at once, and combined into a number with 3 multiplications, by
+ * merging digit pairs, then pairs of pairs, then halves (SWAR, "SIMD within
+ * a register"). Up to 19 digits cannot overflow a uint64_t, so overflow is
+ * only checked for the 20th.
+ */
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+#define BSTRING_SWAR 1
+#endif
+
+#define DIGIT_MAX_SAFE 19 /* # digits that fit in uint64_t regardless of value */
+
+#ifdef BSTRING_SWAR
+static inline bool
+_is_digit8(uint64_t v)
+{
+    /* a digit has high nibble 3 before and after adding 6 */
+    return ((v & 0xf0f0f0f0f0f0f0f0ULL) |
+            (((v + 0x0606060606060606ULL) & 0xf0f0f0f0f0f0f0f0ULL) >> 4)) ==
+            0x3333333333333333ULL;
+}
+
+static inline uint32_t
+_parse_digit8(uint64_t v)
+{
+    v -= 0x3030303030303030ULL;
+    v = v * 10 + (v >> 8);
+    v = (((v & 0x000000ff000000ffULL) * (100 + (1000000ULL << 32))) +
+        (((v >> 16) & 0x000000ff000000ffULL) * (1 + (10000ULL << 32)))) >> 32;
+
+    return (uint32_t)v;
+}
+#endif
+
+/* parses n digits into *u64, n must not exceed DIGIT_MAX_SAFE + 1 */
+static inline rstatus_i
+_parse_uint64(uint64_t *u64, const char *p, uint32_t n)
+{
+    uint64_t u = 0;
+    uint32_t nsafe = n > DIGIT_MAX_SAFE ? DIGIT_MAX_SAFE : n;
+    uint8_t d;
+
+    ASSERT(n <= DIGIT_MAX_SAFE + 1);
+
+    n -= nsafe;
+#ifdef BSTRING_SWAR
+    for (; nsafe >= 8; nsafe -= 8, p += 8) {
+        uint64_t v = cc_load64(p);
+
+        if (!_is_digit8(v)) {
+            return CC_ERROR;
+        }
+        u = u * 100000000ULL + _parse_digit8(v);
+    }
+#endif
+    for (; nsafe > 0; nsafe--, p++) {
+        d = (uint8_t)(*p - '0');
+        if (d > 9) {
+            return CC_ERROR;
+        }
+        u = u * 10 + d;
+    }
+
+    if (n > 0) {
+        d = (uint8_t)(*p - '0');
+        if (d > 9 || u > (UINT64_MAX - d) / 10) {
+            return CC_ERROR;
+        }
+        u = u * 10 + d;
+    }
+
+    *u64 = u;
+
+    return CC_OK;
+}
+
 rstatus_i
 bstring_atoi64(int64_t *i64, struct bstring *str)
 {
     uint32_t offset = 0;
-    uint8_t c;
-    int64_t sign = 1;
+    uint64_t u64;
 
     if (str->len == 0 || str->len >= CC_INT64_MAXLEN) {
         return CC_ERROR;
@@ -128,28 +210,25 @@ bstring_atoi64(int64_t *i64, struct bstring *str)
 
     if (*str->data == '-') {
         offset = 1;
-        sign = -1;
+    }
+    if (offset == str->len) {
+        return CC_ERROR;
+    }
+
+    if (_parse_uint64(&u64, str->data + offset, str->len - offset) != CC_OK) {
+        return CC_ERROR;
     }
 
-    for (*i64 = 0LL; offset < str->len; offset++) {
-        c = *(str->data + offset);
-        if (isdigit(c) == 0) {
+    if (offset == 0) {
+        if (u64 > INT64_MAX) {
             return CC_ERROR;
         }
-
-        // overflow check
-        if (offset == CC_INT64_MAXLEN - 2) {
-            if (sign < 0 && *i64 == INT64_MIN / 10 &&
-                    c - '0' > -(INT64_MIN % 10)) {
-                return CC_ERROR;
-            }
-            if (sign > 0 && *i64 == INT64_MAX / 10 &&
-                    c - '0' > INT64_MAX % 10) {
-                return CC_ERROR;
-            }
+        *i64 = (int64_t)u64;
+    } else {
+        if (u64 > (uint64_t)INT64_MAX + 1) {
+            return CC_ERROR;
         }
-
-        *i64 = *i64 * 10LL + sign * (int64_t)(c - '0');
+        *i64 = u64 == (uint64_t)INT64_MAX + 1 ? INT64_MIN : -(int64_t)u64;
     }
 
     return CC_OK;
@@ -158,48 +237,270 @@ bstring_atoi64(int64_t *i64, struct bstring *str)
 rstatus_i
 bstring_atou64(uint64_t *u64, struct bstring *str)
 {
-    uint32_t offset;
-    uint8_t c;
-
     *u64 = 0ULL;
 
     if (str->len == 0 || str->len >= CC_UINT64_MAXLEN) {
         return CC_ERROR;
     }
 
-    for (offset = 0; offset < str->len; offset++) {
-        c = *(str->data + offset);
-        if (isdigit(c) == 0) {
-            return CC_ERROR;
+    return _parse_uint64(u64, str->data, str->len);
+}
+
+/*
+ * Searches scan the string W bytes at a time with a mask function, which
+ * sets bit i if position i of the chunk matches. If the string is not a
+ * multiple of W long, the last chunk is loaded ending at the end of the
+ * string, overlapping the previous one, and the bits already scanned are
+ * shifted out; strings shorter than 16 bytes are scanned bytewise.
+ *
+ * AVX2 (W = 32) is picked at run time for strings of at least 32 bytes, so
+ * the library needs no -mavx2; otherwise SSE2 (W = 16), which every x86-64
+ * CPU has, is used.
+ */
+#define SCAN(_w, _mask, _p, _n) do {                                    \
+    uint32_t _i, _m;                                                    \
+                                                                        \
+    for (_i = 0; _i + (_w) <= (_n); _i += (_w)) {                       \
+        _m = _mask((_p) + _i);                                          \
+        if (_m != 0) {                                                  \
+            return (char *)(_p) + _i + __builtin_ctz(_m);               \
+        }                                                               \
+    }                                                                   \
+    if (_i < (_n)) {                                                    \
+        _m = _mask((_p) + (_n) - (_w)) >> (_i - ((_n) - (_w)));         \
+        if (_m != 0) {                                                  \
+            return (char *)(_p) + _i + __builtin_ctz(_m);               \
+        }                                                               \
+    }                                                                   \
+    return NULL;                                                        \
+} while (0)
+
+#ifdef BSTRING_SIMD
+
+#define MASK_CHAR_SSE2(_q)                                              \
+    (uint32_t)_mm_movemask_epi8(_mm_cmpeq_epi8(                         \
+        _mm_loadu_si128((const __m128i *)(_q)), vc))
+
+#define MASK_CRLF_SSE2(_q)                                              \
+    ((uint32_t)_mm_movemask_epi8(_mm_cmpeq_epi8(                        \
+        _mm_loadu_si128((const __m128i *)(_q)), vcr)) &                 \
+     (uint32_t)_mm_movemask_epi8(_mm_cmpeq_epi8(                        \
+        _mm_loadu_si128((const __m128i *)((_q) + 1)), vlf)))
+
+#define MASK_CHAR_AVX2(_q)                                              \
+    (uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(                   \
+        _mm256_loadu_si256((const __m256i *)(_q)), vc))
+
+#define MASK_CRLF_AVX2(_q)                                              \
+    ((uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(                  \
+        _mm256_loadu_si256((const __m256i *)(_q)), vcr)) &              \
+     (uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(                  \
+        _mm256_loadu_si256((const __m256i *)((_q) + 1)), vlf)))
+
+static inline uint32_t
+_mask_any_sse2(const char *q, const __m128i *vd, uint32_t ndelim)
+{
+    __m128i x = _mm_loadu_si128((const __m128i *)q), eq;
+    uint32_t k;
+
+    eq = _mm_cmpeq_epi8(x, vd[0]);
+    for (k = 1; k < ndelim; k++) {
+        eq = _mm_or_si128(eq, _mm_cmpeq_epi8(x, vd[k]));
+    }
+
+    return (uint32_t)_mm_movemask_epi8(eq);
+}
+
+__attribute__((target("avx2")))
+static inline uint32_t
+_mask_any_avx2(const char *q, const __m256i *vd, uint32_t ndelim)
+{
+    __m256i x = _mm256_loadu_si256((const __m256i *)q), eq;
+    uint32_t k;
+
+    eq = _mm256_cmpeq_epi8(x, vd[0]);
+    for (k = 1; k < ndelim; k++) {
+        eq = _mm256_or_si256(eq, _mm256_cmpeq_epi8(x, vd[k]));
+    }
+
+    return (uint32_t)_mm256_movemask_epi8(eq);
+}
+
+#define MASK_ANY_SSE2(_q) _mask_any_sse2(_q, vd, ndelim)
+#define MASK_ANY_AVX2(_q) _mask_any_avx2(_q, vd, ndelim)
+
+static char *
+_find_char_sse2(const char *p, uint32_t n, char c)
+{
+    __m128i vc = _mm_set1_epi8(c);
+
+    SCAN(16, MASK_CHAR_SSE2, p, n);
+}
+
+__attribute__((target("avx2")))
+static char *
+_find_char_avx2(const char *p, uint32_t n, char c)
+{
+    __m256i vc = _mm256_set1_epi8(c);
+
+    SCAN(32, MASK_CHAR_AVX2, p, n);
+}
+
+/* n is the number of positions a "\r\n" can start at, i.e. length - 1 */
+static char *
+_find_crlf_sse2(const char *p, uint32_t n)
+{
+    __m128i vcr = _mm_set1_epi8('\r'), vlf = _mm_set1_epi8('\n');
+
+    SCAN(16, MASK_CRLF_SSE2, p, n);
+}
+
+__attribute__((target("avx2")))
+static char *
+_find_crlf_avx2(const char *p, uint32_t n)
+{
+    __m256i vcr = _mm256_set1_epi8('\r'), vlf = _mm256_set1_epi8('\n');
+
+    SCAN(32, MASK_CRLF_AVX2, p, n);
+}
+
+static char *
+_find_any_sse2(const char *p, uint32_t n, const char *delim, uint32_t ndelim)
+{
+    __m128i vd[BSTRING_DELIM_MAX];
+    uint32_t k;
+
+    for (k = 0; k < ndelim; k++) {
+        vd[k] = _mm_set1_epi8(delim[k]);
+    }
+
+    SCAN(16, MASK_ANY_SSE2, p, n);
+}
+
+__attribute__((target("avx2")))
+static char *
+_find_any_avx2(const char *p, uint32_t n, const char *delim, uint32_t ndelim)
+{
+    __m256i vd[BSTRING_DELIM_MAX];
+    uint32_t k;
+
+    for (k = 0; k < ndelim; k++) {
+        vd[k] = _mm256_set1_epi8(delim[k]);
+    }
+
+    SCAN(32, MASK_ANY_AVX2, p, n);
+}
+
+#endif /* BSTRING_SIMD */
+
+char *
+bstring_find_char(const struct bstring *str, char c)
+{
+#ifdef BSTRING_SIMD
+    if (str->len >= 32 && __builtin_cpu_supports("avx2")) {
+        return _find_char_avx2(str->data, str->len, c);
+    }
+    if (str->len >= 16) {
+        return _find_char_sse2(str->data, str->len, c);
+    }
+#endif
+
+    return cc_memchr(str->data, c, str->len);
+}
+
+char *
+bstring_find_crlf(const struct bstring *str)
+{
+    uint32_t i;
+
+    if (str->len < 2) {
+        return NULL;
+    }
+
+#ifdef BSTRING_SIMD
+    if (str->len - 1 >= 32 && __builtin_cpu_supports("avx2")) {
+        return _find_crlf_avx2(str->data, str->len - 1);
+    }
+    if (str->len - 1 >= 16) {
+        return _find_crlf_sse2(str->data, str->len - 1);
+    }
+#endif
+
+    for (i = 0; i + 1 < str->len; i++) {
+        if (str->data[i] == CR && str->data[i + 1] == LF) {
+            return str->data + i;
         }
+    }
 
-        // overflow check
-        if (offset == CC_UINT64_MAXLEN - 2 && *u64 == UINT64_MAX / 10 &&
-                c > UINT64_MAX % 10 + '0') {
-            return CC_ERROR;
+    return NULL;
+}
+
+char *
+bstring_find_any(const struct bstring *str, const char *delim, uint32_t ndelim)
+{
+    uint32_t i, k;
+
+    ASSERT(ndelim > 0 && ndelim <= BSTRING_DELIM_MAX);
+
+    if (ndelim == 1) {
+        return bstring_find_char(str, delim[0]);
+    }
+
+#ifdef BSTRING_SIMD
+    if (str->len >= 32 && __builtin_cpu_supports("avx2")) {
+        return _find_any_avx2(str->data, str->len, delim, ndelim);
+    }
+    if (str->len >= 16) {
+        return _find_any_sse2(str->data, str->len, delim, ndelim);
+    }
+#endif
+
+    for (i = 0; i < str->len; i++) {
+        for (k = 0; k < ndelim; k++) {
+            if (str->data[i] == delim[k]) {
+                return str->data + i;
+            }
         }
+    }
+
+    return NULL;
+}
+
+bool
+bstring_token(struct bstring *token, struct bstring *str, const char *delim,
+        uint32_t ndelim)
+{
+    char *p;
 
-        *u64 = *u64 * 10ULL + (uint64_t)(c - '0');
+    if (str->len == 0) {
+        return false;
     }
 
-    return CC_OK;
+    token->data = str->data;
+    p = bstring_find_any(str, delim, ndelim);
+    if (p == NULL) {
+        token->len = str->len;
+        str->data += str->len;
+        str->len = 0;
+    } else {
+        token->len = (uint32_t)(p - str->data);
+        str->data = p + 1;
+        str->len -= token->len + 1;
+    }
+
+    return true;
 }
 
 struct bstring *
 bstring_alloc(uint32_t size)
 {
-    struct bstring *bs = cc_alloc(sizeof(*bs));
+    struct bstring *bs = cc_alloc(sizeof(*bs) + size);
     if (bs == NULL) {
         return NULL;
     }
-    bstring_init(bs);
 
     bs->len = size;
-    bs->data = cc_alloc(size);
-    if (bs->data == NULL) {
-        cc_free(bs);
-        return NULL;
-    }
+    bs->data = (char *)(bs + 1);
 
     return bs;
 }
@@ -211,8 +512,112 @@ bstring_free(struct bstring **ptr)
         return;
     }
 
-    struct bstring *bs = *ptr;
-    cc_free(bs->data);
-    cc_free(bs);
+    cc_free(*ptr);
     *ptr = NULL;
 }
+
+rstatus_i
+bstring_copy_arena(struct bstring *dst, const char *src, uint32_t srclen,
+        struct arena *arena)
+{
+    ASSERT(dst->len == 0 && dst->data == NULL);
+    ASSERT(src != NULL && srclen != 0);
+
+    /* string bytes need no alignment, so consecutive copies pack tightly */
+    dst->data = arena_alloc_aligned(arena, srclen, 1);
+    if (dst->data == NULL) {
+        return CC_ENOMEM;
+    }
+
+    cc_memcpy(dst->data, src, srclen);
+    dst->len = srclen;
+
+    return CC_OK;
+}
+
+rstatus_i
+bstring_duplicate_arena(struct bstring *dst, const struct bstring *src,
+        struct arena *arena)
+{
+    return bstring_copy_arena(dst, src->data, src->len, arena);
+}
+
+struct bstring *
+bstring_alloc_arena(uint32_t size, struct arena *arena)
+{
+    struct bstring *bs = arena_alloc(arena, sizeof(*bs) + size);
+    if (bs == NULL) {
+        return NULL;
+    }
+
+    bs->len = size;
+    bs->data = (char *)(bs + 1);
+
+    return bs;
+}
+
+void
+bstring_sso_init(struct bstring_sso *str)
+{
+    str->u.buf[0] = '\0';
+    str->u.buf[BSTRING_SSO_CAP] = BSTRING_SSO_CAP;
+}
+
+void
+bstring_sso_deinit(struct bstring_sso *str)
+{
+    if (!bstring_sso_inline(str)) {
+        cc_free(str->u.heap.data);
+    }
+    bstring_sso_init(str);
+}
+
+rstatus_i
+bstring_sso_copy(struct bstring_sso *dst, const char *src, uint32_t srclen)
+{
+    ASSERT(bstring_sso_inline(dst) && bstring_sso_len(dst) == 0);
+    ASSERT(src != NULL || srclen == 0);
+
+    if (srclen <= BSTRING_SSO_CAP) {
+        cc_memcpy(dst->u.buf, src, srclen);
+        dst->u.buf[BSTRING_SSO_CAP] = (char)(BSTRING_SSO_CAP - srclen);
+
+        return CC_OK;
+    }
+
+    dst->u.heap.data = (char *)cc_alloc(srclen);
+    if (dst->u.heap.data == NULL) {
+        bstring_sso_init(dst);
+        return CC_ENOMEM;
+    }
+
+    cc_memcpy(dst->u.heap.data, src, srclen);
+    dst->u.heap.len = srclen;
+    dst->u.buf[BSTRING_SSO_CAP] = (char)BSTRING_SSO_HEAP;
+
+    return CC_OK;
+}
+
+rstatus_i
+bstring_sso_duplicate(struct bstring_sso *dst, const struct bstring_sso *src)
+{
+    ASSERT(bstring_sso_inline(dst) && bstring_sso_len(dst) == 0);
+
+    if (bstring_sso_inline(src)) {
+        /* the whole struct, length byte included, in a couple of moves */
+        *dst = *src;
+
+        return CC_OK;
+    }
+
+    return bstring_sso_copy(dst, src->u.heap.data, src->u.heap.len);
+}
+
+int
+bstring_sso_compare(const struct bstring_sso *s1, const struct bstring_sso *s2)
+{
+    struct bstring b1 = bstring_sso_bstr((struct bstring_sso *)s1);
+    struct bstring b2 = bstring_sso_bstr((struct bstring_sso *)s2);
+
+    return bstring_compare(&b1, &b2);
+}
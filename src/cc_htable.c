@@ -0,0 +1,453 @@
+/*
+ * ccommon - a cache common library.
+ * Copyright (C) 2021 Twitter, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <cc_htable.h>
+
+#include <hash/cc_hash.h>
+
+#include <cc_debug.h>
+#include <cc_mm.h>
+
+#include <inttypes.h>
+#include <string.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+/**
+ * Control bytes: a full slot holds h2, the low 7 bits of the key's hash, so
+ * its top bit is clear; free slots have the top bit set.
+ *
+ * The group a probe starts at comes from the remaining bits (h1). Groups are
+ * visited in triangular steps (+1, +2, +3, ...), which covers every group of
+ * a power-of-2 table. A key can only be in groups before the first one that
+ * has an empty slot, so the probe ends there.
+ *
+ * Erasing a slot in a group that has an empty slot leaves it empty as well,
+ * since no probe goes past that group; otherwise it becomes a tombstone
+ * (CTRL_DELETED) to keep later probes going. At most 7/8 of the slots are
+ * ever taken by entries or tombstones (growth_left), so probes stay short
+ * and always end.
+ */
+#define CTRL_EMPTY      ((uint8_t)0x80)
+#define CTRL_DELETED    ((uint8_t)0xfe)
+
+#define H1(_h)          ((_h) >> 7)
+#define H2(_h)          ((uint8_t)((_h) & 0x7f))
+
+#define SLOT_NONE       UINT32_MAX
+
+static inline uint64_t
+_hash(const struct bstring *key)
+{
+    return hash_xxh3_64(key->data, key->len, 0);
+}
+
+static inline bool
+_key_eq(const struct bstring *k1, const struct bstring *k2)
+{
+    return k1->len == k2->len && cc_bcmp(k1->data, k2->data, k1->len) == 0;
+}
+
+/* bit i is set if ctrl[i] of the group equals c */
+static inline uint32_t
+_match(const uint8_t *ctrl, uint8_t c)
+{
+#ifdef __SSE2__
+    __m128i g = _mm_loadu_si128((const __m128i *)ctrl);
+
+    return (uint32_t)_mm_movemask_epi8(_mm_cmpeq_epi8(g, _mm_set1_epi8(c)));
+#else
+    uint32_t m = 0, i;
+
+    for (i = 0; i < HTABLE_GROUP; i++) {
+        m |= (uint32_t)(ctrl[i] == c) << i;
+    }
+
+    return m;
+#endif
+}
+
+/* bit i is set if ctrl[i] of the group is empty or deleted */
+static inline uint32_t
+_match_free(const uint8_t *ctrl)
+{
+#ifdef __SSE2__
+    __m128i g = _mm_loadu_si128((const __m128i *)ctrl);
+
+    return (uint32_t)_mm_movemask_epi8(g);
+#else
+    uint32_t m = 0, i;
+
+    for (i = 0; i < HTABLE_GROUP; i++) {
+        m |= (uint32_t)(ctrl[i] >> 7) << i;
+    }
+
+    return m;
+#endif
+}
+
+static inline uint32_t
+_nslot(const struct htable_table *t)
+{
+    return t->ngroup * HTABLE_GROUP;
+}
+
+static rstatus_i
+_table_create(struct htable_table *t, uint32_t ngroup)
+{
+    ASSERT(ngroup != 0 && (ngroup & (ngroup - 1)) == 0);
+
+    t->ngroup = ngroup;
+    t->ctrl = cc_alloc(_nslot(t));
+    t->slot = cc_alloc(sizeof(struct htable_slot) * _nslot(t));
+    if (t->ctrl == NULL || t->slot == NULL) {
+        cc_free(t->ctrl);
+        cc_free(t->slot);
+        t->ctrl = NULL;
+        t->slot = NULL;
+
+        return CC_ENOMEM;
+    }
+
+    cc_memset(t->ctrl, CTRL_EMPTY, _nslot(t));
+    t->growth_left = _nslot(t) / 8 * 7;
+
+    return CC_OK;
+}
+
+static void
+_table_destroy(struct htable_table *t)
+{
+    cc_free(t->ctrl);
+    cc_free(t->slot);
+    t->ctrl = NULL;
+    t->slot = NULL;
+}
+
+static uint32_t
+_table_find(const struct htable_table *t, const struct bstring *key,
+        uint64_t h)
+{
+    uint32_t mask = t->ngroup - 1, g = H1(h) & mask, probe;
+
+    for (probe = 1; probe <= t->ngroup; probe++) {
+        const uint8_t *ctrl = t->ctrl + g * HTABLE_GROUP;
+        uint32_t m = _match(ctrl, H2(h));
+
+        for (; m != 0; m &= m - 1) {
+            uint32_t i = g * HTABLE_GROUP + __builtin_ctz(m);
+
+            if (_key_eq(&t->slot[i].key, key)) {
+                return i;
+            }
+        }
+        if (_match(ctrl, CTRL_EMPTY) != 0) {
+            return SLOT_NONE;
+        }
+        g = (g + probe) & mask;
+    }
+
+    return SLOT_NONE;
+}
+
+/* first empty or deleted slot on the probe sequence of h */
+static uint32_t
+_table_find_free(const struct htable_table *t, uint64_t h)
+{
+    uint32_t mask = t->ngroup - 1, g = H1(h) & mask, probe;
+
+    for (probe = 1; probe <= t->ngroup; probe++) {
+        uint32_t m = _match_free(t->ctrl + g * HTABLE_GROUP);
+
+        if (m != 0) {
+            return g * HTABLE_GROUP + __builtin_ctz(m);
+        }
+        g = (g + probe) & mask;
+    }
+
+    NOT_REACHED();
+    return SLOT_NONE;
+}
+
+static void
+_table_place(struct htable_table *t, uint64_t h, const struct bstring *key,
+        void *val)
+{
+    uint32_t i = _table_find_free(t, h);
+
+    ASSERT(t->ctrl[i] == CTRL_DELETED || t->growth_left > 0);
+
+    if (t->ctrl[i] == CTRL_EMPTY) {
+        t->growth_left--;
+    }
+    t->ctrl[i] = H2(h);
+    t->slot[i].key = *key;
+    t->slot[i].val = val;
+}
+
+static void
+_table_erase(struct htable_table *t, uint32_t i)
+{
+    uint8_t *ctrl = t->ctrl + i / HTABLE_GROUP * HTABLE_GROUP;
+
+    if (_match(ctrl, CTRL_EMPTY) != 0) {
+        t->ctrl[i] = CTRL_EMPTY;
+        t->growth_left++;
+    } else {
+        t->ctrl[i] = CTRL_DELETED;
+    }
+}
+
+/* move up to n groups of the old table over, free it once it is empty */
+static void
+_migrate(struct htable *ht, uint32_t n)
+{
+    struct htable_table *old = &ht->old;
+
+    if (old->ctrl == NULL) {
+        return;
+    }
+
+    for (; n > 0 && ht->cursor < old->ngroup; n--, ht->cursor++) {
+        uint32_t i = ht->cursor * HTABLE_GROUP, end = i + HTABLE_GROUP;
+
+        for (; i < end; i++) {
+            if (old->ctrl[i] & 0x80) {
+                continue;
+            }
+            _table_place(&ht->cur, _hash(&old->slot[i].key), &old->slot[i].key,
+                    old->slot[i].val);
+            old->ctrl[i] = CTRL_DELETED;
+        }
+    }
+
+    if (ht->cursor == old->ngroup) {
+        log_verb("htable %p finished migrating %"PRIu32" groups", ht,
+                old->ngroup);
+        _table_destroy(old);
+    }
+}
+
+/*
+ * start moving to a new table: twice the size if more than half of the
+ * allowed load are live entries, otherwise the same size, which clears out
+ * tombstones
+ */
+static rstatus_i
+_grow(struct htable *ht)
+{
+    struct htable_table t;
+    uint32_t ngroup = ht->cur.ngroup;
+    rstatus_i status;
+
+    /* sized as below, the new table never fills up before this finishes */
+    _migrate(ht, UINT32_MAX);
+
+    if (ht->nentry >= _nslot(&ht->cur) / 16 * 7) {
+        ngroup *= 2;
+    }
+    status = _table_create(&t, ngroup);
+    if (status != CC_OK) {
+        log_warn("htable %p cannot grow to %"PRIu32" groups due to OOM", ht,
+                ngroup);
+        return status;
+    }
+
+    log_verb("htable %p with %"PRIu32" entries grows from %"PRIu32" to "
+            "%"PRIu32" groups", ht, ht->nentry, ht->cur.ngroup, ngroup);
+
+    ht->old = ht->cur;
+    ht->cur = t;
+    ht->cursor = 0;
+
+    return CC_OK;
+}
+
+struct htable *
+htable_create(uint32_t nentry)
+{
+    struct htable *ht;
+    uint32_t ngroup = 1;
+
+    ht = (struct htable *)cc_alloc(sizeof(*ht));
+    if (ht == NULL) {
+        log_info("htable creation failed due to OOM");
+        return NULL;
+    }
+
+    while (ngroup * HTABLE_GROUP / 8 * 7 < nentry) {
+        ngroup *= 2;
+    }
+    if (_table_create(&ht->cur, ngroup) != CC_OK) {
+        log_info("htable creation failed due to OOM");
+        cc_free(ht);
+        return NULL;
+    }
+    ht->old.ctrl = NULL;
+    ht->old.slot = NULL;
+    ht->old.ngroup = 0;
+    ht->cursor = 0;
+    ht->nentry = 0;
+
+    return ht;
+}
+
+void
+htable_destroy(struct htable **ht)
+{
+    if (ht == NULL || *ht == NULL) {
+        return;
+    }
+
+    _table_destroy(&(*ht)->cur);
+    _table_destroy(&(*ht)->old);
+    cc_free(*ht);
+    *ht = NULL;
+}
+
+rstatus_i
+htable_put(struct htable *ht, const struct bstring *key, void *val)
+{
+    uint64_t h;
+    uint32_t i;
+
+    ASSERT(ht != NULL && key != NULL);
+
+    if (val == NULL) {
+        return CC_EINVAL;
+    }
+
+    /* grow first, as doing so moves whatever is left in the old table */
+    if (ht->cur.growth_left == 0 && _grow(ht) != CC_OK) {
+        return CC_ENOMEM;
+    }
+
+    h = _hash(key);
+
+    i = _table_find(&ht->cur, key, h);
+    if (i != SLOT_NONE) {
+        ht->cur.slot[i].key = *key;
+        ht->cur.slot[i].val = val;
+        _migrate(ht, HTABLE_MIGRATE);
+
+        return CC_OK;
+    }
+
+    /* not moved yet, take it out of the old table and insert anew */
+    if (htable_migrating(ht)) {
+        i = _table_find(&ht->old, key, h);
+        if (i != SLOT_NONE) {
+            _table_erase(&ht->old, i);
+            ht->nentry--;
+        }
+    }
+
+    _table_place(&ht->cur, h, key, val);
+    ht->nentry++;
+    _migrate(ht, HTABLE_MIGRATE);
+
+    return CC_OK;
+}
+
+void *
+htable_get(const struct htable *ht, const struct bstring *key)
+{
+    uint64_t h;
+    uint32_t i;
+
+    ASSERT(ht != NULL && key != NULL);
+
+    h = _hash(key);
+
+    i = _table_find(&ht->cur, key, h);
+    if (i != SLOT_NONE) {
+        return ht->cur.slot[i].val;
+    }
+
+    if (htable_migrating(ht)) {
+        i = _table_find(&ht->old, key, h);
+        if (i != SLOT_NONE) {
+            return ht->old.slot[i].val;
+        }
+    }
+
+    return NULL;
+}
+
+void *
+htable_delete(struct htable *ht, const struct bstring *key)
+{
+    struct htable_table *t = &ht->cur;
+    void *val = NULL;
+    uint64_t h;
+    uint32_t i;
+
+    ASSERT(ht != NULL && key != NULL);
+
+    h = _hash(key);
+
+    i = _table_find(t, key, h);
+    if (i == SLOT_NONE && htable_migrating(ht)) {
+        t = &ht->old;
+        i = _table_find(t, key, h);
+    }
+    if (i != SLOT_NONE) {
+        val = t->slot[i].val;
+        _table_erase(t, i);
+        ht->nentry--;
+    }
+
+    _migrate(ht, HTABLE_MIGRATE);
+
+    return val;
+}
+
+static rstatus_i
+_table_each(const struct htable_table *t, htable_each_fn func, void *arg)
+{
+    uint32_t i;
+    rstatus_i status;
+
+    for (i = 0; i < _nslot(t); i++) {
+        if (t->ctrl[i] & 0x80) {
+            continue;
+        }
+        status = func(&t->slot[i].key, t->slot[i].val, arg);
+        if (status != CC_OK) {
+            return status;
+        }
+    }
+
+    return CC_OK;
+}
+
+rstatus_i
+htable_each(const struct htable *ht, htable_each_fn func, void *arg)
+{
+    rstatus_i status;
+
+    ASSERT(ht != NULL && func != NULL);
+
+    status = _table_each(&ht->cur, func, arg);
+    if (status == CC_OK && htable_migrating(ht)) {
+        status = _table_each(&ht->old, func, arg);
+    }
+
+    return status;
+}
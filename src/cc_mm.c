@@ -20,9 +20,15 @@
 #include <cc_debug.h>
 
 #include <errno.h>
+#include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <sys/mman.h>
+#include <unistd.h>
+
+#ifdef OS_LINUX
+#include <sys/syscall.h>
+#endif
 
 #ifdef OS_DARWIN
 #   define MAP_ANONYMOUS MAP_ANON
@@ -150,6 +156,230 @@ _cc_mmap(size_t size, const char *name, int line)
     return p;
 }
 
+size_t
+cc_pagesize(void)
+{
+    static size_t pagesize = 0;
+
+    if (pagesize == 0) {
+        long ps = sysconf(_SC_PAGESIZE);
+
+        pagesize = ps > 0 ? (size_t)ps : 4 * KiB;
+    }
+
+    return pagesize;
+}
+
+/* default huge page size of the system, 2MiB if it cannot be told */
+size_t
+cc_hugepagesize(void)
+{
+    static size_t hugepagesize = 0;
+
+    if (hugepagesize == 0) {
+        FILE *fp;
+        char line[128];
+        unsigned long kb;
+
+        hugepagesize = 2 * MiB;
+        fp = fopen("/proc/meminfo", "r");
+        if (fp != NULL) {
+            while (fgets(line, sizeof(line), fp) != NULL) {
+                if (sscanf(line, "Hugepagesize: %lu kB", &kb) == 1) {
+                    hugepagesize = kb * KiB;
+                    break;
+                }
+            }
+            fclose(fp);
+        }
+    }
+
+    return hugepagesize;
+}
+
+/* map size bytes starting at a multiple of align, a multiple of the page size */
+static void *
+_cc_mmap_aligned(size_t size, size_t align, int mflags)
+{
+    char *p, *start;
+
+    if (align <= cc_pagesize()) {
+        return mmap(NULL, size, PROT_READ | PROT_WRITE, mflags, -1, 0);
+    }
+
+    /* over-map, then trim both ends; the tail trim must start on a page */
+    size = CC_ALIGN(size, cc_pagesize());
+    p = mmap(NULL, size + align, PROT_READ | PROT_WRITE, mflags, -1, 0);
+    if (p == MAP_FAILED) {
+        return MAP_FAILED;
+    }
+    start = CC_ALIGN_PTR(p, align);
+    if (start > p) {
+        munmap(p, start - p);
+    }
+    munmap(start + size, p + align - start);
+
+    return start;
+}
+
+static int
+_cc_mbind(void *p, size_t size, int node)
+{
+#if defined OS_LINUX && defined SYS_mbind
+    unsigned long nodemask[node / (8 * sizeof(unsigned long)) + 1];
+    unsigned long nbit = sizeof(nodemask) * 8;
+
+    memset(nodemask, 0, sizeof(nodemask));
+    nodemask[node / (8 * sizeof(unsigned long))] |=
+        1UL << (node % (8 * sizeof(unsigned long)));
+
+    /* MPOL_BIND is 2; maxnode counts one past the last bit */
+    return (int)syscall(SYS_mbind, p, size, 2, nodemask, nbit + 1, 0);
+#else
+    errno = ENOSYS;
+    return -1;
+#endif
+}
+
+static void
+_cc_prefault(void *p, size_t size)
+{
+    volatile char *c = p;
+    size_t i, ps = cc_pagesize();
+
+#ifdef MADV_POPULATE_WRITE
+    if (madvise(p, size, MADV_POPULATE_WRITE) == 0) {
+        return;
+    }
+#endif
+
+    /* fresh anonymous memory reads as 0, so writing 0 changes nothing */
+    for (i = 0; i < size; i += ps) {
+        c[i] = 0;
+    }
+}
+
+void *
+_cc_mmap_opt(size_t size, uint32_t flags, int node, size_t *pagesize,
+        const char *name, int line)
+{
+    void *p = MAP_FAILED;
+    size_t ps = cc_pagesize(), hps = cc_hugepagesize();
+    int mflags = MAP_PRIVATE | MAP_ANONYMOUS;
+    bool prefault = flags & CC_MMAP_POPULATE;
+
+    ASSERT(size != 0);
+    ASSERT(!(flags & CC_MMAP_NUMA) || node >= 0);
+
+#ifdef MAP_POPULATE
+    /* pages faulted in before mbind would come from the local node */
+    if (prefault && !(flags & CC_MMAP_NUMA)) {
+        mflags |= MAP_POPULATE;
+        prefault = false;
+    }
+#endif
+
+#ifdef MAP_HUGETLB
+    if ((flags & CC_MMAP_HUGETLB) && size % hps == 0) {
+        p = mmap(NULL, size, PROT_READ | PROT_WRITE, mflags | MAP_HUGETLB,
+                -1, 0);
+        if (p == MAP_FAILED) {
+            log_info("mmap %zu bytes of huge pages @ %s:%d failed: %s, "
+                    "trying transparent huge pages", size, name, line,
+                    strerror(errno));
+        } else {
+            ps = hps;
+        }
+    }
+#endif
+
+    if (p == MAP_FAILED && (flags & CC_MMAP_HUGETLB)) {
+#ifdef MAP_POPULATE
+        /* populating before madvise would fault in small pages */
+        if (mflags & MAP_POPULATE) {
+            mflags &= ~MAP_POPULATE;
+            prefault = true;
+        }
+#endif
+        p = _cc_mmap_aligned(size, hps, mflags);
+#ifdef MADV_HUGEPAGE
+        if (p != MAP_FAILED && madvise(p, size, MADV_HUGEPAGE) < 0) {
+            log_info("madvise huge pages for %p @ %s:%d failed: %s", p, name,
+                    line, strerror(errno));
+        }
+#endif
+    }
+
+    if (p == MAP_FAILED && !(flags & CC_MMAP_HUGETLB)) {
+        p = mmap(NULL, size, PROT_READ | PROT_WRITE, mflags, -1, 0);
+    }
+
+    if (p == MAP_FAILED) {
+        log_error("mmap %zu bytes @ %s:%d failed: %s", size, name, line,
+                strerror(errno));
+        return NULL;
+    }
+
+    if ((flags & CC_MMAP_NUMA) && _cc_mbind(p, size, node) < 0) {
+        log_error("mbind %zu bytes at %p to node %d @ %s:%d failed: %s", size,
+                p, node, name, line, strerror(errno));
+        goto error;
+    }
+
+    if (prefault) {
+        _cc_prefault(p, size);
+    }
+
+    if ((flags & CC_MMAP_LOCK) && mlock(p, size) < 0) {
+        log_error("mlock %zu bytes at %p @ %s:%d failed: %s", size, p, name,
+                line, strerror(errno));
+        goto error;
+    }
+
+    log_vverb("mmap %zu bytes at %p with flags %#x, page size %zu @ %s:%d",
+            size, p, flags, ps, name, line);
+    if (pagesize != NULL) {
+        *pagesize = ps;
+    }
+
+    return p;
+
+error:
+    munmap(p, size);
+    return NULL;
+}
+
+void *
+_cc_mremap(void *p, size_t osize, size_t size, const char *name, int line)
+{
+    void *np;
+
+    ASSERT(p != NULL);
+    ASSERT(osize != 0 && size != 0);
+
+#ifdef MREMAP_MAYMOVE
+    /* the kernel moves the page table entries, no data is copied */
+    np = mremap(p, osize, size, MREMAP_MAYMOVE);
+    if (np == MAP_FAILED) {
+        log_error("mremap %p from %zu to %zu bytes @ %s:%d failed: %s", p,
+                osize, size, name, line, strerror(errno));
+        return NULL;
+    }
+#else
+    np = _cc_mmap(size, name, line);
+    if (np == NULL) {
+        return NULL;
+    }
+    memcpy(np, p, MIN(osize, size));
+    _cc_munmap(p, osize, name, line);
+#endif
+
+    log_vverb("mremap %p from %zu to %zu bytes at %p @ %s:%d", p, osize, size,
+            np, name, line);
+
+    return np;
+}
+
 int
 _cc_munmap(void *p, size_t size, const char *name, int line)
 {
@@ -177,3 +407,292 @@ _cc_alloc_usable_size(void *ptr, const char *name, int line)
     log_vverb("malloc_usable_size(%p) @ %s:%d", ptr, name, line);
     return malloc_usable_size(ptr);
 }
+
+/*
+ * arena
+ */
+
+#define ARENA_MODULE_NAME "ccommon::mm::arena"
+
+/* chunk data starts right after the header, with the strictest alignment */
+#define ARENA_CHUNK_HDR     CC_ALIGN(sizeof(struct arena_chunk), ARENA_ALIGN)
+#define ARENA_CHUNK_DATA(_c) ((char *)(_c) + ARENA_CHUNK_HDR)
+
+static bool arena_init = false;
+static arena_metrics_st *arena_metrics = NULL;
+
+static size_t chunk_size = ARENA_CHUNK_SIZE;
+static uint32_t chunk_poolsize = ARENA_POOLSIZE;
+/* free chunks of the current thread */
+static __thread struct arena_chunk *chunk_pool = NULL;
+static __thread uint32_t chunk_nfree = 0;
+
+static struct arena_chunk *
+_arena_chunk_create(size_t size)
+{
+    struct arena_chunk *chunk;
+
+    chunk = cc_alloc(ARENA_CHUNK_HDR + size);
+    if (chunk == NULL) {
+        return NULL;
+    }
+
+    chunk->next = NULL;
+    chunk->size = size;
+    INCR(arena_metrics, arena_chunk_create);
+    INCR(arena_metrics, arena_chunk_curr);
+
+    return chunk;
+}
+
+static void
+_arena_chunk_destroy(struct arena_chunk *chunk)
+{
+    cc_free(chunk);
+    INCR(arena_metrics, arena_chunk_destroy);
+    DECR(arena_metrics, arena_chunk_curr);
+}
+
+/* return a list of chunks to the pool, freeing what does not fit */
+static void
+_arena_chunk_return(struct arena_chunk *chunk)
+{
+    struct arena_chunk *next;
+
+    for (; chunk != NULL; chunk = next) {
+        next = chunk->next;
+        if (chunk_nfree < chunk_poolsize && chunk->size == chunk_size) {
+            chunk->next = chunk_pool;
+            chunk_pool = chunk;
+            chunk_nfree++;
+            INCR(arena_metrics, arena_chunk_free);
+        } else {
+            _arena_chunk_destroy(chunk);
+        }
+    }
+}
+
+void
+arena_thread_flush(void)
+{
+    struct arena_chunk *chunk;
+
+    while ((chunk = chunk_pool) != NULL) {
+        chunk_pool = chunk->next;
+        chunk_nfree--;
+        DECR(arena_metrics, arena_chunk_free);
+        _arena_chunk_destroy(chunk);
+    }
+}
+
+void
+arena_setup(arena_options_st *options, arena_metrics_st *metrics)
+{
+    log_info("set up the %s module", ARENA_MODULE_NAME);
+
+    if (arena_init) {
+        log_warn("%s has already been setup, overwrite", ARENA_MODULE_NAME);
+        arena_thread_flush();
+    }
+
+    arena_metrics = metrics;
+
+    if (options != NULL) {
+        chunk_size = option_uint(&options->arena_chunk_size);
+        chunk_poolsize = option_uint(&options->arena_chunk_poolsize);
+    }
+    if (chunk_size < ARENA_ALIGN) {
+        log_warn("arena chunk size %zu too small, using %d", chunk_size,
+                ARENA_ALIGN);
+        chunk_size = ARENA_ALIGN;
+    }
+
+    arena_init = true;
+}
+
+void
+arena_teardown(void)
+{
+    log_info("tear down the %s module", ARENA_MODULE_NAME);
+
+    if (!arena_init) {
+        log_warn("%s was not setup", ARENA_MODULE_NAME);
+    }
+
+    arena_thread_flush();
+    chunk_size = ARENA_CHUNK_SIZE;
+    chunk_poolsize = ARENA_POOLSIZE;
+    arena_metrics = NULL;
+    arena_init = false;
+}
+
+struct arena *
+arena_create(void)
+{
+    struct arena *arena;
+
+    arena = cc_zalloc(sizeof(*arena));
+    if (arena == NULL) {
+        log_info("arena creation failed due to OOM");
+        INCR(arena_metrics, arena_create_ex);
+
+        return NULL;
+    }
+
+    INCR(arena_metrics, arena_create);
+    INCR(arena_metrics, arena_curr);
+
+    return arena;
+}
+
+static void
+_arena_release(struct arena *arena)
+{
+    struct arena_chunk *chunk;
+
+    INCR_N(arena_metrics, arena_alloc, arena->nalloc);
+    INCR_N(arena_metrics, arena_alloc_byte, arena->nbyte);
+
+    while ((chunk = arena->large) != NULL) {
+        arena->large = chunk->next;
+        _arena_chunk_destroy(chunk);
+    }
+
+    arena->pos = arena->end = arena->last = NULL;
+    arena->nalloc = arena->nbyte = 0;
+}
+
+void
+arena_destroy(struct arena **arena)
+{
+    struct arena *a = *arena;
+
+    if (a == NULL) {
+        return;
+    }
+
+    _arena_release(a);
+    _arena_chunk_return(a->used);
+    _arena_chunk_return(a->free);
+    cc_free(*arena);
+
+    INCR(arena_metrics, arena_destroy);
+    DECR(arena_metrics, arena_curr);
+}
+
+void
+arena_reset(struct arena *arena)
+{
+    _arena_release(arena);
+
+    /* the used list goes in front of the free list as a whole */
+    if (arena->used != NULL) {
+        arena->used_tail->next = arena->free;
+        arena->free = arena->used;
+        arena->used = arena->used_tail = NULL;
+    }
+
+    INCR(arena_metrics, arena_reset);
+}
+
+static struct arena_chunk *
+_arena_chunk_get(struct arena *arena)
+{
+    struct arena_chunk *chunk;
+
+    if ((chunk = arena->free) != NULL) {
+        arena->free = chunk->next;
+        return chunk;
+    }
+
+    if ((chunk = chunk_pool) != NULL) {
+        chunk_pool = chunk->next;
+        chunk_nfree--;
+        DECR(arena_metrics, arena_chunk_free);
+        INCR(arena_metrics, arena_chunk_reuse);
+        return chunk;
+    }
+
+    return _arena_chunk_create(chunk_size);
+}
+
+void *
+_arena_alloc_slow(struct arena *arena, size_t size, size_t align)
+{
+    struct arena_chunk *chunk;
+    char *p;
+
+    if (size == 0) {
+        log_debug("arena alloc of 0 bytes");
+        return NULL;
+    }
+
+    /* an oversize allocation never becomes the current chunk */
+    if (size > chunk_size / 4 || align > chunk_size / 4) {
+        chunk = _arena_chunk_create(size + align - 1);
+        if (chunk == NULL) {
+            INCR(arena_metrics, arena_alloc_ex);
+            return NULL;
+        }
+        chunk->next = arena->large;
+        arena->large = chunk;
+        INCR(arena_metrics, arena_oversize);
+
+        arena->last = NULL;
+        arena->nalloc++;
+        arena->nbyte += size;
+
+        return CC_ALIGN_PTR(ARENA_CHUNK_DATA(chunk), align);
+    }
+
+    chunk = _arena_chunk_get(arena);
+    if (chunk == NULL) {
+        INCR(arena_metrics, arena_alloc_ex);
+        return NULL;
+    }
+    chunk->next = arena->used;
+    arena->used = chunk;
+    if (arena->used_tail == NULL) {
+        arena->used_tail = chunk;
+    }
+    arena->pos = ARENA_CHUNK_DATA(chunk);
+    arena->end = arena->pos + chunk->size;
+
+    /* a chunk taken from an old configuration may be smaller */
+    p = CC_ALIGN_PTR(arena->pos, align);
+    if (p > arena->end || size > (size_t)(arena->end - p)) {
+        return _arena_alloc_slow(arena, size, align);
+    }
+
+    arena->last = p;
+    arena->pos = p + size;
+    arena->nalloc++;
+    arena->nbyte += size;
+
+    return p;
+}
+
+void *
+arena_realloc(struct arena *arena, void *p, size_t osize, size_t size)
+{
+    void *np;
+
+    if (p == NULL) {
+        return arena_alloc(arena, size);
+    }
+
+    if (p == arena->last && size <= (size_t)(arena->end - arena->last)) {
+        arena->pos = arena->last + size;
+        if (size > osize) {
+            arena->nbyte += size - osize;
+        }
+        return p;
+    }
+
+    np = arena_alloc(arena, size);
+    if (np != NULL) {
+        memcpy(np, p, MIN(osize, size));
+    }
+
+    return np;
+}
@@ -17,25 +17,42 @@
 
 #include <cc_print.h>
 
+#include <cc_bstring.h>
+
 /*
  * Note: the impelmentation of cc_print_uint64_unsafe uses Facebook/folly's
  * implementation as a reference (folly/Conv.h)
  */
 
-/* use our own macro instead of llabs() to make sure it works with INT64_MIN */
-#define abs_int64(_x) ((_x) >= 0 ? (_x) : -(_x))
+/* magnitude of n as uint64_t, which is well-defined for INT64_MIN as well */
+#define abs_int64(_x) ((_x) >= 0 ? (uint64_t)(_x) : 0 - (uint64_t)(_x))
+
+/* "00", "01", ..., "99" */
+static const char DIGIT_PAIRS[200] =
+    "0001020304050607080910111213141516171819"
+    "2021222324252627282930313233343536373839"
+    "4041424344454647484950515253545556575859"
+    "6061626364656667686970717273747576777879"
+    "8081828384858687888990919293949596979899";
 
+/* writes the d digits of n backwards from buf + d, two per division */
 static inline void
 _print_uint64(char *buf, size_t d, uint64_t n)
 {
     char *p;
 
     p = buf + d;
-    do {
-        p--;
-        *p = '0' + n % 10;
-        n = n / 10;
-    } while (n > 0);
+    while (n >= 100) {
+        p -= 2;
+        cc_memcpy(p, DIGIT_PAIRS + (n % 100) * 2, 2);
+        n /= 100;
+    }
+    if (n >= 10) {
+        p -= 2;
+        cc_memcpy(p, DIGIT_PAIRS + n * 2, 2);
+    } else {
+        *--p = '0' + n;
+    }
 }
 
 size_t
@@ -95,7 +112,7 @@ cc_print_int64(char *buf, size_t size, int64_t n)
         *buf++ = '-';
     }
 
-    _print_uint64(buf, d, n);
+    _print_uint64(buf, d, ab);
 
     return d + (n < 0);
 }
@@ -0,0 +1,299 @@
+/*
+ * ccommon - a cache common library.
+ * Copyright (C) 2013 Twitter, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <channel/cc_notify.h>
+
+#include <cc_debug.h>
+#include <cc_mm.h>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#ifdef CC_EVENTFD
+#include <sys/eventfd.h>
+#endif
+
+#define NOTIFY_MODULE_NAME "ccommon::notify"
+
+static bool notify_init = false;
+static notify_metrics_st *notify_metrics = NULL;
+
+void
+notify_setup(notify_metrics_st *metrics)
+{
+    log_info("set up the %s module", NOTIFY_MODULE_NAME);
+
+    if (notify_init) {
+        log_warn("%s has already been setup, overwrite", NOTIFY_MODULE_NAME);
+    }
+
+    notify_metrics = metrics;
+    notify_init = true;
+}
+
+void
+notify_teardown(void)
+{
+    log_info("tear down the %s module", NOTIFY_MODULE_NAME);
+
+    if (!notify_init) {
+        log_warn("%s has never been setup", NOTIFY_MODULE_NAME);
+    }
+
+    notify_metrics = NULL;
+    notify_init = false;
+}
+
+struct notify_conn *
+notify_conn_create(void)
+{
+    struct notify_conn *c =
+        (struct notify_conn *)cc_alloc(sizeof(struct notify_conn));
+
+    if (c == NULL) {
+        log_info("notify connection creation failed due to OOM");
+        return NULL;
+    }
+
+    log_verb("created notify conn %p", c);
+
+    notify_conn_reset(c);
+
+    return c;
+}
+
+void
+notify_conn_destroy(struct notify_conn **c)
+{
+    if (c == NULL || *c == NULL) {
+        return;
+    }
+
+    log_verb("destroy notify conn %p", *c);
+
+    cc_free(*c);
+    *c = NULL;
+}
+
+void
+notify_conn_reset(struct notify_conn *c)
+{
+    c->fd[0] = c->fd[1] = -1;
+    c->pending = false;
+    c->state = CHANNEL_TERM;
+    c->err = 0;
+}
+
+bool
+notify_open(void *addr, struct notify_conn *c)
+{
+    ASSERT(addr == NULL);
+    ASSERT(c != NULL);
+
+#ifdef CC_EVENTFD
+    c->fd[0] = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (c->fd[0] < 0) {
+        log_error("eventfd() for conn %p failed: %s", c, strerror(errno));
+        goto error;
+    }
+    c->fd[1] = c->fd[0];
+#else
+    if (pipe(c->fd) < 0) {
+        log_error("pipe() for conn %p failed: %s", c, strerror(errno));
+        goto error;
+    }
+    if (fcntl(c->fd[0], F_SETFL, O_NONBLOCK) < 0 ||
+            fcntl(c->fd[1], F_SETFL, O_NONBLOCK) < 0) {
+        log_error("set nonblock on conn %p failed: %s", c, strerror(errno));
+        close(c->fd[0]);
+        close(c->fd[1]);
+        goto error;
+    }
+#endif
+
+    c->pending = false;
+    c->state = CHANNEL_ESTABLISHED;
+    INCR(notify_metrics, notify_open);
+
+    log_verb("opened notify conn %p fd %d and %d", c, c->fd[0], c->fd[1]);
+
+    return true;
+
+error:
+    c->err = errno;
+    c->fd[0] = c->fd[1] = -1;
+    INCR(notify_metrics, notify_open_ex);
+
+    return false;
+}
+
+void
+notify_close(struct notify_conn *c)
+{
+    if (c == NULL) {
+        return;
+    }
+
+    log_info("closing notify conn %p fd %d and %d", c, c->fd[0], c->fd[1]);
+
+    if (c->fd[0] >= 0) {
+        close(c->fd[0]);
+    }
+    if (c->fd[1] >= 0 && c->fd[1] != c->fd[0]) {
+        close(c->fd[1]);
+    }
+    c->fd[0] = c->fd[1] = -1;
+    c->state = CHANNEL_TERM;
+
+    INCR(notify_metrics, notify_close);
+}
+
+rstatus_i
+notify_signal(struct notify_conn *c)
+{
+    ssize_t n;
+#ifdef CC_EVENTFD
+    uint64_t one = 1;
+#else
+    uint8_t one = 1;
+#endif
+
+    ASSERT(c != NULL);
+
+    /* full barrier: items pushed before are visible once pending is seen */
+    if (__atomic_exchange_n(&c->pending, true, __ATOMIC_SEQ_CST)) {
+        INCR(notify_metrics, notify_coalesce);
+
+        return CC_OK;
+    }
+
+    for (;;) {
+        n = write(c->fd[1], &one, sizeof(one));
+        INCR(notify_metrics, notify_signal);
+        if (n == sizeof(one)) {
+            return CC_OK;
+        }
+
+        INCR(notify_metrics, notify_signal_ex);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        /* counter or pipe full, the consumer has a wakeup coming anyway */
+        if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            return CC_OK;
+        }
+
+        c->err = errno;
+        log_error("signal on notify fd %d failed: %s", c->fd[1],
+                strerror(errno));
+        /* no wakeup was posted, let the next push try again */
+        __atomic_store_n(&c->pending, false, __ATOMIC_SEQ_CST);
+
+        return CC_ERROR;
+    }
+
+    NOT_REACHED();
+
+    return CC_ERROR;
+}
+
+rstatus_i
+notify_push(struct notify_conn *c, struct ring_array *arr, const void *elem)
+{
+    rstatus_i status;
+
+    status = ring_array_push(elem, arr);
+    if (status != CC_OK) {
+        return status;
+    }
+
+    return notify_signal(c);
+}
+
+rstatus_i
+notify_drain(struct notify_conn *c)
+{
+    ssize_t n;
+    bool drained = false;
+#ifdef CC_EVENTFD
+    uint64_t buf;
+#else
+    uint8_t buf[64];
+#endif
+
+    ASSERT(c != NULL);
+
+    /* clear before reading payloads, so later pushes signal again */
+    __atomic_store_n(&c->pending, false, __ATOMIC_SEQ_CST);
+
+    for (;;) {
+        n = read(c->fd[0], &buf, sizeof(buf));
+        INCR(notify_metrics, notify_drain);
+        if (n > 0) {
+            drained = true;
+#ifdef CC_EVENTFD
+            return CC_OK; /* reading an eventfd resets it */
+#else
+            continue;
+#endif
+        }
+
+        if (n == 0 || (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))) {
+            return drained ? CC_OK : CC_EAGAIN;
+        }
+        if (errno == EINTR) {
+            continue;
+        }
+
+        INCR(notify_metrics, notify_drain_ex);
+        c->err = errno;
+        log_error("drain on notify fd %d failed: %s", c->fd[0],
+                strerror(errno));
+
+        return CC_ERROR;
+    }
+
+    NOT_REACHED();
+
+    return CC_ERROR;
+}
+
+ssize_t
+notify_recv(struct notify_conn *c, void *buf, size_t nbyte)
+{
+    rstatus_i status;
+
+    status = notify_drain(c);
+    if (status != CC_OK) {
+        return status;
+    }
+
+    return nbyte;
+}
+
+ssize_t
+notify_send(struct notify_conn *c, void *buf, size_t nbyte)
+{
+    rstatus_i status;
+
+    status = notify_signal(c);
+    if (status != CC_OK) {
+        return status;
+    }
+
+    return nbyte;
+}
@@ -17,17 +17,21 @@
 
 #include <channel/cc_pipe.h>
 
+#include <cc_array.h>
 #include <cc_debug.h>
 #include <cc_mm.h>
 #include <cc_pool.h>
 #include <channel/cc_channel.h>
 #include <channel/cc_pipe.h>
+#include <channel/cc_tcp.h>
 
 #include <errno.h>
 #include <fcntl.h>
+#include <inttypes.h>
 #include <stdbool.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/uio.h>
 
 #define PIPE_MODULE_NAME "ccommon::pipe"
 
@@ -314,6 +318,241 @@ ssize_t pipe_send(struct pipe_conn *c, void *buf, size_t nbyte)
     return CC_ERROR;
 }
 
+ssize_t
+pipe_recvv(struct pipe_conn *c, struct array *bufv, size_t nbyte)
+{
+    ssize_t n;
+
+    ASSERT(c != NULL);
+    ASSERT(array_nelem(bufv) > 0);
+    ASSERT(nbyte > 0);
+
+    log_verb("recvv on pipe fd %d, capacity %zu bytes", c->fd[0], nbyte);
+
+    for (;;) {
+        n = readv(c->fd[0], (const struct iovec *)bufv->data, bufv->nelem);
+        INCR(pipe_metrics, pipe_recv);
+
+        if (n > 0) {
+            log_verb("%zu bytes recv'd on pipe fd %d in %"PRIu32" buffers", n,
+                    c->fd[0], bufv->nelem);
+            c->recv_nbyte += (size_t)n;
+            INCR_N(pipe_metrics, pipe_recv_byte, n);
+            return n;
+        }
+
+        if (n == 0) {
+            log_debug("eof recv'd on pipe fd %d, total: rb %zu sb %zu", c->fd[0],
+                      c->recv_nbyte, c->send_nbyte);
+            return n;
+        }
+
+        /* n < 0 */
+        INCR(pipe_metrics, pipe_recv_ex);
+        if (errno == EINTR) {
+            log_debug("recvv on pipe fd %d not ready - EINTR", c->fd[0]);
+            continue;
+        } else if (errno == EAGAIN || errno == EWOULDBLOCK) {
+            log_debug("recvv on pipe fd %d not ready - EAGAIN", c->fd[0]);
+            return CC_EAGAIN;
+        } else {
+            c->err = errno;
+            log_error("recvv on pipe fd %d failed: %s", c->fd[0],
+                    strerror(errno));
+            return CC_ERROR;
+        }
+    }
+
+    NOT_REACHED();
+
+    return CC_ERROR;
+}
+
+ssize_t
+pipe_sendv(struct pipe_conn *c, struct array *bufv, size_t nbyte)
+{
+    ssize_t n;
+
+    ASSERT(c != NULL);
+    ASSERT(array_nelem(bufv) > 0);
+    ASSERT(nbyte > 0);
+
+    log_verb("sendv on pipe fd %d, total %zu bytes", c->fd[1], nbyte);
+
+    for (;;) {
+        n = writev(c->fd[1], (const struct iovec *)bufv->data, bufv->nelem);
+        INCR(pipe_metrics, pipe_send);
+
+        if (n > 0) {
+            log_verb("%zu bytes sent on pipe fd %d in %"PRIu32" buffers", n,
+                    c->fd[1], bufv->nelem);
+            c->send_nbyte += (size_t)n;
+            INCR_N(pipe_metrics, pipe_send_byte, n);
+            return n;
+        }
+
+        if (n == 0) {
+            log_warn("sendv on pipe fd %d returned zero", c->fd[1]);
+            return 0;
+        }
+
+        /* n < 0 */
+        INCR(pipe_metrics, pipe_send_ex);
+        if (errno == EINTR) {
+            log_debug("sendv on pipe fd %d not ready - EINTR", c->fd[1]);
+            continue;
+        } else if (errno == EAGAIN || errno == EWOULDBLOCK) {
+            log_debug("sendv on pipe fd %d not ready - EAGAIN", c->fd[1]);
+            return CC_EAGAIN;
+        } else {
+            c->err = errno;
+            log_error("sendv on pipe fd %d failed: %s", c->fd[1],
+                    strerror(errno));
+            return CC_ERROR;
+        }
+    }
+
+    NOT_REACHED();
+
+    return CC_ERROR;
+}
+
+/* splice nbyte from fd in to fd out, one of which is an end of pipe c */
+static ssize_t
+_pipe_splice(struct pipe_conn *c, int in, int out, size_t nbyte)
+{
+#ifdef CC_SPLICE
+    ssize_t n;
+
+    ASSERT(nbyte > 0);
+
+    for (;;) {
+        n = splice(in, NULL, out, NULL, nbyte,
+                SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+        INCR(pipe_metrics, pipe_splice);
+
+        if (n > 0) {
+            log_verb("%zd bytes spliced from fd %d to fd %d", n, in, out);
+            INCR_N(pipe_metrics, pipe_splice_byte, n);
+            return n;
+        }
+
+        if (n == 0) {
+            log_debug("splice from fd %d to fd %d returned zero", in, out);
+            return 0;
+        }
+
+        /* n < 0 */
+        INCR(pipe_metrics, pipe_splice_ex);
+        if (errno == EINTR) {
+            log_debug("splice from fd %d to fd %d not ready - EINTR", in, out);
+            continue;
+        } else if (errno == EAGAIN || errno == EWOULDBLOCK) {
+            log_debug("splice from fd %d to fd %d not ready - EAGAIN", in, out);
+            return CC_EAGAIN;
+        } else {
+            c->err = errno;
+            log_error("splice from fd %d to fd %d failed: %s", in, out,
+                    strerror(errno));
+            return CC_ERROR;
+        }
+    }
+
+    NOT_REACHED();
+#else
+    c->err = ENOTSUP;
+    INCR(pipe_metrics, pipe_splice_ex);
+#endif
+
+    return CC_ERROR;
+}
+
+ssize_t
+pipe_splice_send(struct pipe_conn *c, struct tcp_conn *s, size_t nbyte)
+{
+    ssize_t n;
+
+    ASSERT(c != NULL && s != NULL);
+
+    n = _pipe_splice(c, c->fd[0], s->sd, nbyte);
+    if (n > 0) {
+        c->recv_nbyte += (size_t)n;
+        s->send_nbyte += (size_t)n;
+    }
+
+    return n;
+}
+
+ssize_t
+pipe_splice_recv(struct pipe_conn *c, struct tcp_conn *s, size_t nbyte)
+{
+    ssize_t n;
+
+    ASSERT(c != NULL && s != NULL);
+
+    n = _pipe_splice(c, s->sd, c->fd[1], nbyte);
+    if (n > 0) {
+        s->recv_nbyte += (size_t)n;
+        c->send_nbyte += (size_t)n;
+    }
+
+    return n;
+}
+
+ssize_t
+pipe_vmsplice(struct pipe_conn *c, struct array *bufv, size_t nbyte)
+{
+#ifdef CC_SPLICE
+    ssize_t n;
+
+    ASSERT(c != NULL);
+    ASSERT(array_nelem(bufv) > 0);
+    ASSERT(nbyte > 0);
+
+    log_verb("vmsplice on pipe fd %d, total %zu bytes", c->fd[1], nbyte);
+
+    for (;;) {
+        n = vmsplice(c->fd[1], (const struct iovec *)bufv->data, bufv->nelem,
+                SPLICE_F_NONBLOCK);
+        INCR(pipe_metrics, pipe_splice);
+
+        if (n > 0) {
+            log_verb("%zd bytes vmspliced on pipe fd %d", n, c->fd[1]);
+            c->send_nbyte += (size_t)n;
+            INCR_N(pipe_metrics, pipe_splice_byte, n);
+            return n;
+        }
+
+        if (n == 0) {
+            log_warn("vmsplice on pipe fd %d returned zero", c->fd[1]);
+            return 0;
+        }
+
+        /* n < 0 */
+        INCR(pipe_metrics, pipe_splice_ex);
+        if (errno == EINTR) {
+            log_debug("vmsplice on pipe fd %d not ready - EINTR", c->fd[1]);
+            continue;
+        } else if (errno == EAGAIN || errno == EWOULDBLOCK) {
+            log_debug("vmsplice on pipe fd %d not ready - EAGAIN", c->fd[1]);
+            return CC_EAGAIN;
+        } else {
+            c->err = errno;
+            log_error("vmsplice on pipe fd %d failed: %s", c->fd[1],
+                    strerror(errno));
+            return CC_ERROR;
+        }
+    }
+
+    NOT_REACHED();
+#else
+    c->err = ENOTSUP;
+    INCR(pipe_metrics, pipe_splice_ex);
+#endif
+
+    return CC_ERROR;
+}
+
 static void
 _pipe_set_blocking(int fd)
 {
@@ -23,6 +23,7 @@
 #include <cc_pool.h>
 #include <cc_util.h>
 #include <cc_event.h>
+#include <cc_histogram.h>
 
 #include <errno.h>
 #include <fcntl.h>
@@ -30,9 +31,15 @@
 #include <netinet/ip.h>
 #include <netinet/tcp.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
+#include <sys/ioctl.h>
 #include <sys/types.h>
 #include <sys/uio.h>
+#ifdef CC_ZEROCOPY
+#include <time.h> /* linux/errqueue.h needs struct timespec */
+#include <linux/errqueue.h>
+#endif
 
 #define TCP_MODULE_NAME "ccommon::tcp"
 
@@ -43,6 +50,54 @@ static bool tcp_init = false;
 static bool cp_init = false;
 static tcp_metrics_st *tcp_metrics = NULL;
 static int max_backlog = TCP_BACKLOG;
+static bool tcp_zerocopy = false;
+static int busy_poll = TCP_BUSY_POLL;
+static struct tcp_profile profile = {.nodelay = true};
+
+/* TCP_INFO sampling */
+#define TCP_INFO_RTT_N      27  /* up to ~134 seconds in usec */
+#define TCP_INFO_SEG_N      20  /* up to ~1M segments */
+#define TCP_INFO_M          0
+#define TCP_INFO_R          7   /* ~1.5% precision */
+
+static uint32_t info_rate = TCP_INFO_RATE;
+static uint32_t info_ncall = 0;
+static struct histo_u32 *rtt_histo = NULL;
+static struct histo_u32 *unacked_histo = NULL;
+static struct histo_u32 *inretrans_histo = NULL;
+static struct percentile_profile *info_pp = NULL;
+static const double info_percentile[] = {50.0, 99.0};
+
+static void
+_tcp_enable_zerocopy(struct tcp_conn *c)
+{
+    if (!tcp_zerocopy) {
+        return;
+    }
+
+    if (tcp_set_zerocopy(c->sd) < 0) {
+        log_warn("set zerocopy on c %p sd %d failed, ignored: %s", c, c->sd,
+                strerror(errno));
+
+        return;
+    }
+
+    c->zerocopy = true;
+}
+
+static void
+_tcp_enable_busy_poll(struct tcp_conn *c)
+{
+    if (busy_poll == 0) {
+        return;
+    }
+
+    /* raising SO_BUSY_POLL above net.core.busy_read needs CAP_NET_ADMIN */
+    if (tcp_set_busy_poll(c->sd, busy_poll) < 0) {
+        log_warn("set busy poll %d on c %p sd %d failed, ignored: %s",
+                busy_poll, c, c->sd, strerror(errno));
+    }
+}
 
 void
 tcp_conn_reset(struct tcp_conn *c)
@@ -60,6 +115,12 @@ tcp_conn_reset(struct tcp_conn *c)
     c->flags = 0;
 
     c->err = 0;
+
+    c->zerocopy = false;
+    c->zc_next = 0;
+    c->zc_done = 0;
+
+    c->total_retrans = 0;
 }
 
 struct tcp_conn *
@@ -181,6 +242,11 @@ tcp_conn_return(struct tcp_conn **c)
     DECR(tcp_metrics, tcp_conn_active);
 }
 
+/*
+ * the socket is made non-blocking before connect, so connect never blocks; if
+ * it returns with the connection still in progress, c is left CHANNEL_OPEN and
+ * tcp_connect_finish should be called once the socket turns writable.
+ */
 bool
 tcp_connect(struct addrinfo *ai, struct tcp_conn *c)
 {
@@ -196,9 +262,17 @@ tcp_connect(struct addrinfo *ai, struct tcp_conn *c)
         goto error;
     }
 
-    ret = tcp_set_tcpnodelay(c->sd);
+    ret = tcp_set_nonblocking(c->sd);
+    if (ret < 0) {
+        log_error("set nonblock on c %p sd %d failed: %s", c, c->sd,
+                strerror(errno));
+
+        goto error;
+    }
+
+    ret = tcp_profile_apply(c->sd, &profile);
     if (ret < 0) {
-        log_error("set tcpnodelay on c %p sd %d failed: %s", c, c->sd,
+        log_error("set socket options on c %p sd %d failed: %s", c, c->sd,
                 strerror(errno));
 
         goto error;
@@ -214,23 +288,14 @@ tcp_connect(struct addrinfo *ai, struct tcp_conn *c)
         }
 
         c->state = CHANNEL_OPEN;
-        /* TODO(yao): if connect fails we should get an event with error mask,
-         * figure out how to update metrics properly in that case.
-         */
         log_info("connecting on c %p sd %d", c, c->sd);
     } else {
         c->state = CHANNEL_ESTABLISHED;
         log_info("connected on c %p sd %d", c, c->sd);
     }
 
-
-    ret = tcp_set_nonblocking(c->sd);
-    if (ret < 0) {
-        log_error("set nonblock on c %p sd %d failed: %s", c, c->sd,
-                strerror(errno));
-
-        goto error;
-    }
+    _tcp_enable_zerocopy(c);
+    _tcp_enable_busy_poll(c);
 
     return true;
 
@@ -244,6 +309,53 @@ error:
     return false;
 }
 
+rstatus_i
+tcp_connect_finish(struct tcp_conn *c)
+{
+    struct sockaddr_storage addr;
+    socklen_t len = sizeof(addr);
+
+    ASSERT(c != NULL);
+
+    if (c->state == CHANNEL_ESTABLISHED) {
+        return CC_OK;
+    }
+
+    if (c->state != CHANNEL_OPEN) {
+        return CC_ERROR;
+    }
+
+    if (tcp_get_soerror(c->sd) < 0 || errno != 0) {
+        log_info("connect on c %p sd %d failed: %s", c, c->sd,
+                strerror(errno));
+        c->err = errno;
+        c->state = CHANNEL_ERROR;
+        INCR(tcp_metrics, tcp_connect_ex);
+
+        return CC_ERROR;
+    }
+
+    /* no error pending, but the handshake may not have completed yet */
+    if (getpeername(c->sd, (struct sockaddr *)&addr, &len) < 0) {
+        if (errno == ENOTCONN) {
+            return CC_EAGAIN;
+        }
+
+        log_info("getpeername on c %p sd %d failed: %s", c, c->sd,
+                strerror(errno));
+        c->err = errno;
+        c->state = CHANNEL_ERROR;
+        INCR(tcp_metrics, tcp_connect_ex);
+
+        return CC_ERROR;
+    }
+
+    c->state = CHANNEL_ESTABLISHED;
+    log_info("connected on c %p sd %d", c, c->sd);
+
+    return CC_OK;
+}
+
 bool
 tcp_listen(struct addrinfo *ai, struct tcp_conn *c)
 {
@@ -264,6 +376,13 @@ tcp_listen(struct addrinfo *ai, struct tcp_conn *c)
         goto error;
     }
 
+    /* set before listen so accepted sockets inherit them, see tcp_profile */
+    ret = tcp_profile_apply(sd, &profile);
+    if (ret < 0) {
+        log_warn("set socket options on listening sd %d failed, ignored: %s",
+                sd, strerror(errno));
+    }
+
     ret = bind(sd, ai->ai_addr, ai->ai_addrlen);
     if (ret < 0) {
         log_error("bind on sd %d failed: %s", sd, strerror(errno));
@@ -282,12 +401,6 @@ tcp_listen(struct addrinfo *ai, struct tcp_conn *c)
         goto error;
     }
 
-    ret = tcp_set_tcpnodelay(sd);
-    if (ret < 0) {
-        log_warn("set tcp nodelay on listening sd %d failed, ignored: %s", sd,
-                 strerror(errno));
-    }
-
     c->level = CHANNEL_META;
     c->state = CHANNEL_LISTEN;
     log_info("server listen setup on socket descriptor %d", c->sd);
@@ -409,6 +522,17 @@ tcp_accept(struct tcp_conn *sc, struct tcp_conn *c)
     }
 #endif
 
+#ifndef OS_LINUX /* linux accepted sockets inherit options of the listener */
+    ret = tcp_profile_apply(sd, &profile);
+    if (ret < 0) {
+        log_warn("set socket options on sd %d failed, ignored: %s", sd,
+                strerror(errno));
+    }
+#endif
+
+    _tcp_enable_zerocopy(c);
+    _tcp_enable_busy_poll(c);
+
     log_info("accepted c %d on sd %d", c->sd, sc->sd);
 
     return true;
@@ -633,16 +757,17 @@ tcp_get_rcvbuf(int sd)
     return size;
 }
 
-void
-tcp_maximize_sndbuf(int sd)
+int
+tcp_max_sndbuf(int sd)
 {
-    int status, min, max, avg;
+    int status, min, max, avg, best;
 
     /* start with the default size */
     min = tcp_get_sndbuf(sd);
     if (min < 0) {
-        return;
+        return min;
     }
+    best = 0;
 
     /* binary-search for the real maximum */
     max = 256 * MiB;
@@ -653,9 +778,79 @@ tcp_maximize_sndbuf(int sd)
         if (status != 0) {
             max = avg - 1;
         } else {
+            best = avg;
             min = avg + 1;
         }
     }
+
+    if (best > 0) {
+        tcp_set_sndbuf(sd, best);
+    }
+
+    return best;
+}
+
+void
+tcp_maximize_sndbuf(int sd)
+{
+    tcp_max_sndbuf(sd);
+}
+
+int
+tcp_profile_apply(int sd, const struct tcp_profile *p)
+{
+    int status = 0;
+
+    ASSERT(p != NULL);
+
+    if (p->nodelay && tcp_set_tcpnodelay(sd) < 0) {
+        status = -1;
+    }
+    if (p->keepalive && tcp_set_keepalive(sd) < 0) {
+        status = -1;
+    }
+    if (p->sndbuf > 0 && tcp_set_sndbuf(sd, p->sndbuf) < 0) {
+        status = -1;
+    }
+    if (p->rcvbuf > 0 && tcp_set_rcvbuf(sd, p->rcvbuf) < 0) {
+        status = -1;
+    }
+
+    return status;
+}
+
+const struct tcp_profile *
+tcp_profile(void)
+{
+    return &profile;
+}
+
+/* the largest sndbuf any socket can get, found once on a scratch socket */
+static int
+_tcp_probe_sndbuf(void)
+{
+    int sd, size;
+
+    sd = socket(AF_INET, SOCK_STREAM, 0);
+    if (sd < 0) {
+        log_warn("cannot create socket to probe max sndbuf: %s",
+                strerror(errno));
+
+        return 0;
+    }
+
+    size = tcp_max_sndbuf(sd);
+    close(sd);
+
+    if (size <= 0) {
+        log_warn("cannot probe max sndbuf, use default");
+
+        return 0;
+    }
+
+    log_info("max sndbuf is %d bytes", size);
+
+    return size;
 }
 
 int
@@ -675,6 +870,211 @@ tcp_get_soerror(int sd)
     return status;
 }
 
+/* number of bytes that can be read without blocking, or -1 on error */
+int
+tcp_get_nread(int sd)
+{
+    int status, nbyte;
+
+    nbyte = 0;
+
+    status = ioctl(sd, FIONREAD, &nbyte);
+    if (status < 0) {
+        return status;
+    }
+
+    return nbyte;
+}
+
+rstatus_i
+tcp_conn_info(struct tcp_conn *c, struct tcp_conn_info *info)
+{
+#if defined OS_LINUX && defined TCP_INFO
+    struct tcp_info ti;
+    socklen_t len = sizeof(ti);
+
+    if (getsockopt(c->sd, IPPROTO_TCP, TCP_INFO, &ti, &len) < 0) {
+        log_debug("get TCP_INFO on sd %d failed: %s", c->sd, strerror(errno));
+
+        return CC_ERROR;
+    }
+
+    info->rtt = ti.tcpi_rtt;
+    info->rttvar = ti.tcpi_rttvar;
+    info->snd_cwnd = ti.tcpi_snd_cwnd;
+    info->unacked = ti.tcpi_unacked;
+    info->retrans = ti.tcpi_retrans;
+    info->total_retrans = ti.tcpi_total_retrans;
+    info->rcv_space = ti.tcpi_rcv_space;
+
+    return CC_OK;
+#else
+    (void)c;
+    (void)info;
+
+    return CC_ERROR;
+#endif
+}
+
+static inline void
+_tcp_info_record(struct histo_u32 *h, uint32_t value)
+{
+    /* outliers count as the max value of the histogram */
+    histo_u32_record(h, MIN(value, h->N), 1);
+}
+
+void
+tcp_conn_sample(struct tcp_conn *c)
+{
+    struct tcp_conn_info info;
+
+    if (info_rate == 0 || ++info_ncall < info_rate) {
+        return;
+    }
+    info_ncall = 0;
+
+    if (tcp_conn_info(c, &info) != CC_OK) {
+        INCR(tcp_metrics, tcp_info_sample_ex);
+
+        return;
+    }
+    INCR(tcp_metrics, tcp_info_sample);
+
+    _tcp_info_record(rtt_histo, info.rtt);
+    _tcp_info_record(unacked_histo, info.unacked);
+    _tcp_info_record(inretrans_histo, info.retrans);
+
+    if (info.total_retrans > c->total_retrans) {
+        INCR_N(tcp_metrics, tcp_retrans, info.total_retrans - c->total_retrans);
+    }
+    c->total_retrans = info.total_retrans;
+}
+
+/* p50, p99 and max of h into v, or 0s if h is empty, then reset h */
+static void
+_tcp_info_percentile(struct histo_u32 *h, uint64_t v[3])
+{
+    if (histo_u32_report_multi(info_pp, h) == HISTO_OK) {
+        v[0] = bucket_high_u32(h, info_pp->result[0]);
+        v[1] = bucket_high_u32(h, info_pp->result[1]);
+        v[2] = bucket_high_u32(h, info_pp->max);
+    } else {
+        v[0] = v[1] = v[2] = 0;
+    }
+
+    histo_u32_reset(h);
+}
+
+void
+tcp_info_report(void)
+{
+    uint64_t v[3];
+
+    if (info_rate == 0) {
+        return;
+    }
+
+    _tcp_info_percentile(rtt_histo, v);
+    UPDATE_VAL(tcp_metrics, tcp_rtt_p50, v[0]);
+    UPDATE_VAL(tcp_metrics, tcp_rtt_p99, v[1]);
+    UPDATE_VAL(tcp_metrics, tcp_rtt_max, v[2]);
+
+    _tcp_info_percentile(unacked_histo, v);
+    UPDATE_VAL(tcp_metrics, tcp_unacked_p50, v[0]);
+    UPDATE_VAL(tcp_metrics, tcp_unacked_p99, v[1]);
+    UPDATE_VAL(tcp_metrics, tcp_unacked_max, v[2]);
+
+    _tcp_info_percentile(inretrans_histo, v);
+    UPDATE_VAL(tcp_metrics, tcp_inretrans_p99, v[1]);
+    UPDATE_VAL(tcp_metrics, tcp_inretrans_max, v[2]);
+}
+
+static void
+_tcp_info_destroy(void)
+{
+    histo_u32_destroy(&rtt_histo);
+    histo_u32_destroy(&unacked_histo);
+    histo_u32_destroy(&inretrans_histo);
+    percentile_profile_destroy(&info_pp);
+    info_rate = 0;
+    info_ncall = 0;
+}
+
+static void
+_tcp_info_create(uint32_t rate)
+{
+    _tcp_info_destroy();
+
+    if (rate == 0) {
+        return;
+    }
+
+    rtt_histo = histo_u32_create(TCP_INFO_M, TCP_INFO_R, TCP_INFO_RTT_N);
+    unacked_histo = histo_u32_create(TCP_INFO_M, TCP_INFO_R, TCP_INFO_SEG_N);
+    inretrans_histo = histo_u32_create(TCP_INFO_M, TCP_INFO_R, TCP_INFO_SEG_N);
+    info_pp = percentile_profile_create(2);
+    if (rtt_histo == NULL || unacked_histo == NULL || inretrans_histo == NULL
+            || info_pp == NULL || percentile_profile_set(info_pp,
+            info_percentile, 2) != HISTO_OK) {
+        log_crit("cannot create histograms for TCP_INFO sampling");
+        exit(EXIT_FAILURE);
+    }
+
+    info_rate = rate;
+}
+
+int
+tcp_set_zerocopy(int sd)
+{
+#ifdef CC_ZEROCOPY
+    int zerocopy = 1;
+
+    return setsockopt(sd, SOL_SOCKET, SO_ZEROCOPY, &zerocopy, sizeof(zerocopy));
+#else
+    errno = ENOTSUP;
+
+    return -1;
+#endif
+}
+
+/*
+ * Let the kernel busy poll the device queue for up to usec microseconds when
+ * a read on sd finds no data, instead of waiting for the softirq. With
+ * SO_PREFER_BUSY_POLL (linux 5.11+) the NAPI context is left to the polling
+ * application while it keeps polling.
+ */
+int
+tcp_set_busy_poll(int sd, int usec)
+{
+#ifdef SO_BUSY_POLL
+    int status;
+
+    status = setsockopt(sd, SOL_SOCKET, SO_BUSY_POLL, &usec, sizeof(usec));
+    if (status < 0) {
+        return status;
+    }
+
+# ifdef SO_PREFER_BUSY_POLL
+    {
+        int prefer = usec > 0;
+
+        status = setsockopt(sd, SOL_SOCKET, SO_PREFER_BUSY_POLL, &prefer,
+                sizeof(prefer));
+        if (status < 0) {
+            log_debug("set prefer busy poll on sd %d failed, ignored: %s", sd,
+                    strerror(errno));
+        }
+    }
+# endif
+
+    return 0;
+#else
+    errno = ENOTSUP;
+
+    return -1;
+#endif
+}
+
 
 /*
  * try reading nbyte bytes from tcp_conn and place the data in buf
@@ -895,6 +1295,145 @@ tcp_sendv(struct tcp_conn *c, struct array *bufv, size_t nbyte)
     return CC_ERROR;
 }
 
+/*
+ * tcp_send with MSG_ZEROCOPY, see notes in cc_tcp.h. If the kernel runs out of
+ * memory to pin pages with (ENOBUFS), data is sent by copying instead.
+ */
+ssize_t
+tcp_send_zc(struct tcp_conn *c, void *buf, size_t nbyte)
+{
+#ifdef CC_ZEROCOPY
+    ssize_t n;
+
+    ASSERT(buf != NULL);
+    ASSERT(nbyte > 0);
+
+    if (!c->zerocopy) {
+        return tcp_send(c, buf, nbyte);
+    }
+
+    log_verb("send zerocopy on sd %d, total %zu bytes", c->sd, nbyte);
+
+    for (;;) {
+        n = send(c->sd, buf, nbyte, MSG_ZEROCOPY);
+        INCR(tcp_metrics, tcp_send);
+        INCR(tcp_metrics, tcp_send_zc);
+
+        log_verb("send zerocopy on sd %d %zd of %zu", c->sd, n, nbyte);
+
+        if (n > 0) {
+            INCR_N(tcp_metrics, tcp_send_byte, n);
+            INCR_N(tcp_metrics, tcp_send_zc_byte, n);
+            c->send_nbyte += (size_t)n;
+            c->zc_next++;
+            return n;
+        }
+
+        if (n == 0) {
+            log_warn("send zerocopy on sd %d returned zero", c->sd);
+            return 0;
+        }
+
+        /* n < 0 */
+        INCR(tcp_metrics, tcp_send_ex);
+        if (errno == EINTR) {
+            log_verb("send zerocopy on sd %d not ready - EINTR", c->sd);
+            continue;
+        } else if (errno == EAGAIN || errno == EWOULDBLOCK) {
+            log_verb("send zerocopy on sd %d not ready - EAGAIN", c->sd);
+            return CC_EAGAIN;
+        } else if (errno == ENOBUFS) {
+            log_debug("send zerocopy on sd %d out of optmem, copying", c->sd);
+            return tcp_send(c, buf, nbyte);
+        } else {
+            c->err = errno;
+            log_error("send zerocopy on sd %d failed: %s", c->sd,
+                    strerror(errno));
+            return CC_ERROR;
+        }
+    }
+
+    NOT_REACHED();
+
+    return CC_ERROR;
+#else
+    return tcp_send(c, buf, nbyte);
+#endif
+}
+
+/*
+ * read zerocopy completions off the error queue of c and advance c->zc_done;
+ * TCP completes sends in order, each notification covering a range of ids
+ */
+int
+tcp_reap_zc(struct tcp_conn *c)
+{
+#ifdef CC_ZEROCOPY
+    struct msghdr msg;
+    struct cmsghdr *cm;
+    struct sock_extended_err *serr;
+    char control[CMSG_SPACE(sizeof(struct sock_extended_err)) +
+        CMSG_SPACE(sizeof(struct sockaddr_in6))];
+    uint32_t ncomplete;
+    int total = 0;
+
+    if (!tcp_zc_pending(c)) {
+        return 0;
+    }
+
+    for (;;) {
+        memset(&msg, 0, sizeof(msg));
+        msg.msg_control = control;
+        msg.msg_controllen = sizeof(control);
+
+        if (recvmsg(c->sd, &msg, MSG_ERRQUEUE) < 0) {
+            if (errno == EINTR) {
+                continue;
+            } else if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                break;
+            }
+
+            c->err = errno;
+            log_error("read error queue on sd %d failed: %s", c->sd,
+                    strerror(errno));
+
+            return CC_ERROR;
+        }
+
+        for (cm = CMSG_FIRSTHDR(&msg); cm != NULL; cm = CMSG_NXTHDR(&msg, cm)) {
+            if (!((cm->cmsg_level == SOL_IP && cm->cmsg_type == IP_RECVERR) ||
+                    (cm->cmsg_level == SOL_IPV6 &&
+                     cm->cmsg_type == IPV6_RECVERR))) {
+                continue;
+            }
+
+            serr = (struct sock_extended_err *)CMSG_DATA(cm);
+            if (serr->ee_errno != 0 ||
+                    serr->ee_origin != SO_EE_ORIGIN_ZEROCOPY) {
+                continue;
+            }
+
+            /* ids in [ee_info, ee_data] have completed */
+            ncomplete = serr->ee_data - serr->ee_info + 1;
+            c->zc_done = serr->ee_data + 1;
+            total += ncomplete;
+            INCR_N(tcp_metrics, tcp_zc_complete, ncomplete);
+            if (serr->ee_code & SO_EE_CODE_ZEROCOPY_COPIED) {
+                INCR_N(tcp_metrics, tcp_zc_copied, ncomplete);
+            }
+        }
+    }
+
+    log_verb("reaped %d zerocopy completions on sd %d", total, c->sd);
+
+    return total;
+#else
+    (void)c;
+
+    return 0;
+#endif
+}
+
 void
 tcp_setup(tcp_options_st *options, tcp_metrics_st *metrics)
 {
@@ -911,6 +1450,16 @@ tcp_setup(tcp_options_st *options, tcp_metrics_st *metrics)
     if (options != NULL) {
         max_backlog = option_uint(&options->tcp_backlog);
         max = option_uint(&options->tcp_poolsize);
+        tcp_zerocopy = option_bool(&options->tcp_zerocopy);
+        busy_poll = (int)option_uint(&options->tcp_busy_poll);
+        profile.nodelay = option_bool(&options->tcp_nodelay);
+        profile.keepalive = option_bool(&options->tcp_keepalive);
+        profile.sndbuf = (int)option_uint(&options->tcp_sndbuf);
+        profile.rcvbuf = (int)option_uint(&options->tcp_rcvbuf);
+        if (option_bool(&options->tcp_sndbuf_max)) {
+            profile.sndbuf = _tcp_probe_sndbuf();
+        }
+        _tcp_info_create(option_uint(&options->tcp_info_rate));
     }
     tcp_conn_pool_create(max);
 
@@ -929,6 +1478,10 @@ tcp_teardown(void)
 
     tcp_conn_pool_destroy();
     tcp_metrics = NULL;
+    tcp_zerocopy = false;
+    busy_poll = TCP_BUSY_POLL;
+    profile = (struct tcp_profile){.nodelay = true};
+    _tcp_info_destroy();
 
     tcp_init = false;
 }
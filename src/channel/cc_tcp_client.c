@@ -0,0 +1,339 @@
+/*
+ * ccommon - a cache common library.
+ * Copyright (C) 2013 Twitter, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <channel/cc_tcp_client.h>
+
+#include <cc_debug.h>
+#include <cc_mm.h>
+
+#include <errno.h>
+#include <inttypes.h>
+#include <netdb.h>
+#include <string.h>
+
+static inline bool
+_tcp_client_open(struct tcp_client *cl)
+{
+    return cl->c->state == CHANNEL_OPEN || cl->c->state == CHANNEL_ESTABLISHED;
+}
+
+static struct tcp_client *
+_tcp_client_find(struct tcp_client_pool *pool, struct tcp_conn *c)
+{
+    uint32_t i;
+
+    for (i = 0; i < pool->nconn; i++) {
+        if (pool->client[i].c == c) {
+            return &pool->client[i];
+        }
+    }
+
+    return NULL;
+}
+
+static void
+_tcp_client_disarm(struct tcp_client *cl)
+{
+    if (cl->tev != NULL) {
+        timing_wheel_remove(cl->pool->tw, &cl->tev);
+    }
+}
+
+/*
+ * close by whether the socket is still held rather than by channel state: a
+ * failed connect_finish or read/write moves the conn to ERROR or TERM, but
+ * leaves sd open
+ */
+static void
+_tcp_client_close(struct tcp_client *cl)
+{
+    _tcp_client_disarm(cl);
+
+    if (cl->c->sd > 0) {
+        tcp_close(cl->c);
+        cl->c->sd = 0;
+    }
+    cl->c->state = CHANNEL_ERROR;
+    cl->nreq = 0;
+}
+
+/* timeout_cb_fn, the wheel recycles the event after the callback returns */
+static void
+_tcp_client_expire(void *arg)
+{
+    struct tcp_client *cl = arg;
+
+    cl->tev = NULL;
+
+    if (cl->c->state != CHANNEL_OPEN) {
+        return;
+    }
+
+    log_info("connect on c %p sd %d timed out", cl->c, cl->c->sd);
+
+    _tcp_client_close(cl);
+    cl->c->err = ETIMEDOUT;
+    cl->pool->ntimeout++;
+}
+
+static bool
+_tcp_client_connect(struct tcp_client *cl)
+{
+    struct tcp_client_pool *pool = cl->pool;
+    struct addrinfo ai;
+
+    memset(&ai, 0, sizeof(ai));
+    ai.ai_family = pool->family;
+    ai.ai_socktype = pool->socktype;
+    ai.ai_protocol = pool->protocol;
+    ai.ai_addrlen = pool->addrlen;
+    ai.ai_addr = (struct sockaddr *)&pool->addr;
+
+    _tcp_client_close(cl);
+    tcp_conn_reset(cl->c);
+    pool->nconnect++;
+    if (!tcp_connect(&ai, cl->c)) {
+        cl->c->sd = 0; /* already closed by tcp_connect */
+        cl->c->state = CHANNEL_ERROR;
+        pool->nfail++;
+
+        return false;
+    }
+
+    if (cl->c->state == CHANNEL_OPEN && pool->tw != NULL &&
+            pool->deadline.is_set) {
+        cl->tev = timing_wheel_insert(pool->tw, &pool->deadline, false,
+                _tcp_client_expire, cl);
+        if (cl->tev == NULL) {
+            log_warn("cannot arm connect deadline for c %p, ignored", cl->c);
+        }
+    }
+
+    return true;
+}
+
+struct tcp_client_pool *
+tcp_client_pool_create(struct addrinfo *ai, uint32_t nconn,
+        struct timing_wheel *tw, struct timeout *deadline)
+{
+    struct tcp_client_pool *pool;
+    uint32_t i;
+
+    ASSERT(ai != NULL && ai->ai_addrlen <= sizeof(pool->addr));
+    ASSERT(nconn > 0);
+
+    pool = (struct tcp_client_pool *)cc_alloc(sizeof(*pool));
+    if (pool == NULL) {
+        goto error;
+    }
+
+    memcpy(&pool->addr, ai->ai_addr, ai->ai_addrlen);
+    pool->addrlen = ai->ai_addrlen;
+    pool->family = ai->ai_family;
+    pool->socktype = ai->ai_socktype;
+    pool->protocol = ai->ai_protocol;
+
+    pool->tw = tw;
+    if (deadline != NULL) {
+        pool->deadline = *deadline;
+    } else {
+        timeout_reset(&pool->deadline);
+    }
+
+    pool->nconn = nconn;
+    pool->next = 0;
+    pool->nconnect = 0;
+    pool->ntimeout = 0;
+    pool->nfail = 0;
+
+    pool->client = (struct tcp_client *)cc_calloc(nconn, sizeof(*pool->client));
+    if (pool->client == NULL) {
+        cc_free(pool);
+        goto error;
+    }
+
+    for (i = 0; i < nconn; i++) {
+        struct tcp_client *cl = &pool->client[i];
+
+        cl->pool = pool;
+        cl->c = tcp_conn_create();
+        if (cl->c == NULL) {
+            pool->nconn = i;
+            tcp_client_pool_destroy(&pool);
+            goto error;
+        }
+    }
+
+    log_info("created tcp client pool %p with %"PRIu32" connections", pool,
+            nconn);
+
+    return pool;
+
+error:
+    log_error("cannot create tcp client pool with %"PRIu32" connections due "
+            "to OOM", nconn);
+
+    return NULL;
+}
+
+void
+tcp_client_pool_destroy(struct tcp_client_pool **pool)
+{
+    struct tcp_client_pool *p = *pool;
+    uint32_t i;
+
+    if (p == NULL) {
+        return;
+    }
+
+    log_info("destroy tcp client pool %p", p);
+
+    for (i = 0; i < p->nconn; i++) {
+        _tcp_client_close(&p->client[i]);
+        tcp_conn_destroy(&p->client[i].c);
+    }
+
+    cc_free(p->client);
+    cc_free(p);
+
+    *pool = NULL;
+}
+
+uint32_t
+tcp_client_pool_connect(struct tcp_client_pool *pool)
+{
+    uint32_t i, n = 0;
+
+    ASSERT(pool != NULL);
+
+    for (i = 0; i < pool->nconn; i++) {
+        struct tcp_client *cl = &pool->client[i];
+
+        if (!_tcp_client_open(cl) && _tcp_client_connect(cl)) {
+            n++;
+        }
+    }
+
+    log_verb("started %"PRIu32" connects in tcp client pool %p", n, pool);
+
+    return n;
+}
+
+rstatus_i
+tcp_client_pool_ready(struct tcp_client_pool *pool, struct tcp_conn *c)
+{
+    struct tcp_client *cl;
+    rstatus_i status;
+
+    ASSERT(pool != NULL);
+
+    cl = _tcp_client_find(pool, c);
+    if (cl == NULL) {
+        return CC_EINVAL;
+    }
+
+    status = tcp_connect_finish(c);
+    if (status == CC_OK) {
+        _tcp_client_disarm(cl);
+    } else if (status == CC_ERROR) {
+        _tcp_client_close(cl);
+        pool->nfail++;
+    }
+
+    return status;
+}
+
+void
+tcp_client_pool_close(struct tcp_client_pool *pool, struct tcp_conn *c)
+{
+    struct tcp_client *cl;
+
+    ASSERT(pool != NULL);
+
+    cl = _tcp_client_find(pool, c);
+    if (cl == NULL) {
+        log_warn("c %p not in tcp client pool %p, ignored", c, pool);
+
+        return;
+    }
+
+    _tcp_client_close(cl);
+    pool->nfail++;
+}
+
+struct tcp_conn *
+tcp_client_pool_get(struct tcp_client_pool *pool)
+{
+    struct tcp_client *best = NULL;
+    uint32_t i, idx = 0;
+
+    ASSERT(pool != NULL);
+
+    /* start the scan after the last pick so ties are spread round robin */
+    for (i = 0; i < pool->nconn; i++) {
+        uint32_t j = (pool->next + i) % pool->nconn;
+        struct tcp_client *cl = &pool->client[j];
+
+        if (cl->c->state != CHANNEL_ESTABLISHED) {
+            continue;
+        }
+        if (best == NULL || cl->nreq < best->nreq) {
+            best = cl;
+            idx = j;
+        }
+    }
+
+    if (best == NULL) {
+        tcp_client_pool_connect(pool);
+
+        return NULL;
+    }
+
+    pool->next = (idx + 1) % pool->nconn;
+    best->nreq++;
+
+    return best->c;
+}
+
+void
+tcp_client_pool_put(struct tcp_client_pool *pool, struct tcp_conn *c)
+{
+    struct tcp_client *cl;
+
+    ASSERT(pool != NULL);
+
+    cl = _tcp_client_find(pool, c);
+    if (cl == NULL || cl->nreq == 0) {
+        return;
+    }
+
+    cl->nreq--;
+}
+
+uint32_t
+tcp_client_pool_nactive(struct tcp_client_pool *pool)
+{
+    uint32_t i, n = 0;
+
+    for (i = 0; i < pool->nconn; i++) {
+        if (pool->client[i].c->state == CHANNEL_ESTABLISHED) {
+            n++;
+        }
+    }
+
+    return n;
+}
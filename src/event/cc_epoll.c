@@ -46,6 +46,10 @@ struct event_base {
     int                nevent;  /* # events */
 
     event_cb_fn         cb;      /* event callback */
+
+    uint32_t           spin;    /* busy poll budget in usec, 0 to disable */
+    uint64_t           nhit;    /* # waits served by spinning */
+    uint64_t           nblock;  /* # waits blocked after spinning */
 };
 
 struct event_base *
@@ -86,6 +90,9 @@ event_base_create(int nevent, event_cb_fn cb)
     evb->event = event;
     evb->nevent = nevent;
     evb->cb = cb;
+    evb->spin = event_busy_poll;
+    evb->nhit = 0;
+    evb->nblock = 0;
 
     log_info("epoll fd %d with nevent %d", evb->ep, evb->nevent);
 
@@ -191,6 +198,107 @@ event_del(struct event_base *evb, int fd)
     return status;
 }
 
+void
+event_base_busy_poll(struct event_base *evb, uint32_t budget)
+{
+    ASSERT(evb != NULL);
+
+    evb->spin = budget;
+
+    log_info("epoll fd %d busy polls for up to %"PRIu32" usec", evb->ep,
+            budget);
+}
+
+void
+event_base_spin_stats(struct event_base *evb, uint64_t *nhit, uint64_t *nblock)
+{
+    ASSERT(evb != NULL);
+
+    *nhit = evb->nhit;
+    *nblock = evb->nblock;
+}
+
+static void
+_event_dispatch(struct event_base *evb, int nreturned)
+{
+    int i;
+
+    INCR_N(event_metrics, event_total, nreturned);
+    for (i = 0; i < nreturned; i++) {
+        struct epoll_event *ev = evb->event + i;
+        uint32_t events = 0;
+
+        log_verb("epoll %04"PRIX32" against data %p",
+                  ev->events, ev->data.ptr);
+
+
+        if (ev->events & (EPOLLERR | EPOLLHUP)) {
+            events |= EVENT_ERR;
+        }
+
+        if (ev->events & (EPOLLIN | EPOLLRDHUP)) {
+            events |= EVENT_READ;
+        }
+
+        if (ev->events & EPOLLOUT) {
+            events |= EVENT_WRITE;
+        }
+
+        if (evb->cb != NULL) {
+            evb->cb(ev->data.ptr, events);
+        }
+    }
+
+    log_verb("returned %d events from epoll fd %d", nreturned, evb->ep);
+}
+
+/*
+ * poll with a zero timeout until events arrive or the spin budget (capped by
+ * timeout, in millisecond) runs out. Returns the number of events dispatched,
+ * or 0 with timeout reduced by the time spent spinning, or -1 on error.
+ */
+static int
+_event_spin(struct event_base *evb, int *timeout)
+{
+    uint64_t start, now, budget;
+    int nreturned;
+
+    budget = evb->spin;
+    if (*timeout > 0 && (uint64_t)*timeout * 1000 < budget) {
+        budget = (uint64_t)*timeout * 1000;
+    }
+
+    start = event_now_us();
+    do {
+        nreturned = epoll_wait(evb->ep, evb->event, evb->nevent, 0);
+        INCR(event_metrics, event_spin);
+        if (nreturned > 0) {
+            evb->nhit++;
+            INCR(event_metrics, event_spin_hit);
+            _event_dispatch(evb, nreturned);
+
+            return nreturned;
+        }
+
+        if (nreturned < 0 && errno != EINTR) {
+            log_error("spin on epoll fd %d with nevent %d failed: %s", evb->ep,
+                    evb->nevent, strerror(errno));
+
+            return -1;
+        }
+
+        now = event_now_us();
+    } while (now - start < budget);
+
+    if (*timeout > 0) {
+        *timeout -= (int)((now - start) / 1000);
+        if (*timeout < 0) {
+            *timeout = 0;
+        }
+    }
+
+    return 0;
+}
 
 /*
  * create a timed event with event base function and timeout (in millisecond)
@@ -212,40 +320,36 @@ event_wait(struct event_base *evb, int timeout)
     ASSERT(ev_arr != NULL);
     ASSERT(nevent > 0);
 
-    for (;;) {
-        int i, nreturned;
-
-        nreturned = epoll_wait(ep, ev_arr, nevent, timeout);
-        INCR(event_metrics, event_loop);
-        if (nreturned > 0) {
-            INCR_N(event_metrics, event_total, nreturned);
-            for (i = 0; i < nreturned; i++) {
-                struct epoll_event *ev = ev_arr + i;
-                uint32_t events = 0;
+    if (evb->spin > 0 && timeout != 0) {
+        int nreturned = _event_spin(evb, &timeout);
 
-                log_verb("epoll %04"PRIX32" against data %p",
-                          ev->events, ev->data.ptr);
+        /*
+         * a spin counts as one loop with each poll in it as a spin, unless a
+         * blocking wait follows, which counts the loop instead
+         */
+        if (nreturned != 0) {
+            INCR(event_metrics, event_loop);
 
+            return nreturned;
+        }
 
-                if (ev->events & (EPOLLERR | EPOLLHUP)) {
-                    events |= EVENT_ERR;
-                }
+        if (timeout == 0) { /* the whole timeout was spent spinning */
+            INCR(event_metrics, event_loop);
 
-                if (ev->events & (EPOLLIN | EPOLLRDHUP)) {
-                    events |= EVENT_READ;
-                }
+            return 0;
+        }
 
-                if (ev->events & EPOLLOUT) {
-                    events |= EVENT_WRITE;
-                }
+        evb->nblock++;
+        INCR(event_metrics, event_spin_block);
+    }
 
-                if (evb->cb != NULL) {
-                    evb->cb(ev->data.ptr, events);
-                }
-            }
+    for (;;) {
+        int nreturned;
 
-            log_verb("returned %d events from epoll fd %d",
-                    nreturned, ep);
+        nreturned = epoll_wait(ep, ev_arr, nevent, timeout);
+        INCR(event_metrics, event_loop);
+        if (nreturned > 0) {
+            _event_dispatch(evb, nreturned);
 
             return nreturned;
         }
@@ -41,6 +41,10 @@ struct event_base {
     int           nprocessed;   /* # events processed from event[] */
 
     event_cb_fn    cb;           /* event callback */
+
+    uint32_t      spin;         /* busy poll budget in usec, 0 to disable */
+    uint64_t      nhit;         /* # waits served by spinning */
+    uint64_t      nblock;       /* # waits blocked after spinning */
 };
 
 struct event_base *
@@ -99,6 +103,9 @@ event_base_create(int nevent, event_cb_fn cb)
     evb->nreturned = 0;
     evb->nprocessed = 0;
     evb->cb = cb;
+    evb->spin = event_busy_poll;
+    evb->nhit = 0;
+    evb->nblock = 0;
 
     log_info("kqueue fd %d with nevent %d", evb->kq, evb->nevent);
 
@@ -180,6 +187,130 @@ event_del(struct event_base *evb, int fd)
     return 0;
 }
 
+void
+event_base_busy_poll(struct event_base *evb, uint32_t budget)
+{
+    ASSERT(evb != NULL);
+
+    evb->spin = budget;
+
+    log_info("kqueue fd %d busy polls for up to %"PRIu32" usec", evb->kq,
+            budget);
+}
+
+void
+event_base_spin_stats(struct event_base *evb, uint64_t *nhit, uint64_t *nblock)
+{
+    ASSERT(evb != NULL);
+
+    *nhit = evb->nhit;
+    *nblock = evb->nblock;
+}
+
+static void
+_event_dispatch(struct event_base *evb)
+{
+    INCR_N(event_metrics, event_total, evb->nreturned);
+    for (evb->nprocessed = 0; evb->nprocessed < evb->nreturned;
+        evb->nprocessed++) {
+        struct kevent *ev = &evb->event[evb->nprocessed];
+        uint32_t events = 0;
+
+        log_verb("kevent %04"PRIX32" with filter %"PRIX16" triggered "
+                  "on ident %d", ev->flags, ev->filter, ev->ident);
+
+        /*
+         * If an error occurs while processing an element of the
+         * change[] and there is enough room in the event[], then the
+         * event event will be placed in the eventlist with EV_ERROR
+         * set in flags and the system error(errno) in data.
+         */
+        if (ev->flags & EV_ERROR) {
+           /*
+            * Error messages that can happen, when a delete fails.
+            *   EBADF happens when the file descriptor has been closed
+            *   ENOENT when the file descriptor was closed and then
+            *   reopened.
+            *   EINVAL for some reasons not understood; EINVAL
+            *   should not be returned ever; but FreeBSD does :-\
+            * An error is also indicated when a callback deletes an
+            * event we are still processing. In that case the data
+            * field is set to ENOENT.
+            */
+
+            if (ev->data != ENOMEM && ev->data != EFAULT &&
+                    ev->data != EACCES && ev->data != EINVAL) {
+                continue;
+            }
+            events |= EVENT_ERR;
+        }
+
+        if (ev->filter == EVFILT_READ) {
+            events |= EVENT_READ;
+        }
+
+        if (ev->filter == EVFILT_WRITE) {
+            events |= EVENT_WRITE;
+        }
+
+        if (evb->cb != NULL && events != 0) {
+            evb->cb(ev->udata, events);
+        }
+    }
+
+    log_verb("returned %d events from kqueue fd %d", evb->nreturned, evb->kq);
+}
+
+/*
+ * poll with a zero timeout until events arrive or the spin budget (capped by
+ * timeout, in millisecond) runs out. Returns the number of events dispatched,
+ * or 0 with timeout reduced by the time spent spinning, or -1 on error.
+ */
+static int
+_event_spin(struct event_base *evb, int *timeout)
+{
+    struct timespec zero = {0, 0};
+    uint64_t start, now, budget;
+
+    budget = evb->spin;
+    if (*timeout > 0 && (uint64_t)*timeout * 1000 < budget) {
+        budget = (uint64_t)*timeout * 1000;
+    }
+
+    start = event_now_us();
+    do {
+        evb->nreturned = kevent(evb->kq, evb->change, evb->nchange, evb->event,
+                                evb->nevent, &zero);
+        INCR(event_metrics, event_spin);
+        evb->nchange = 0;
+        if (evb->nreturned > 0) {
+            evb->nhit++;
+            INCR(event_metrics, event_spin_hit);
+            _event_dispatch(evb);
+
+            return evb->nreturned;
+        }
+
+        if (evb->nreturned < 0 && errno != EINTR) {
+            log_error("spin on kqueue fd %d with nevent %d failed: %s",
+                    evb->kq, evb->nevent, strerror(errno));
+
+            return -1;
+        }
+
+        now = event_now_us();
+    } while (now - start < budget);
+
+    if (*timeout > 0) {
+        *timeout -= (int)((now - start) / 1000);
+        if (*timeout < 0) {
+            *timeout = 0;
+        }
+    }
+
+    return 0;
+}
+
 int
 event_wait(struct event_base *evb, int timeout)
 {
@@ -192,6 +323,29 @@ event_wait(struct event_base *evb, int timeout)
 
     ASSERT(kq > 0);
 
+    if (evb->spin > 0 && timeout != 0) {
+        int nreturned = _event_spin(evb, &timeout);
+
+        /*
+         * a spin counts as one loop with each poll in it as a spin, unless a
+         * blocking wait follows, which counts the loop instead
+         */
+        if (nreturned != 0) {
+            INCR(event_metrics, event_loop);
+
+            return nreturned;
+        }
+
+        if (timeout == 0) { /* the whole timeout was spent spinning */
+            INCR(event_metrics, event_loop);
+
+            return 0;
+        }
+
+        evb->nblock++;
+        INCR(event_metrics, event_spin_block);
+    }
+
     /* kevent should block indefinitely if timeout < 0 */
     if (timeout < 0) {
         tsp = NULL;
@@ -220,55 +374,7 @@ event_wait(struct event_base *evb, int timeout)
         INCR(event_metrics, event_loop);
         evb->nchange = 0;
         if (evb->nreturned > 0) {
-            INCR_N(event_metrics, event_total, evb->nreturned);
-            for (evb->nprocessed = 0; evb->nprocessed < evb->nreturned;
-                evb->nprocessed++) {
-                struct kevent *ev = &evb->event[evb->nprocessed];
-                uint32_t events = 0;
-
-                log_verb("kevent %04"PRIX32" with filter %"PRIX16" triggered "
-                          "on ident %d", ev->flags, ev->filter, ev->ident);
-
-                /*
-                 * If an error occurs while processing an element of the
-                 * change[] and there is enough room in the event[], then the
-                 * event event will be placed in the eventlist with EV_ERROR
-                 * set in flags and the system error(errno) in data.
-                 */
-                if (ev->flags & EV_ERROR) {
-                   /*
-                    * Error messages that can happen, when a delete fails.
-                    *   EBADF happens when the file descriptor has been closed
-                    *   ENOENT when the file descriptor was closed and then
-                    *   reopened.
-                    *   EINVAL for some reasons not understood; EINVAL
-                    *   should not be returned ever; but FreeBSD does :-\
-                    * An error is also indicated when a callback deletes an
-                    * event we are still processing. In that case the data
-                    * field is set to ENOENT.
-                    */
-
-                    if (ev->data != ENOMEM && ev->data != EFAULT &&
-                            ev->data != EACCES && ev->data != EINVAL) {
-                        continue;
-                    }
-                    events |= EVENT_ERR;
-                }
-
-                if (ev->filter == EVFILT_READ) {
-                    events |= EVENT_READ;
-                }
-
-                if (ev->filter == EVFILT_WRITE) {
-                    events |= EVENT_WRITE;
-                }
-
-                if (evb->cb != NULL && events != 0) {
-                    evb->cb(ev->udata, events);
-                }
-            }
-
-            log_verb("returned %d events from kqueue fd %d", evb->nreturned, kq);
+            _event_dispatch(evb);
 
             return evb->nreturned;
         }
@@ -21,14 +21,19 @@
 
 static bool event_init = false;
 event_metrics_st *event_metrics = NULL;
+uint32_t event_busy_poll = EVENT_BUSY_POLL;
 
 void
-event_setup(event_metrics_st *metrics)
+event_setup(event_options_st *options, event_metrics_st *metrics)
 {
     log_info("set up the %s module", EVENT_MODULE_NAME);
 
     event_metrics = metrics;
 
+    if (options != NULL) {
+        event_busy_poll = option_uint(&options->event_busy_poll);
+    }
+
     if (event_init) {
         log_warn("%s has already been setup, overwrite", EVENT_MODULE_NAME);
     }
@@ -44,5 +49,6 @@ event_teardown(void)
         log_warn("%s has never been setup", EVENT_MODULE_NAME);
     }
     event_metrics = NULL;
+    event_busy_poll = EVENT_BUSY_POLL;
     event_init = false;
 }
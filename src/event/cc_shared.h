@@ -25,10 +25,24 @@ extern "C" {
 #include <cc_event.h>
 
 #include <stdbool.h>
+#include <stdint.h>
+#include <time.h>
 
 #define EVENT_MODULE_NAME "ccommon::event"
 
 extern event_metrics_st *event_metrics;
+extern uint32_t event_busy_poll; /* default spin budget of new event bases */
+
+/* monotonic time in usec, used to bound busy polling */
+static inline uint64_t
+event_now_us(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (uint64_t)ts.tv_sec * 1000000ULL + (uint64_t)ts.tv_nsec / 1000ULL;
+}
 
 #ifdef __cplusplus
 }
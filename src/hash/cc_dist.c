@@ -0,0 +1,444 @@
+/*
+ * ccommon - a cache common library.
+ * Copyright (C) 2021 Twitter, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <hash/cc_dist.h>
+
+#include <hash/cc_murmur3.h>
+
+#include <cc_debug.h>
+#include <cc_mm.h>
+
+#include <inttypes.h>
+#include <math.h>
+
+/* keeps weight * DIST_KETAMA_POINT, and the continuum size, within 32 bits */
+#define DIST_WEIGHT_MAX (1 << 16)
+
+static uint64_t
+_dist_hash(const char *key, uint32_t len)
+{
+    uint64_t h[2];
+
+    hash_murmur3_128_x64(key, (int)len, 0, h);
+
+    return h[0];
+}
+
+/* 64-bit finalizer of splitmix64, for rendezvous scores */
+static inline uint64_t
+_mix64(uint64_t x)
+{
+    x ^= x >> 30;
+    x *= 0xbf58476d1ce4e5b9ULL;
+    x ^= x >> 27;
+    x *= 0x94d049bb133111ebULL;
+    x ^= x >> 31;
+
+    return x;
+}
+
+static inline struct dist_node *
+_node(const struct dist *d, uint32_t id)
+{
+    return (struct dist_node *)(d->node.data + d->node.size * id);
+}
+
+static int
+_point_compare(const void *lhs, const void *rhs)
+{
+    const struct dist_point *p1 = lhs, *p2 = rhs;
+
+    if (p1->hash != p2->hash) {
+        return p1->hash < p2->hash ? -1 : 1;
+    }
+
+    /* equal hashes resolve by id, so the continuum is a total order */
+    return p1->id < p2->id ? -1 : p1->id > p2->id;
+}
+
+/*
+ * ketama: generate and sort the points of a node, then merge them with the
+ * continuum into a new array; the points of other nodes are only copied
+ */
+static rstatus_i
+_ketama_add(struct dist *d, uint32_t id)
+{
+    struct dist_node *node = _node(d, id);
+    struct array new, merged;
+    struct dist_point *p, *q, *r, *pend, *qend;
+    uint32_t npoint, i;
+    rstatus_i status;
+
+    npoint = node->weight * DIST_KETAMA_POINT;
+    status = array_data_create(&new, npoint, sizeof(struct dist_point));
+    if (status != CC_OK) {
+        return status;
+    }
+
+    /* like ketama's md5, each 128-bit digest yields 4 points */
+    for (i = 0; i < npoint / 4; i++) {
+        uint32_t h[4];
+        int j;
+
+        hash_murmur3_128_x64(node->name.data, (int)node->name.len, i, h);
+        for (j = 0; j < 4; j++) {
+            p = array_push(&new);
+            p->hash = h[j];
+            p->id = id;
+        }
+    }
+    array_sort(&new, _point_compare);
+
+    if (array_nelem(&d->point) == 0) {
+        array_data_destroy(&d->point);
+        d->point = new;
+
+        return CC_OK;
+    }
+
+    status = array_data_create(&merged, array_nelem(&d->point) + npoint,
+            sizeof(struct dist_point));
+    if (status != CC_OK) {
+        array_data_destroy(&new);
+        return status;
+    }
+
+    p = (struct dist_point *)d->point.data;
+    pend = p + array_nelem(&d->point);
+    q = (struct dist_point *)new.data;
+    qend = q + npoint;
+    r = (struct dist_point *)merged.data;
+    while (p < pend && q < qend) {
+        *r++ = _point_compare(p, q) <= 0 ? *p++ : *q++;
+    }
+    while (p < pend) {
+        *r++ = *p++;
+    }
+    while (q < qend) {
+        *r++ = *q++;
+    }
+    merged.nelem = array_nelem(&d->point) + npoint;
+
+    array_data_destroy(&new);
+    array_data_destroy(&d->point);
+    d->point = merged;
+
+    return CC_OK;
+}
+
+/* ketama: drop the points of a node, in place and in order */
+static void
+_ketama_remove(struct dist *d, uint32_t id)
+{
+    struct dist_point *p, *r, *pend;
+
+    p = r = (struct dist_point *)d->point.data;
+    pend = p + array_nelem(&d->point);
+    for (; p < pend; p++) {
+        if (p->id != id) {
+            *r++ = *p;
+        }
+    }
+    d->point.nelem = (uint32_t)(r - (struct dist_point *)d->point.data);
+}
+
+static uint32_t
+_ketama_lookup(const struct dist *d, uint64_t hash)
+{
+    const struct dist_point *point = (const struct dist_point *)d->point.data;
+    uint32_t h = (uint32_t)hash, lo = 0, hi = array_nelem(&d->point);
+
+    if (hi == 0) {
+        return DIST_NODE_NONE;
+    }
+
+    /* first point at or after h, wrapping around past the last one */
+    while (lo < hi) {
+        uint32_t mid = lo + (hi - lo) / 2;
+
+        if (point[mid].hash < h) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    if (lo == array_nelem(&d->point)) {
+        lo = 0;
+    }
+
+    return point[lo].id;
+}
+
+/*
+ * rendezvous: every node draws u in (0, 1) from the key and node hashes, the
+ * key goes to the node with the lowest -ln(u) / weight, which is a node with
+ * probability proportional to its weight. With equal weights that is simply
+ * the node with the highest draw, which saves a log() per node.
+ */
+static uint32_t
+_rendezvous_lookup(const struct dist *d, uint64_t hash)
+{
+    uint32_t id, best = DIST_NODE_NONE;
+    double score, min = HUGE_VAL;
+
+    if (!d->weighted) {
+        uint64_t draw, max = 0;
+
+        for (id = 0; id < array_nelem(&d->node); id++) {
+            const struct dist_node *node = _node(d, id);
+
+            if (node->weight == 0) {
+                continue;
+            }
+
+            draw = _mix64(hash ^ node->hash);
+            if (best == DIST_NODE_NONE || draw > max) {
+                max = draw;
+                best = id;
+            }
+        }
+
+        return best;
+    }
+
+    for (id = 0; id < array_nelem(&d->node); id++) {
+        const struct dist_node *node = _node(d, id);
+        double u;
+
+        if (node->weight == 0) {
+            continue;
+        }
+
+        u = ((_mix64(hash ^ node->hash) >> 11) + 0.5) / (double)(1ULL << 53);
+        score = -log(u) / node->weight;
+        if (score < min) {
+            min = score;
+            best = id;
+        }
+    }
+
+    return best;
+}
+
+static void
+_update_weighted(struct dist *d)
+{
+    uint32_t id, weight = 0;
+
+    d->weighted = false;
+    for (id = 0; id < array_nelem(&d->node); id++) {
+        const struct dist_node *node = _node(d, id);
+
+        if (node->weight == 0) {
+            continue;
+        }
+        if (weight != 0 && node->weight != weight) {
+            d->weighted = true;
+            return;
+        }
+        weight = node->weight;
+    }
+}
+
+int32_t
+dist_jump_hash(uint64_t key, int32_t nbucket)
+{
+    int64_t b = -1, j = 0;
+
+    while (j < nbucket) {
+        b = j;
+        key = key * 2862933555777941757ULL + 1;
+        j = (int64_t)((b + 1) * ((double)(1LL << 31) /
+                    (double)((key >> 33) + 1)));
+    }
+
+    return (int32_t)b;
+}
+
+struct dist *
+dist_create(dist_type_e type, uint32_t nnode)
+{
+    struct dist *d;
+
+    ASSERT(type < DIST_SENTINEL);
+
+    d = (struct dist *)cc_alloc(sizeof(*d));
+    if (d == NULL) {
+        log_info("dist creation failed due to OOM");
+        return NULL;
+    }
+
+    if (array_data_create(&d->node, nnode == 0 ? 1 : nnode,
+            sizeof(struct dist_node)) != CC_OK) {
+        log_info("dist creation failed due to OOM");
+        cc_free(d);
+        return NULL;
+    }
+    array_reset(&d->point);
+    d->type = type;
+    d->nnode = 0;
+    d->weighted = false;
+
+    return d;
+}
+
+void
+dist_destroy(struct dist **d)
+{
+    uint32_t id;
+
+    if (d == NULL || *d == NULL) {
+        return;
+    }
+
+    for (id = 0; id < array_nelem(&(*d)->node); id++) {
+        bstring_deinit(&_node(*d, id)->name);
+    }
+    array_data_destroy(&(*d)->node);
+    array_data_destroy(&(*d)->point);
+    cc_free(*d);
+    *d = NULL;
+}
+
+rstatus_i
+dist_add(struct dist *d, const char *name, uint32_t len, uint32_t weight,
+        uint32_t *id)
+{
+    struct dist_node *node = NULL;
+    uint32_t i;
+    rstatus_i status;
+
+    ASSERT(d != NULL && id != NULL);
+
+    if (name == NULL || len == 0 || weight == 0 || weight > DIST_WEIGHT_MAX) {
+        return CC_EINVAL;
+    }
+
+    /* take a free slot if there is one, jump hash needs ids to stay dense */
+    if (d->type != DIST_JUMP) {
+        for (i = 0; i < array_nelem(&d->node); i++) {
+            if (_node(d, i)->weight == 0) {
+                node = _node(d, i);
+                break;
+            }
+        }
+    }
+    if (node == NULL) {
+        node = array_push(&d->node);
+        if (node == NULL) {
+            return CC_ENOMEM;
+        }
+        i = array_nelem(&d->node) - 1;
+        bstring_init(&node->name);
+        node->weight = 0;
+    }
+
+    status = bstring_copy(&node->name, name, len);
+    if (status != CC_OK) {
+        goto error;
+    }
+    node->weight = weight;
+    node->hash = _dist_hash(name, len);
+
+    if (d->type == DIST_KETAMA) {
+        status = _ketama_add(d, i);
+        if (status != CC_OK) {
+            bstring_deinit(&node->name);
+            node->weight = 0;
+            goto error;
+        }
+    }
+
+    d->nnode++;
+    _update_weighted(d);
+    *id = i;
+
+    log_verb("dist %p added node %.*s as id %"PRIu32" with weight %"PRIu32,
+            d, len, name, i, weight);
+
+    return CC_OK;
+
+error:
+    if (i == array_nelem(&d->node) - 1) {
+        array_pop(&d->node);
+    }
+    return status;
+}
+
+rstatus_i
+dist_remove(struct dist *d, uint32_t id)
+{
+    struct dist_node *node;
+
+    ASSERT(d != NULL);
+
+    if (id >= array_nelem(&d->node) || _node(d, id)->weight == 0) {
+        return CC_EINVAL;
+    }
+
+    /* jump hash can only shrink from the end */
+    if (d->type == DIST_JUMP && id != array_nelem(&d->node) - 1) {
+        return CC_EINVAL;
+    }
+
+    if (d->type == DIST_KETAMA) {
+        _ketama_remove(d, id);
+    }
+
+    node = _node(d, id);
+    log_verb("dist %p removed node %.*s with id %"PRIu32, d, node->name.len,
+            node->name.data, id);
+
+    bstring_deinit(&node->name);
+    node->weight = 0;
+    if (d->type == DIST_JUMP) {
+        array_pop(&d->node);
+    }
+    d->nnode--;
+    _update_weighted(d);
+
+    return CC_OK;
+}
+
+uint32_t
+dist_lookup(const struct dist *d, const char *key, uint32_t len)
+{
+    uint64_t hash;
+
+    ASSERT(d != NULL);
+
+    if (d->nnode == 0) {
+        return DIST_NODE_NONE;
+    }
+
+    hash = _dist_hash(key, len);
+
+    switch (d->type) {
+    case DIST_KETAMA:
+        return _ketama_lookup(d, hash);
+
+    case DIST_JUMP:
+        return (uint32_t)dist_jump_hash(hash, (int32_t)d->nnode);
+
+    case DIST_RENDEZVOUS:
+        return _rendezvous_lookup(d, hash);
+
+    default:
+        NOT_REACHED();
+        return DIST_NODE_NONE;
+    }
+}
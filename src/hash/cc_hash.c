@@ -0,0 +1,144 @@
+/*
+ * ccommon - a cache common library.
+ * Copyright (C) 2021 Twitter, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <hash/cc_hash.h>
+
+#include <cc_debug.h>
+#include <cc_mm.h>
+
+/* compile xxhash into this unit only, with all of its functions static */
+#define XXH_INLINE_ALL
+#include <hash/xxhash.h>
+
+/* how many keys ahead hash_many prefetches */
+#define HASH_PREFETCH_AHEAD 4
+
+struct hash_state {
+    XXH3_state_t    *xxh3;
+};
+
+uint64_t
+hash_xxh3_64(const void *key, size_t len, uint64_t seed)
+{
+    return XXH3_64bits_withSeed(key, len, seed);
+}
+
+struct hash128
+hash_xxh3_128(const void *key, size_t len, uint64_t seed)
+{
+    XXH128_hash_t h = XXH3_128bits_withSeed(key, len, seed);
+
+    return (struct hash128){.low = h.low64, .high = h.high64};
+}
+
+void
+hash_many(const void *const keys[], const size_t lens[], uint64_t out[],
+        size_t n, uint64_t seed)
+{
+    size_t i;
+
+    /*
+     * keys of a batch are usually scattered over memory, fetching later keys
+     * while hashing the current one hides most of the cache misses
+     */
+    for (i = 0; i < n && i < HASH_PREFETCH_AHEAD; i++) {
+        __builtin_prefetch(keys[i]);
+    }
+    for (i = 0; i < n; i++) {
+        if (i + HASH_PREFETCH_AHEAD < n) {
+            __builtin_prefetch(keys[i + HASH_PREFETCH_AHEAD]);
+        }
+        out[i] = XXH3_64bits_withSeed(keys[i], lens[i], seed);
+    }
+}
+
+struct hash_state *
+hash_state_create(uint64_t seed)
+{
+    struct hash_state *state;
+
+    state = (struct hash_state *)cc_alloc(sizeof(*state));
+    if (state == NULL) {
+        return NULL;
+    }
+
+    /* XXH3_state_t wants 64-byte alignment, leave that to xxhash */
+    state->xxh3 = XXH3_createState();
+    if (state->xxh3 == NULL) {
+        cc_free(state);
+        return NULL;
+    }
+
+    /* a fresh state has a garbage seed, which reset_withSeed compares to */
+    XXH3_64bits_reset(state->xxh3);
+    hash_reset(state, seed);
+
+    return state;
+}
+
+void
+hash_state_destroy(struct hash_state **state)
+{
+    if (state == NULL || *state == NULL) {
+        return;
+    }
+
+    XXH3_freeState((*state)->xxh3);
+    cc_free(*state);
+    *state = NULL;
+}
+
+void
+hash_reset(struct hash_state *state, uint64_t seed)
+{
+    ASSERT(state != NULL);
+
+    /* the 64- and 128-bit variants share the same state and reset */
+    XXH3_64bits_reset_withSeed(state->xxh3, seed);
+}
+
+rstatus_i
+hash_update(struct hash_state *state, const void *data, size_t len)
+{
+    ASSERT(state != NULL);
+
+    if (XXH3_64bits_update(state->xxh3, data, len) != XXH_OK) {
+        return CC_ERROR;
+    }
+
+    return CC_OK;
+}
+
+uint64_t
+hash_digest_64(const struct hash_state *state)
+{
+    ASSERT(state != NULL);
+
+    return XXH3_64bits_digest(state->xxh3);
+}
+
+struct hash128
+hash_digest_128(const struct hash_state *state)
+{
+    XXH128_hash_t h;
+
+    ASSERT(state != NULL);
+
+    h = XXH3_128bits_digest(state->xxh3);
+
+    return (struct hash128){.low = h.low64, .high = h.high64};
+}
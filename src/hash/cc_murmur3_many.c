@@ -0,0 +1,347 @@
+/*
+ * ccommon - a cache common library.
+ * Copyright (C) 2021 Twitter, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <hash/cc_murmur3.h>
+
+#include <stdint.h>
+#include <string.h>
+
+/*
+ * hash_murmur3_32 over several keys at once: each SIMD lane runs the scalar
+ * algorithm on its own key. Lanes advance in lockstep one 4-byte block at a
+ * time. While every key has blocks left, 16 bytes of each key are loaded and
+ * transposed into 4 rounds; after that, once a lane has consumed all blocks
+ * of its key its hash is held still (blended back) while longer keys in the
+ * batch keep going. The tail
+ * bytes of each key are gathered into a word per lane (which is 0 when there
+ * is no tail, leaving the hash unchanged), so the tail and finalization are
+ * vectorized as well. Keys that do not fill a group of lanes are hashed by
+ * the scalar function.
+ *
+ * The vector paths are compiled with target attributes and picked at run
+ * time, so the library needs no -mavx2 and still runs on older CPUs.
+ */
+
+#define C1 0xcc9e2d51
+#define C2 0x1b873593
+#define C3 0xe6546b64
+
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__)
+#define MURMUR3_SIMD 1
+#include <immintrin.h>
+#endif
+
+/* next block of a key, or 0 past its last block */
+static inline uint32_t
+_block(const void *key, size_t nblock, size_t i)
+{
+    uint32_t k = 0;
+
+    if (i < nblock) {
+        memcpy(&k, (const uint8_t *)key + i * 4, sizeof(k));
+    }
+
+    return k;
+}
+
+/* tail bytes of a key, assembled as by hash_murmur3_32 */
+static inline uint32_t
+_tail(const void *key, size_t len)
+{
+    const uint8_t *tail = (const uint8_t *)key + (len & ~(size_t)3);
+    uint32_t k = 0;
+
+    switch (len & 3) {
+    case 3:
+        k ^= tail[2] << 16;
+        /* fall through */
+    case 2:
+        k ^= tail[1] << 8;
+        /* fall through */
+    case 1:
+        k ^= tail[0];
+    }
+
+    return k;
+}
+
+#ifdef MURMUR3_SIMD
+
+#define MURMUR3_LANE_SSE    4
+#define MURMUR3_LANE_AVX2   8
+
+/*
+ * SSE4.1, 4 lanes
+ */
+
+__attribute__((target("sse4.1")))
+static inline __m128i
+_rotl_sse(__m128i x, int r)
+{
+    return _mm_or_si128(_mm_slli_epi32(x, r), _mm_srli_epi32(x, 32 - r));
+}
+
+/* mix one block of each lane into its hash, h * 5 as (h << 2) + h */
+__attribute__((target("sse4.1")))
+static inline __m128i
+_round_sse(__m128i h, __m128i k)
+{
+    k = _mm_mullo_epi32(k, _mm_set1_epi32(C1));
+    k = _rotl_sse(k, 15);
+    k = _mm_mullo_epi32(k, _mm_set1_epi32(C2));
+
+    h = _mm_xor_si128(h, k);
+    h = _rotl_sse(h, 13);
+
+    return _mm_add_epi32(_mm_add_epi32(_mm_slli_epi32(h, 2), h),
+            _mm_set1_epi32(C3));
+}
+
+/* mix the tail word and length of each lane into its hash, then finalize */
+__attribute__((target("sse4.1")))
+static inline __m128i
+_final_sse(__m128i h, __m128i k, __m128i len)
+{
+    k = _mm_mullo_epi32(k, _mm_set1_epi32(C1));
+    k = _rotl_sse(k, 15);
+    k = _mm_mullo_epi32(k, _mm_set1_epi32(C2));
+    h = _mm_xor_si128(h, k);
+
+    h = _mm_xor_si128(h, len);
+    h = _mm_xor_si128(h, _mm_srli_epi32(h, 16));
+    h = _mm_mullo_epi32(h, _mm_set1_epi32(0x85ebca6b));
+    h = _mm_xor_si128(h, _mm_srli_epi32(h, 13));
+    h = _mm_mullo_epi32(h, _mm_set1_epi32(0xc2b2ae35));
+
+    return _mm_xor_si128(h, _mm_srli_epi32(h, 16));
+}
+
+/* x[j] holds 4 blocks of key j on input, x[b] block b of each key on output */
+__attribute__((target("sse4.1")))
+static inline void
+_transpose_sse(__m128i x[4])
+{
+    __m128i t0 = _mm_unpacklo_epi32(x[0], x[1]);
+    __m128i t1 = _mm_unpacklo_epi32(x[2], x[3]);
+    __m128i t2 = _mm_unpackhi_epi32(x[0], x[1]);
+    __m128i t3 = _mm_unpackhi_epi32(x[2], x[3]);
+
+    x[0] = _mm_unpacklo_epi64(t0, t1);
+    x[1] = _mm_unpackhi_epi64(t0, t1);
+    x[2] = _mm_unpacklo_epi64(t2, t3);
+    x[3] = _mm_unpackhi_epi64(t2, t3);
+}
+
+__attribute__((target("sse4.1")))
+static void
+_murmur3_32_sse(const void *const keys[], const size_t lens[], uint32_t out[],
+        uint32_t seed)
+{
+    const uint8_t *p[MURMUR3_LANE_SSE];
+    size_t nblock[MURMUR3_LANE_SSE], min = SIZE_MAX, max = 0, i;
+    __m128i h, nb, x[4];
+    int j, b;
+
+    for (j = 0; j < MURMUR3_LANE_SSE; j++) {
+        p[j] = keys[j];
+        nblock[j] = lens[j] / 4;
+        min = nblock[j] < min ? nblock[j] : min;
+        max = nblock[j] > max ? nblock[j] : max;
+    }
+
+    h = _mm_set1_epi32(seed);
+
+    /* blocks all keys have: 4 at a time, loaded 16 bytes per key */
+    for (i = 0; i + 4 <= min; i += 4) {
+        for (j = 0; j < MURMUR3_LANE_SSE; j++) {
+            x[j] = _mm_loadu_si128((const __m128i *)(p[j] + i * 4));
+        }
+        _transpose_sse(x);
+        for (b = 0; b < 4; b++) {
+            h = _round_sse(h, x[b]);
+        }
+    }
+
+    /* the rest, lanes past their last block keep their hash */
+    if (i < max) {
+        /* keys are far shorter than 2^31 blocks */
+        nb = _mm_setr_epi32(nblock[0], nblock[1], nblock[2], nblock[3]);
+        for (; i < max; i++) {
+            __m128i k = _mm_setr_epi32(_block(p[0], nblock[0], i),
+                    _block(p[1], nblock[1], i), _block(p[2], nblock[2], i),
+                    _block(p[3], nblock[3], i));
+            __m128i mask = _mm_cmpgt_epi32(nb, _mm_set1_epi32((int)i));
+
+            h = _mm_blendv_epi8(h, _round_sse(h, k), mask);
+        }
+    }
+
+    h = _final_sse(h,
+            _mm_setr_epi32(_tail(p[0], lens[0]), _tail(p[1], lens[1]),
+                _tail(p[2], lens[2]), _tail(p[3], lens[3])),
+            _mm_setr_epi32(lens[0], lens[1], lens[2], lens[3]));
+
+    _mm_storeu_si128((__m128i *)out, h);
+}
+
+/*
+ * AVX2, 8 lanes
+ */
+
+__attribute__((target("avx2")))
+static inline __m256i
+_rotl_avx2(__m256i x, int r)
+{
+    return _mm256_or_si256(_mm256_slli_epi32(x, r),
+            _mm256_srli_epi32(x, 32 - r));
+}
+
+__attribute__((target("avx2")))
+static inline __m256i
+_round_avx2(__m256i h, __m256i k)
+{
+    k = _mm256_mullo_epi32(k, _mm256_set1_epi32(C1));
+    k = _rotl_avx2(k, 15);
+    k = _mm256_mullo_epi32(k, _mm256_set1_epi32(C2));
+
+    h = _mm256_xor_si256(h, k);
+    h = _rotl_avx2(h, 13);
+
+    return _mm256_add_epi32(_mm256_add_epi32(_mm256_slli_epi32(h, 2), h),
+            _mm256_set1_epi32(C3));
+}
+
+__attribute__((target("avx2")))
+static inline __m256i
+_final_avx2(__m256i h, __m256i k, __m256i len)
+{
+    k = _mm256_mullo_epi32(k, _mm256_set1_epi32(C1));
+    k = _rotl_avx2(k, 15);
+    k = _mm256_mullo_epi32(k, _mm256_set1_epi32(C2));
+    h = _mm256_xor_si256(h, k);
+
+    h = _mm256_xor_si256(h, len);
+    h = _mm256_xor_si256(h, _mm256_srli_epi32(h, 16));
+    h = _mm256_mullo_epi32(h, _mm256_set1_epi32(0x85ebca6b));
+    h = _mm256_xor_si256(h, _mm256_srli_epi32(h, 13));
+    h = _mm256_mullo_epi32(h, _mm256_set1_epi32(0xc2b2ae35));
+
+    return _mm256_xor_si256(h, _mm256_srli_epi32(h, 16));
+}
+
+/*
+ * x[j] holds 4 blocks of key j in its low half and of key j + 4 in its high
+ * half; the transpose works within halves, leaving block b of keys 0..7 in
+ * x[b]
+ */
+__attribute__((target("avx2")))
+static inline void
+_transpose_avx2(__m256i x[4])
+{
+    __m256i t0 = _mm256_unpacklo_epi32(x[0], x[1]);
+    __m256i t1 = _mm256_unpacklo_epi32(x[2], x[3]);
+    __m256i t2 = _mm256_unpackhi_epi32(x[0], x[1]);
+    __m256i t3 = _mm256_unpackhi_epi32(x[2], x[3]);
+
+    x[0] = _mm256_unpacklo_epi64(t0, t1);
+    x[1] = _mm256_unpackhi_epi64(t0, t1);
+    x[2] = _mm256_unpacklo_epi64(t2, t3);
+    x[3] = _mm256_unpackhi_epi64(t2, t3);
+}
+
+__attribute__((target("avx2")))
+static void
+_murmur3_32_avx2(const void *const keys[], const size_t lens[], uint32_t out[],
+        uint32_t seed)
+{
+    const uint8_t *p[MURMUR3_LANE_AVX2];
+    size_t nblock[MURMUR3_LANE_AVX2], min = SIZE_MAX, max = 0, i;
+    __m256i h, nb, x[4];
+    int j, b;
+
+    for (j = 0; j < MURMUR3_LANE_AVX2; j++) {
+        p[j] = keys[j];
+        nblock[j] = lens[j] / 4;
+        min = nblock[j] < min ? nblock[j] : min;
+        max = nblock[j] > max ? nblock[j] : max;
+    }
+
+    h = _mm256_set1_epi32(seed);
+
+    for (i = 0; i + 4 <= min; i += 4) {
+        for (j = 0; j < 4; j++) {
+            x[j] = _mm256_inserti128_si256(_mm256_castsi128_si256(
+                        _mm_loadu_si128((const __m128i *)(p[j] + i * 4))),
+                    _mm_loadu_si128((const __m128i *)(p[j + 4] + i * 4)), 1);
+        }
+        _transpose_avx2(x);
+        for (b = 0; b < 4; b++) {
+            h = _round_avx2(h, x[b]);
+        }
+    }
+
+    if (i < max) {
+        nb = _mm256_setr_epi32(nblock[0], nblock[1], nblock[2], nblock[3],
+                nblock[4], nblock[5], nblock[6], nblock[7]);
+        for (; i < max; i++) {
+            __m256i k = _mm256_setr_epi32(_block(p[0], nblock[0], i),
+                    _block(p[1], nblock[1], i), _block(p[2], nblock[2], i),
+                    _block(p[3], nblock[3], i), _block(p[4], nblock[4], i),
+                    _block(p[5], nblock[5], i), _block(p[6], nblock[6], i),
+                    _block(p[7], nblock[7], i));
+            __m256i mask = _mm256_cmpgt_epi32(nb, _mm256_set1_epi32((int)i));
+
+            h = _mm256_blendv_epi8(h, _round_avx2(h, k), mask);
+        }
+    }
+
+    h = _final_avx2(h,
+            _mm256_setr_epi32(_tail(p[0], lens[0]), _tail(p[1], lens[1]),
+                _tail(p[2], lens[2]), _tail(p[3], lens[3]),
+                _tail(p[4], lens[4]), _tail(p[5], lens[5]),
+                _tail(p[6], lens[6]), _tail(p[7], lens[7])),
+            _mm256_setr_epi32(lens[0], lens[1], lens[2], lens[3], lens[4],
+                lens[5], lens[6], lens[7]));
+
+    _mm256_storeu_si256((__m256i *)out, h);
+}
+
+#endif /* MURMUR3_SIMD */
+
+void
+hash_murmur3_32_many(const void *const keys[], const size_t lens[],
+        uint32_t out[], size_t n, uint32_t seed)
+{
+    size_t i = 0;
+
+#ifdef MURMUR3_SIMD
+    if (__builtin_cpu_supports("avx2")) {
+        for (; i + MURMUR3_LANE_AVX2 <= n; i += MURMUR3_LANE_AVX2) {
+            _murmur3_32_avx2(keys + i, lens + i, out + i, seed);
+        }
+    }
+    if (__builtin_cpu_supports("sse4.1")) {
+        for (; i + MURMUR3_LANE_SSE <= n; i += MURMUR3_LANE_SSE) {
+            _murmur3_32_sse(keys + i, lens + i, out + i, seed);
+        }
+    }
+#endif
+
+    for (; i < n; i++) {
+        hash_murmur3_32(keys[i], (int)lens[i], seed, &out[i]);
+    }
+}
@@ -7,77 +7,6 @@
 #include <math.h>
 #include <x86intrin.h>
 
-struct histo_u32 *
-histo_u32_create(uint32_t m, uint32_t r, uint32_t n)
-{
-    struct histo_u32 *histo;
-
-    if (r <= m || r > n || n > 64) { /* validate constraints on input */
-        log_error("Invalid input value among m=%"PRIu32", r=%"PRIu32", n=%"
-            PRIu32, m, r, n);
-
-        return NULL;
-    }
-
-    histo = cc_alloc(sizeof(struct histo_u32));
-    if (histo == NULL) {
-        log_error("Failed to allocate struct histo_u32");
-
-        return NULL;
-    }
-
-    histo->m = m;
-    histo->r = r;
-    histo->n = n;
-
-    histo->M = 1 << m;
-    histo->R = (1 << r) - 1;
-    histo->N = (1 << n) - 1;
-    histo->G = 1 << (r - m - 1);
-    histo->nbucket = (n - r + 2) * histo->G;
-
-    histo->buckets = cc_alloc(histo->nbucket * sizeof(*histo->buckets));
-    if (histo->buckets == NULL) {
-        log_error("Failed to allocate buckets");
-        cc_free(histo);
-
-        return NULL;
-    }
-
-    histo_u32_reset(histo);
-    log_verb("Created histogram %p with parametersm=%"PRIu32", r=%"PRIu32", n=%"
-            PRIu32"; nbucket=%"PRIu64, histo, m, r, n, histo->nbucket);
-
-    return histo;
-}
-
-void
-histo_u32_destroy(struct histo_u32 **h)
-{
-    ASSERT(h != NULL);
-
-    struct histo_u32 *histo = *h;
-
-    if (histo == NULL) {
-        return;
-    }
-
-    cc_free(histo->buckets);
-    cc_free(histo);
-    *h = NULL;
-
-    log_verb("Destroyed histogram at %p", histo);
-}
-
-void
-histo_u32_reset(struct histo_u32 *h)
-{
-    ASSERT(h != NULL);
-
-    h->nrecord = 0;
-    memset(h->buckets, 0, sizeof(uint32_t) * h->nbucket);
-}
-
 static inline uint64_t
 _bucket_offset(uint64_t value, uint32_t m, uint32_t r, uint64_t G)
 {
@@ -92,29 +21,10 @@ _bucket_offset(uint64_t value, uint32_t m, uint32_t r, uint64_t G)
         return value >> m;
     } else {
         uint32_t d = h - r + 1;
-        return (d + 1) * G + ((value - (1 << h)) >> (m + d));
+        return (d + 1) * G + ((value - (1ULL << h)) >> (m + d));
     }
 }
 
-histo_rstatus_e
-histo_u32_record(struct histo_u32 *h, uint64_t value, uint32_t count)
-{
-    uint64_t offset = 0;
-
-    if (value > h->N) {
-        log_error("Value not recorded due to overflow: %"PRIu64" is greater"
-                "than max value allowed, which is %"PRIu64, value, h->N);
-
-        return HISTO_EOVERFLOW;
-    }
-
-    offset = _bucket_offset(value, h->m, h->r, h->G);
-    *(h->buckets + offset) += count;
-    h->nrecord += count;
-
-    return HISTO_OK;
-}
-
 static inline bool
 _greater_dbl(double a, double b) {
     return (a - b) >= DBL_EPSILON;
@@ -136,109 +46,930 @@ _threshold(uint64_t nrecord, double percentile)
     return (uint64_t)ceil(percentile * nrecord / 100);
 }
 
-histo_rstatus_e
-histo_u32_report(uint64_t *value, const struct histo_u32 *h, double p)
+/* Scanning primitives: each looks at HISTO_NSCAN_T consecutive buckets, which
+ * is one 256-bit vector. The mask has one bit per bucket, set if the bucket is
+ * non-empty; sums are widened to 64-bit so they cannot wrap.
+ *
+ * The AVX2 versions are picked at run time, so the library needs no -mavx2 and
+ * still runs on older CPUs; the scalar ones are used everywhere else.
+ */
+#define HISTO_NSCAN_u32 8
+#define HISTO_NSCAN_u64 4
+
+#if defined(__x86_64__) && defined(__GNUC__)
+#define HISTO_SIMD 1
+#include <immintrin.h>
+#endif
+
+static inline uint32_t
+_nonempty_mask_scalar_u32(const uint32_t *b)
 {
-    ASSERT(h != NULL);
+    uint32_t i, mask = 0;
 
-    uint64_t rthreshold, rcount = 0;
-    uint64_t offset = 0;
-    uint32_t *bucket = h->buckets;
+    for (i = 0; i < HISTO_NSCAN_u32; ++i) {
+        mask |= (uint32_t)(b[i] > 0) << i;
+    }
 
-    if (_greater_dbl(p, 100.0f)) {
-        log_error("Percentile must be between [0.0, 100.0], %f provided", p);
+    return mask;
+}
 
-        return HISTO_EOVERFLOW;
-    }
-    if (_lesser_dbl(p, 0.0f)) {
-        log_error("Percentile must be between [0.0, 100.0], %f provided", p);
+static inline uint64_t
+_sum_scalar_u32(const uint32_t *b)
+{
+    uint32_t i;
+    uint64_t sum = 0;
 
-        return HISTO_EUNDERFLOW;
+    for (i = 0; i < HISTO_NSCAN_u32; ++i) {
+        sum += b[i];
     }
-    if (h->nrecord == 0) {
-        log_info("No value to report due to histogram being empty");
 
-        return HISTO_EEMPTY;
-    }
+    return sum;
+}
 
-    rthreshold = _threshold(h->nrecord, p);
-    /* find the lowest non-empty bucket, this is done separately to make sure
-     * that if the threshold is 0 (e.g. p=0.0), we still return a bucket within
-     * the range of recorded values.
-     */
-    while (offset < h->nbucket && *bucket == 0) {
-        bucket++;
-        offset++;
+static inline uint32_t
+_nonempty_mask_scalar_u64(const uint64_t *b)
+{
+    uint32_t i, mask = 0;
+
+    for (i = 0; i < HISTO_NSCAN_u64; ++i) {
+        mask |= (uint32_t)(b[i] > 0) << i;
     }
-    *value = offset; /* value must be no smaller than the lowest non-empty bucket */
-    /* find the first bucket where the record count threshold is met */
-    for (; offset < h->nbucket && rcount < rthreshold; ++offset, ++bucket) {
-        rcount += *bucket;
-        *value = offset;
+
+    return mask;
+}
+
+static inline uint64_t
+_sum_scalar_u64(const uint64_t *b)
+{
+    uint32_t i;
+    uint64_t sum = 0;
+
+    for (i = 0; i < HISTO_NSCAN_u64; ++i) {
+        sum += b[i];
     }
 
-    return HISTO_OK;
+    return sum;
 }
 
-histo_rstatus_e
-histo_u32_report_multi(struct percentile_profile *pp, const struct histo_u32 *h)
+#ifdef HISTO_SIMD
+__attribute__((target("avx2")))
+static inline uint32_t
+_nonempty_mask_avx2_u32(const uint32_t *b)
 {
-    ASSERT(pp != NULL);
-    ASSERT(h != NULL);
+    __m256i v = _mm256_loadu_si256((const __m256i *)b);
+    __m256i z = _mm256_cmpeq_epi32(v, _mm256_setzero_si256());
+
+    return ~(uint32_t)_mm256_movemask_ps(_mm256_castsi256_ps(z)) & 0xff;
+}
+
+__attribute__((target("avx2")))
+static inline uint64_t
+_sum_avx2_u32(const uint32_t *b)
+{
+    __m256i v = _mm256_loadu_si256((const __m256i *)b);
+    __m256i lo = _mm256_cvtepu32_epi64(_mm256_castsi256_si128(v));
+    __m256i hi = _mm256_cvtepu32_epi64(_mm256_extracti128_si256(v, 1));
+    __m256i s = _mm256_add_epi64(lo, hi);
+    __m128i t = _mm_add_epi64(_mm256_castsi256_si128(s),
+            _mm256_extracti128_si256(s, 1));
+
+    return (uint64_t)_mm_cvtsi128_si64(t) + (uint64_t)_mm_extract_epi64(t, 1);
+}
+
+__attribute__((target("avx2")))
+static inline uint32_t
+_nonempty_mask_avx2_u64(const uint64_t *b)
+{
+    __m256i v = _mm256_loadu_si256((const __m256i *)b);
+    __m256i z = _mm256_cmpeq_epi64(v, _mm256_setzero_si256());
+
+    return ~(uint32_t)_mm256_movemask_pd(_mm256_castsi256_pd(z)) & 0xf;
+}
+
+__attribute__((target("avx2")))
+static inline uint64_t
+_sum_avx2_u64(const uint64_t *b)
+{
+    __m256i v = _mm256_loadu_si256((const __m256i *)b);
+    __m128i t = _mm_add_epi64(_mm256_castsi256_si128(v),
+            _mm256_extracti128_si256(v, 1));
+
+    return (uint64_t)_mm_cvtsi128_si64(t) + (uint64_t)_mm_extract_epi64(t, 1);
+}
+#endif
+
+/* bucket scanning helpers, all ranges are [start, end) */
+#define HISTO_SCAN_DEFINE(_sfx, _type, _isa, _attr)                           \
+                                                                               \
+/* returns the first non-empty bucket, or end if all buckets are empty */      \
+_attr                                                                          \
+static inline uint64_t                                                         \
+_bucket_first##_isa##_##_sfx(const _type *buckets, uint64_t start,             \
+        uint64_t end)                                                          \
+{                                                                              \
+    uint64_t i = start;                                                        \
+                                                                               \
+    for (; i + HISTO_NSCAN_##_sfx <= end; i += HISTO_NSCAN_##_sfx) {           \
+        uint32_t mask = _nonempty_mask##_isa##_##_sfx(buckets + i);            \
+        if (mask != 0) {                                                       \
+            return i + __builtin_ctz(mask);                                    \
+        }                                                                      \
+    }                                                                          \
+    for (; i < end && buckets[i] == 0; ++i);                                   \
+                                                                               \
+    return i;                                                                  \
+}                                                                              \
+                                                                               \
+/* returns the last non-empty bucket, or end if all buckets are empty */       \
+_attr                                                                          \
+static inline uint64_t                                                         \
+_bucket_last##_isa##_##_sfx(const _type *buckets, uint64_t start,              \
+        uint64_t end)                                                          \
+{                                                                              \
+    uint64_t i = end;                                                          \
+                                                                               \
+    for (; i >= start + HISTO_NSCAN_##_sfx; i -= HISTO_NSCAN_##_sfx) {         \
+        uint32_t mask = _nonempty_mask##_isa##_##_sfx(buckets + i -            \
+                HISTO_NSCAN_##_sfx);                                           \
+        if (mask != 0) {                                                       \
+            return i - HISTO_NSCAN_##_sfx + (31 - __builtin_clz(mask));        \
+        }                                                                      \
+    }                                                                          \
+    while (i > start) {                                                        \
+        if (buckets[--i] > 0) {                                                \
+            return i;                                                          \
+        }                                                                      \
+    }                                                                          \
+                                                                               \
+    return end;                                                                \
+}                                                                              \
+                                                                               \
+/* returns the first bucket where the cumulative count, which is rcount before \
+ * start, reaches rthreshold; or the last bucket if the threshold is never met \
+ */                                                                            \
+_attr                                                                          \
+static inline uint64_t                                                         \
+_bucket_cross##_isa##_##_sfx(const _type *buckets, uint64_t start,             \
+        uint64_t end, uint64_t rcount, uint64_t rthreshold)                    \
+{                                                                              \
+    uint64_t i = start;                                                        \
+                                                                               \
+    for (; i + HISTO_NSCAN_##_sfx <= end; i += HISTO_NSCAN_##_sfx) {           \
+        uint64_t sum = _sum##_isa##_##_sfx(buckets + i);                       \
+        if (rcount + sum >= rthreshold) {                                      \
+            break;                                                             \
+        }                                                                      \
+        rcount += sum;                                                         \
+    }                                                                          \
+    for (; i < end; ++i) {                                                     \
+        rcount += buckets[i];                                                  \
+        if (rcount >= rthreshold) {                                            \
+            return i;                                                          \
+        }                                                                      \
+    }                                                                          \
+                                                                               \
+    return end - 1;                                                            \
+}
 
-    uint64_t rthreshold, rcount = 0;
-    uint64_t curr = 0, offset = 0;
-    uint32_t *bucket = h->buckets;
-    double *p = pp->percentile;
-    uint64_t *v = pp->result;
-    uint8_t count = pp->count;
+#define HISTO_SCAN_SCALAR(_sfx, _type) HISTO_SCAN_DEFINE(_sfx, _type, _scalar, )
+HISTO_TYPE(HISTO_SCAN_SCALAR)
 
-    if (h->nrecord == 0) {
-        log_info("No value to report due to histogram being empty");
+#ifdef HISTO_SIMD
+#define HISTO_SCAN_AVX2(_sfx, _type)                                           \
+    HISTO_SCAN_DEFINE(_sfx, _type, _avx2, __attribute__((target("avx2"))))
+HISTO_TYPE(HISTO_SCAN_AVX2)
+
+#define HISTO_SCAN(_fn, _sfx, ...)                                             \
+    (__builtin_cpu_supports("avx2") ? _fn##_avx2_##_sfx(__VA_ARGS__) :         \
+        _fn##_scalar_##_sfx(__VA_ARGS__))
+#else
+#define HISTO_SCAN(_fn, _sfx, ...) _fn##_scalar_##_sfx(__VA_ARGS__)
+#endif
+
+/* serialization helpers, integers are encoded as unsigned LEB128 varints */
+#define VARINT_MAXLEN 10 /* for uint64_t */
+
+static inline size_t
+_varint_size(uint64_t v)
+{
+    size_t len = 1;
 
-        return HISTO_EEMPTY;
+    for (; v >= 0x80; v >>= 7) {
+        len++;
     }
 
-    /* find the lowest non-empty bucket */
-    while (curr < h->nbucket && *bucket == 0) {
-        bucket++;
-        curr++;
+    return len;
+}
+
+static inline uint8_t *
+_varint_write(uint8_t *p, uint64_t v)
+{
+    for (; v >= 0x80; v >>= 7) {
+        *p++ = (uint8_t)(v | 0x80);
     }
-    pp->min = offset = curr;
-    rthreshold = _threshold(h->nrecord, *p);
-
-    /* Assume the percentiles are set according to percentile_profile_set */
-    while (curr < h->nbucket && count > 0) {
-        while (curr < h->nbucket && rcount < rthreshold) {
-            if (*bucket > 0) {
-                rcount += *bucket;
-                offset = curr; /* offset always points to a non-empty bucket */
-            }
-            curr++;
-            bucket++;
+    *p++ = (uint8_t)v;
+
+    return p;
+}
+
+/* returns the byte after the varint, or NULL if it is truncated/too long */
+static inline const uint8_t *
+_varint_read(uint64_t *v, const uint8_t *p, const uint8_t *end)
+{
+    uint32_t shift;
+
+    *v = 0;
+    for (shift = 0; p < end && shift < 7 * VARINT_MAXLEN; shift += 7, p++) {
+        *v |= (uint64_t)(*p & 0x7f) << shift;
+        if ((*p & 0x80) == 0) {
+            return p + 1;
         }
-        do { /* the same bucket may satisfy multiple percentile */
-            *v = offset;
-            count--;
-            if (count == 0) {
-                break;
-            }
-            p++;
-            v++;
-            rthreshold = _threshold(h->nrecord, *p);
-        } while (rthreshold <= rcount);
     }
 
-    /* scan the rest of the buckets to find max */
-    pp->max = offset;
-    for (;curr < h->nbucket; ++curr, ++bucket) {
-        bool empty = (*bucket == 0);
-        pp->max = pp->max * empty + offset * !empty;
-    }
+    return NULL;
+}
 
-    return HISTO_OK;
+/* Everything that touches buckets is defined once for each variant in
+ * HISTO_TYPE, (_type)-1 being the largest count a bucket can hold.
+ */
+#define HISTO_DEFINE(_sfx, _type)                                              \
+                                                                               \
+struct histo_##_sfx *                                                          \
+histo_##_sfx##_create(uint32_t m, uint32_t r, uint32_t n)                      \
+{                                                                              \
+    struct histo_##_sfx *histo;                                                \
+                                                                               \
+    if (r <= m || r > n || n > 64) { /* validate constraints on input */       \
+        log_error("Invalid input value among m=%"PRIu32", r=%"PRIu32", n=%"    \
+            PRIu32, m, r, n);                                                  \
+                                                                               \
+        return NULL;                                                           \
+    }                                                                          \
+                                                                               \
+    histo = cc_alloc(sizeof(struct histo_##_sfx));                             \
+    if (histo == NULL) {                                                       \
+        log_error("Failed to allocate struct histo_" #_sfx);                   \
+                                                                               \
+        return NULL;                                                           \
+    }                                                                          \
+                                                                               \
+    histo->m = m;                                                              \
+    histo->r = r;                                                              \
+    histo->n = n;                                                              \
+                                                                               \
+    histo->M = 1ULL << m;                                                      \
+    histo->R = UINT64_MAX >> (64 - r);                                         \
+    histo->N = UINT64_MAX >> (64 - n);                                         \
+    histo->G = 1ULL << (r - m - 1);                                            \
+    histo->nbucket = (n - r + 2) * histo->G;                                   \
+    histo->nblock = (histo->nbucket + HISTO_BLOCK_SIZE - 1) >>                 \
+        HISTO_BLOCK_SHIFT;                                                     \
+                                                                               \
+    histo->buckets = cc_alloc(histo->nbucket * sizeof(*histo->buckets));       \
+    if (histo->buckets == NULL) {                                              \
+        log_error("Failed to allocate buckets");                               \
+        cc_free(histo);                                                        \
+                                                                               \
+        return NULL;                                                           \
+    }                                                                          \
+    histo->blocks = cc_alloc(histo->nblock * sizeof(*histo->blocks));          \
+    if (histo->blocks == NULL) {                                               \
+        log_error("Failed to allocate blocks");                                \
+        cc_free(histo->buckets);                                               \
+        cc_free(histo);                                                        \
+                                                                               \
+        return NULL;                                                           \
+    }                                                                          \
+                                                                               \
+    histo_##_sfx##_reset(histo);                                               \
+    log_verb("Created histogram %p with parametersm=%"PRIu32", r=%"PRIu32      \
+            ", n=%"PRIu32"; nbucket=%"PRIu64, histo, m, r, n,                  \
+            histo->nbucket);                                                   \
+                                                                               \
+    return histo;                                                              \
+}                                                                              \
+                                                                               \
+void                                                                           \
+histo_##_sfx##_destroy(struct histo_##_sfx **h)                                \
+{                                                                              \
+    ASSERT(h != NULL);                                                         \
+                                                                               \
+    struct histo_##_sfx *histo = *h;                                           \
+                                                                               \
+    if (histo == NULL) {                                                       \
+        return;                                                                \
+    }                                                                          \
+                                                                               \
+    cc_free(histo->blocks);                                                    \
+    cc_free(histo->buckets);                                                   \
+    cc_free(histo);                                                            \
+    *h = NULL;                                                                 \
+                                                                               \
+    log_verb("Destroyed histogram at %p", histo);                              \
+}                                                                              \
+                                                                               \
+void                                                                           \
+histo_##_sfx##_reset(struct histo_##_sfx *h)                                   \
+{                                                                              \
+    ASSERT(h != NULL);                                                         \
+                                                                               \
+    h->nrecord = 0;                                                            \
+    memset(h->buckets, 0, sizeof(_type) * h->nbucket);                         \
+    memset(h->blocks, 0, sizeof(uint64_t) * h->nblock);                        \
+}                                                                              \
+                                                                               \
+histo_rstatus_e                                                                \
+histo_##_sfx##_record(struct histo_##_sfx *h, uint64_t value, _type count)     \
+{                                                                              \
+    uint64_t offset = 0;                                                       \
+    _type *bucket;                                                             \
+                                                                               \
+    if (value > h->N) {                                                        \
+        log_error("Value not recorded due to overflow: %"PRIu64" is greater"   \
+                "than max value allowed, which is %"PRIu64, value, h->N);      \
+                                                                               \
+        return HISTO_EOVERFLOW;                                                \
+    }                                                                          \
+                                                                               \
+    offset = _bucket_offset(value, h->m, h->r, h->G);                          \
+    bucket = h->buckets + offset;                                              \
+    if (count > (_type)-1 - *bucket) {                                         \
+        log_error("Value %"PRIu64" not recorded due to bucket %"PRIu64         \
+                " overflow", value, offset);                                   \
+                                                                               \
+        return HISTO_EOVERFLOW;                                                \
+    }                                                                          \
+    *bucket += count;                                                          \
+    *(h->blocks + (offset >> HISTO_BLOCK_SHIFT)) += count;                     \
+    h->nrecord += count;                                                       \
+                                                                               \
+    return HISTO_OK;                                                           \
+}                                                                              \
+                                                                               \
+histo_rstatus_e                                                                \
+histo_##_sfx##_record_atomic(struct histo_##_sfx *h, uint64_t value,           \
+        _type count)                                                           \
+{                                                                              \
+    uint64_t offset = 0;                                                       \
+    _type *bucket, old;                                                        \
+                                                                               \
+    if (value > h->N) {                                                        \
+        log_error("Value not recorded due to overflow: %"PRIu64" is greater"   \
+                "than max value allowed, which is %"PRIu64, value, h->N);      \
+                                                                               \
+        return HISTO_EOVERFLOW;                                                \
+    }                                                                          \
+                                                                               \
+    offset = _bucket_offset(value, h->m, h->r, h->G);                          \
+    bucket = h->buckets + offset;                                              \
+    /* check before publishing, so no one sees a wrapped bucket */             \
+    old = __atomic_load_n(bucket, __ATOMIC_RELAXED);                           \
+    do {                                                                       \
+        if (count > (_type)-1 - old) {                                         \
+            log_error("Value %"PRIu64" not recorded due to bucket %"PRIu64     \
+                    " overflow", value, offset);                               \
+                                                                               \
+            return HISTO_EOVERFLOW;                                            \
+        }                                                                      \
+    } while (!__atomic_compare_exchange_n(bucket, &old, old + count, true,     \
+                __ATOMIC_RELAXED, __ATOMIC_RELAXED));                          \
+    __atomic_add_fetch(h->blocks + (offset >> HISTO_BLOCK_SHIFT), count,       \
+            __ATOMIC_RELAXED);                                                 \
+    __atomic_add_fetch(&h->nrecord, count, __ATOMIC_RELAXED);                  \
+                                                                               \
+    return HISTO_OK;                                                           \
+}                                                                              \
+                                                                               \
+static inline uint64_t                                                         \
+_block_end_##_sfx(const struct histo_##_sfx *h, uint64_t block)                \
+{                                                                              \
+    uint64_t end = (block + 1) << HISTO_BLOCK_SHIFT;                           \
+                                                                               \
+    return end < h->nbucket ? end : h->nbucket;                                \
+}                                                                              \
+                                                                               \
+/* lowest non-empty bucket, histogram must not be empty */                     \
+static inline uint64_t                                                         \
+_histo_min_##_sfx(const struct histo_##_sfx *h)                                \
+{                                                                              \
+    uint64_t blk = 0;                                                          \
+                                                                               \
+    while (blk < h->nblock - 1 && h->blocks[blk] == 0) {                       \
+        blk++;                                                                 \
+    }                                                                          \
+                                                                               \
+    return HISTO_SCAN(_bucket_first, _sfx, h->buckets,                         \
+            blk << HISTO_BLOCK_SHIFT, _block_end_##_sfx(h, blk));              \
+}                                                                              \
+                                                                               \
+/* highest non-empty bucket, histogram must not be empty */                    \
+static inline uint64_t                                                         \
+_histo_max_##_sfx(const struct histo_##_sfx *h)                                \
+{                                                                              \
+    uint64_t blk = h->nblock - 1;                                              \
+                                                                               \
+    while (blk > 0 && h->blocks[blk] == 0) {                                   \
+        blk--;                                                                 \
+    }                                                                          \
+                                                                               \
+    return HISTO_SCAN(_bucket_last, _sfx, h->buckets,                          \
+            blk << HISTO_BLOCK_SHIFT, _block_end_##_sfx(h, blk));              \
+}                                                                              \
+                                                                               \
+/* find the first bucket where the cumulative count reaches rthreshold (> 0).  \
+ * The cursor (blk, rcount) records the block to start from and the            \
+ * cumulative count of all blocks before it, and is advanced so that lookups   \
+ * of increasing thresholds never revisit a block.                             \
+ */                                                                            \
+static inline uint64_t                                                         \
+_histo_seek_##_sfx(const struct histo_##_sfx *h, uint64_t *blk,                \
+        uint64_t *rcount, uint64_t rthreshold)                                 \
+{                                                                              \
+    while (*blk < h->nblock - 1 && *rcount + h->blocks[*blk] < rthreshold) {   \
+        *rcount += h->blocks[*blk];                                            \
+        (*blk)++;                                                              \
+    }                                                                          \
+                                                                               \
+    return HISTO_SCAN(_bucket_cross, _sfx, h->buckets,                         \
+            *blk << HISTO_BLOCK_SHIFT, _block_end_##_sfx(h, *blk), *rcount,    \
+            rthreshold);                                                       \
+}                                                                              \
+                                                                               \
+histo_rstatus_e                                                                \
+histo_##_sfx##_report(uint64_t *value, const struct histo_##_sfx *h, double p) \
+{                                                                              \
+    ASSERT(h != NULL);                                                         \
+                                                                               \
+    uint64_t rthreshold, rcount = 0;                                           \
+    uint64_t blk = 0;                                                          \
+                                                                               \
+    if (_greater_dbl(p, 100.0f)) {                                             \
+        log_error("Percentile must be between [0.0, 100.0], %f provided", p);  \
+                                                                               \
+        return HISTO_EOVERFLOW;                                                \
+    }                                                                          \
+    if (_lesser_dbl(p, 0.0f)) {                                                \
+        log_error("Percentile must be between [0.0, 100.0], %f provided", p);  \
+                                                                               \
+        return HISTO_EUNDERFLOW;                                               \
+    }                                                                          \
+    if (h->nrecord == 0) {                                                     \
+        log_info("No value to report due to histogram being empty");           \
+                                                                               \
+        return HISTO_EEMPTY;                                                   \
+    }                                                                          \
+                                                                               \
+    rthreshold = _threshold(h->nrecord, p);                                    \
+    /* if the threshold is 0 (e.g. p=0.0), we still return a bucket within the \
+     * range of recorded values, i.e. the lowest non-empty bucket. Otherwise   \
+     * the first bucket where the record count threshold is met is non-empty.  \
+     */                                                                        \
+    if (rthreshold == 0) {                                                     \
+        *value = _histo_min_##_sfx(h);                                         \
+    } else {                                                                   \
+        *value = _histo_seek_##_sfx(h, &blk, &rcount, rthreshold);             \
+    }                                                                          \
+                                                                               \
+    return HISTO_OK;                                                           \
+}                                                                              \
+                                                                               \
+histo_rstatus_e                                                                \
+histo_##_sfx##_report_multi(struct percentile_profile *pp,                     \
+        const struct histo_##_sfx *h)                                          \
+{                                                                              \
+    ASSERT(pp != NULL);                                                        \
+    ASSERT(h != NULL);                                                         \
+                                                                               \
+    uint64_t rthreshold, rcount = 0;                                           \
+    uint64_t blk = 0;                                                          \
+    double *p = pp->percentile;                                                \
+    uint64_t *v = pp->result;                                                  \
+    uint8_t count = pp->count;                                                 \
+                                                                               \
+    if (h->nrecord == 0) {                                                     \
+        log_info("No value to report due to histogram being empty");           \
+                                                                               \
+        return HISTO_EEMPTY;                                                   \
+    }                                                                          \
+                                                                               \
+    pp->min = _histo_min_##_sfx(h);                                            \
+    pp->max = _histo_max_##_sfx(h);                                            \
+                                                                               \
+    /* Assume the percentiles are set according to percentile_profile_set, so  \
+     * thresholds are non-decreasing and the cursor only moves forward         \
+     */                                                                        \
+    for (; count > 0; count--, p++, v++) {                                     \
+        rthreshold = _threshold(h->nrecord, *p);                               \
+        if (rthreshold == 0) {                                                 \
+            *v = pp->min;                                                      \
+        } else {                                                               \
+            *v = _histo_seek_##_sfx(h, &blk, &rcount, rthreshold);             \
+        }                                                                      \
+    }                                                                          \
+                                                                               \
+    return HISTO_OK;                                                           \
+}                                                                              \
+                                                                               \
+/* number of non-empty buckets */                                              \
+static uint64_t                                                                \
+_histo_nentry_##_sfx(const struct histo_##_sfx *h)                             \
+{                                                                              \
+    uint64_t blk, i, nentry = 0;                                               \
+                                                                               \
+    for (blk = 0; blk < h->nblock; ++blk) {                                    \
+        if (h->blocks[blk] == 0) {                                             \
+            continue;                                                          \
+        }                                                                      \
+        for (i = blk << HISTO_BLOCK_SHIFT; i < _block_end_##_sfx(h, blk);      \
+                ++i) {                                                         \
+            nentry += (h->buckets[i] > 0);                                     \
+        }                                                                      \
+    }                                                                          \
+                                                                               \
+    return nentry;                                                             \
+}                                                                              \
+                                                                               \
+size_t                                                                         \
+histo_##_sfx##_serial_size(const struct histo_##_sfx *h)                       \
+{                                                                              \
+    ASSERT(h != NULL);                                                         \
+                                                                               \
+    uint64_t blk, i, prev = 0;                                                 \
+    size_t size;                                                               \
+                                                                               \
+    size = 1 + _varint_size(h->m) + _varint_size(h->r) + _varint_size(h->n) +  \
+        _varint_size(h->nrecord) + _varint_size(_histo_nentry_##_sfx(h));      \
+    for (blk = 0; blk < h->nblock; ++blk) {                                    \
+        if (h->blocks[blk] == 0) {                                             \
+            continue;                                                          \
+        }                                                                      \
+        for (i = blk << HISTO_BLOCK_SHIFT; i < _block_end_##_sfx(h, blk);      \
+                ++i) {                                                         \
+            if (h->buckets[i] > 0) {                                           \
+                size += _varint_size(i - prev) + _varint_size(h->buckets[i]);  \
+                prev = i;                                                      \
+            }                                                                  \
+        }                                                                      \
+    }                                                                          \
+                                                                               \
+    return size;                                                               \
+}                                                                              \
+                                                                               \
+histo_rstatus_e                                                                \
+histo_##_sfx##_serialize(uint8_t *buf, size_t nbuf, size_t *len,               \
+        const struct histo_##_sfx *h)                                          \
+{                                                                              \
+    ASSERT(buf != NULL);                                                       \
+    ASSERT(len != NULL);                                                       \
+    ASSERT(h != NULL);                                                         \
+                                                                               \
+    uint64_t blk, i, prev = 0;                                                 \
+    uint8_t *p = buf;                                                          \
+    size_t size = histo_##_sfx##_serial_size(h);                               \
+                                                                               \
+    if (size > nbuf) {                                                         \
+        log_warn("Not enough space to serialize histogram %p: %zu bytes "      \
+                "needed, %zu provided", h, size, nbuf);                        \
+                                                                               \
+        return HISTO_EOVERFLOW;                                                \
+    }                                                                          \
+                                                                               \
+    *p++ = HISTO_SERIAL_VERSION;                                               \
+    p = _varint_write(p, h->m);                                                \
+    p = _varint_write(p, h->r);                                                \
+    p = _varint_write(p, h->n);                                                \
+    p = _varint_write(p, h->nrecord);                                          \
+    p = _varint_write(p, _histo_nentry_##_sfx(h));                             \
+    for (blk = 0; blk < h->nblock; ++blk) {                                    \
+        if (h->blocks[blk] == 0) {                                             \
+            continue;                                                          \
+        }                                                                      \
+        for (i = blk << HISTO_BLOCK_SHIFT; i < _block_end_##_sfx(h, blk);      \
+                ++i) {                                                         \
+            if (h->buckets[i] > 0) {                                           \
+                p = _varint_write(p, i - prev);                                \
+                p = _varint_write(p, h->buckets[i]);                           \
+                prev = i;                                                      \
+            }                                                                  \
+        }                                                                      \
+    }                                                                          \
+    *len = p - buf;                                                            \
+    ASSERT(*len == size);                                                      \
+                                                                               \
+    return HISTO_OK;                                                           \
+}                                                                              \
+                                                                               \
+/* Walk through a serialized histogram compatible with h. If apply is false,   \
+ * only validate the content and that no bucket will overflow, taking the      \
+ * current counts of h into account if merge is true; otherwise add the        \
+ * counts to h, assuming the content has been validated.                       \
+ */                                                                            \
+static histo_rstatus_e                                                         \
+_histo_decode_##_sfx(struct histo_##_sfx *h, const uint8_t *buf, size_t len,   \
+        bool apply, bool merge)                                                \
+{                                                                              \
+    const uint8_t *p = buf, *end = buf + len;                                  \
+    uint64_t m, r, n, nrecord, nentry, delta, count, offset = 0, sum = 0;      \
+    bool first = true;                                                         \
+                                                                               \
+    if (len == 0 || *p++ != HISTO_SERIAL_VERSION) {                            \
+        log_warn("Unsupported serialized histogram version");                  \
+                                                                               \
+        return HISTO_EFORMAT;                                                  \
+    }                                                                          \
+    if ((p = _varint_read(&m, p, end)) == NULL ||                              \
+            (p = _varint_read(&r, p, end)) == NULL ||                          \
+            (p = _varint_read(&n, p, end)) == NULL ||                          \
+            (p = _varint_read(&nrecord, p, end)) == NULL ||                    \
+            (p = _varint_read(&nentry, p, end)) == NULL) {                     \
+        log_warn("Truncated serialized histogram header");                     \
+                                                                               \
+        return HISTO_EFORMAT;                                                  \
+    }                                                                          \
+    if (m != h->m || r != h->r || n != h->n) {                                 \
+        log_warn("Serialized histogram with m=%"PRIu64", r=%"PRIu64", n=%"     \
+                PRIu64" does not match histogram %p", m, r, n, h);             \
+                                                                               \
+        return HISTO_EMISMATCH;                                                \
+    }                                                                          \
+    if (!apply && merge && h->nrecord + nrecord < h->nrecord) {                \
+        return HISTO_EOVERFLOW;                                                \
+    }                                                                          \
+                                                                               \
+    for (; nentry > 0; --nentry) {                                             \
+        if ((p = _varint_read(&delta, p, end)) == NULL ||                      \
+                (p = _varint_read(&count, p, end)) == NULL) {                  \
+            log_warn("Truncated serialized histogram");                        \
+                                                                               \
+            return HISTO_EFORMAT;                                              \
+        }                                                                      \
+        /* offsets strictly increase, only the first entry may be bucket 0 */ \
+        if ((delta == 0 && !first) || delta > h->nbucket - 1 - offset ||       \
+                count == 0 || sum + count < sum) {                             \
+            log_warn("Invalid bucket in serialized histogram");                \
+                                                                               \
+            return HISTO_EFORMAT;                                              \
+        }                                                                      \
+        offset += delta;                                                       \
+        first = false;                                                         \
+        sum += count;                                                          \
+        if (apply) {                                                           \
+            h->buckets[offset] += count;                                       \
+            h->blocks[offset >> HISTO_BLOCK_SHIFT] += count;                   \
+        } else if (count > (_type)-1 - (merge ? h->buckets[offset] : 0)) {     \
+            log_warn("Serialized histogram overflows bucket %"PRIu64           \
+                    " of histogram %p", offset, h);                            \
+                                                                               \
+            return HISTO_EOVERFLOW;                                            \
+        }                                                                      \
+    }                                                                          \
+    if (p != end || sum != nrecord) {                                          \
+        log_warn("Inconsistent serialized histogram");                         \
+                                                                               \
+        return HISTO_EFORMAT;                                                  \
+    }                                                                          \
+    if (apply) {                                                               \
+        h->nrecord += nrecord;                                                 \
+    }                                                                          \
+                                                                               \
+    return HISTO_OK;                                                           \
+}                                                                              \
+                                                                               \
+histo_rstatus_e                                                                \
+histo_##_sfx##_merge_serial(struct histo_##_sfx *h, const uint8_t *buf,        \
+        size_t len)                                                            \
+{                                                                              \
+    ASSERT(h != NULL);                                                         \
+    ASSERT(buf != NULL || len == 0);                                           \
+                                                                               \
+    histo_rstatus_e status;                                                    \
+                                                                               \
+    status = _histo_decode_##_sfx(h, buf, len, false, true);                   \
+    if (status != HISTO_OK) {                                                  \
+        return status;                                                         \
+    }                                                                          \
+                                                                               \
+    return _histo_decode_##_sfx(h, buf, len, true, true);                      \
+}                                                                              \
+                                                                               \
+histo_rstatus_e                                                                \
+histo_##_sfx##_deserialize(struct histo_##_sfx *h, const uint8_t *buf,         \
+        size_t len)                                                            \
+{                                                                              \
+    ASSERT(h != NULL);                                                         \
+    ASSERT(buf != NULL || len == 0);                                           \
+                                                                               \
+    histo_rstatus_e status;                                                    \
+                                                                               \
+    status = _histo_decode_##_sfx(h, buf, len, false, false);                  \
+    if (status != HISTO_OK) {                                                  \
+        return status;                                                         \
+    }                                                                          \
+                                                                               \
+    histo_##_sfx##_reset(h);                                                   \
+                                                                               \
+    return _histo_decode_##_sfx(h, buf, len, true, false);                     \
+}                                                                              \
+                                                                               \
+histo_rstatus_e                                                                \
+histo_##_sfx##_merge(struct histo_##_sfx *h, const struct histo_##_sfx *src)   \
+{                                                                              \
+    ASSERT(h != NULL);                                                         \
+    ASSERT(src != NULL);                                                       \
+                                                                               \
+    uint64_t blk, i;                                                           \
+                                                                               \
+    if (h->m != src->m || h->r != src->r || h->n != src->n) {                  \
+        log_warn("Cannot merge histogram %p into %p with different m, r, n",   \
+                src, h);                                                       \
+                                                                               \
+        return HISTO_EMISMATCH;                                                \
+    }                                                                          \
+    if (h->nrecord + src->nrecord < h->nrecord) {                              \
+        log_warn("Merging histogram %p overflows the record count of "         \
+                "histogram %p", src, h);                                       \
+                                                                               \
+        return HISTO_EOVERFLOW;                                                \
+    }                                                                          \
+                                                                               \
+    for (blk = 0; blk < src->nblock; ++blk) {                                  \
+        if (src->blocks[blk] == 0) {                                           \
+            continue;                                                          \
+        }                                                                      \
+        for (i = blk << HISTO_BLOCK_SHIFT; i < _block_end_##_sfx(src, blk);    \
+                ++i) {                                                         \
+            if (src->buckets[i] > (_type)-1 - h->buckets[i]) {                 \
+                log_warn("Merging histogram %p overflows bucket %"PRIu64       \
+                        " of histogram %p", src, i, h);                        \
+                                                                               \
+                return HISTO_EOVERFLOW;                                        \
+            }                                                                  \
+        }                                                                      \
+    }                                                                          \
+                                                                               \
+    for (blk = 0; blk < src->nblock; ++blk) {                                  \
+        if (src->blocks[blk] == 0) {                                           \
+            continue;                                                          \
+        }                                                                      \
+        for (i = blk << HISTO_BLOCK_SHIFT; i < _block_end_##_sfx(src, blk);    \
+                ++i) {                                                         \
+            h->buckets[i] += src->buckets[i];                                  \
+        }                                                                      \
+        h->blocks[blk] += src->blocks[blk];                                    \
+    }                                                                          \
+    h->nrecord += src->nrecord;                                                \
+                                                                               \
+    return HISTO_OK;                                                           \
+}                                                                              \
+                                                                               \
+struct histo_##_sfx##_window *                                                 \
+histo_##_sfx##_window_create(uint32_t m, uint32_t r, uint32_t n,               \
+        uint32_t nslot)                                                        \
+{                                                                              \
+    struct histo_##_sfx##_window *w;                                           \
+    uint32_t i;                                                                \
+                                                                               \
+    if (nslot == 0) {                                                          \
+        log_error("Invalid number of slots for histogram window: 0");          \
+                                                                               \
+        return NULL;                                                           \
+    }                                                                          \
+                                                                               \
+    w = cc_zalloc(sizeof(struct histo_##_sfx##_window));                       \
+    if (w == NULL) {                                                           \
+        log_error("Failed to allocate struct histo_" #_sfx "_window");         \
+                                                                               \
+        return NULL;                                                           \
+    }                                                                          \
+    w->slot = cc_calloc(nslot, sizeof(*w->slot));                              \
+    if (w->slot == NULL) {                                                     \
+        log_error("Failed to allocate slots in struct histo_" #_sfx            \
+                "_window");                                                    \
+        cc_free(w);                                                            \
+                                                                               \
+        return NULL;                                                           \
+    }                                                                          \
+    w->nslot = nslot;                                                          \
+    w->curr = 0;                                                               \
+                                                                               \
+    w->total = histo_##_sfx##_create(m, r, n);                                 \
+    if (w->total == NULL) {                                                    \
+        goto error;                                                            \
+    }                                                                          \
+    for (i = 0; i < nslot; ++i) {                                              \
+        w->slot[i] = histo_##_sfx##_create(m, r, n);                           \
+        if (w->slot[i] == NULL) {                                              \
+            goto error;                                                        \
+        }                                                                      \
+    }                                                                          \
+                                                                               \
+    log_verb("Created histogram window %p with %"PRIu32" slots", w, nslot);    \
+                                                                               \
+    return w;                                                                  \
+                                                                               \
+error:                                                                         \
+    log_error("Failed to create histograms for histogram window");             \
+    histo_##_sfx##_window_destroy(&w);                                         \
+                                                                               \
+    return NULL;                                                               \
+}                                                                              \
+                                                                               \
+void                                                                           \
+histo_##_sfx##_window_destroy(struct histo_##_sfx##_window **w)                \
+{                                                                              \
+    ASSERT(w != NULL);                                                         \
+                                                                               \
+    struct histo_##_sfx##_window *win = *w;                                    \
+    uint32_t i;                                                                \
+                                                                               \
+    if (win == NULL) {                                                         \
+        return;                                                                \
+    }                                                                          \
+                                                                               \
+    for (i = 0; i < win->nslot; ++i) {                                         \
+        histo_##_sfx##_destroy(&win->slot[i]);                                 \
+    }                                                                          \
+    histo_##_sfx##_destroy(&win->total);                                       \
+    cc_free(win->slot);                                                        \
+    cc_free(win);                                                              \
+    *w = NULL;                                                                 \
+                                                                               \
+    log_verb("Destroyed histogram window at %p", win);                         \
+}                                                                              \
+                                                                               \
+void                                                                           \
+histo_##_sfx##_window_reset(struct histo_##_sfx##_window *w)                   \
+{                                                                              \
+    ASSERT(w != NULL);                                                         \
+                                                                               \
+    uint32_t i;                                                                \
+                                                                               \
+    for (i = 0; i < w->nslot; ++i) {                                           \
+        histo_##_sfx##_reset(w->slot[i]);                                      \
+    }                                                                          \
+    histo_##_sfx##_reset(w->total);                                            \
+    w->curr = 0;                                                               \
+}                                                                              \
+                                                                               \
+histo_rstatus_e                                                                \
+histo_##_sfx##_window_record(struct histo_##_sfx##_window *w, uint64_t value,  \
+        _type count)                                                           \
+{                                                                              \
+    ASSERT(w != NULL);                                                         \
+                                                                               \
+    histo_rstatus_e status;                                                    \
+                                                                               \
+    /* the total holds at least as much as any slot, so check it first */      \
+    status = histo_##_sfx##_record(w->total, value, count);                    \
+    if (status != HISTO_OK) {                                                  \
+        return status;                                                         \
+    }                                                                          \
+                                                                               \
+    return histo_##_sfx##_record(w->slot[w->curr], value, count);              \
+}                                                                              \
+                                                                               \
+/* subtract counts in src from dst and clear src, only visiting blocks that    \
+ * are non-empty in src                                                        \
+ */                                                                            \
+static void                                                                    \
+_histo_drain_##_sfx(struct histo_##_sfx *dst, struct histo_##_sfx *src)        \
+{                                                                              \
+    uint64_t blk, i;                                                           \
+                                                                               \
+    for (blk = 0; blk < src->nblock; ++blk) {                                  \
+        if (src->blocks[blk] == 0) {                                           \
+            continue;                                                          \
+        }                                                                      \
+        for (i = blk << HISTO_BLOCK_SHIFT; i < _block_end_##_sfx(src, blk);    \
+                ++i) {                                                         \
+            dst->buckets[i] -= src->buckets[i];                                \
+            src->buckets[i] = 0;                                               \
+        }                                                                      \
+        dst->blocks[blk] -= src->blocks[blk];                                  \
+        src->blocks[blk] = 0;                                                  \
+    }                                                                          \
+    dst->nrecord -= src->nrecord;                                              \
+    src->nrecord = 0;                                                          \
+}                                                                              \
+                                                                               \
+void                                                                           \
+histo_##_sfx##_window_rotate(struct histo_##_sfx##_window *w)                  \
+{                                                                              \
+    ASSERT(w != NULL);                                                         \
+                                                                               \
+    struct histo_##_sfx *oldest;                                               \
+                                                                               \
+    w->curr = (w->curr + 1) % w->nslot;                                        \
+    oldest = w->slot[w->curr];                                                 \
+    if (oldest->nrecord > 0) {                                                 \
+        _histo_drain_##_sfx(w->total, oldest);                                 \
+    }                                                                          \
+                                                                               \
+    log_vverb("Rotated histogram window %p to slot %"PRIu32, w, w->curr);      \
 }
 
+HISTO_TYPE(HISTO_DEFINE)
+
 struct percentile_profile *
 percentile_profile_create(uint8_t cap)
 {
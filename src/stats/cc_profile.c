@@ -0,0 +1,259 @@
+#include <cc_profile.h>
+
+#include <cc_debug.h>
+#include <cc_mm.h>
+#include <cc_print.h>
+#include <cc_stats_log.h>
+
+#include <sched.h>
+#include <string.h>
+
+#define PROFILE_MODULE_NAME "util::profile"
+
+#define PROFILE_CALIBRATE_NS    10000000L   /* 10ms */
+#define PROFILE_SUFFIX_MAXLEN   8
+
+#define PROFILE_METRIC_SUFFIX(_suffix, _type, _percentile)      #_suffix,
+#define PROFILE_METRIC_TYPE(_suffix, _type, _percentile)        _type,
+#define PROFILE_METRIC_PERCENTILE(_suffix, _type, _percentile)  _percentile,
+
+static const char *suffix[PROFILE_NMETRIC] =
+    { PROFILE_METRIC(PROFILE_METRIC_SUFFIX) };
+static const metric_type_e type[PROFILE_NMETRIC] =
+    { PROFILE_METRIC(PROFILE_METRIC_TYPE) };
+static const double percentile[PROFILE_NMETRIC] =
+    { PROFILE_METRIC(PROFILE_METRIC_PERCENTILE) };
+
+static bool profile_init = false;
+
+static uint32_t histo_m = PROFILE_HISTO_M;
+static uint32_t histo_r = PROFILE_HISTO_R;
+static uint32_t histo_n = PROFILE_HISTO_N;
+
+static double tick_ns = 1.0; /* nanoseconds per profile_tick() unit */
+/* all metrics but count (the first one) are looked up as percentiles */
+static struct percentile_profile *pp = NULL;
+
+static void
+_profile_calibrate(void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+    struct timespec t0, t1;
+    struct timespec wait = {0, PROFILE_CALIBRATE_NS};
+    uint64_t c0, c1;
+
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    c0 = profile_tick();
+    nanosleep(&wait, NULL);
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+    c1 = profile_tick();
+
+    if (c1 > c0) {
+        tick_ns = ((double)(t1.tv_sec - t0.tv_sec) * 1000000000L +
+                t1.tv_nsec - t0.tv_nsec) / (c1 - c0);
+    }
+#endif
+    log_info("profile tick calibrated to %f ns", tick_ns);
+}
+
+void
+profile_setup(profile_options_st *options)
+{
+    log_info("set up the %s module", PROFILE_MODULE_NAME);
+
+    if (profile_init) {
+        log_warn("%s has already been setup, overwrite", PROFILE_MODULE_NAME);
+        percentile_profile_destroy(&pp);
+    }
+
+    if (options != NULL) {
+        histo_m = option_uint(&options->profile_histo_m);
+        histo_r = option_uint(&options->profile_histo_r);
+        histo_n = option_uint(&options->profile_histo_n);
+    }
+
+    pp = percentile_profile_create(PROFILE_NMETRIC - 1);
+    if (pp == NULL ||
+            percentile_profile_set(pp, percentile + 1, PROFILE_NMETRIC - 1) !=
+            HISTO_OK) {
+        log_crit("cannot set up percentiles for profiling");
+        exit(EXIT_FAILURE);
+    }
+
+    _profile_calibrate();
+
+    profile_init = true;
+}
+
+void
+profile_teardown(void)
+{
+    log_info("tear down the %s module", PROFILE_MODULE_NAME);
+
+    if (!profile_init) {
+        log_warn("%s has never been setup", PROFILE_MODULE_NAME);
+    }
+
+    percentile_profile_destroy(&pp);
+
+    profile_init = false;
+}
+
+rstatus_i
+profile_span_create_all(struct profile_span spans[], unsigned int nspan)
+{
+    unsigned int i, j;
+
+    for (i = 0; i < nspan; i++) {
+        struct profile_span *span = &spans[i];
+        size_t len = strlen(span->name) + 1 + PROFILE_SUFFIX_MAXLEN + 1;
+
+        span->histo = histo_u64_create(histo_m, histo_r, histo_n);
+        span->spare = histo_u64_create(histo_m, histo_r, histo_n);
+        if (span->histo == NULL || span->spare == NULL) {
+            goto error;
+        }
+        span->epoch = 0;
+        span->nwriter[0] = span->nwriter[1] = 0;
+        memset(span->metrics, 0, sizeof(span->metrics));
+        for (j = 0; j < PROFILE_NMETRIC; j++) {
+            span->metrics[j].name = cc_alloc(len);
+            if (span->metrics[j].name == NULL) {
+                goto error;
+            }
+            cc_scnprintf(span->metrics[j].name, len, "%s_%s", span->name,
+                    suffix[j]);
+            span->metrics[j].desc = span->desc;
+            span->metrics[j].type = type[j];
+        }
+    }
+
+    return CC_OK;
+
+error:
+    log_error("cannot create profile span %s", spans[i].name);
+    profile_span_destroy_all(spans, i + 1);
+
+    return CC_ENOMEM;
+}
+
+void
+profile_span_destroy_all(struct profile_span spans[], unsigned int nspan)
+{
+    unsigned int i, j;
+
+    for (i = 0; i < nspan; i++) {
+        histo_u64_destroy(&spans[i].histo);
+        histo_u64_destroy(&spans[i].spare);
+        for (j = 0; j < PROFILE_NMETRIC; j++) {
+            if (spans[i].metrics[j].name != NULL) {
+                cc_free(spans[i].metrics[j].name);
+            }
+        }
+    }
+}
+
+void
+profile_span_record(struct profile_span *span, uint64_t ntick)
+{
+    struct histo_u64 *h;
+    uint32_t epoch;
+    uint64_t ns;
+
+    if (span->histo == NULL) {
+        return;
+    }
+
+    /*
+     * announce the record under the current epoch, and retry if a report
+     * started meanwhile: once the epoch is seen unchanged after the announce,
+     * profile_report waits for this record before touching the histogram
+     */
+    for (;;) {
+        epoch = __atomic_load_n(&span->epoch, __ATOMIC_SEQ_CST);
+        __atomic_add_fetch(&span->nwriter[epoch & 1], 1, __ATOMIC_SEQ_CST);
+        if (__atomic_load_n(&span->epoch, __ATOMIC_SEQ_CST) == epoch) {
+            break;
+        }
+        __atomic_sub_fetch(&span->nwriter[epoch & 1], 1, __ATOMIC_SEQ_CST);
+    }
+    h = __atomic_load_n(&span->histo, __ATOMIC_SEQ_CST);
+
+    /* outliers beyond the range of the histogram count as the max value */
+    ns = (uint64_t)(ntick * tick_ns);
+    if (ns > h->N) {
+        ns = h->N;
+    }
+    histo_u64_record_atomic(h, ns, 1);
+
+    __atomic_sub_fetch(&span->nwriter[epoch & 1], 1, __ATOMIC_RELEASE);
+}
+
+/* swap in the spare histogram, and return the old one once no one writes it */
+static struct histo_u64 *
+_profile_span_swap(struct profile_span *span)
+{
+    struct histo_u64 *h = span->histo;
+    uint32_t epoch = span->epoch;
+
+    __atomic_store_n(&span->histo, span->spare, __ATOMIC_SEQ_CST);
+    __atomic_store_n(&span->epoch, epoch + 1, __ATOMIC_SEQ_CST);
+    while (__atomic_load_n(&span->nwriter[epoch & 1], __ATOMIC_ACQUIRE) != 0) {
+        sched_yield();
+    }
+    span->spare = h;
+
+    return h;
+}
+
+void
+profile_report(struct profile_span spans[], unsigned int nspan)
+{
+    unsigned int i, j;
+
+    if (!profile_init) {
+        log_warn("%s has never been setup, cannot report", PROFILE_MODULE_NAME);
+
+        return;
+    }
+
+    for (i = 0; i < nspan; i++) {
+        struct profile_span *span = &spans[i];
+        struct histo_u64 *h;
+
+        if (span->histo == NULL) {
+            continue;
+        }
+
+        /* new records go to the spare histogram while this one is reported */
+        h = _profile_span_swap(span);
+
+        span->metrics[0].gauge = (int64_t)h->nrecord;
+        if (histo_u64_report_multi(pp, h) == HISTO_OK) {
+            for (j = 1; j < PROFILE_NMETRIC; j++) {
+                span->metrics[j].gauge =
+                    (int64_t)bucket_high_u64(h, pp->result[j - 1]);
+            }
+        } else { /* no record during this interval */
+            for (j = 1; j < PROFILE_NMETRIC; j++) {
+                span->metrics[j].gauge = 0;
+            }
+        }
+
+        histo_u64_reset(h);
+    }
+}
+
+void
+profile_stats_log(struct profile_span spans[], unsigned int nspan)
+{
+    unsigned int i;
+
+    profile_report(spans, nspan);
+
+    for (i = 0; i < nspan; i++) {
+        if (spans[i].histo != NULL) {
+            stats_log(spans[i].metrics, PROFILE_NMETRIC);
+        }
+    }
+}
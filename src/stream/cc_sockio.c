@@ -45,6 +45,104 @@ struct buf_sock_pool bsp;
 static bool sockio_init = false;
 static bool bsp_init = false;
 static sockio_metrics_st *sockio_metrics = NULL;
+static bool sockio_lazy = false;
+static bool sockio_scratch = false;
+static uint32_t zc_min = BUFSOCK_ZC_MIN;
+
+/* scratch buffer of the current thread and the buf_sock it is lent to */
+static __thread struct buf *scratch = NULL;
+static __thread struct buf_sock *scratch_owner = NULL;
+
+/*
+ * move unread data in the scratch buffer of s to a buffer from the pool, which
+ * leaves s without rbuf if all data has been consumed
+ */
+static rstatus_i
+_buf_sock_promote(struct buf_sock *s)
+{
+    struct buf *buf = NULL;
+    uint32_t size;
+
+    ASSERT(s->rbuf == scratch && scratch_owner == s);
+
+    size = buf_rsize(scratch);
+    if (size > 0) {
+        buf = buf_borrow();
+        if (buf == NULL) {
+            log_debug("cannot move scratch data of buf_sock %p: OOM", s);
+            INCR(sockio_metrics, buf_sock_attach_ex);
+
+            return CC_ENOMEM;
+        }
+        /* scratch buffer is never resized, so its data always fits */
+        ASSERT(buf_wsize(buf) >= size);
+        buf_write(buf, scratch->rpos, size);
+        INCR(sockio_metrics, buf_sock_attach);
+        INCR(sockio_metrics, buf_sock_promote);
+    }
+
+    buf_reset(scratch);
+    scratch_owner = NULL;
+    s->rbuf = buf;
+
+    return CC_OK;
+}
+
+/* give back a buffer attached lazily, regardless of unread data */
+static void
+_buf_sock_release(struct buf **buf)
+{
+    if (*buf == NULL) {
+        return;
+    }
+
+    if (*buf == scratch) {
+        buf_reset(scratch);
+        scratch_owner = NULL;
+        *buf = NULL;
+
+        return;
+    }
+
+    /* a doubled buf goes back to the pool of its size class */
+    buf_return(buf);
+    INCR(sockio_metrics, buf_sock_detach);
+}
+
+/* make sure s has a buffer to read into, only needed in lazy mode */
+static rstatus_i
+_buf_sock_rbuf(struct buf_sock *s)
+{
+    if (s->rbuf != NULL) {
+        return CC_OK;
+    }
+
+    ASSERT(sockio_lazy);
+
+    if (sockio_scratch) {
+        if (scratch == NULL) {
+            scratch = buf_create();
+        }
+        if (scratch != NULL && (scratch_owner == NULL ||
+                _buf_sock_promote(scratch_owner) == CC_OK)) {
+            scratch_owner = s;
+            s->rbuf = scratch;
+            INCR(sockio_metrics, buf_sock_scratch);
+
+            return CC_OK;
+        }
+    }
+
+    s->rbuf = buf_borrow();
+    if (s->rbuf == NULL) {
+        INCR(sockio_metrics, buf_sock_attach_ex);
+
+        return CC_ENOMEM;
+    }
+    INCR(sockio_metrics, buf_sock_attach);
+
+    return CC_OK;
+}
 
 rstatus_i
 buf_tcp_read(struct buf_sock *s)
@@ -53,10 +151,15 @@ buf_tcp_read(struct buf_sock *s)
 
     struct tcp_conn *c = (struct tcp_conn *)s->ch;
     channel_handler_st *h = s->hdl;
-    struct buf *buf = s->rbuf;
+    struct buf *buf;
     rstatus_i status = CC_OK;
     ssize_t cap, n;
 
+    if (_buf_sock_rbuf(s) != CC_OK) {
+        return CC_ENOMEM;
+    }
+    buf = s->rbuf;
+
     ASSERT(c != NULL);
     ASSERT(buf != NULL);
     ASSERT(h != NULL && h->recv != NULL);
@@ -93,6 +196,89 @@ buf_tcp_read(struct buf_sock *s)
     return status;
 }
 
+/* should the next send on s go zerocopy? make sure wbuf can be pinned if so */
+static bool
+_buf_sock_zc(struct buf_sock *s, size_t cap)
+{
+    if (!s->ch->zerocopy || cap < zc_min) {
+        return false;
+    }
+
+    if (s->wbuf_pinned) { /* a slot was reserved when wbuf got pinned */
+        return true;
+    }
+
+    if (s->npinned == BUFSOCK_NPINNED) {
+        return false;
+    }
+
+    if (s->zc_spare == NULL) {
+        s->zc_spare = buf_borrow();
+    }
+
+    return s->zc_spare != NULL;
+}
+
+/* hold the drained wbuf until its sends complete, continue with a spare */
+static void
+_buf_sock_pin(struct buf_sock *s)
+{
+    ASSERT(s->npinned < BUFSOCK_NPINNED && s->zc_spare != NULL);
+    ASSERT(tcp_zc_pending(s->ch));
+
+    s->pinned[s->npinned] = s->wbuf;
+    s->pinned_id[s->npinned] = s->ch->zc_next - 1;
+    s->npinned++;
+
+    s->wbuf = s->zc_spare;
+    s->zc_spare = NULL;
+    s->wbuf_pinned = false;
+    INCR(sockio_metrics, buf_sock_pin);
+}
+
+/* release the first n pinned buffers */
+static void
+_buf_sock_unpin(struct buf_sock *s, uint32_t n)
+{
+    uint32_t i;
+
+    ASSERT(n <= s->npinned);
+
+    for (i = 0; i < n; i++) {
+        buf_return(&s->pinned[i]);
+    }
+    for (i = n; i < s->npinned; i++) {
+        s->pinned[i - n] = s->pinned[i];
+        s->pinned_id[i - n] = s->pinned_id[i];
+    }
+    s->npinned -= n;
+    INCR_N(sockio_metrics, buf_sock_unpin, n);
+}
+
+/*
+ * forget about zerocopy state, used when s is returned or destroyed. Sends of
+ * pinned buffers may not have completed, and once the socket is closed their
+ * completions are never reported, while the kernel may still transmit from
+ * them. So they are freed rather than returned to the pool, where the next
+ * borrower would overwrite data in flight.
+ */
+static void
+_buf_sock_unpin_all(struct buf_sock *s)
+{
+    uint32_t i;
+
+    if (s->npinned > 0) {
+        log_debug("free %"PRIu32" pinned bufs of buf_sock %p", s->npinned, s);
+        for (i = 0; i < s->npinned; i++) {
+            buf_destroy(&s->pinned[i]);
+        }
+        INCR_N(sockio_metrics, buf_sock_unpin_ex, s->npinned);
+        s->npinned = 0;
+    }
+    buf_return(&s->zc_spare);
+    s->wbuf_pinned = false;
+}
+
 rstatus_i
 buf_tcp_write(struct buf_sock *s)
 {
@@ -105,7 +291,13 @@ buf_tcp_write(struct buf_sock *s)
     size_t cap;
     ssize_t n;
 
-    ASSERT(c != NULL && h != NULL && buf != NULL);
+    if (buf == NULL) { /* lazy mode, nothing has been written */
+        log_verb("no wbuf attached to buf_sock %p", s);
+
+        return CC_EEMPTY;
+    }
+
+    ASSERT(c != NULL && h != NULL);
     ASSERT(h->send != NULL);
 
     cap = buf_rsize(buf);
@@ -116,7 +308,16 @@ buf_tcp_write(struct buf_sock *s)
         return CC_EEMPTY;
     }
 
-    n = h->send(c, buf->rpos, cap);
+    if (_buf_sock_zc(s, cap)) {
+        uint32_t id = c->zc_next;
+
+        n = tcp_send_zc(c, buf->rpos, cap);
+        if (c->zc_next != id) {
+            s->wbuf_pinned = true;
+        }
+    } else {
+        n = h->send(c, buf->rpos, cap);
+    }
     if (n < 0) {
         if (n == CC_EAGAIN) {
             log_verb("send on conn returns rescuable error: EAGAIN", c);
@@ -138,9 +339,57 @@ buf_tcp_write(struct buf_sock *s)
         log_verb("send %zd bytes on conn %p", n, c);
     }
 
+    if (status == CC_OK && s->wbuf_pinned) {
+        _buf_sock_pin(s);
+    }
+
     return status;
 }
 
+rstatus_i
+buf_tcp_reap(struct buf_sock *s)
+{
+    ASSERT(s != NULL && s->ch != NULL);
+
+    rstatus_i status = CC_OK;
+    uint32_t n = 0;
+
+    if (tcp_reap_zc(s->ch) < 0) {
+        status = CC_ERROR;
+    }
+
+    while (n < s->npinned && tcp_zc_complete(s->ch, s->pinned_id[n])) {
+        n++;
+    }
+    if (n > 0) {
+        log_verb("release %"PRIu32" pinned bufs of buf_sock %p", n, s);
+        _buf_sock_unpin(s, n);
+    }
+
+    return status;
+}
+
+/*
+ * grow the full rbuf of s: a recv that fills the buffer hints that more data
+ * is pending, so ask the socket how much and fit all of it with a single move
+ * rather than doubling and recv'ing repeatedly. Doubling is the fallback when
+ * the amount is unknown or cannot be fit.
+ */
+static rstatus_i
+_dbuf_tcp_grow(struct buf_sock *s)
+{
+    int nread = tcp_get_nread(s->ch->sd);
+
+    if (nread > 0 &&
+            dbuf_fit(&s->rbuf, buf_rsize(s->rbuf) + (uint32_t)nread) == CC_OK) {
+        log_verb("rbuf on buf_sock %p fit to %d pending bytes", s, nread);
+
+        return CC_OK;
+    }
+
+    return dbuf_double(&s->rbuf);
+}
+
 rstatus_i
 dbuf_tcp_read(struct buf_sock *s)
 {
@@ -152,14 +401,18 @@ dbuf_tcp_read(struct buf_sock *s)
     uint32_t cap;
     ssize_t n, total_n = 0;
 
-    ASSERT(c != NULL && h != NULL && s->rbuf != NULL);
+    if (_buf_sock_rbuf(s) != CC_OK) {
+        return CC_ENOMEM;
+    }
+
+    ASSERT(c != NULL && h != NULL);
     ASSERT(h->recv != NULL);
 
     do {
         /*
          * Try to recv:
-         * 1. if remaining cap is zero, double
-         *   - if double fails, return CC_ERETRY
+         * 1. if remaining cap is zero, fit pending data or double
+         *   - if both fail, return CC_ERETRY
          * 2. Call recv w/ cap
          *   - if n < 0, check status and return
          *   - if n == 0, set to close and return
@@ -168,9 +421,15 @@ dbuf_tcp_read(struct buf_sock *s)
          */
         cap = buf_wsize(s->rbuf);
         if (cap == 0) {
-            status = dbuf_double(&s->rbuf);
+            if (s->rbuf == scratch) {
+                /* scratch buffer is shared, move data out before doubling */
+                status = _buf_sock_promote(s);
+            }
+            if (status == CC_OK) {
+                status = _dbuf_tcp_grow(s);
+            }
             if (status != CC_OK) {
-                log_verb("doubling rbuf on buf_sock %p failed: %d", s, status);
+                log_verb("growing rbuf on buf_sock %p failed: %d", s, status);
                 status = CC_ERETRY;
 
                 goto done;
@@ -225,11 +484,17 @@ buf_sock_create(void)
     s->ch = NULL;
     s->rbuf = NULL;
     s->wbuf = NULL;
+    s->wbuf_pinned = false;
+    s->zc_spare = NULL;
+    s->npinned = 0;
 
     s->ch = tcp_conn_create();
     if (s->ch == NULL) {
         goto error;
     }
+    if (sockio_lazy) { /* buffers are attached when needed */
+        goto done;
+    }
     s->rbuf = buf_create();
     if (s->rbuf == NULL) {
         goto error;
@@ -239,6 +504,7 @@ buf_sock_create(void)
         goto error;
     }
 
+done:
     INCR(sockio_metrics, buf_sock_create);
     INCR(sockio_metrics, buf_sock_curr);
 
@@ -264,8 +530,14 @@ buf_sock_destroy(struct buf_sock **s)
     log_verb("destroy buffered socket %p", *s);
 
     tcp_conn_destroy(&(*s)->ch);
-    buf_destroy(&(*s)->rbuf);
-    buf_destroy(&(*s)->wbuf);
+    _buf_sock_unpin_all(*s);
+    if (sockio_lazy) {
+        _buf_sock_release(&(*s)->rbuf);
+        _buf_sock_release(&(*s)->wbuf);
+    } else {
+        buf_destroy(&(*s)->rbuf);
+        buf_destroy(&(*s)->wbuf);
+    }
     cc_free(*s);
 
     *s = NULL;
@@ -317,7 +589,7 @@ buf_sock_pool_create(uint32_t max)
 void
 buf_sock_reset(struct buf_sock *s)
 {
-    ASSERT(s->rbuf != NULL && s->wbuf != NULL);
+    ASSERT(sockio_lazy || (s->rbuf != NULL && s->wbuf != NULL));
 
     log_verb("reset buffered socket %p", s);
 
@@ -329,8 +601,55 @@ buf_sock_reset(struct buf_sock *s)
     s->hdl = NULL;
 
     tcp_conn_reset(s->ch);
-    buf_reset(s->rbuf);
-    buf_reset(s->wbuf);
+    if (s->rbuf != NULL) {
+        buf_reset(s->rbuf);
+    }
+    if (s->wbuf != NULL) {
+        buf_reset(s->wbuf);
+    }
+}
+
+rstatus_i
+buf_sock_attach(struct buf_sock *s)
+{
+    ASSERT(s != NULL);
+
+    if (_buf_sock_rbuf(s) != CC_OK) {
+        return CC_ENOMEM;
+    }
+
+    if (s->wbuf == NULL) {
+        s->wbuf = buf_borrow();
+        if (s->wbuf == NULL) {
+            INCR(sockio_metrics, buf_sock_attach_ex);
+
+            return CC_ENOMEM;
+        }
+        INCR(sockio_metrics, buf_sock_attach);
+    }
+
+    return CC_OK;
+}
+
+void
+buf_sock_detach(struct buf_sock *s)
+{
+    ASSERT(s != NULL);
+
+    if (!sockio_lazy) {
+        return;
+    }
+
+    if (s->rbuf != NULL && s->rbuf == scratch) {
+        /* keep using scratch buffer if unread data cannot be moved out */
+        _buf_sock_promote(s);
+    } else if (s->rbuf != NULL && buf_rsize(s->rbuf) == 0) {
+        _buf_sock_release(&s->rbuf);
+    }
+
+    if (s->wbuf != NULL && buf_rsize(s->wbuf) == 0) {
+        _buf_sock_release(&s->wbuf);
+    }
 }
 
 struct buf_sock *
@@ -363,6 +682,12 @@ buf_sock_return(struct buf_sock **s)
 
     log_verb("return buffered socket %p", *s);
 
+    _buf_sock_unpin_all(*s);
+    if (sockio_lazy) {
+        _buf_sock_release(&(*s)->rbuf);
+        _buf_sock_release(&(*s)->wbuf);
+    }
+
     (*s)->free = true;
     FREEPOOL_RETURN(*s, &bsp, next);
 
@@ -384,8 +709,16 @@ sockio_setup(sockio_options_st *options, sockio_metrics_st *metrics)
 
     sockio_metrics = metrics;
 
+    /* buf_socks in the old pool are created with the old mode */
+    if (bsp_init) {
+        buf_sock_pool_destroy();
+    }
+
     if (options != NULL) {
         max = option_uint(&options->buf_sock_poolsize);
+        sockio_lazy = option_bool(&options->buf_sock_lazy);
+        sockio_scratch = sockio_lazy && option_bool(&options->buf_sock_scratch);
+        zc_min = option_uint(&options->buf_sock_zc_min);
     }
 
     buf_sock_pool_create(max);
@@ -396,4 +729,15 @@ void
 sockio_teardown(void)
 {
     buf_sock_pool_destroy();
+
+    /* only the scratch buffer of the calling thread can be freed here */
+    if (scratch_owner != NULL) {
+        scratch_owner->rbuf = NULL;
+        scratch_owner = NULL;
+    }
+    buf_destroy(&scratch);
+
+    sockio_lazy = false;
+    sockio_scratch = false;
+    sockio_init = false;
 }
@@ -34,6 +34,22 @@ test_reset(void)
     test_setup();
 }
 
+/* set up with the given growth policy instead */
+static void
+test_reset_policy(uint32_t delta, double factor, uint32_t mremap_size)
+{
+    array_options_st options = {
+        .array_nelem_delta = {.set = true, .type = OPTION_TYPE_UINT,
+            .val.vuint = delta},
+        .array_growth_factor = {.set = true, .type = OPTION_TYPE_FPN,
+            .val.vfpn = factor},
+        .array_mremap_size = {.set = true, .type = OPTION_TYPE_UINT,
+            .val.vuint = mremap_size}};
+
+    test_teardown();
+    array_setup(&options);
+}
+
 static void
 _test_create_push_pop_destroy(uint32_t initial_nalloc, uint32_t times, uint32_t expected_nalloc)
 {
@@ -89,6 +105,122 @@ START_TEST(test_expand_max)
 }
 END_TEST
 
+START_TEST(test_expand_geometric)
+{
+#define SIZE 8
+    struct array *arr;
+    uint32_t i, nexpand = 0, nalloc;
+
+    test_reset_policy(0, 1.5, 0);
+
+    ck_assert_int_eq(array_create(&arr, 1, SIZE), CC_OK);
+    nalloc = array_nalloc(arr);
+    for (i = 0; i < 100000; i++) {
+        ck_assert_ptr_ne(array_push(arr), NULL);
+        if (array_nalloc(arr) != nalloc) {
+            /* never less than one more element, otherwise by 1.5x */
+            ck_assert_int_eq(array_nalloc(arr), nalloc < 2 ? nalloc + 1 :
+                    (uint32_t)(nalloc * 1.5));
+            nalloc = array_nalloc(arr);
+            nexpand++;
+        }
+    }
+    ck_assert_int_lt(nexpand, 32);
+    array_destroy(&arr);
+
+    /* capped, as with array_nelem_delta set */
+    test_reset_policy(100, 2.0, 0);
+    ck_assert_int_eq(array_create(&arr, 64, SIZE), CC_OK);
+    for (i = 0; i < 65; i++) {
+        array_push(arr);
+    }
+    ck_assert_int_eq(array_nalloc(arr), 128);
+    for (; i < 129; i++) {
+        array_push(arr);
+    }
+    ck_assert_int_eq(array_nalloc(arr), 228);
+    array_destroy(&arr);
+
+    test_reset();
+#undef SIZE
+}
+END_TEST
+
+START_TEST(test_reserve_push_n)
+{
+#define SIZE 8
+    struct array *arr;
+    uint64_t src[100], *el;
+    uint32_t i;
+
+    test_reset_policy(0, 2.0, 0);
+
+    for (i = 0; i < 100; i++) {
+        src[i] = i;
+    }
+
+    ck_assert_int_eq(array_create(&arr, 4, SIZE), CC_OK);
+    /* straight to what is needed if that beats doubling */
+    ck_assert_int_eq(array_reserve(arr, 10), CC_OK);
+    ck_assert_int_eq(array_nalloc(arr), 10);
+    ck_assert_int_eq(array_nelem(arr), 0);
+    ck_assert_int_eq(array_reserve(arr, 10), CC_OK);
+    ck_assert_int_eq(array_nalloc(arr), 10);
+
+    el = array_push_n(arr, 3);
+    ck_assert_ptr_eq(el, arr->data);
+    el[0] = 0; el[1] = 1; el[2] = 2;
+    ck_assert_int_eq(array_nelem(arr), 3);
+
+    /* doubling beats what is needed */
+    ck_assert_int_eq(array_append(arr, src + 3, 8), CC_OK);
+    ck_assert_int_eq(array_nalloc(arr), 20);
+    ck_assert_int_eq(array_append(arr, src + 11, 89), CC_OK);
+    ck_assert_int_eq(array_append(arr, src, 0), CC_OK);
+    ck_assert_int_eq(array_nelem(arr), 100);
+    for (i = 0; i < 100; i++) {
+        ck_assert_int_eq(*(uint64_t *)array_get(arr, i), i);
+    }
+
+    array_destroy(&arr);
+    test_reset();
+#undef SIZE
+}
+END_TEST
+
+START_TEST(test_expand_mremap)
+{
+#define SIZE 8
+#define NELEM 100000
+    struct array *arr;
+    uint64_t *el;
+    uint32_t i;
+
+    test_reset_policy(0, 2.0, 4096);
+
+    ck_assert_int_eq(array_create(&arr, 16, SIZE), CC_OK);
+    for (i = 0; i < NELEM; i++) {
+        el = array_push(arr);
+        ck_assert_ptr_ne(el, NULL);
+        *el = i;
+        if (array_nalloc(arr) * SIZE < 4096) {
+            ck_assert_int_eq(arr->nmap, 0);
+        }
+    }
+    ck_assert_int_ge(arr->nmap, NELEM * SIZE);
+    /* capacity covers all of the mapped pages */
+    ck_assert_int_eq(array_nalloc(arr), arr->nmap / SIZE);
+    for (i = 0; i < NELEM; i++) {
+        ck_assert_int_eq(*(uint64_t *)array_get(arr, i), i);
+    }
+
+    array_destroy(&arr);
+    test_reset();
+#undef NELEM
+#undef SIZE
+}
+END_TEST
+
 static rstatus_i
 sum(void *_elem, void *_agg)
 {
@@ -175,6 +307,9 @@ array_suite(void)
     tcase_add_test(tc_array, test_create_push_pop_destroy);
     tcase_add_test(tc_array, test_expand);
     tcase_add_test(tc_array, test_expand_max);
+    tcase_add_test(tc_array, test_expand_geometric);
+    tcase_add_test(tc_array, test_reserve_push_n);
+    tcase_add_test(tc_array, test_expand_mremap);
     tcase_add_test(tc_array, test_each);
     tcase_add_test(tc_array, test_sort);
 
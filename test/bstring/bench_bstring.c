@@ -0,0 +1,145 @@
+/*
+ * parses a buffer of memcache-style requests into lines (find CRLF) and
+ * words (split on spaces), with the bstring search primitives and with a
+ * bytewise loop, and reports ns per request and GB/s:
+ *
+ *  bench_bstring [nround]
+ */
+
+#include <cc_bstring.h>
+#include <time/cc_timer.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#define BENCH_NREQ      10000
+#define BENCH_NROUND    100
+#define BENCH_BUF       (BENCH_NREQ * 128)
+
+static char buf[BENCH_BUF];
+static uint32_t nbuf;
+static volatile uint32_t sink;
+
+/* mix of short and long lines, as in a multiget-heavy workload */
+static void
+_fill(void)
+{
+    uint32_t i;
+
+    for (i = 0; i < BENCH_NREQ; i++) {
+        switch (i % 4) {
+        case 0:
+            nbuf += sprintf(buf + nbuf, "get user:%08u:profile\r\n", i);
+            break;
+        case 1:
+            nbuf += sprintf(buf + nbuf, "get user:%08u:profile "
+                    "user:%08u:friends user:%08u:settings\r\n", i, i, i);
+            break;
+        case 2:
+            nbuf += sprintf(buf + nbuf, "set session:%08u 0 3600 5\r\n"
+                    "hello\r\n", i);
+            break;
+        default:
+            nbuf += sprintf(buf + nbuf, "delete session:%08u\r\n", i);
+        }
+    }
+}
+
+static char *
+_crlf_bytewise(const struct bstring *s)
+{
+    uint32_t i;
+
+    for (i = 0; i + 1 < s->len; i++) {
+        if (s->data[i] == '\r' && s->data[i + 1] == '\n') {
+            return s->data + i;
+        }
+    }
+
+    return NULL;
+}
+
+static bool
+_token_bytewise(struct bstring *token, struct bstring *str, char delim)
+{
+    uint32_t i;
+
+    if (str->len == 0) {
+        return false;
+    }
+
+    for (i = 0; i < str->len && str->data[i] != delim; i++);
+    token->data = str->data;
+    token->len = i;
+    if (i < str->len) {
+        i++;
+    }
+    str->data += i;
+    str->len -= i;
+
+    return true;
+}
+
+static uint32_t
+_parse(bool simd)
+{
+    struct bstring rest = {nbuf, buf}, line, word;
+    uint32_t nword = 0;
+    char *p;
+
+    for (;;) {
+        p = simd ? bstring_find_crlf(&rest) : _crlf_bytewise(&rest);
+        if (p == NULL) {
+            break;
+        }
+        line.data = rest.data;
+        line.len = (uint32_t)(p - rest.data);
+        rest.len -= line.len + 2;
+        rest.data = p + 2;
+
+        if (simd) {
+            while (bstring_token(&word, &line, " ", 1)) {
+                nword += word.len;
+            }
+        } else {
+            while (_token_bytewise(&word, &line, ' ')) {
+                nword += word.len;
+            }
+        }
+    }
+
+    return nword;
+}
+
+int
+main(int argc, char *argv[])
+{
+    uint32_t nround = BENCH_NROUND, i;
+    int simd;
+
+    if (argc > 1) {
+        nround = (uint32_t)strtoul(argv[1], NULL, 10);
+    }
+    if (nround == 0) {
+        nround = 1;
+    }
+
+    _fill();
+
+    printf("%-10s %12s %10s\n", "parser", "ns/request", "GB/s");
+    for (simd = 0; simd <= 1; simd++) {
+        struct duration d;
+
+        duration_start(&d);
+        for (i = 0; i < nround; i++) {
+            sink = _parse(simd);
+        }
+        duration_stop(&d);
+
+        printf("%-10s %12.2f %10.2f\n", simd ? "bstring" : "bytewise",
+                duration_ns(&d) / nround / BENCH_NREQ,
+                (double)nbuf * nround / duration_ns(&d));
+    }
+
+    return EXIT_SUCCESS;
+}
@@ -93,6 +93,11 @@ START_TEST(test_compare)
     ck_assert_int_lt(bstring_compare(&bstr3, &bstr1), 0);
     ck_assert_int_gt(bstring_compare(&bstr3, &bstr2), 0);
     ck_assert_int_eq(bstring_compare(&bstr3, &bstr3), 0);
+
+    /* the shorter string orders first */
+    bstr2 = (struct bstring)str2bstr("ba");
+    ck_assert_int_lt(bstring_compare(&bstr2, &bstr3), 0);
+    ck_assert_int_gt(bstring_compare(&bstr3, &bstr2), 0);
 }
 END_TEST
 
@@ -115,6 +120,12 @@ START_TEST(test_strcmp)
                 'p', 'a', 'r', 'd'));
     ck_assert(!str12cmp("pocket mouse", 's', 'n', 'o', 'w', ' ', 'l', 'e', 'o',
                 'p', 'a', 'r', 'd'));
+    ck_assert(!str12cmp("snow leopars", 's', 'n', 'o', 'w', ' ', 'l', 'e', 'o',
+                'p', 'a', 'r', 'd'));
+    ck_assert(!str10cmp("everywhera", 'e', 'v', 'e', 'r', 'y', 'w', 'h', 'e',
+                'r', 'e'));
+    ck_assert(!str6cmp("horset", 'h', 'o', 'r', 's', 'e', 's'));
+    ck_assert(!str8cmp("McDonalt", 'M', 'c', 'D', 'o', 'n', 'a', 'l', 'd'));
 }
 END_TEST
 
@@ -204,6 +215,367 @@ START_TEST(test_bstring_alloc_and_free)
 }
 END_TEST
 
+/*
+ * fuzzing the integer parsers against straightforward reference parsers: up
+ * to 20 characters, all digits (after a '-' for atoi64), no overflow
+ */
+static uint64_t rng = 88172645463325252ULL;
+
+static uint64_t
+xorshift(void)
+{
+    rng ^= rng << 13;
+    rng ^= rng >> 7;
+    rng ^= rng << 17;
+
+    return rng;
+}
+
+static rstatus_i
+ref_atou64(uint64_t *u64, const char *p, uint32_t len)
+{
+    uint64_t u = 0;
+    uint32_t i;
+
+    if (len == 0 || len >= CC_UINT64_MAXLEN) {
+        return CC_ERROR;
+    }
+    for (i = 0; i < len; i++) {
+        if (p[i] < '0' || p[i] > '9' ||
+                __builtin_mul_overflow(u, 10, &u) ||
+                __builtin_add_overflow(u, (uint64_t)(p[i] - '0'), &u)) {
+            return CC_ERROR;
+        }
+    }
+    *u64 = u;
+
+    return CC_OK;
+}
+
+static rstatus_i
+ref_atoi64(int64_t *i64, const char *p, uint32_t len)
+{
+    uint64_t u;
+    bool neg = len > 0 && p[0] == '-';
+
+    if (len == 0 || len >= CC_INT64_MAXLEN ||
+            ref_atou64(&u, p + neg, len - neg) != CC_OK) {
+        return CC_ERROR;
+    }
+    if (u > (uint64_t)INT64_MAX + neg) {
+        return CC_ERROR;
+    }
+    *i64 = neg ? (int64_t)(0 - u) : (int64_t)u;
+
+    return CC_OK;
+}
+
+/* a number of random magnitude, then a random mutation or none */
+static uint32_t
+fuzz_number(char *buf)
+{
+    static const char noise[] = "09/:-+ a\xff\x80";
+    uint64_t r = xorshift(), v = xorshift() >> (xorshift() % 64);
+    uint32_t len;
+
+    if (r & 1) {
+        len = (uint32_t)sprintf(buf, "%" PRIu64, v);
+    } else {
+        len = (uint32_t)sprintf(buf, "-%" PRIu64, v >> (r & 2 ? 1 : 0));
+    }
+
+    r >>= 2;
+    switch (r % 8) {
+    case 0: /* a byte changed */
+        if (len > 0) {
+            buf[(r >> 3) % len] = noise[(r >> 8) % (sizeof(noise) - 1)];
+        }
+        break;
+
+    case 1: /* leading zeros */
+        len = (uint32_t)sprintf(buf, "%0*" PRIu64, (int)((r >> 3) % 22), v);
+        break;
+
+    case 2: /* cut short */
+        len = (uint32_t)((r >> 3) % (len + 1));
+        break;
+
+    case 3: /* a digit appended */
+        buf[len++] = '0' + (r >> 3) % 10;
+        break;
+
+    default:
+        break;
+    }
+
+    return len;
+}
+
+#define NFUZZ 2000000
+
+START_TEST(test_atoi_fuzz)
+{
+    char buf[64];
+    uint32_t i;
+    uint64_t u;
+    int64_t v;
+
+    for (i = 0; i < NFUZZ; i++) {
+        struct bstring str;
+        uint64_t u1 = 0, u2 = 0;
+        int64_t i1 = 0, i2 = 0;
+        rstatus_i s1, s2;
+
+        str.len = fuzz_number(buf);
+        str.data = buf;
+
+        s1 = bstring_atou64(&u1, &str);
+        s2 = ref_atou64(&u2, buf, str.len);
+        ck_assert_msg(s1 == s2 && (s1 != CC_OK || u1 == u2),
+                "atou64 '%.*s': %d %" PRIu64 ", expected %d %" PRIu64,
+                str.len, buf, s1, u1, s2, u2);
+
+        s1 = bstring_atoi64(&i1, &str);
+        s2 = ref_atoi64(&i2, buf, str.len);
+        ck_assert_msg(s1 == s2 && (s1 != CC_OK || i1 == i2),
+                "atoi64 '%.*s': %d %" PRIi64 ", expected %d %" PRIi64,
+                str.len, buf, s1, i1, s2, i2);
+    }
+
+    /* boundaries */
+    ck_assert_int_eq(bstring_atoi64(&v, &str2bstr("-")), CC_ERROR);
+    ck_assert_int_eq(bstring_atou64(&u, &str2bstr("99999999999999999999")),
+            CC_ERROR);
+    ck_assert_int_eq(bstring_atoi64(&v, &str2bstr("-9999999999999999999")),
+            CC_ERROR);
+    ck_assert_int_eq(bstring_atoi64(&v, &str2bstr("9223372036854775808")),
+            CC_ERROR);
+    ck_assert_int_eq(bstring_atou64(&u, &str2bstr("00000000000000000042")),
+            CC_OK);
+    ck_assert_uint_eq(u, 42);
+}
+END_TEST
+
+#undef NFUZZ
+
+/*
+ * the data of every bstring below ends exactly at the end of a heap buffer, so
+ * reading past the end shows up under valgrind/asan
+ */
+static struct bstring *
+fill(uint32_t len, char c)
+{
+    struct bstring *bs = bstring_alloc(len == 0 ? 1 : len);
+
+    memset(bs->data, c, bs->len);
+    bs->len = len;
+
+    return bs;
+}
+
+#define MAXLEN 100
+
+START_TEST(test_find_char)
+{
+    struct bstring *bs;
+    uint32_t len, i;
+
+    for (len = 0; len <= MAXLEN; len++) {
+        bs = fill(len, 'a');
+        ck_assert_ptr_null(bstring_find_char(bs, 'b'));
+        for (i = 0; i < len; i++) {
+            bs->data[i] = 'b';
+            ck_assert_ptr_eq(bstring_find_char(bs, 'b'), bs->data + i);
+            /* a later match does not hide an earlier one */
+            if (i + 1 < len) {
+                bs->data[len - 1] = 'b';
+                ck_assert_ptr_eq(bstring_find_char(bs, 'b'), bs->data + i);
+                bs->data[len - 1] = 'a';
+            }
+            bs->data[i] = 'a';
+        }
+        bstring_free(&bs);
+    }
+}
+END_TEST
+
+START_TEST(test_find_crlf)
+{
+    struct bstring *bs;
+    uint32_t len, i;
+
+    for (len = 0; len <= MAXLEN; len++) {
+        bs = fill(len, 'a');
+        ck_assert_ptr_null(bstring_find_crlf(bs));
+        for (i = 0; i + 1 < len; i++) {
+            /* a lone CR or LF is not a match */
+            bs->data[i] = '\r';
+            ck_assert_ptr_null(bstring_find_crlf(bs));
+            bs->data[i] = '\n';
+            ck_assert_ptr_null(bstring_find_crlf(bs));
+            bs->data[i] = 'a';
+
+            bs->data[i] = '\r';
+            bs->data[i + 1] = '\n';
+            ck_assert_ptr_eq(bstring_find_crlf(bs), bs->data + i);
+            /* nor is LF CR */
+            if (i > 0) {
+                bs->data[i - 1] = '\n';
+                bs->data[i] = 'a';
+                bs->data[i + 1] = '\r';
+                ck_assert_ptr_null(bstring_find_crlf(bs));
+                bs->data[i - 1] = 'a';
+            }
+            bs->data[i] = 'a';
+            bs->data[i + 1] = 'a';
+        }
+        bstring_free(&bs);
+    }
+}
+END_TEST
+
+START_TEST(test_find_any)
+{
+    struct bstring *bs;
+    uint32_t len, i, k;
+    const char *delim = " \r\n\t";
+
+    for (len = 0; len <= MAXLEN; len++) {
+        bs = fill(len, 'a');
+        for (k = 1; k <= 4; k++) {
+            ck_assert_ptr_null(bstring_find_any(bs, delim, k));
+        }
+        for (i = 0; i < len; i++) {
+            for (k = 0; k < 4; k++) {
+                bs->data[i] = delim[k];
+                ck_assert_ptr_eq(bstring_find_any(bs, delim, 4), bs->data + i);
+                ck_assert_ptr_eq(bstring_find_any(bs, delim, k + 1),
+                        bs->data + i);
+                if (k > 0) {
+                    ck_assert_ptr_null(bstring_find_any(bs, delim, k));
+                }
+            }
+            bs->data[i] = 'a';
+        }
+        bstring_free(&bs);
+    }
+}
+END_TEST
+
+#undef MAXLEN
+
+START_TEST(test_token)
+{
+    struct bstring str = str2bstr("get foo  barbazbarbazbarbazbarbazbarbaz\tqux");
+    struct bstring token = null_bstring;
+    const char *expect[] = {"get", "foo", "",
+        "barbazbarbazbarbazbarbazbarbaz", "qux"};
+    uint32_t n = 0;
+
+    while (bstring_token(&token, &str, " \t", 2)) {
+        ck_assert_int_lt(n, 5);
+        ck_assert_int_eq(token.len, strlen(expect[n]));
+        ck_assert_int_eq(memcmp(token.data, expect[n], token.len), 0);
+        n++;
+    }
+    ck_assert_int_eq(n, 5);
+    ck_assert_int_eq(str.len, 0);
+
+    /* a trailing delimiter ends the input */
+    str = (struct bstring)str2bstr("a b ");
+    ck_assert(bstring_token(&token, &str, " ", 1));
+    ck_assert(bstring_token(&token, &str, " ", 1));
+    ck_assert_int_eq(token.len, 1);
+    ck_assert_int_eq(token.data[0], 'b');
+    ck_assert(!bstring_token(&token, &str, " ", 1));
+}
+END_TEST
+
+START_TEST(test_prefix)
+{
+    struct bstring str = str2bstr("incrementally");
+    struct bstring prefix;
+    uint32_t len;
+
+    for (len = 0; len <= str.len; len++) {
+        prefix.data = str.data;
+        prefix.len = len;
+        ck_assert(bstring_prefix(&str, &prefix));
+    }
+    prefix = (struct bstring)str2bstr("incrementally!");
+    ck_assert(!bstring_prefix(&str, &prefix));
+    prefix = (struct bstring)str2bstr("incrementallX");
+    ck_assert(!bstring_prefix(&str, &prefix));
+    prefix = (struct bstring)str2bstr("incrEment");
+    ck_assert(!bstring_prefix(&str, &prefix));
+    prefix = (struct bstring)str2bstr("inct");
+    ck_assert(!bstring_prefix(&str, &prefix));
+}
+END_TEST
+
+START_TEST(test_sso)
+{
+    struct bstring_sso s1, s2, s3;
+    struct bstring view;
+    char src[64];
+    uint32_t len;
+
+    ck_assert_int_eq(sizeof(struct bstring_sso), BSTRING_SSO_SIZE);
+    for (len = 0; len < sizeof(src); len++) {
+        src[len] = 'a' + len % 26;
+    }
+
+    bstring_sso_init(&s1);
+    ck_assert(bstring_sso_inline(&s1));
+    ck_assert_int_eq(bstring_sso_len(&s1), 0);
+
+    for (len = 0; len <= sizeof(src); len++) {
+        bstring_sso_init(&s1);
+        bstring_sso_init(&s2);
+        bstring_sso_init(&s3);
+
+        ck_assert_int_eq(bstring_sso_copy(&s1, src, len), CC_OK);
+        ck_assert_int_eq(bstring_sso_inline(&s1), len <= BSTRING_SSO_CAP);
+        ck_assert_int_eq(bstring_sso_len(&s1), len);
+        ck_assert_int_eq(memcmp(bstring_sso_data(&s1), src, len), 0);
+        if (bstring_sso_inline(&s1)) {
+            ck_assert_ptr_eq(bstring_sso_data(&s1), (char *)&s1);
+        }
+
+        view = bstring_sso_bstr(&s1);
+        ck_assert_int_eq(view.len, len);
+        ck_assert_ptr_eq(view.data, bstring_sso_data(&s1));
+
+        /* a duplicate is equal but owns its data */
+        ck_assert_int_eq(bstring_sso_duplicate(&s2, &s1), CC_OK);
+        ck_assert_int_eq(bstring_sso_compare(&s1, &s2), 0);
+        ck_assert_int_eq(bstring_sso_len(&s2), len);
+        if (len > 0) {
+            ck_assert_ptr_ne(bstring_sso_data(&s2), bstring_sso_data(&s1));
+        }
+
+        /* one byte shorter orders first, one byte different compares */
+        if (len > 0) {
+            ck_assert_int_eq(bstring_sso_copy(&s3, src, len - 1), CC_OK);
+            ck_assert_int_lt(bstring_sso_compare(&s3, &s1), 0);
+            ck_assert_int_gt(bstring_sso_compare(&s1, &s3), 0);
+            bstring_sso_deinit(&s3);
+
+            src[len - 1]++;
+            ck_assert_int_eq(bstring_sso_copy(&s3, src, len), CC_OK);
+            ck_assert_int_gt(bstring_sso_compare(&s3, &s1), 0);
+            src[len - 1]--;
+        }
+
+        bstring_sso_deinit(&s1);
+        ck_assert(bstring_sso_inline(&s1));
+        ck_assert_int_eq(bstring_sso_len(&s1), 0);
+        bstring_sso_deinit(&s2);
+        bstring_sso_deinit(&s3);
+    }
+}
+END_TEST
+
 /*
  * test suite
  */
@@ -222,7 +594,14 @@ bstring_suite(void)
     tcase_add_test(tc_bstring, test_strcmp);
     tcase_add_test(tc_bstring, test_atoi64);
     tcase_add_test(tc_bstring, test_atou64);
+    tcase_add_test(tc_bstring, test_atoi_fuzz);
     tcase_add_test(tc_bstring, test_bstring_alloc_and_free);
+    tcase_add_test(tc_bstring, test_find_char);
+    tcase_add_test(tc_bstring, test_find_crlf);
+    tcase_add_test(tc_bstring, test_find_any);
+    tcase_add_test(tc_bstring, test_token);
+    tcase_add_test(tc_bstring, test_prefix);
+    tcase_add_test(tc_bstring, test_sso);
 
     return s;
 }
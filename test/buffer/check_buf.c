@@ -5,6 +5,9 @@
 
 #include <check.h>
 
+#include <stdio.h>
+#include <stdlib.h>
+
 #define SUITE_NAME "buffer"
 #define DEBUG_LOG  SUITE_NAME ".log"
 
@@ -12,6 +15,7 @@
 #define TEST_BUF_SIZE      (TEST_BUF_CAP + BUF_HDR_SIZE)
 #define TEST_BUF_POOLSIZE                              0
 #define TEST_DBUF_MAX                                  2
+#define TEST_BUF_NCLASS                (TEST_DBUF_MAX + 2)
 
 static buf_metrics_st bmetrics;
 static dbuf_metrics_st dmetrics;
@@ -38,6 +42,11 @@ test_setup(void)
             .set = true,
             .type = OPTION_TYPE_UINT,
             .val.vuint = TEST_BUF_POOLSIZE,
+        },
+        .buf_nclass = {
+            .set = true,
+            .type = OPTION_TYPE_UINT,
+            .val.vuint = TEST_BUF_NCLASS,
         }};
 
     doptions = (dbuf_options_st){
@@ -257,7 +266,7 @@ START_TEST(test_dbuf_double_basic)
     buf = buf_create();
     ck_assert_ptr_ne(buf, NULL);
 
-    /* double buffer, check state */
+    /* double buffer, check state, a created buf is resized in place */
     ck_assert_int_eq(dbuf_double(&buf), CC_OK);
     ck_assert_ptr_ne(buf, NULL);
     ck_assert_int_eq(bmetrics.buf_curr.gauge, 1);
@@ -299,6 +308,33 @@ START_TEST(test_dbuf_double_over_max)
 }
 END_TEST
 
+START_TEST(test_dbuf_max_over_nclass)
+{
+    dbuf_options_st options = {
+        .dbuf_max_power = {
+            .set = true,
+            .type = OPTION_TYPE_UINT,
+            .val.vuint = TEST_BUF_NCLASS,
+        }};
+
+    struct buf *buf;
+    int i;
+
+    /* growth beyond the largest buf size class is clamped to it */
+    test_reset();
+    dbuf_setup(&options, &dmetrics);
+
+    buf = buf_borrow();
+    ck_assert_ptr_ne(buf, NULL);
+    for (i = 0; i < TEST_BUF_NCLASS - 1; i++) {
+        ck_assert_int_eq(dbuf_double(&buf), CC_OK);
+    }
+    ck_assert_int_eq(dbuf_double(&buf), CC_ERROR);
+    ck_assert_uint_eq(buf_size(buf), TEST_BUF_SIZE << (TEST_BUF_NCLASS - 1));
+    buf_return(&buf);
+}
+END_TEST
+
 START_TEST(test_dbuf_fit)
 {
 #define CAP_SMALL                         (TEST_BUF_CAP * 4)
@@ -314,7 +350,9 @@ START_TEST(test_dbuf_fit)
 
     /* fit to small size, check state */
     ck_assert_int_eq(dbuf_fit(&buf, CAP_SMALL), CC_OK);
+    /* the created buf is resized, not kept in a pool */
     ck_assert_int_eq(bmetrics.buf_memory.gauge, EXPECTED_BUF_SIZE);
+    ck_assert_int_eq(bmetrics.buf_curr.gauge, 1);
     ck_assert_uint_eq(buf_rsize(buf), 0);
     ck_assert_uint_eq(buf_wsize(buf), EXPECTED_BUF_CAP);
     ck_assert_uint_eq(buf_size(buf), EXPECTED_BUF_SIZE);
@@ -349,8 +387,9 @@ START_TEST(test_dbuf_shrink)
     ck_assert_int_eq(dbuf_double(&buf), CC_OK);
     ck_assert_int_eq(dbuf_double(&buf), CC_OK);
 
-    /* shrink, then check state */
+    /* shrink, then check state, created bufs are resized in place */
     ck_assert_int_eq(dbuf_shrink(&buf), CC_OK);
+    ck_assert_int_eq(bmetrics.buf_curr.gauge, 1);
     ck_assert_int_eq(bmetrics.buf_memory.gauge, TEST_BUF_SIZE);
     ck_assert_uint_eq(buf_rsize(buf), sizeof(MSG1));
     ck_assert_uint_eq(buf_wsize(buf), TEST_BUF_CAP - sizeof(MSG1));
@@ -366,6 +405,7 @@ START_TEST(test_dbuf_shrink)
 
     /* shrink, then check state */
     ck_assert_int_eq(dbuf_shrink(&buf), CC_OK);
+    ck_assert_int_eq(bmetrics.buf_curr.gauge, 1);
     ck_assert_int_eq(bmetrics.buf_memory.gauge, EXPECTED_BUF_SIZE);
     ck_assert_uint_eq(buf_rsize(buf), sizeof(MSG2));
     ck_assert_uint_eq(buf_wsize(buf), EXPECTED_BUF_CAP - sizeof(MSG2));
@@ -380,6 +420,56 @@ START_TEST(test_dbuf_shrink)
 }
 END_TEST
 
+START_TEST(test_dbuf_class_pool)
+{
+#define MSG "Hello World"
+    struct buf *buf;
+    struct metric *metrics;
+    unsigned int nmetric;
+    char name[32];
+
+    test_reset();
+
+    metrics = buf_class_metrics(&nmetric);
+    ck_assert_uint_eq(nmetric, TEST_BUF_NCLASS * BUF_CLASS_NMETRIC);
+    snprintf(name, sizeof(name), "buf_%zu_curr", TEST_BUF_SIZE);
+    ck_assert_str_eq(metrics[0].name, name);
+    snprintf(name, sizeof(name), "buf_%zu_active", TEST_BUF_SIZE * 2);
+    ck_assert_str_eq(metrics[BUF_CLASS_NMETRIC + 1].name, name);
+
+    /* a borrowed buf is swapped with one from the pool of the next class */
+    buf = buf_borrow();
+    ck_assert_ptr_ne(buf, NULL);
+    ck_assert_uint_eq(buf_write(buf, MSG, sizeof(MSG)), sizeof(MSG));
+    ck_assert_int_eq(dbuf_double(&buf), CC_OK);
+    ck_assert_uint_eq(buf_size(buf), TEST_BUF_SIZE * 2);
+    ck_assert_uint_eq(buf_rsize(buf), sizeof(MSG));
+    ck_assert_int_eq(cc_memcmp(buf->rpos, MSG, sizeof(MSG)), 0);
+    ck_assert_int_eq(bmetrics.buf_active.gauge, 1);
+    ck_assert_int_eq(metrics[1].gauge, 0);
+    ck_assert_int_eq(metrics[BUF_CLASS_NMETRIC + 1].gauge, 1);
+
+    /* and goes back to the pool of its own class */
+    buf_return(&buf);
+    ck_assert_int_eq(bmetrics.buf_active.gauge, 0);
+    ck_assert_int_eq(metrics[BUF_CLASS_NMETRIC + 1].gauge, 0);
+
+    /* so doubling again does not allocate */
+    buf = buf_borrow();
+    ck_assert_int_eq(dbuf_double(&buf), CC_OK);
+    ck_assert_uint_eq(bmetrics.buf_create.counter, 2);
+    ck_assert_int_eq(dbuf_shrink(&buf), CC_OK);
+    ck_assert_uint_eq(buf_size(buf), TEST_BUF_SIZE);
+    ck_assert_uint_eq(bmetrics.buf_create.counter, 2);
+    buf_return(&buf);
+
+    ck_assert_int_eq(metrics[0].gauge, 1);
+    ck_assert_int_eq(metrics[BUF_CLASS_NMETRIC].gauge, 1);
+    ck_assert_int_eq(bmetrics.buf_active.gauge, 0);
+#undef MSG
+}
+END_TEST
+
 /*
  * test suite
  */
@@ -401,8 +491,10 @@ buf_suite(void)
 
     tcase_add_test(tc_dbuf, test_dbuf_double_basic);
     tcase_add_test(tc_dbuf, test_dbuf_double_over_max);
+    tcase_add_test(tc_dbuf, test_dbuf_max_over_nclass);
     tcase_add_test(tc_dbuf, test_dbuf_fit);
     tcase_add_test(tc_dbuf, test_dbuf_shrink);
+    tcase_add_test(tc_dbuf, test_dbuf_class_pool);
 
     return s;
 }
@@ -0,0 +1,248 @@
+#include <channel/cc_notify.h>
+#include <cc_event.h>
+#include <cc_ring_array.h>
+
+#include <check.h>
+
+#include <fcntl.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <unistd.h>
+
+#define SUITE_NAME "notify"
+#define DEBUG_LOG  SUITE_NAME ".log"
+
+static notify_metrics_st metrics;
+
+/*
+ * utilities
+ */
+static void
+test_setup(void)
+{
+    metrics = (notify_metrics_st) { NOTIFY_METRIC(METRIC_INIT) };
+    notify_setup(&metrics);
+    event_setup(NULL, NULL);
+}
+
+static void
+test_teardown(void)
+{
+    event_teardown();
+    notify_teardown();
+}
+
+static void
+test_reset(void)
+{
+    test_teardown();
+    test_setup();
+}
+
+static int nwakeup;
+
+static void
+count_wakeup(void *arg, uint32_t events)
+{
+    ck_assert_int_eq(events, EVENT_READ);
+    nwakeup++;
+}
+
+START_TEST(test_signal_coalesce)
+{
+    struct notify_conn *c;
+    struct event_base *evb;
+    char buf[1];
+
+    test_reset();
+
+    c = notify_conn_create();
+    ck_assert_ptr_ne(c, NULL);
+    ck_assert(notify_open(NULL, c));
+    ck_assert_int_ge(notify_read_id(c), 0);
+
+    evb = event_base_create(8, count_wakeup);
+    ck_assert_int_eq(event_add_read(evb, notify_read_id(c), c), 0);
+
+    /* nothing signaled */
+    ck_assert_int_eq(notify_drain(c), CC_EAGAIN);
+    nwakeup = 0;
+    ck_assert_int_eq(event_wait(evb, 0), 0);
+
+    /* many signals, one syscall and one wakeup */
+    ck_assert_int_eq(notify_signal(c), CC_OK);
+    ck_assert_int_eq(notify_signal(c), CC_OK);
+    ck_assert_int_eq(notify_send(c, buf, sizeof(buf)), sizeof(buf));
+    ck_assert_int_eq(metrics.notify_signal.counter, 1);
+    ck_assert_int_eq(metrics.notify_coalesce.counter, 2);
+    ck_assert_int_eq(event_wait(evb, 0), 1);
+    ck_assert_int_eq(nwakeup, 1);
+
+    ck_assert_int_eq(notify_recv(c, buf, sizeof(buf)), sizeof(buf));
+    ck_assert_int_eq(event_wait(evb, 0), 0);
+    ck_assert_int_eq(notify_drain(c), CC_EAGAIN);
+
+    /* signals again once drained */
+    ck_assert_int_eq(notify_signal(c), CC_OK);
+    ck_assert_int_eq(metrics.notify_signal.counter, 2);
+    ck_assert_int_eq(notify_drain(c), CC_OK);
+
+    event_base_destroy(&evb);
+    notify_close(c);
+    ck_assert_int_eq(notify_read_id(c), -1);
+    notify_conn_destroy(&c);
+    ck_assert_ptr_eq(c, NULL);
+    ck_assert_int_eq(metrics.notify_open.counter, 1);
+    ck_assert_int_eq(metrics.notify_close.counter, 1);
+}
+END_TEST
+
+START_TEST(test_signal_error)
+{
+    struct notify_conn *c;
+    int wfd, rofd;
+
+    test_reset();
+
+    c = notify_conn_create();
+    ck_assert(notify_open(NULL, c));
+
+    /* a write that fails for real must not leave the conn marked pending */
+    rofd = open("/dev/null", O_RDONLY);
+    ck_assert_int_ge(rofd, 0);
+    wfd = c->fd[1];
+    c->fd[1] = rofd;
+    ck_assert_int_eq(notify_signal(c), CC_ERROR);
+    ck_assert_int_eq(notify_signal(c), CC_ERROR);
+    ck_assert_int_eq(metrics.notify_signal.counter, 2);
+    ck_assert_int_eq(metrics.notify_coalesce.counter, 0);
+    c->fd[1] = wfd;
+    close(rofd);
+
+    ck_assert_int_eq(notify_signal(c), CC_OK);
+    ck_assert_int_eq(notify_drain(c), CC_OK);
+
+    notify_close(c);
+    notify_conn_destroy(&c);
+}
+END_TEST
+
+#define NITEM 10000
+#define BATCH 16
+
+struct handoff {
+    struct notify_conn *c;
+    struct ring_array *arr;
+};
+
+static void *
+produce(void *arg)
+{
+    struct handoff *h = arg;
+    uint32_t i = 0;
+
+    while (i < NITEM) {
+        uint32_t j;
+
+        /* push a batch, then signal once */
+        for (j = 0; j < BATCH && i < NITEM; i++, j++) {
+            while (ring_array_push(&i, h->arr) != CC_OK) {
+                notify_signal(h->c);
+                sched_yield();
+            }
+        }
+        ck_assert_int_eq(notify_signal(h->c), CC_OK);
+    }
+
+    return NULL;
+}
+
+START_TEST(test_handoff)
+{
+    struct handoff h;
+    struct event_base *evb;
+    pthread_t producer;
+    uint32_t next = 0, item, ndrain = 0;
+
+    test_reset();
+
+    h.c = notify_conn_create();
+    ck_assert(notify_open(NULL, h.c));
+    h.arr = ring_array_create(sizeof(uint32_t), 64);
+    ck_assert_ptr_ne(h.arr, NULL);
+
+    evb = event_base_create(8, count_wakeup);
+    ck_assert_int_eq(event_add_read(evb, notify_read_id(h.c), h.c), 0);
+    nwakeup = 0;
+
+    ck_assert_int_eq(pthread_create(&producer, NULL, produce, &h), 0);
+
+    /* consumer: wait, drain, then pop everything */
+    while (next < NITEM) {
+        ck_assert_int_ge(event_wait(evb, 1000), 0);
+        notify_drain(h.c);
+        ndrain++;
+        while (ring_array_pop(&item, h.arr) == CC_OK) {
+            ck_assert_int_eq(item, next);
+            next++;
+        }
+    }
+
+    pthread_join(producer, NULL);
+
+    /* a wakeup costs a syscall only after the consumer has drained */
+    ck_assert_int_le(metrics.notify_signal.counter, ndrain + 1);
+    ck_assert_int_lt(metrics.notify_signal.counter, NITEM);
+
+    event_base_destroy(&evb);
+    ring_array_destroy(&h.arr);
+    notify_close(h.c);
+    notify_conn_destroy(&h.c);
+}
+END_TEST
+
+#undef NITEM
+#undef BATCH
+
+/*
+ * test suite
+ */
+static Suite *
+notify_suite(void)
+{
+    Suite *s = suite_create(SUITE_NAME);
+
+    TCase *tc_notify = tcase_create("notify test");
+    tcase_add_test(tc_notify, test_signal_coalesce);
+    tcase_add_test(tc_notify, test_signal_error);
+    tcase_add_test(tc_notify, test_handoff);
+    suite_add_tcase(s, tc_notify);
+
+    return s;
+}
+/**************
+ * test cases *
+ **************/
+
+int
+main(void)
+{
+    int nfail;
+
+    /* setup */
+    test_setup();
+
+    Suite *suite = notify_suite();
+    SRunner *srunner = srunner_create(suite);
+    srunner_set_log(srunner, DEBUG_LOG);
+    srunner_run_all(srunner, CK_ENV); /* set CK_VEBOSITY in ENV to customize */
+    nfail = srunner_ntests_failed(srunner);
+    srunner_free(srunner);
+
+    /* teardown */
+    test_teardown();
+
+    return (nfail == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
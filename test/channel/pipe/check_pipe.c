@@ -1,4 +1,6 @@
+#include <cc_array.h>
 #include <channel/cc_pipe.h>
+#include <channel/cc_tcp.h>
 #include <time/cc_timer.h>
 
 #include <check.h>
@@ -9,6 +11,9 @@
 #include <unistd.h>
 #include <time.h>
 #include <errno.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
 
 #define SUITE_NAME "pipe"
 #define DEBUG_LOG  SUITE_NAME ".log"
@@ -171,6 +176,116 @@ START_TEST(test_read_nonblocking)
 }
 END_TEST
 
+START_TEST(test_sendv_recvv)
+{
+#define PART1 "foo bar "
+#define PART2 "baz"
+#define LEN (sizeof(PART1) - 1 + sizeof(PART2))
+    struct pipe_conn *pipe;
+    struct array *send_array, *recv_array;
+    struct iovec *iov;
+    char part1[] = PART1, part2[] = PART2;
+    char head[4], tail[LEN - 4];
+
+    test_reset();
+
+    pipe = pipe_conn_create();
+    ck_assert_int_eq(pipe_open(NULL, pipe), true);
+
+    array_create(&send_array, 2, sizeof(struct iovec));
+    iov = array_push(send_array);
+    iov->iov_base = part1;
+    iov->iov_len = sizeof(PART1) - 1;
+    iov = array_push(send_array);
+    iov->iov_base = part2;
+    iov->iov_len = sizeof(PART2);
+    ck_assert_int_eq(pipe_sendv(pipe, send_array, LEN), LEN);
+
+    array_create(&recv_array, 2, sizeof(struct iovec));
+    iov = array_push(recv_array);
+    iov->iov_base = head;
+    iov->iov_len = sizeof(head);
+    iov = array_push(recv_array);
+    iov->iov_base = tail;
+    iov->iov_len = sizeof(tail);
+    ck_assert_int_eq(pipe_recvv(pipe, recv_array, LEN), LEN);
+    ck_assert_int_eq(memcmp(head, "foo ", sizeof(head)), 0);
+    ck_assert_str_eq(tail, "bar baz");
+    ck_assert_int_eq(pipe->send_nbyte, LEN);
+    ck_assert_int_eq(pipe->recv_nbyte, LEN);
+
+    array_destroy(&send_array);
+    array_destroy(&recv_array);
+    pipe_close(pipe);
+    pipe_conn_destroy(&pipe);
+#undef PART1
+#undef PART2
+#undef LEN
+}
+END_TEST
+
+START_TEST(test_splice)
+{
+#define MESSAGE "foo bar baz"
+#define LEN sizeof(MESSAGE)
+    struct pipe_conn *pipe;
+    struct tcp_conn *conn;
+    struct array *bufv;
+    struct iovec *iov;
+    char message[] = MESSAGE;
+    char buf[LEN];
+    int sv[2];
+
+    test_reset();
+
+    pipe = pipe_conn_create();
+    ck_assert_int_eq(pipe_open(NULL, pipe), true);
+    ck_assert_int_eq(socketpair(AF_UNIX, SOCK_STREAM, 0, sv), 0);
+    conn = tcp_conn_create();
+    conn->sd = sv[0];
+
+#ifdef CC_SPLICE
+    /* user buffers into the pipe, then pipe to socket */
+    array_create(&bufv, 1, sizeof(struct iovec));
+    iov = array_push(bufv);
+    iov->iov_base = message;
+    iov->iov_len = LEN;
+    ck_assert_int_eq(pipe_vmsplice(pipe, bufv, LEN), LEN);
+    ck_assert_int_eq(pipe_splice_send(pipe, conn, LEN), LEN);
+    ck_assert_int_eq(read(sv[1], buf, LEN), LEN);
+    ck_assert_str_eq(buf, MESSAGE);
+    ck_assert_int_eq(conn->send_nbyte, LEN);
+
+    /* empty pipe does not block */
+    ck_assert_int_eq(pipe_splice_send(pipe, conn, LEN), CC_EAGAIN);
+
+    /* socket to pipe */
+    ck_assert_int_eq(write(sv[1], MESSAGE, LEN), LEN);
+    ck_assert_int_eq(pipe_splice_recv(pipe, conn, LEN), LEN);
+    memset(buf, 0, LEN);
+    ck_assert_int_eq(pipe_recv(pipe, buf, LEN), LEN);
+    ck_assert_str_eq(buf, MESSAGE);
+    ck_assert_int_eq(conn->recv_nbyte, LEN);
+    array_destroy(&bufv);
+#else
+    (void)bufv;
+    (void)iov;
+    (void)message;
+    (void)buf;
+    ck_assert_int_eq(pipe_splice_send(pipe, conn, LEN), CC_ERROR);
+    ck_assert_int_eq(pipe->err, ENOTSUP);
+#endif
+
+    close(sv[0]);
+    close(sv[1]);
+    tcp_conn_destroy(&conn);
+    pipe_close(pipe);
+    pipe_conn_destroy(&pipe);
+#undef MESSAGE
+#undef LEN
+}
+END_TEST
+
 /*
  * test suite
  */
@@ -183,6 +298,8 @@ pipe_suite(void)
     tcase_add_test(tc_pipe, test_send_recv);
     tcase_add_test(tc_pipe, test_read_blocking);
     tcase_add_test(tc_pipe, test_read_nonblocking);
+    tcase_add_test(tc_pipe, test_sendv_recvv);
+    tcase_add_test(tc_pipe, test_splice);
     suite_add_tcase(s, tc_pipe);
 
     return s;
@@ -1,8 +1,14 @@
 #include <channel/cc_tcp.h>
+#include <channel/cc_tcp_client.h>
 #include <time/cc_timer.h>
+#include <time/cc_wheel.h>
 
 #include <check.h>
 
+#include <errno.h>
+#include <fcntl.h>
+#include <netinet/tcp.h>
+#include <poll.h>
 #include <pthread.h>
 #include <stdlib.h>
 #include <stdio.h>
@@ -32,6 +38,31 @@ test_reset(void)
     test_setup();
 }
 
+/* connect, and wait for the non-blocking connect to complete */
+static bool
+connect_wait(struct addrinfo *ai, struct tcp_conn *c)
+{
+    struct pollfd pfd;
+    rstatus_i status;
+
+    if (!tcp_connect(ai, c)) {
+        return false;
+    }
+
+    pfd.fd = c->sd;
+    pfd.events = POLLOUT;
+    while ((status = tcp_connect_finish(c)) == CC_EAGAIN) {
+        poll(&pfd, 1, 100);
+    }
+    if (status != CC_OK) {
+        tcp_close(c);
+
+        return false;
+    }
+
+    return true;
+}
+
 static void
 find_port_listen(struct tcp_conn **_conn_listen, struct addrinfo **_ai, uint16_t *_port)
 {
@@ -56,7 +87,7 @@ find_port_listen(struct tcp_conn **_conn_listen, struct addrinfo **_ai, uint16_t
     for (;;) {
         sprintf(servname, "%"PRIu32, port);
         ck_assert_int_eq(getaddrinfo("localhost", servname, &hints, &ai), 0);
-        if (tcp_connect(ai, conn_client)) {
+        if (connect_wait(ai, conn_client)) {
             // port is in use by other process
             freeaddrinfo(ai);
             tcp_close(conn_client);
@@ -72,7 +103,7 @@ find_port_listen(struct tcp_conn **_conn_listen, struct addrinfo **_ai, uint16_t
         freeaddrinfo(ai);
     }
     /* for some reason this line is needed, I would appreciate some insight */
-    ck_assert(tcp_connect(ai, conn_client));
+    ck_assert(connect_wait(ai, conn_client));
     tcp_reject(conn_listen);
 
     if (_conn_listen) {
@@ -100,7 +131,7 @@ START_TEST(test_listen_connect)
     conn_client = tcp_conn_create();
     ck_assert_ptr_ne(conn_client, NULL);
 
-    ck_assert_int_eq(tcp_connect(ai, conn_client), true);
+    ck_assert(connect_wait(ai, conn_client));
 
     tcp_close(conn_listen);
     tcp_close(conn_client);
@@ -152,7 +183,7 @@ START_TEST(test_client_send_server_recv)
     conn_client = tcp_conn_create();
     ck_assert_ptr_ne(conn_client, NULL);
 
-    ck_assert_int_eq(tcp_connect(ai, conn_client), true);
+    ck_assert(connect_wait(ai, conn_client));
 
     conn_server = tcp_conn_create();
     ck_assert_ptr_ne(conn_server, NULL);
@@ -194,7 +225,7 @@ START_TEST(test_server_send_client_recv)
     conn_client = tcp_conn_create();
     ck_assert_ptr_ne(conn_client, NULL);
 
-    ck_assert_int_eq(tcp_connect(ai, conn_client), true);
+    ck_assert(connect_wait(ai, conn_client));
 
     conn_server = tcp_conn_create();
     ck_assert_ptr_ne(conn_server, NULL);
@@ -247,7 +278,7 @@ START_TEST(test_client_sendv_server_recvv)
     conn_client = tcp_conn_create();
     ck_assert_ptr_ne(conn_client, NULL);
 
-    ck_assert_int_eq(tcp_connect(ai, conn_client), true);
+    ck_assert(connect_wait(ai, conn_client));
 
     conn_server = tcp_conn_create();
     ck_assert_ptr_ne(conn_server, NULL);
@@ -310,7 +341,7 @@ START_TEST(test_nonblocking)
     conn_client = tcp_conn_create();
     ck_assert_ptr_ne(conn_client, NULL);
 
-    ck_assert_int_eq(tcp_connect(ai, conn_client), true);
+    ck_assert(connect_wait(ai, conn_client));
 
     conn_server = tcp_conn_create();
     ck_assert_ptr_ne(conn_server, NULL);
@@ -348,6 +379,246 @@ START_TEST(test_nonblocking)
 }
 END_TEST
 
+START_TEST(test_conn_info)
+{
+#define LEN 20
+#define RATE 2
+    struct tcp_conn *conn_listen, *conn_client, *conn_server;
+    struct tcp_conn_info info;
+    struct addrinfo *ai;
+    tcp_options_st options = { TCP_OPTION(OPTION_INIT) };
+    tcp_metrics_st metrics = { TCP_METRIC(METRIC_INIT) };
+    char data[LEN + 1] = {0};
+    ssize_t recv;
+    int i;
+
+    find_port_listen(&conn_listen, &ai, NULL);
+
+    option_load_default((struct option *)&options, OPTION_CARDINALITY(options));
+    options.tcp_info_rate.val.vuint = RATE;
+    tcp_teardown();
+    tcp_setup(&options, &metrics);
+
+    conn_client = tcp_conn_create();
+    ck_assert_ptr_ne(conn_client, NULL);
+    ck_assert(connect_wait(ai, conn_client));
+    conn_server = tcp_conn_create();
+    ck_assert_ptr_ne(conn_server, NULL);
+    ck_assert(tcp_accept(conn_listen, conn_server));
+
+    ck_assert_int_eq(tcp_send(conn_client, data, LEN), LEN);
+    while ((recv = tcp_recv(conn_server, data, LEN + 1)) == CC_EAGAIN) {}
+    ck_assert_int_eq(recv, LEN);
+
+    /* stats are read from the kernel */
+    ck_assert_int_eq(tcp_conn_info(conn_client, &info), CC_OK);
+    ck_assert_uint_gt(info.rtt, 0);
+    ck_assert_uint_gt(info.snd_cwnd, 0);
+    ck_assert_uint_eq(info.total_retrans, 0);
+    ck_assert_int_eq(tcp_conn_info(conn_listen, &info), CC_OK);
+
+    /* 1 in RATE calls is sampled */
+    for (i = 0; i < 2 * RATE; i++) {
+        tcp_conn_sample(conn_client);
+    }
+    ck_assert_uint_eq(metrics.tcp_info_sample.counter, 2);
+    ck_assert_uint_eq(metrics.tcp_retrans.counter, 0);
+
+    tcp_info_report();
+    ck_assert_int_gt(metrics.tcp_rtt_p50.gauge, 0);
+    ck_assert_int_ge(metrics.tcp_rtt_max.gauge, metrics.tcp_rtt_p50.gauge);
+    ck_assert_int_eq(metrics.tcp_inretrans_max.gauge, 0);
+
+    /* an interval without samples reports 0 */
+    tcp_info_report();
+    ck_assert_int_eq(metrics.tcp_rtt_max.gauge, 0);
+
+    tcp_close(conn_listen);
+    tcp_close(conn_server);
+    tcp_close(conn_client);
+
+    /* closed connection cannot be sampled */
+    ck_assert_int_eq(tcp_conn_info(conn_client, &info), CC_ERROR);
+    tcp_conn_sample(conn_client);
+    tcp_conn_sample(conn_client);
+    ck_assert_uint_eq(metrics.tcp_info_sample_ex.counter, 1);
+
+    tcp_conn_destroy(&conn_listen);
+    tcp_conn_destroy(&conn_client);
+    tcp_conn_destroy(&conn_server);
+    freeaddrinfo(ai);
+    test_reset();
+#undef LEN
+#undef RATE
+}
+END_TEST
+
+START_TEST(test_profile)
+{
+#define RCVBUF 65536
+    struct tcp_conn *conn_listen, *conn_client, *conn_server;
+    struct addrinfo *ai;
+    tcp_options_st options = { TCP_OPTION(OPTION_INIT) };
+    int val, sd;
+    socklen_t len = sizeof(val);
+
+    option_load_default((struct option *)&options, OPTION_CARDINALITY(options));
+    options.tcp_keepalive.val.vbool = true;
+    options.tcp_sndbuf_max.val.vbool = true;
+    options.tcp_rcvbuf.val.vuint = RCVBUF;
+    tcp_teardown();
+    tcp_setup(&options, NULL);
+
+    ck_assert(tcp_profile()->nodelay);
+    ck_assert(tcp_profile()->keepalive);
+    ck_assert_int_gt(tcp_profile()->sndbuf, 0);
+    ck_assert_int_eq(tcp_profile()->rcvbuf, RCVBUF);
+
+    /* find_port_listen resets the module, so listen again */
+    find_port_listen(&conn_listen, &ai, NULL);
+    tcp_close(conn_listen);
+    tcp_teardown();
+    tcp_setup(&options, NULL);
+    ck_assert(tcp_listen(ai, conn_listen));
+
+    conn_client = tcp_conn_create();
+    ck_assert(connect_wait(ai, conn_client));
+    conn_server = tcp_conn_create();
+    ck_assert(tcp_accept(conn_listen, conn_server));
+
+    /* accepted sockets carry the whole profile */
+    ck_assert_int_eq(getsockopt(conn_server->sd, IPPROTO_TCP, TCP_NODELAY,
+                &val, &len), 0);
+    ck_assert_int_ne(val, 0);
+    ck_assert_int_eq(getsockopt(conn_server->sd, SOL_SOCKET, SO_KEEPALIVE,
+                &val, &len), 0);
+    ck_assert_int_ne(val, 0);
+    ck_assert_int_ge(tcp_get_rcvbuf(conn_server->sd), RCVBUF);
+    sd = socket(AF_INET, SOCK_STREAM, 0);
+    ck_assert_int_ge(sd, 0);
+    ck_assert_int_gt(tcp_get_sndbuf(conn_server->sd), tcp_get_sndbuf(sd));
+    close(sd);
+    ck_assert_int_eq(getsockopt(conn_client->sd, SOL_SOCKET, SO_KEEPALIVE,
+                &val, &len), 0);
+    ck_assert_int_ne(val, 0);
+
+    tcp_close(conn_listen);
+    tcp_close(conn_server);
+    tcp_close(conn_client);
+    tcp_conn_destroy(&conn_listen);
+    tcp_conn_destroy(&conn_client);
+    tcp_conn_destroy(&conn_server);
+    freeaddrinfo(ai);
+    test_reset();
+#undef RCVBUF
+}
+END_TEST
+
+START_TEST(test_client_pool)
+{
+#define NCONN 3
+    struct tcp_conn *conn_listen, *conn_server[NCONN], *c[NCONN], *conn;
+    struct tcp_client_pool *pool;
+    struct timing_wheel *tw;
+    struct timeout tick, deadline;
+    struct addrinfo *ai;
+    int i;
+
+    find_port_listen(&conn_listen, &ai, NULL);
+
+    timing_wheel_setup(NULL);
+    timeout_set_ms(&tick, 1);
+    tw = timing_wheel_create(&tick, 1024, 1024);
+    ck_assert_ptr_ne(tw, NULL);
+    timeout_set_ms(&deadline, 100);
+
+    pool = tcp_client_pool_create(ai, NCONN, tw, &deadline);
+    ck_assert_ptr_ne(pool, NULL);
+
+    /* nothing established yet, get starts connecting */
+    ck_assert_ptr_eq(tcp_client_pool_get(pool), NULL);
+    ck_assert_int_eq(pool->nconnect, NCONN);
+    ck_assert_int_eq(tw->nevent, NCONN);
+    ck_assert_int_eq(tcp_client_pool_connect(pool), 0);
+
+    for (i = 0; i < NCONN; i++) {
+        struct pollfd pfd = {.fd = pool->client[i].c->sd, .events = POLLOUT};
+
+        ck_assert_int_eq(poll(&pfd, 1, 1000), 1);
+        ck_assert_int_eq(tcp_client_pool_ready(pool, pool->client[i].c), CC_OK);
+        conn_server[i] = tcp_conn_create();
+        ck_assert(tcp_accept(conn_listen, conn_server[i]));
+    }
+    ck_assert_int_eq(tw->nevent, 0);
+    ck_assert_int_eq(tcp_client_pool_nactive(pool), NCONN);
+
+    /* least loaded first, ties round robin */
+    for (i = 0; i < NCONN; i++) {
+        c[i] = tcp_client_pool_get(pool);
+        ck_assert_ptr_eq(c[i], pool->client[i].c);
+    }
+    tcp_client_pool_put(pool, c[1]);
+    ck_assert_ptr_eq(tcp_client_pool_get(pool), c[1]);
+    tcp_client_pool_put(pool, c[2]);
+    tcp_client_pool_put(pool, c[2]);
+    conn = tcp_client_pool_get(pool);
+    ck_assert_ptr_eq(conn, c[2]);
+    ck_assert_int_eq(pool->client[2].nreq, 1);
+
+    /* a closed connection is skipped, then reconnected */
+    tcp_client_pool_close(pool, c[0]);
+    ck_assert_int_eq(tcp_client_pool_nactive(pool), NCONN - 1);
+    for (i = 0; i < 4; i++) {
+        ck_assert_ptr_ne(tcp_client_pool_get(pool), c[0]);
+    }
+    ck_assert_int_eq(tcp_client_pool_connect(pool), 1);
+    ck_assert_int_eq(tw->nevent, 1);
+
+    /* the connect deadline expires before it is completed */
+    timing_wheel_flush(tw);
+    ck_assert_int_eq(pool->ntimeout, 1);
+    ck_assert_int_eq(pool->client[0].c->err, ETIMEDOUT);
+    ck_assert_int_eq(tcp_client_pool_nactive(pool), NCONN - 1);
+
+    tcp_client_pool_destroy(&pool);
+    ck_assert_ptr_eq(pool, NULL);
+    timing_wheel_destroy(&tw);
+    timing_wheel_teardown();
+
+    for (i = 0; i < NCONN; i++) {
+        tcp_close(conn_server[i]);
+        tcp_conn_destroy(&conn_server[i]);
+    }
+    tcp_close(conn_listen);
+    tcp_conn_destroy(&conn_listen);
+
+    /* refused connects must not leave the socket open */
+    pool = tcp_client_pool_create(ai, 1, NULL, NULL);
+    ck_assert_ptr_ne(pool, NULL);
+    for (i = 0; i < 4; i++) {
+        struct pollfd pfd = {.events = POLLOUT};
+        int sd;
+
+        if (tcp_client_pool_connect(pool) == 0) { /* refused right away */
+            continue;
+        }
+        sd = pfd.fd = pool->client[0].c->sd;
+
+        ck_assert_int_eq(poll(&pfd, 1, 1000), 1);
+        ck_assert_int_eq(tcp_client_pool_ready(pool, pool->client[0].c),
+                CC_ERROR);
+        ck_assert_int_eq(fcntl(sd, F_GETFD), -1);
+        ck_assert_int_eq(errno, EBADF);
+    }
+    ck_assert_int_eq(pool->nfail, 4);
+    ck_assert_int_eq(tcp_client_pool_nactive(pool), 0);
+    tcp_client_pool_destroy(&pool);
+
+    freeaddrinfo(ai);
+#undef NCONN
+}
+END_TEST
+
 /*
  * test suite
  */
@@ -364,6 +635,9 @@ log_suite(void)
     tcase_add_test(tc_log, test_server_send_client_recv);
     tcase_add_test(tc_log, test_client_sendv_server_recvv);
     tcase_add_test(tc_log, test_nonblocking);
+    tcase_add_test(tc_log, test_conn_info);
+    tcase_add_test(tc_log, test_profile);
+    tcase_add_test(tc_log, test_client_pool);
 
     return s;
 }
@@ -28,7 +28,7 @@ static void
 test_setup(void)
 {
     event_log_count = 0;
-    event_setup(NULL);
+    event_setup(NULL, NULL);
 }
 
 static void
@@ -142,6 +142,72 @@ START_TEST(test_write)
 }
 END_TEST
 
+START_TEST(test_busy_poll)
+{
+#define DATA "foo bar baz"
+    struct event_base *event_base;
+    int random_pointer[1] = {1};
+    struct pipe_conn *pipe;
+    event_metrics_st metrics = { EVENT_METRIC(METRIC_INIT) };
+    event_options_st options = { EVENT_OPTION(OPTION_INIT) };
+    uint64_t nhit, nblock;
+    char buf[sizeof(DATA)];
+
+    test_teardown();
+    event_log_count = 0;
+    option_load_default((struct option *)&options, OPTION_CARDINALITY(options));
+    options.event_busy_poll.val.vuint = 1000;
+    event_setup(&options, &metrics);
+
+    /* the budget of a new event base comes from the option */
+    event_base = event_base_create(1024, log_event);
+
+    pipe = pipe_conn_create();
+    ck_assert_int_eq(pipe_open(NULL, pipe), true);
+    event_add_read(event_base, pipe_read_id(pipe), random_pointer);
+
+    /* nothing to read: spin for the budget, then block until timeout */
+    ck_assert_int_eq(event_wait(event_base, 10), 0);
+    event_base_spin_stats(event_base, &nhit, &nblock);
+    ck_assert_int_eq(nhit, 0);
+    ck_assert_int_eq(nblock, 1);
+    ck_assert_int_eq(metrics.event_loop.counter, 1);
+    ck_assert_int_gt(metrics.event_spin.counter, 0);
+
+    /* data ready: served while spinning */
+    ck_assert_int_eq(pipe_send(pipe, DATA, sizeof(DATA)), sizeof(DATA));
+    ck_assert_int_eq(event_wait(event_base, -1), 1);
+    ck_assert_int_eq(event_log_count, 1);
+    ck_assert_ptr_eq(event_log[0].arg, random_pointer);
+    ck_assert_int_eq(event_log[0].events, EVENT_READ);
+    event_base_spin_stats(event_base, &nhit, &nblock);
+    ck_assert_int_eq(nhit, 1);
+    ck_assert_int_eq(nblock, 1);
+    ck_assert_int_eq(metrics.event_spin_hit.counter, 1);
+    ck_assert_int_eq(metrics.event_spin_block.counter, 1);
+    ck_assert_int_eq(metrics.event_loop.counter, 2);
+
+    /* a timeout shorter than the budget is spent spinning only */
+    event_base_busy_poll(event_base, 1000000);
+    ck_assert_int_eq(pipe_recv(pipe, buf, sizeof(DATA)), sizeof(DATA));
+    event_log_count = 0;
+    ck_assert_int_eq(event_wait(event_base, 2), 0);
+    event_base_spin_stats(event_base, &nhit, &nblock);
+    ck_assert_int_eq(nhit, 1);
+    ck_assert_int_eq(nblock, 1);
+    ck_assert_int_eq(event_log_count, 0);
+    ck_assert_int_eq(metrics.event_loop.counter, 3);
+
+    ck_assert_int_eq(event_del(event_base, pipe_read_id(pipe)), 0);
+    event_base_destroy(&event_base);
+    pipe_close(pipe);
+    pipe_conn_destroy(&pipe);
+
+    test_reset();
+#undef DATA
+}
+END_TEST
+
 /*
  * test suite
  */
@@ -157,6 +223,7 @@ event_suite(void)
     tcase_add_test(tc_event, test_read);
     tcase_add_test(tc_event, test_cannot_read);
     tcase_add_test(tc_event, test_write);
+    tcase_add_test(tc_event, test_busy_poll);
 
     return s;
 }
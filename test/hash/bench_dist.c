@@ -0,0 +1,102 @@
+/*
+ * lookup latency of each distribution at a given number of nodes, and the
+ * cost of adding and removing a node:
+ *
+ *  bench_dist [nnode] [nlookup]
+ */
+
+#include <hash/cc_dist.h>
+#include <time/cc_timer.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#define BENCH_NNODE     1000
+#define BENCH_NLOOKUP   (1 << 20)
+#define BENCH_NKEY      4096        /* distinct keys, reused round robin */
+#define BENCH_KEYLEN    32
+
+static char key[BENCH_NKEY][BENCH_KEYLEN];
+static uint32_t keylen[BENCH_NKEY];
+static volatile uint32_t sink;
+
+static const char *dist_name[DIST_SENTINEL] = {
+    "ketama", "jump", "rendezvous"
+};
+
+static void
+_bench(dist_type_e type, uint32_t nnode, uint32_t nlookup)
+{
+    struct dist *d;
+    struct duration dbuild, dchurn, dlookup;
+    char name[32];
+    uint32_t i, id, acc = 0;
+
+    d = dist_create(type, nnode);
+    if (d == NULL) {
+        fprintf(stderr, "cannot create dist\n");
+        exit(EXIT_FAILURE);
+    }
+
+    duration_start(&dbuild);
+    for (i = 0; i < nnode; i++) {
+        int len = snprintf(name, sizeof(name), "10.%u.%u.%u:11211",
+                (i >> 16) & 0xff, (i >> 8) & 0xff, i & 0xff);
+
+        if (dist_add(d, name, len, 1, &id) != CC_OK) {
+            fprintf(stderr, "cannot add node\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+    duration_stop(&dbuild);
+
+    /* remove and re-add the last node, the only churn jump hash allows */
+    duration_start(&dchurn);
+    dist_remove(d, id);
+    dist_add(d, name, cc_strlen(name), 1, &id);
+    duration_stop(&dchurn);
+
+    duration_start(&dlookup);
+    for (i = 0; i < nlookup; i++) {
+        acc += dist_lookup(d, key[i % BENCH_NKEY], keylen[i % BENCH_NKEY]);
+    }
+    duration_stop(&dlookup);
+    sink = acc;
+
+    printf("%-12s %8u %12.2f %12.2f %12.2f\n", dist_name[type], nnode,
+            duration_ms(&dbuild), duration_us(&dchurn),
+            duration_ns(&dlookup) / nlookup);
+
+    dist_destroy(&d);
+}
+
+int
+main(int argc, char *argv[])
+{
+    uint32_t nnode = BENCH_NNODE, nlookup = BENCH_NLOOKUP, i;
+    int t;
+
+    if (argc > 1) {
+        nnode = (uint32_t)strtoul(argv[1], NULL, 10);
+    }
+    if (argc > 2) {
+        nlookup = (uint32_t)strtoul(argv[2], NULL, 10);
+    }
+    if (nnode == 0 || nlookup == 0) {
+        fprintf(stderr, "usage: %s [nnode] [nlookup]\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    for (i = 0; i < BENCH_NKEY; i++) {
+        keylen[i] = (uint32_t)snprintf(key[i], BENCH_KEYLEN, "user:%u:profile",
+                i * 7919);
+    }
+
+    printf("%-12s %8s %12s %12s %12s\n", "dist", "nnode", "build (ms)",
+            "churn (us)", "ns/lookup");
+    for (t = 0; t < DIST_SENTINEL; t++) {
+        _bench(t, nnode, nlookup);
+    }
+
+    return EXIT_SUCCESS;
+}
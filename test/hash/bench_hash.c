@@ -0,0 +1,136 @@
+/*
+ * throughput of xxh3 (one-shot and hash_many) against murmur3 (one-shot and
+ * hash_murmur3_32_many) across key sizes, in ns per key and GB/s:
+ *
+ *  bench_hash [nkey_total]
+ */
+
+#include <hash/cc_hash.h>
+#include <hash/cc_murmur3.h>
+#include <time/cc_timer.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#define BENCH_NKEY      (1 << 22)   /* keys hashed per key size by default */
+#define BENCH_BATCH     256         /* keys per hash_many call */
+#define BENCH_DATA      (1 << 20)   /* keys are drawn from this much memory */
+
+static const size_t key_size[] = {4, 8, 16, 32, 64, 128, 256, 1024, 4096};
+
+static uint8_t data[BENCH_DATA + 4096];
+static volatile uint64_t sink;
+
+enum bench_hash {
+    BENCH_XXH3_64,
+    BENCH_XXH3_128,
+    BENCH_XXH3_MANY,
+    BENCH_MURMUR3_32,
+    BENCH_MURMUR3_MANY,
+    BENCH_MURMUR3_128,
+
+    BENCH_SENTINEL
+};
+
+static const char *bench_name[BENCH_SENTINEL] = {
+    "xxh3_64", "xxh3_128", "hash_many", "murmur3_32",
+    "murmur3_many", "murmur3_128"
+};
+
+static double
+_run(enum bench_hash type, size_t size, size_t nkey)
+{
+    const void *keys[BENCH_BATCH];
+    size_t lens[BENCH_BATCH];
+    uint64_t out[BENCH_BATCH], acc = 0;
+    uint32_t h32, out32[BENCH_BATCH];
+    uint64_t h128[2];
+    struct duration d;
+    size_t i, j;
+
+    duration_start(&d);
+    for (i = 0; i < nkey; i += BENCH_BATCH) {
+        for (j = 0; j < BENCH_BATCH; j++) {
+            keys[j] = data + ((i + j) * 4099) % BENCH_DATA;
+            lens[j] = size;
+        }
+
+        switch (type) {
+        case BENCH_XXH3_64:
+            for (j = 0; j < BENCH_BATCH; j++) {
+                acc += hash_xxh3_64(keys[j], size, 0);
+            }
+            break;
+
+        case BENCH_XXH3_128:
+            for (j = 0; j < BENCH_BATCH; j++) {
+                acc += hash_xxh3_128(keys[j], size, 0).low;
+            }
+            break;
+
+        case BENCH_XXH3_MANY:
+            hash_many(keys, lens, out, BENCH_BATCH, 0);
+            acc += out[BENCH_BATCH - 1];
+            break;
+
+        case BENCH_MURMUR3_32:
+            for (j = 0; j < BENCH_BATCH; j++) {
+                hash_murmur3_32(keys[j], (int)size, 0, &h32);
+                acc += h32;
+            }
+            break;
+
+        case BENCH_MURMUR3_MANY:
+            hash_murmur3_32_many(keys, lens, out32, BENCH_BATCH, 0);
+            acc += out32[BENCH_BATCH - 1];
+            break;
+
+        case BENCH_MURMUR3_128:
+            for (j = 0; j < BENCH_BATCH; j++) {
+                hash_murmur3_128_x64(keys[j], (int)size, 0, h128);
+                acc += h128[0];
+            }
+            break;
+
+        default:
+            break;
+        }
+    }
+    duration_stop(&d);
+    sink = acc;
+
+    return duration_ns(&d) / nkey;
+}
+
+int
+main(int argc, char *argv[])
+{
+    size_t nkey = BENCH_NKEY, i;
+    int t;
+
+    if (argc > 1) {
+        nkey = strtoul(argv[1], NULL, 10);
+    }
+    if (nkey < BENCH_BATCH) {
+        nkey = BENCH_BATCH;
+    }
+
+    for (i = 0; i < sizeof(data); i++) {
+        data[i] = (uint8_t)(i * 131 + 17);
+    }
+
+    printf("%-12s %8s %12s %10s\n", "hash", "key size", "ns/key", "GB/s");
+    for (i = 0; i < sizeof(key_size) / sizeof(key_size[0]); i++) {
+        /* keep the bytes hashed per key size roughly constant */
+        size_t n = nkey / (key_size[i] > 64 ? key_size[i] / 64 : 1);
+
+        for (t = 0; t < BENCH_SENTINEL; t++) {
+            double ns = _run(t, key_size[i], n);
+
+            printf("%-12s %8zu %12.2f %10.2f\n", bench_name[t], key_size[i],
+                    ns, key_size[i] / ns);
+        }
+    }
+
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,370 @@
+#include <hash/cc_dist.h>
+#include <hash/cc_hash.h>
+#include <hash/cc_murmur3.h>
+
+#include <check.h>
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#define SUITE_NAME "hash"
+#define DEBUG_LOG  SUITE_NAME ".log"
+
+#define SEED 0x9e3779b97f4a7c15ULL
+
+static char data[4096];
+
+/*
+ * utilities
+ */
+static void
+test_setup(void)
+{
+    size_t i;
+
+    for (i = 0; i < sizeof(data); i++) {
+        data[i] = (char)(i * 31 + 7);
+    }
+}
+
+static void
+test_teardown(void)
+{
+}
+
+START_TEST(test_xxh3_vectors)
+{
+    struct hash128 h;
+
+    /* reference digests of the empty input, from the xxHash test suite */
+    ck_assert_uint_eq(hash_xxh3_64("", 0, 0), 0x2D06800538D394C2ULL);
+    h = hash_xxh3_128("", 0, 0);
+    ck_assert_uint_eq(h.low, 0x6001C324468D497FULL);
+    ck_assert_uint_eq(h.high, 0x99AA06D3014798D8ULL);
+
+    /* seed and content matter */
+    ck_assert_uint_ne(hash_xxh3_64(data, 16, 0), hash_xxh3_64(data, 16, SEED));
+    ck_assert_uint_ne(hash_xxh3_64(data, 16, 0), hash_xxh3_64(data + 1, 16, 0));
+}
+END_TEST
+
+START_TEST(test_streaming)
+{
+    static const size_t len[] = {0, 1, 3, 16, 17, 128, 129, 240, 241, 1024,
+        sizeof(data)};
+    struct hash_state *state;
+    struct hash128 h1, h2;
+    size_t i, off, step;
+
+    state = hash_state_create(SEED);
+    ck_assert_ptr_ne(state, NULL);
+
+    /* feeding in pieces of any size gives the one-shot digest */
+    for (i = 0; i < sizeof(len) / sizeof(len[0]); i++) {
+        for (step = 1; step <= 257; step += 64) {
+            hash_reset(state, SEED);
+            for (off = 0; off < len[i]; off += step) {
+                size_t n = len[i] - off < step ? len[i] - off : step;
+
+                ck_assert_int_eq(hash_update(state, data + off, n), CC_OK);
+            }
+            ck_assert_uint_eq(hash_digest_64(state),
+                    hash_xxh3_64(data, len[i], SEED));
+            h1 = hash_digest_128(state);
+            h2 = hash_xxh3_128(data, len[i], SEED);
+            ck_assert_uint_eq(h1.low, h2.low);
+            ck_assert_uint_eq(h1.high, h2.high);
+        }
+    }
+
+    /* reset to another seed */
+    hash_reset(state, 0);
+    hash_update(state, data, 100);
+    ck_assert_uint_eq(hash_digest_64(state), hash_xxh3_64(data, 100, 0));
+
+    hash_state_destroy(&state);
+    ck_assert_ptr_eq(state, NULL);
+}
+END_TEST
+
+START_TEST(test_many)
+{
+#define NKEY 100
+    const void *keys[NKEY];
+    size_t lens[NKEY];
+    uint64_t out[NKEY];
+    size_t i;
+
+    for (i = 0; i < NKEY; i++) {
+        keys[i] = data + i * 7;
+        lens[i] = i % 50;
+    }
+
+    hash_many(keys, lens, out, NKEY, SEED);
+    for (i = 0; i < NKEY; i++) {
+        ck_assert_uint_eq(out[i], hash_xxh3_64(keys[i], lens[i], SEED));
+    }
+
+    /* empty batch touches nothing */
+    hash_many(keys, lens, NULL, 0, SEED);
+#undef NKEY
+}
+END_TEST
+
+START_TEST(test_murmur3_many)
+{
+#define NKEY 111 /* 13 groups of 8, one of 4, 3 left for the scalar tail */
+    const void *keys[NKEY];
+    size_t lens[NKEY];
+    uint32_t out[NKEY], h;
+    size_t i, n;
+
+    /* lanes of a group have different lengths, including 0 and long keys */
+    for (i = 0; i < NKEY; i++) {
+        keys[i] = data + i * 13;
+        lens[i] = (i * 7) % 41;
+    }
+    lens[5] = 1000;
+    lens[NKEY - 6] = 2000;
+
+    /* every batch size covers a different mix of vector and scalar paths */
+    for (n = 0; n <= NKEY; n += 37) {
+        hash_murmur3_32_many(keys, lens, out, n, (uint32_t)SEED);
+        for (i = 0; i < n; i++) {
+            hash_murmur3_32(keys[i], (int)lens[i], (uint32_t)SEED, &h);
+            ck_assert_uint_eq(out[i], h);
+        }
+    }
+
+    hash_murmur3_32_many(keys, lens, out, NKEY, 0);
+    for (i = 0; i < NKEY; i++) {
+        hash_murmur3_32(keys[i], (int)lens[i], 0, &h);
+        ck_assert_uint_eq(out[i], h);
+    }
+#undef NKEY
+}
+END_TEST
+
+#define NNODE 20
+#define NKEY 20000
+
+static char *
+key_of(char *buf, uint32_t i, uint32_t *len)
+{
+    *len = (uint32_t)snprintf(buf, 32, "key:%u", i);
+
+    return buf;
+}
+
+static void
+add_nodes(struct dist *d, uint32_t id[], uint32_t n, uint32_t weight)
+{
+    char name[32];
+    uint32_t i;
+
+    for (i = 0; i < n; i++) {
+        int len = snprintf(name, sizeof(name), "10.0.0.%u:11211", i);
+
+        ck_assert_int_eq(dist_add(d, name, len, weight, &id[i]), CC_OK);
+    }
+    ck_assert_int_eq(dist_nnode(d), n);
+}
+
+/*
+ * removing a node moves only the keys it owned, and keys are spread fairly
+ * (every node gets at least half its fair share)
+ */
+static void
+check_remove(dist_type_e type, uint32_t removed)
+{
+    struct dist *d;
+    uint32_t id[NNODE], count[NNODE] = {0}, *owner, i, len;
+    char buf[32];
+
+    owner = malloc(sizeof(*owner) * NKEY);
+    d = dist_create(type, 4);
+    ck_assert_ptr_ne(d, NULL);
+    ck_assert_int_eq(dist_lookup(d, "k", 1), DIST_NODE_NONE);
+
+    add_nodes(d, id, NNODE, 1);
+    for (i = 0; i < NKEY; i++) {
+        key_of(buf, i, &len);
+        owner[i] = dist_lookup(d, buf, len);
+        ck_assert_int_lt(owner[i], NNODE);
+        count[owner[i]]++;
+    }
+    for (i = 0; i < NNODE; i++) {
+        ck_assert_int_gt(count[i], NKEY / NNODE / 2);
+    }
+
+    ck_assert_int_eq(dist_remove(d, id[removed]), CC_OK);
+    ck_assert_int_eq(dist_remove(d, id[removed]), CC_EINVAL);
+    for (i = 0; i < NKEY; i++) {
+        uint32_t now;
+
+        key_of(buf, i, &len);
+        now = dist_lookup(d, buf, len);
+        ck_assert_int_ne(now, id[removed]);
+        if (owner[i] != id[removed]) {
+            ck_assert_int_eq(now, owner[i]);
+        }
+    }
+
+    /* adding it back restores the mapping */
+    ck_assert_int_eq(dist_add(d, "10.0.0.0:11211", 14, 1, &i), CC_OK);
+    if (removed == 0) {
+        ck_assert_int_eq(i, id[removed]);
+        for (i = 0; i < NKEY; i++) {
+            key_of(buf, i, &len);
+            ck_assert_int_eq(dist_lookup(d, buf, len), owner[i]);
+        }
+    }
+
+    dist_destroy(&d);
+    ck_assert_ptr_eq(d, NULL);
+    free(owner);
+}
+
+START_TEST(test_ketama)
+{
+    struct dist *d;
+    uint32_t id[NNODE], count[2] = {0}, i, len;
+    char buf[32];
+
+    check_remove(DIST_KETAMA, 0);
+    check_remove(DIST_KETAMA, NNODE / 2);
+
+    /* continuum holds the points of live nodes only */
+    d = dist_create(DIST_KETAMA, 0);
+    add_nodes(d, id, 3, 2);
+    ck_assert_int_eq(array_nelem(&d->point), 3 * 2 * DIST_KETAMA_POINT);
+    ck_assert_int_eq(dist_remove(d, id[1]), CC_OK);
+    ck_assert_int_eq(array_nelem(&d->point), 2 * 2 * DIST_KETAMA_POINT);
+    for (i = 1; i < array_nelem(&d->point); i++) {
+        ck_assert_int_le(((struct dist_point *)array_get(&d->point, i - 1))->hash,
+                ((struct dist_point *)array_get(&d->point, i))->hash);
+    }
+    ck_assert_int_eq(dist_add(d, "", 0, 1, &i), CC_EINVAL);
+    ck_assert_int_eq(dist_add(d, "a", 1, 0, &i), CC_EINVAL);
+    dist_destroy(&d);
+
+    /* weights */
+    d = dist_create(DIST_KETAMA, 2);
+    ck_assert_int_eq(dist_add(d, "light", 5, 1, &id[0]), CC_OK);
+    ck_assert_int_eq(dist_add(d, "heavy", 5, 3, &id[1]), CC_OK);
+    for (i = 0; i < NKEY; i++) {
+        key_of(buf, i, &len);
+        count[dist_lookup(d, buf, len)]++;
+    }
+    ck_assert_int_gt(count[id[1]], 2 * count[id[0]]);
+    dist_destroy(&d);
+}
+END_TEST
+
+START_TEST(test_jump)
+{
+    struct dist *d;
+    uint32_t id[NNODE];
+    uint64_t key;
+    int32_t n;
+
+    /* known values of the reference implementation */
+    ck_assert_int_eq(dist_jump_hash(0, 1), 0);
+    ck_assert_int_eq(dist_jump_hash(0, 1000), 0);
+    for (key = 1; key < 1000; key++) {
+        /* growing from n to n + 1 buckets moves keys only to bucket n */
+        for (n = 1; n < 50; n++) {
+            int32_t b = dist_jump_hash(key * 0x9e3779b97f4a7c15ULL, n);
+            int32_t b1 = dist_jump_hash(key * 0x9e3779b97f4a7c15ULL, n + 1);
+
+            ck_assert(b1 == b || b1 == n);
+        }
+    }
+
+    check_remove(DIST_JUMP, NNODE - 1);
+
+    /* only the last node can go */
+    d = dist_create(DIST_JUMP, NNODE);
+    add_nodes(d, id, 3, 1);
+    ck_assert_int_eq(dist_remove(d, id[0]), CC_EINVAL);
+    ck_assert_int_eq(dist_remove(d, id[2]), CC_OK);
+    ck_assert_int_eq(dist_remove(d, id[1]), CC_OK);
+    ck_assert_int_eq(dist_nnode(d), 1);
+    dist_destroy(&d);
+}
+END_TEST
+
+START_TEST(test_rendezvous)
+{
+    struct dist *d;
+    uint32_t id[2], count[2] = {0}, i, len;
+    char buf[32];
+
+    check_remove(DIST_RENDEZVOUS, 0);
+    check_remove(DIST_RENDEZVOUS, NNODE / 2);
+
+    d = dist_create(DIST_RENDEZVOUS, 2);
+    ck_assert_int_eq(dist_add(d, "light", 5, 1, &id[0]), CC_OK);
+    ck_assert_int_eq(dist_add(d, "heavy", 5, 3, &id[1]), CC_OK);
+    for (i = 0; i < NKEY; i++) {
+        key_of(buf, i, &len);
+        count[dist_lookup(d, buf, len)]++;
+    }
+    /* 1:3 expected */
+    ck_assert_int_gt(count[id[1]], 2 * count[id[0]]);
+    ck_assert_int_lt(count[id[1]], 4 * count[id[0]]);
+    dist_destroy(&d);
+}
+END_TEST
+
+#undef NNODE
+#undef NKEY
+
+/*
+ * test suite
+ */
+static Suite *
+hash_suite(void)
+{
+    Suite *s = suite_create(SUITE_NAME);
+
+    TCase *tc_hash = tcase_create("hash test");
+    tcase_add_test(tc_hash, test_xxh3_vectors);
+    tcase_add_test(tc_hash, test_streaming);
+    tcase_add_test(tc_hash, test_many);
+    tcase_add_test(tc_hash, test_murmur3_many);
+    suite_add_tcase(s, tc_hash);
+
+    TCase *tc_dist = tcase_create("dist test");
+    tcase_add_test(tc_dist, test_ketama);
+    tcase_add_test(tc_dist, test_jump);
+    tcase_add_test(tc_dist, test_rendezvous);
+    suite_add_tcase(s, tc_dist);
+
+    return s;
+}
+/**************
+ * test cases *
+ **************/
+
+int
+main(void)
+{
+    int nfail;
+
+    /* setup */
+    test_setup();
+
+    Suite *suite = hash_suite();
+    SRunner *srunner = srunner_create(suite);
+    srunner_set_log(srunner, DEBUG_LOG);
+    srunner_run_all(srunner, CK_ENV); /* set CK_VEBOSITY in ENV to customize */
+    nfail = srunner_ntests_failed(srunner);
+    srunner_free(srunner);
+
+    /* teardown */
+    test_teardown();
+
+    return (nfail == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,233 @@
+#include <cc_htable.h>
+
+#include <check.h>
+
+#include <stdlib.h>
+#include <stdio.h>
+
+#define SUITE_NAME "htable"
+#define DEBUG_LOG  SUITE_NAME ".log"
+
+#define NKEY 50000
+#define KEYLEN 24
+
+static char keybuf[NKEY][KEYLEN];
+static struct bstring key[NKEY];
+
+/*
+ * utilities
+ */
+static void
+test_setup(void)
+{
+    uint32_t i;
+
+    for (i = 0; i < NKEY; i++) {
+        key[i].len = (uint32_t)snprintf(keybuf[i], KEYLEN, "key:%u", i);
+        key[i].data = keybuf[i];
+    }
+}
+
+static void
+test_teardown(void)
+{
+}
+
+/* distinct non-NULL value per key */
+#define VAL(_i) ((void *)((uintptr_t)(_i) + 1))
+
+static rstatus_i
+count_entry(const struct bstring *k, void *val, void *arg)
+{
+    uint32_t *n = arg;
+    uint32_t i = (uint32_t)((uintptr_t)val - 1);
+
+    ck_assert_int_eq(bstring_compare(k, &key[i]), 0);
+    (*n)++;
+
+    return CC_OK;
+}
+
+static rstatus_i
+stop_entry(const struct bstring *k, void *val, void *arg)
+{
+    return CC_ERROR;
+}
+
+START_TEST(test_basic)
+{
+    struct htable *ht;
+    struct bstring other = str2bstr("key:1");
+
+    ht = htable_create(0);
+    ck_assert_ptr_ne(ht, NULL);
+
+    ck_assert_ptr_eq(htable_get(ht, &key[1]), NULL);
+    ck_assert_ptr_eq(htable_delete(ht, &key[1]), NULL);
+    ck_assert_int_eq(htable_put(ht, &key[1], NULL), CC_EINVAL);
+
+    ck_assert_int_eq(htable_put(ht, &key[1], VAL(1)), CC_OK);
+    ck_assert_int_eq(htable_put(ht, &key[2], VAL(2)), CC_OK);
+    ck_assert_int_eq(htable_nentry(ht), 2);
+
+    /* keys compare by content */
+    ck_assert_ptr_eq(htable_get(ht, &other), VAL(1));
+    ck_assert_ptr_eq(htable_get(ht, &key[2]), VAL(2));
+    ck_assert_ptr_eq(htable_get(ht, &key[3]), NULL);
+
+    /* replace */
+    ck_assert_int_eq(htable_put(ht, &other, VAL(3)), CC_OK);
+    ck_assert_int_eq(htable_nentry(ht), 2);
+    ck_assert_ptr_eq(htable_get(ht, &key[1]), VAL(3));
+
+    ck_assert_ptr_eq(htable_delete(ht, &key[1]), VAL(3));
+    ck_assert_ptr_eq(htable_get(ht, &key[1]), NULL);
+    ck_assert_ptr_eq(htable_delete(ht, &key[1]), NULL);
+    ck_assert_int_eq(htable_nentry(ht), 1);
+
+    htable_destroy(&ht);
+    ck_assert_ptr_eq(ht, NULL);
+}
+END_TEST
+
+START_TEST(test_grow)
+{
+    struct htable *ht;
+    uint32_t i, j, n, nmigrate = 0;
+
+    ht = htable_create(1);
+    ck_assert_int_eq(ht->cur.ngroup, 1);
+
+    for (i = 0; i < NKEY; i++) {
+        ck_assert_int_eq(htable_put(ht, &key[i], VAL(i)), CC_OK);
+        if (htable_migrating(ht)) {
+            nmigrate++;
+            /* everything stays reachable while entries move */
+            for (j = 0; j <= i; j += 97) {
+                ck_assert_ptr_eq(htable_get(ht, &key[j]), VAL(j));
+            }
+            n = 0;
+            ck_assert_int_eq(htable_each(ht, count_entry, &n), CC_OK);
+            ck_assert_int_eq(n, i + 1);
+        }
+    }
+    ck_assert_int_gt(nmigrate, 0);
+    ck_assert_int_eq(htable_nentry(ht), NKEY);
+    ck_assert_int_ge(ht->cur.ngroup * HTABLE_GROUP, NKEY);
+
+    for (i = 0; i < NKEY; i++) {
+        ck_assert_ptr_eq(htable_get(ht, &key[i]), VAL(i));
+    }
+
+    n = 0;
+    ck_assert_int_eq(htable_each(ht, count_entry, &n), CC_OK);
+    ck_assert_int_eq(n, NKEY);
+    ck_assert_int_eq(htable_each(ht, stop_entry, NULL), CC_ERROR);
+
+    /* delete every other key, with and without a migration in progress */
+    for (i = 0; i < NKEY; i += 2) {
+        ck_assert_ptr_eq(htable_delete(ht, &key[i]), VAL(i));
+    }
+    ck_assert_int_eq(htable_nentry(ht), NKEY / 2);
+    for (i = 0; i < NKEY; i++) {
+        ck_assert_ptr_eq(htable_get(ht, &key[i]), i % 2 ? VAL(i) : NULL);
+    }
+
+    htable_destroy(&ht);
+}
+END_TEST
+
+START_TEST(test_migrate_ops)
+{
+    struct htable *ht;
+    uint32_t i;
+
+    /* fill up to the point where the next put starts a migration */
+    ht = htable_create(0);
+    for (i = 0; !htable_migrating(ht); i++) {
+        ck_assert_int_eq(htable_put(ht, &key[i], VAL(i)), CC_OK);
+    }
+    /* the key just added is new, older ones may still be in the old table */
+    ck_assert_int_eq(htable_nentry(ht), i);
+    ck_assert_ptr_eq(htable_get(ht, &key[0]), VAL(0));
+
+    /* replace and delete entries that may not have moved yet */
+    ck_assert_int_eq(htable_put(ht, &key[0], VAL(1)), CC_OK);
+    ck_assert_ptr_eq(htable_get(ht, &key[0]), VAL(1));
+    ck_assert_int_eq(htable_nentry(ht), i);
+    ck_assert_ptr_eq(htable_delete(ht, &key[1]), VAL(1));
+    ck_assert_int_eq(htable_nentry(ht), i - 1);
+
+    htable_destroy(&ht);
+}
+END_TEST
+
+START_TEST(test_churn)
+{
+    struct htable *ht;
+    uint32_t i, round;
+
+    /* a steady set of keys coming and going does not grow the table */
+    ht = htable_create(64);
+    for (round = 0; round < 100; round++) {
+        for (i = 0; i < 32; i++) {
+            uint32_t k = round * 32 + i;
+
+            ck_assert_int_eq(htable_put(ht, &key[k], VAL(k)), CC_OK);
+        }
+        for (i = 0; i < 32; i++) {
+            uint32_t k = round * 32 + i;
+
+            ck_assert_ptr_eq(htable_delete(ht, &key[k]), VAL(k));
+        }
+    }
+    ck_assert_int_eq(htable_nentry(ht), 0);
+    ck_assert_int_le(ht->cur.ngroup, 8);
+
+    htable_destroy(&ht);
+}
+END_TEST
+
+#undef VAL
+
+/*
+ * test suite
+ */
+static Suite *
+htable_suite(void)
+{
+    Suite *s = suite_create(SUITE_NAME);
+
+    TCase *tc_htable = tcase_create("htable test");
+    tcase_add_test(tc_htable, test_basic);
+    tcase_add_test(tc_htable, test_grow);
+    tcase_add_test(tc_htable, test_migrate_ops);
+    tcase_add_test(tc_htable, test_churn);
+    suite_add_tcase(s, tc_htable);
+
+    return s;
+}
+/**************
+ * test cases *
+ **************/
+
+int
+main(void)
+{
+    int nfail;
+
+    /* setup */
+    test_setup();
+
+    Suite *suite = htable_suite();
+    SRunner *srunner = srunner_create(suite);
+    srunner_set_log(srunner, DEBUG_LOG);
+    srunner_run_all(srunner, CK_ENV); /* set CK_VEBOSITY in ENV to customize */
+    nfail = srunner_ntests_failed(srunner);
+    srunner_free(srunner);
+
+    /* teardown */
+    test_teardown();
+
+    return (nfail == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,431 @@
+#include <cc_array.h>
+#include <cc_bstring.h>
+#include <cc_mm.h>
+
+#include <check.h>
+
+#include <pthread.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#define SUITE_NAME "mm"
+#define DEBUG_LOG  SUITE_NAME ".log"
+
+#define TEST_CHUNK_SIZE     1024
+#define TEST_POOLSIZE       2
+
+static arena_metrics_st metrics;
+static arena_options_st options;
+
+/*
+ * utilities
+ */
+static void
+test_setup(void)
+{
+    metrics = (arena_metrics_st) { ARENA_METRIC(METRIC_INIT) };
+
+    options = (arena_options_st){
+        .arena_chunk_size = {
+            .set = true,
+            .type = OPTION_TYPE_UINT,
+            .val.vuint = TEST_CHUNK_SIZE,
+        },
+        .arena_chunk_poolsize = {
+            .set = true,
+            .type = OPTION_TYPE_UINT,
+            .val.vuint = TEST_POOLSIZE,
+        }};
+
+    arena_setup(&options, &metrics);
+}
+
+static void
+test_teardown(void)
+{
+    arena_teardown();
+}
+
+static void
+test_reset(void)
+{
+    test_teardown();
+    test_setup();
+}
+
+/*
+ * tests
+ */
+START_TEST(test_alloc)
+{
+    struct arena *arena;
+    char *p[64];
+    uint32_t i;
+
+    test_reset();
+
+    arena = arena_create();
+    ck_assert_ptr_ne(arena, NULL);
+    ck_assert_int_eq(metrics.arena_curr.gauge, 1);
+    ck_assert_ptr_eq(arena_alloc(arena, 0), NULL);
+
+    for (i = 0; i < 64; i++) {
+        p[i] = arena_alloc(arena, i + 1);
+        ck_assert_ptr_ne(p[i], NULL);
+        ck_assert_int_eq((uintptr_t)p[i] % ARENA_ALIGN, 0);
+        memset(p[i], i, i + 1);
+    }
+    /* 64 * 16B of room needed on average, more than one chunk */
+    ck_assert_int_gt(metrics.arena_chunk_create.counter, 1);
+    for (i = 0; i < 64; i++) {
+        ck_assert_int_eq(p[i][0], i);
+        ck_assert_int_eq(p[i][i], i);
+    }
+    ck_assert_int_eq(arena->nalloc, 64);
+    ck_assert_int_eq(arena->nbyte, 64 * 65 / 2);
+
+    /* alignment control */
+    p[0] = arena_alloc_aligned(arena, 1, 1);
+    p[1] = arena_alloc_aligned(arena, 1, 1);
+    ck_assert_ptr_eq(p[1], p[0] + 1);
+    p[2] = arena_alloc_aligned(arena, 8, 64);
+    ck_assert_int_eq((uintptr_t)p[2] % 64, 0);
+
+    arena_destroy(&arena);
+    ck_assert_ptr_eq(arena, NULL);
+    ck_assert_int_eq(metrics.arena_curr.gauge, 0);
+    ck_assert_int_eq(metrics.arena_alloc.counter, 67);
+    ck_assert_int_eq(metrics.arena_alloc_byte.counter, 64 * 65 / 2 + 10);
+}
+END_TEST
+
+START_TEST(test_reset_recycle)
+{
+    struct arena *arena;
+    uint64_t ncreate;
+    uint32_t i, round;
+
+    test_reset();
+
+    arena = arena_create();
+    for (round = 0; round < 10; round++) {
+        for (i = 0; i < 40; i++) {
+            ck_assert_ptr_ne(arena_alloc(arena, 100), NULL);
+        }
+        if (round == 0) {
+            ncreate = metrics.arena_chunk_create.counter;
+            ck_assert_int_ge(ncreate, 4);
+        }
+        arena_reset(arena);
+        ck_assert_int_eq(arena->nalloc, 0);
+        ck_assert_ptr_eq(arena->used, NULL);
+    }
+    /* later rounds run on the chunks of the first one */
+    ck_assert_int_eq(metrics.arena_chunk_create.counter, ncreate);
+    ck_assert_int_eq(metrics.arena_chunk_destroy.counter, 0);
+    ck_assert_int_eq(metrics.arena_reset.counter, 10);
+    ck_assert_int_eq(metrics.arena_alloc.counter, 400);
+
+    /* chunks beyond the pool size are freed when the arena goes */
+    arena_destroy(&arena);
+    ck_assert_int_eq(metrics.arena_chunk_free.gauge, TEST_POOLSIZE);
+    ck_assert_int_eq(metrics.arena_chunk_curr.gauge, TEST_POOLSIZE);
+    ck_assert_int_eq(metrics.arena_chunk_destroy.counter,
+            ncreate - TEST_POOLSIZE);
+
+    /* and pooled chunks are taken by the next arena */
+    arena = arena_create();
+    ck_assert_ptr_ne(arena_alloc(arena, 100), NULL);
+    ck_assert_int_eq(metrics.arena_chunk_reuse.counter, 1);
+    ck_assert_int_eq(metrics.arena_chunk_free.gauge, TEST_POOLSIZE - 1);
+    ck_assert_int_eq(metrics.arena_chunk_create.counter, ncreate);
+    arena_destroy(&arena);
+
+    test_teardown();
+    ck_assert_int_eq(metrics.arena_chunk_curr.gauge, 0);
+}
+END_TEST
+
+START_TEST(test_oversize)
+{
+    struct arena *arena;
+    char *p, *q, *pos;
+
+    test_reset();
+
+    arena = arena_create();
+    p = arena_alloc(arena, 16);
+    pos = arena->pos;
+
+    /* gets a chunk of its own, the current chunk is left as is */
+    q = arena_alloc(arena, TEST_CHUNK_SIZE);
+    ck_assert_ptr_ne(q, NULL);
+    memset(q, 0xff, TEST_CHUNK_SIZE);
+    ck_assert_int_eq(metrics.arena_oversize.counter, 1);
+    ck_assert_ptr_eq(arena->pos, pos);
+    ck_assert_ptr_eq(arena_alloc(arena, 16), p + 16);
+
+    arena_reset(arena);
+    ck_assert_ptr_eq(arena->large, NULL);
+    ck_assert_int_eq(metrics.arena_chunk_destroy.counter, 1);
+    ck_assert_int_eq(metrics.arena_alloc_byte.counter, 32 + TEST_CHUNK_SIZE);
+
+    arena_destroy(&arena);
+}
+END_TEST
+
+START_TEST(test_realloc)
+{
+    struct arena *arena;
+    char *p, *q;
+
+    test_reset();
+
+    arena = arena_create();
+    p = arena_alloc(arena, 16);
+    memset(p, 'a', 16);
+
+    /* the latest allocation grows in place */
+    ck_assert_ptr_eq(arena_realloc(arena, p, 16, 64), p);
+    ck_assert_ptr_eq(arena->pos, p + 64);
+    ck_assert_ptr_eq(arena_realloc(arena, p, 64, 32), p);
+    ck_assert_ptr_eq(arena->pos, p + 32);
+
+    /* anything else moves */
+    q = arena_alloc(arena, 16);
+    ck_assert_ptr_eq(q, p + 32);
+    q = arena_realloc(arena, p, 32, 48);
+    ck_assert_ptr_ne(q, p);
+    ck_assert_int_eq(memcmp(q, "aaaaaaaaaaaaaaaa", 16), 0);
+
+    /* including past the end of the chunk */
+    p = arena_realloc(arena, q, 48, TEST_CHUNK_SIZE / 8);
+    ck_assert_ptr_eq(p, q);
+    q = arena_realloc(arena, p, TEST_CHUNK_SIZE / 8, TEST_CHUNK_SIZE / 4);
+    ck_assert_int_eq(memcmp(q, "aaaaaaaaaaaaaaaa", 16), 0);
+
+    arena_destroy(&arena);
+}
+END_TEST
+
+START_TEST(test_array)
+{
+    struct arena *arena;
+    struct array *arr;
+    uint32_t i, *elem;
+
+    test_reset();
+
+    arena = arena_create();
+    ck_assert_int_eq(array_create_arena(&arr, 2, sizeof(uint32_t), arena),
+            CC_OK);
+    ck_assert_ptr_eq(arr->arena, arena);
+    for (i = 0; i < 200; i++) {
+        elem = array_push(arr);
+        ck_assert_ptr_ne(elem, NULL);
+        *elem = i;
+    }
+    ck_assert_int_eq(array_nelem(arr), 200);
+    for (i = 0; i < 200; i++) {
+        ck_assert_int_eq(*(uint32_t *)array_get(arr, i), i);
+    }
+
+    /* no-op on arena memory */
+    array_destroy(&arr);
+    ck_assert_ptr_eq(arr, NULL);
+
+    /* no half-made array is handed out when the data cannot be allocated */
+    ck_assert_int_eq(array_create_arena(&arr, 2, SIZE_MAX / 4, arena),
+            CC_ENOMEM);
+    ck_assert_ptr_eq(arr, NULL);
+
+    arena_destroy(&arena);
+}
+END_TEST
+
+#define NTHREAD 4
+
+static void *
+arena_worker(void *arg)
+{
+    struct arena *arena;
+    uint32_t i, round;
+
+    for (round = 0; round < 1000; round++) {
+        arena = arena_create();
+        for (i = 0; i < 20; i++) {
+            ck_assert_ptr_ne(arena_alloc(arena, 100), NULL);
+        }
+        arena_destroy(&arena);
+    }
+    arena_thread_flush();
+
+    return NULL;
+}
+
+START_TEST(test_thread_pool)
+{
+    pthread_t thread[NTHREAD];
+    struct arena *arena;
+    int i;
+
+    test_reset();
+
+    /* fill the pool of this thread */
+    arena = arena_create();
+    for (i = 0; i < 40; i++) {
+        ck_assert_ptr_ne(arena_alloc(arena, 100), NULL);
+    }
+    arena_destroy(&arena);
+    ck_assert_int_eq(metrics.arena_chunk_free.gauge, TEST_POOLSIZE);
+
+    /* each thread recycles chunks through a pool of its own */
+    for (i = 0; i < NTHREAD; i++) {
+        ck_assert_int_eq(pthread_create(&thread[i], NULL, arena_worker, NULL),
+                0);
+    }
+    for (i = 0; i < NTHREAD; i++) {
+        ck_assert_int_eq(pthread_join(thread[i], NULL), 0);
+    }
+
+    /* and only flushes that one */
+    ck_assert_int_gt(metrics.arena_chunk_reuse.counter, 0);
+    ck_assert_int_eq(metrics.arena_chunk_free.gauge, TEST_POOLSIZE);
+    ck_assert_int_eq(metrics.arena_chunk_curr.gauge, TEST_POOLSIZE);
+    ck_assert_int_eq(metrics.arena_curr.gauge, 0);
+
+    test_teardown();
+    ck_assert_int_eq(metrics.arena_chunk_curr.gauge, 0);
+}
+END_TEST
+#undef NTHREAD
+
+START_TEST(test_bstring)
+{
+    struct arena *arena;
+    struct bstring s1, s2, *s3;
+
+    test_reset();
+
+    arena = arena_create();
+    bstring_init(&s1);
+    bstring_init(&s2);
+
+    ck_assert_int_eq(bstring_copy_arena(&s1, "foo", 3, arena), CC_OK);
+    ck_assert_int_eq(s1.len, 3);
+    ck_assert_int_eq(memcmp(s1.data, "foo", 3), 0);
+
+    ck_assert_int_eq(bstring_duplicate_arena(&s2, &s1, arena), CC_OK);
+    ck_assert_int_eq(bstring_compare(&s1, &s2), 0);
+    /* string bytes are packed */
+    ck_assert_ptr_eq(s2.data, s1.data + 3);
+
+    s3 = bstring_alloc_arena(5, arena);
+    ck_assert_ptr_ne(s3, NULL);
+    ck_assert_int_eq(s3->len, 5);
+    ck_assert_ptr_eq(s3->data, (char *)(s3 + 1));
+
+    arena_destroy(&arena);
+}
+END_TEST
+
+START_TEST(test_mmap_opt)
+{
+#define SIZE (64 * KiB)
+    char *p;
+    size_t ps = 0;
+
+    p = cc_mmap_opt(SIZE, 0, 0, &ps);
+    ck_assert_ptr_ne(p, NULL);
+    ck_assert_int_eq(ps, cc_pagesize());
+    ck_assert_int_eq(cc_munmap(p, SIZE), 0);
+
+    p = cc_mmap_opt(SIZE, CC_MMAP_POPULATE | CC_MMAP_LOCK, 0, &ps);
+    ck_assert_ptr_ne(p, NULL);
+    ck_assert_int_eq(p[0] + p[SIZE - 1], 0);
+    ck_assert_int_eq(cc_munmap(p, SIZE), 0);
+
+    /* not a multiple of the huge page size: THP at best */
+    p = cc_mmap_opt(SIZE, CC_MMAP_HUGETLB | CC_MMAP_POPULATE, 0, &ps);
+    ck_assert_ptr_ne(p, NULL);
+    ck_assert_int_eq(ps, cc_pagesize());
+    memset(p, 1, SIZE);
+    ck_assert_int_eq(cc_munmap(p, SIZE), 0);
+
+#ifdef OS_LINUX
+    p = cc_mmap_opt(SIZE, CC_MMAP_NUMA | CC_MMAP_POPULATE, 0, &ps);
+    ck_assert_ptr_ne(p, NULL);
+    ck_assert_int_eq(cc_munmap(p, SIZE), 0);
+#endif
+    /* binding to a node that does not exist fails the mapping */
+    ck_assert_ptr_eq(cc_mmap_opt(SIZE, CC_MMAP_NUMA, 4000, &ps), NULL);
+#undef SIZE
+}
+END_TEST
+
+START_TEST(test_mmap_hugepage)
+{
+    char *p;
+    size_t ps = 0, size = 2 * cc_hugepagesize();
+
+    /* hugetlb pages if the pool has any, aligned THP region otherwise */
+    p = cc_mmap_opt(size, CC_MMAP_HUGETLB, 0, &ps);
+    ck_assert_ptr_ne(p, NULL);
+    ck_assert(ps == cc_hugepagesize() || ps == cc_pagesize());
+    ck_assert_int_eq((uintptr_t)p % cc_hugepagesize(), 0);
+    memset(p, 1, size);
+    ck_assert_int_eq(cc_munmap(p, size), 0);
+}
+END_TEST
+
+/*
+ * test suite
+ */
+static Suite *
+mm_suite(void)
+{
+    Suite *s = suite_create(SUITE_NAME);
+
+    TCase *tc_arena = tcase_create("arena test");
+    tcase_add_test(tc_arena, test_alloc);
+    tcase_add_test(tc_arena, test_reset_recycle);
+    tcase_add_test(tc_arena, test_oversize);
+    tcase_add_test(tc_arena, test_realloc);
+    tcase_add_test(tc_arena, test_array);
+    tcase_add_test(tc_arena, test_thread_pool);
+    tcase_add_test(tc_arena, test_bstring);
+    suite_add_tcase(s, tc_arena);
+
+    TCase *tc_mmap = tcase_create("mmap test");
+    tcase_add_test(tc_mmap, test_mmap_opt);
+    tcase_add_test(tc_mmap, test_mmap_hugepage);
+    suite_add_tcase(s, tc_mmap);
+
+    return s;
+}
+/**************
+ * test cases *
+ **************/
+
+int
+main(void)
+{
+    int nfail;
+
+    /* setup */
+    test_setup();
+
+    Suite *suite = mm_suite();
+    SRunner *srunner = srunner_create(suite);
+    srunner_set_log(srunner, DEBUG_LOG);
+    srunner_run_all(srunner, CK_ENV); /* set CK_VEBOSITY in ENV to customize */
+    nfail = srunner_ntests_failed(srunner);
+    srunner_free(srunner);
+
+    /* teardown */
+    test_teardown();
+
+    return (nfail == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
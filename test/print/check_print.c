@@ -0,0 +1,186 @@
+#include <cc_print.h>
+
+#include <check.h>
+
+#include <inttypes.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#define SUITE_NAME "print"
+#define DEBUG_LOG  SUITE_NAME ".log"
+
+#define NFUZZ 2000000
+
+static uint64_t rng = 88172645463325252ULL;
+
+/*
+ * utilities
+ */
+static void
+test_setup(void)
+{
+}
+
+static void
+test_teardown(void)
+{
+}
+
+static uint64_t
+xorshift(void)
+{
+    rng ^= rng << 13;
+    rng ^= rng >> 7;
+    rng ^= rng << 17;
+
+    return rng;
+}
+
+/* random value of random magnitude, or one next to a power of 2 or 10 */
+static uint64_t
+fuzz_value(void)
+{
+    uint64_t r = xorshift(), v;
+
+    switch (r % 4) {
+    case 0:
+        v = BASE10[(r >> 2) % (CC_UINT64_MAXLEN - 1)];
+        break;
+
+    case 1:
+        v = 1ULL << ((r >> 2) % 64);
+        break;
+
+    default:
+        return xorshift() >> ((r >> 2) % 64);
+    }
+
+    /* v - 1, v or v + 1 */
+    return v + (r >> 8) % 3 - 1;
+}
+
+/* the linear scan digits() used to be */
+static size_t
+ref_digits(uint64_t n)
+{
+    size_t d = 1;
+
+    while (d < CC_UINT64_MAXLEN - 1 && n >= BASE10[d]) {
+        d++;
+    }
+
+    return d;
+}
+
+START_TEST(test_digits)
+{
+    uint64_t v;
+    uint32_t i, d;
+
+    ck_assert_int_eq(digits(0), 1);
+    ck_assert_int_eq(digits(UINT64_MAX), 20);
+    for (d = 1; d < CC_UINT64_MAXLEN - 1; d++) {
+        ck_assert_int_eq(digits(BASE10[d] - 1), d);
+        ck_assert_int_eq(digits(BASE10[d]), d + 1);
+    }
+
+    for (i = 0; i < NFUZZ; i++) {
+        v = fuzz_value();
+        ck_assert_int_eq(digits(v), ref_digits(v));
+    }
+}
+END_TEST
+
+START_TEST(test_print_uint64)
+{
+    char buf[CC_UINT64_MAXLEN], ref[CC_UINT64_MAXLEN];
+    uint64_t v;
+    uint32_t i;
+    size_t n;
+
+    for (i = 0; i < NFUZZ; i++) {
+        v = fuzz_value();
+        sprintf(ref, "%" PRIu64, v);
+
+        n = cc_print_uint64_unsafe(buf, v);
+        ck_assert_int_eq(n, strlen(ref));
+        ck_assert_int_eq(memcmp(buf, ref, n), 0);
+
+        memset(buf, 0, sizeof(buf));
+        ck_assert_int_eq(cc_print_uint64(buf, n, v), n);
+        ck_assert_int_eq(memcmp(buf, ref, n), 0);
+        ck_assert_int_eq(cc_print_uint64(buf, n - 1, v), 0);
+    }
+}
+END_TEST
+
+START_TEST(test_print_int64)
+{
+    char buf[CC_INT64_MAXLEN], ref[CC_INT64_MAXLEN];
+    int64_t v;
+    uint32_t i;
+    size_t n;
+
+    for (i = 0; i < NFUZZ; i++) {
+        v = (int64_t)fuzz_value();
+        if (i & 1) {
+            v = -(v >> 1);
+        }
+        if (i % 1000 == 0) {
+            v = i & 2 ? INT64_MIN : INT64_MAX;
+        }
+        sprintf(ref, "%" PRIi64, v);
+
+        n = cc_print_int64_unsafe(buf, v);
+        ck_assert_int_eq(n, strlen(ref));
+        ck_assert_int_eq(memcmp(buf, ref, n), 0);
+
+        memset(buf, 0, sizeof(buf));
+        ck_assert_int_eq(cc_print_int64(buf, n, v), n);
+        ck_assert_int_eq(memcmp(buf, ref, n), 0);
+        ck_assert_int_eq(cc_print_int64(buf, n - 1, v), 0);
+    }
+}
+END_TEST
+
+/*
+ * test suite
+ */
+static Suite *
+print_suite(void)
+{
+    Suite *s = suite_create(SUITE_NAME);
+
+    TCase *tc_print = tcase_create("print test");
+    tcase_add_test(tc_print, test_digits);
+    tcase_add_test(tc_print, test_print_uint64);
+    tcase_add_test(tc_print, test_print_int64);
+    suite_add_tcase(s, tc_print);
+
+    return s;
+}
+/**************
+ * test cases *
+ **************/
+
+int
+main(void)
+{
+    int nfail;
+
+    /* setup */
+    test_setup();
+
+    Suite *suite = print_suite();
+    SRunner *srunner = srunner_create(suite);
+    srunner_set_log(srunner, DEBUG_LOG);
+    srunner_run_all(srunner, CK_ENV); /* set CK_VEBOSITY in ENV to customize */
+    nfail = srunner_ntests_failed(srunner);
+    srunner_free(srunner);
+
+    /* teardown */
+    test_teardown();
+
+    return (nfail == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -3,6 +3,8 @@
 #include <check.h>
 
 #include <float.h>
+#include <math.h>
+#include <pthread.h>
 #include <stdlib.h>
 #include <stdio.h>
 
@@ -26,6 +28,17 @@ test_teardown(void)
 {
 }
 
+static uint8_t *
+_varint(uint8_t *p, uint64_t v)
+{
+    for (; v >= 0x80; v >>= 7) {
+        *p++ = (uint8_t)(v | 0x80);
+    }
+    *p++ = (uint8_t)v;
+
+    return p;
+}
+
 /*
  * tests
  */
@@ -191,6 +204,407 @@ START_TEST(test_report_exact)
 }
 END_TEST
 
+/* reference implementation: linear scan over every bucket */
+static uint64_t
+_report_linear(const struct histo_u32 *h, double p)
+{
+    uint64_t rthreshold = (uint64_t)ceil(p * h->nrecord / 100);
+    uint64_t rcount = 0, offset = 0;
+
+    while (offset < h->nbucket && h->buckets[offset] == 0) {
+        offset++;
+    }
+    if (rthreshold == 0) {
+        return offset;
+    }
+    for (; offset < h->nbucket; ++offset) {
+        rcount += h->buckets[offset];
+        if (rcount >= rthreshold) {
+            break;
+        }
+    }
+
+    return offset;
+}
+
+START_TEST(test_report_blocks)
+{
+#define m 0
+#define r 10
+#define n 20
+    uint64_t value, max = 0;
+    struct histo_u32 *histo = histo_u32_create(m, r, n);
+    struct percentile_profile *pp = percentile_profile_create(PARRAY_SIZE);
+
+    ck_assert_int_eq(histo->nblock, histo->nbucket / HISTO_BLOCK_SIZE);
+    ck_assert_int_eq(percentile_profile_set(pp, parray, PARRAY_SIZE), HISTO_OK);
+
+    /* clustered values with long empty runs in between, spanning many blocks */
+    srand(42);
+    for (int i = 0; i < 1000; ++i) {
+        uint64_t v = (uint64_t)(rand() % 100) << (rand() % 13);
+
+        histo_u32_record(histo, v, rand() % 5 + 1);
+    }
+    for (uint64_t b = 0; b < histo->nbucket; ++b) {
+        uint64_t sum = 0;
+
+        if (histo->buckets[b] > 0) {
+            max = b;
+        }
+        if (b % HISTO_BLOCK_SIZE == 0) {
+            for (uint64_t i = b; i < b + HISTO_BLOCK_SIZE; ++i) {
+                sum += histo->buckets[i];
+            }
+            ck_assert_int_eq(histo->blocks[b / HISTO_BLOCK_SIZE], sum);
+        }
+    }
+
+    for (double p = 0.0; p <= 100.0; p += 0.5) {
+        ck_assert(histo_u32_report(&value, histo, p) == HISTO_OK);
+        ck_assert_int_eq(value, _report_linear(histo, p));
+    }
+    ck_assert(histo_u32_report_multi(pp, histo) == HISTO_OK);
+    ck_assert_int_eq(pp->min, _report_linear(histo, 0));
+    ck_assert_int_eq(pp->max, max);
+    for (int i = 0; i < PARRAY_SIZE; ++i) {
+        ck_assert_int_eq(*(pp->result + i), _report_linear(histo, parray[i]));
+    }
+
+    /* max must be found even if no percentile queried reaches it */
+    histo_u32_reset(histo);
+    histo_u32_record(histo, 3, 10000);
+    histo_u32_record(histo, 1000000, 1);
+    ck_assert(histo_u32_report_multi(pp, histo) == HISTO_OK);
+    ck_assert_int_eq(pp->min, 3);
+    ck_assert_int_eq(*(pp->result + PARRAY_SIZE - 1), 3);
+    ck_assert_int_eq(pp->max, _report_linear(histo, 100));
+    ck_assert_int_gt(pp->max, 3);
+
+    percentile_profile_destroy(&pp);
+    histo_u32_destroy(&histo);
+#undef n
+#undef r
+#undef m
+}
+END_TEST
+
+START_TEST(test_window)
+{
+#define m 0
+#define r 10
+#define n 20
+#define NSLOT 3
+    uint64_t value;
+    struct histo_u32_window *w = histo_u32_window_create(m, r, n, NSLOT);
+
+    ck_assert(w != NULL);
+    ck_assert_int_eq(w->nslot, NSLOT);
+    ck_assert(histo_u32_report(&value, w->total, 50) == HISTO_EEMPTY);
+
+    /* one distinct value per interval */
+    histo_u32_window_record(w, 10, 1);
+    histo_u32_window_rotate(w);
+    histo_u32_window_record(w, 20, 2);
+    histo_u32_window_rotate(w);
+    histo_u32_window_record(w, 5000, 3);
+    ck_assert_int_eq(w->total->nrecord, 6);
+    ck_assert(histo_u32_report(&value, w->total, 0) == HISTO_OK);
+    ck_assert_int_eq(value, 10);
+
+    /* the first interval falls out of the window */
+    histo_u32_window_rotate(w);
+    ck_assert_int_eq(w->total->nrecord, 5);
+    ck_assert_int_eq(*(w->total->buckets + 10), 0);
+    ck_assert(histo_u32_report(&value, w->total, 0) == HISTO_OK);
+    ck_assert_int_eq(value, 20);
+    ck_assert(histo_u32_report(&value, w->total, 100) == HISTO_OK);
+    ck_assert_int_le(bucket_low(w->total, value), 5000);
+    ck_assert_int_ge(bucket_high(w->total, value), 5000);
+    ck_assert(histo_u32_window_record(w, 1 << 20, 1) == HISTO_EOVERFLOW);
+    ck_assert_int_eq(w->total->nrecord, 5);
+
+    /* rotating a full cycle without records empties the window */
+    for (int i = 0; i < NSLOT; ++i) {
+        histo_u32_window_rotate(w);
+    }
+    ck_assert_int_eq(w->total->nrecord, 0);
+    for (uint64_t blk = 0; blk < w->total->nblock; ++blk) {
+        ck_assert_int_eq(*(w->total->blocks + blk), 0);
+    }
+
+    histo_u32_window_record(w, 7, 1);
+    histo_u32_window_reset(w);
+    ck_assert_int_eq(w->total->nrecord, 0);
+    ck_assert_int_eq(w->curr, 0);
+
+    histo_u32_window_destroy(&w);
+    ck_assert(w == NULL);
+#undef NSLOT
+#undef n
+#undef r
+#undef m
+}
+END_TEST
+
+START_TEST(test_serialize)
+{
+#define m 0
+#define r 10
+#define n 20
+    uint8_t buf[1024];
+    size_t len, size;
+    struct histo_u32 *h1 = histo_u32_create(m, r, n);
+    struct histo_u32 *h2 = histo_u32_create(m, r, n);
+    struct histo_u32 *h3 = histo_u32_create(m, r + 1, n);
+
+    /* empty histogram: version and 5 single-byte varints */
+    ck_assert_int_eq(histo_u32_serial_size(h1), 6);
+    ck_assert(histo_u32_serialize(buf, sizeof(buf), &len, h1) == HISTO_OK);
+    ck_assert_int_eq(len, 6);
+
+    histo_u32_record(h1, 0, 3);
+    histo_u32_record(h1, 100, 1);
+    histo_u32_record(h1, 5000, 200);
+    histo_u32_record(h1, (1 << 20) - 1, 1);
+    size = histo_u32_serial_size(h1);
+    ck_assert(histo_u32_serialize(buf, size - 1, &len, h1) == HISTO_EOVERFLOW);
+    ck_assert(histo_u32_serialize(buf, sizeof(buf), &len, h1) == HISTO_OK);
+    ck_assert_int_eq(len, size);
+
+    /* round trip replaces content */
+    histo_u32_record(h2, 7, 1);
+    ck_assert(histo_u32_deserialize(h2, buf, len) == HISTO_OK);
+    ck_assert_int_eq(h2->nrecord, h1->nrecord);
+    for (uint64_t i = 0; i < h1->nbucket; ++i) {
+        ck_assert_int_eq(*(h2->buckets + i), *(h1->buckets + i));
+    }
+    for (uint64_t i = 0; i < h1->nblock; ++i) {
+        ck_assert_int_eq(*(h2->blocks + i), *(h1->blocks + i));
+    }
+
+    /* merge adds counts, both serialized and in-memory */
+    ck_assert(histo_u32_merge_serial(h2, buf, len) == HISTO_OK);
+    ck_assert_int_eq(h2->nrecord, 2 * h1->nrecord);
+    ck_assert_int_eq(*(h2->buckets + 100), 2);
+    ck_assert(histo_u32_merge(h2, h1) == HISTO_OK);
+    ck_assert_int_eq(h2->nrecord, 3 * h1->nrecord);
+    ck_assert_int_eq(*h2->buckets, 9);
+
+    /* incompatible or malformed input leaves the histogram untouched */
+    ck_assert(histo_u32_merge(h3, h1) == HISTO_EMISMATCH);
+    ck_assert(histo_u32_deserialize(h3, buf, len) == HISTO_EMISMATCH);
+    ck_assert(histo_u32_merge_serial(h2, buf, len - 1) == HISTO_EFORMAT);
+    ck_assert(histo_u32_merge_serial(h2, buf, 3) == HISTO_EFORMAT);
+    ck_assert(histo_u32_merge_serial(h2, buf, 0) == HISTO_EFORMAT);
+    buf[0] = HISTO_SERIAL_VERSION + 1;
+    ck_assert(histo_u32_deserialize(h2, buf, len) == HISTO_EFORMAT);
+    ck_assert_int_eq(h2->nrecord, 3 * h1->nrecord);
+
+    /* bucket counts must not wrap around */
+    histo_u32_reset(h2);
+    histo_u32_record(h2, 100, UINT32_MAX);
+    ck_assert(histo_u32_merge(h2, h1) == HISTO_EOVERFLOW);
+    ck_assert_int_eq(h2->nrecord, UINT32_MAX);
+    ck_assert_int_eq(*h2->buckets, 0);
+
+    /* an offset wrapping around to an earlier bucket, or repeating one */
+    for (int dup = 0; dup < 2; ++dup) {
+        uint8_t *p = buf;
+
+        *p++ = HISTO_SERIAL_VERSION;
+        p = _varint(p, m);
+        p = _varint(p, r);
+        p = _varint(p, n);
+        p = _varint(p, 2 * (uint64_t)(UINT32_MAX - 1) + 1);
+        p = _varint(p, 3);
+        p = _varint(p, 5);
+        p = _varint(p, UINT32_MAX - 1);
+        p = _varint(p, 5);
+        p = _varint(p, 1);
+        p = _varint(p, dup ? 0 : UINT64_MAX - 4);
+        p = _varint(p, UINT32_MAX - 1);
+        histo_u32_reset(h2);
+        ck_assert(histo_u32_deserialize(h2, buf, p - buf) == HISTO_EFORMAT);
+        ck_assert(histo_u32_merge_serial(h2, buf, p - buf) == HISTO_EFORMAT);
+        ck_assert_int_eq(h2->nrecord, 0);
+    }
+
+    /* nor may the record count */
+    histo_u32_reset(h1);
+    histo_u32_record(h1, 100, 1);
+    h2->nrecord = UINT64_MAX;
+    ck_assert(histo_u32_merge(h2, h1) == HISTO_EOVERFLOW);
+    ck_assert_int_eq(*(h2->buckets + 100), 0);
+
+    histo_u32_destroy(&h1);
+    histo_u32_destroy(&h2);
+    histo_u32_destroy(&h3);
+#undef n
+#undef r
+#undef m
+}
+END_TEST
+
+START_TEST(test_overflow)
+{
+#define m 0
+#define r 10
+#define n 20
+    uint64_t value;
+    struct histo_u32 *h32 = histo_u32_create(m, r, n);
+    struct histo_u64 *h64 = histo_u64_create(m, r, n);
+    uint8_t buf[64];
+    size_t len;
+
+    ck_assert(histo_u32_record(h32, 100, UINT32_MAX) == HISTO_OK);
+    ck_assert(histo_u32_record(h32, 100, 1) == HISTO_EOVERFLOW);
+    ck_assert(histo_u32_record_atomic(h32, 100, 1) == HISTO_EOVERFLOW);
+    ck_assert_int_eq(*(h32->buckets + 100), UINT32_MAX);
+    ck_assert_int_eq(h32->nrecord, UINT32_MAX);
+
+    /* 64-bit buckets go well past 2^32 */
+    ck_assert(histo_u64_record(h64, 100, UINT32_MAX) == HISTO_OK);
+    ck_assert(histo_u64_record(h64, 100, UINT32_MAX) == HISTO_OK);
+    ck_assert(histo_u64_record_atomic(h64, 200, 2) == HISTO_OK);
+    ck_assert_uint_eq(*(h64->buckets + 100), 2 * (uint64_t)UINT32_MAX);
+    ck_assert_uint_eq(h64->nrecord, 2 * (uint64_t)UINT32_MAX + 2);
+    ck_assert(histo_u64_report(&value, h64, 99.9) == HISTO_OK);
+    ck_assert_int_eq(value, 100);
+    ck_assert(histo_u64_report(&value, h64, 100) == HISTO_OK);
+    ck_assert_int_eq(value, 200);
+    ck_assert_int_eq(bucket_low_u64(h64, value), 200);
+    ck_assert(histo_u64_record(h64, 1 << 20, 1) == HISTO_EOVERFLOW);
+
+    /* serialized u32 histograms can be merged into a u64 one, not back */
+    ck_assert(histo_u32_serialize(buf, sizeof(buf), &len, h32) == HISTO_OK);
+    ck_assert(histo_u64_merge_serial(h64, buf, len) == HISTO_OK);
+    ck_assert_uint_eq(*(h64->buckets + 100), 3 * (uint64_t)UINT32_MAX);
+    ck_assert(histo_u64_serialize(buf, sizeof(buf), &len, h64) == HISTO_OK);
+    ck_assert(histo_u32_deserialize(h32, buf, len) == HISTO_EOVERFLOW);
+    ck_assert_int_eq(*(h32->buckets + 100), UINT32_MAX);
+    histo_u64_destroy(&h64);
+
+    /* values beyond 32 bits */
+    h64 = histo_u64_create(m, r, 40);
+    ck_assert_uint_eq(h64->N, (1ULL << 40) - 1);
+    ck_assert(histo_u64_record(h64, 1ULL << 39, 1) == HISTO_OK);
+    ck_assert(histo_u64_report(&value, h64, 100) == HISTO_OK);
+    ck_assert_int_eq(value, h64->nbucket - h64->G);
+    ck_assert_uint_eq(bucket_low_u64(h64, value), 1ULL << 39);
+
+    histo_u32_destroy(&h32);
+    histo_u64_destroy(&h64);
+#undef n
+#undef r
+#undef m
+}
+END_TEST
+
+#define NTHREAD 4
+#define NRECORD 100000
+
+static void *
+_record_atomic(void *arg)
+{
+    struct histo_u64 *h = arg;
+
+    for (int i = 0; i < NRECORD; ++i) {
+        histo_u64_record_atomic(h, i % 2048, 1);
+    }
+
+    return NULL;
+}
+
+START_TEST(test_record_atomic)
+{
+#define m 0
+#define r 10
+#define n 20
+    pthread_t tid[NTHREAD];
+    uint64_t sum = 0;
+    struct histo_u64 *h = histo_u64_create(m, r, n);
+
+    for (int i = 0; i < NTHREAD; ++i) {
+        ck_assert_int_eq(pthread_create(&tid[i], NULL, _record_atomic, h), 0);
+    }
+    for (int i = 0; i < NTHREAD; ++i) {
+        pthread_join(tid[i], NULL);
+    }
+
+    ck_assert_uint_eq(h->nrecord, NTHREAD * NRECORD);
+    for (uint64_t i = 0; i < h->nbucket; ++i) {
+        sum += *(h->buckets + i);
+    }
+    ck_assert_uint_eq(sum, NTHREAD * NRECORD);
+    sum = 0;
+    for (uint64_t i = 0; i < h->nblock; ++i) {
+        sum += *(h->blocks + i);
+    }
+    ck_assert_uint_eq(sum, NTHREAD * NRECORD);
+
+    histo_u64_destroy(&h);
+#undef n
+#undef r
+#undef m
+}
+END_TEST
+
+#define NROOM 1000
+
+static void *
+_record_atomic_full(void *arg)
+{
+    struct histo_u32 *h = arg;
+    uintptr_t nok = 0;
+
+    for (int i = 0; i < NROOM; ++i) {
+        if (histo_u32_record_atomic(h, 100, 1) == HISTO_OK) {
+            nok++;
+        }
+        /* a wrapped bucket is never published, not even for a moment */
+        ck_assert_uint_ge(__atomic_load_n(h->buckets + 100, __ATOMIC_RELAXED),
+                UINT32_MAX - NROOM);
+    }
+
+    return (void *)nok;
+}
+
+START_TEST(test_record_atomic_overflow)
+{
+#define m 0
+#define r 10
+#define n 20
+    pthread_t tid[NTHREAD];
+    uintptr_t nok = 0;
+    void *ret;
+    struct histo_u32 *h = histo_u32_create(m, r, n);
+
+    /* threads race for the last NROOM counts of a bucket */
+    ck_assert(histo_u32_record(h, 100, UINT32_MAX - NROOM) == HISTO_OK);
+    for (int i = 0; i < NTHREAD; ++i) {
+        ck_assert_int_eq(pthread_create(&tid[i], NULL, _record_atomic_full, h),
+                0);
+    }
+    for (int i = 0; i < NTHREAD; ++i) {
+        pthread_join(tid[i], &ret);
+        nok += (uintptr_t)ret;
+    }
+
+    ck_assert_uint_eq(nok, NROOM);
+    ck_assert_uint_eq(*(h->buckets + 100), UINT32_MAX);
+    ck_assert_uint_eq(h->nrecord, UINT32_MAX);
+
+    histo_u32_destroy(&h);
+#undef n
+#undef r
+#undef m
+}
+END_TEST
+#undef NROOM
+#undef NRECORD
+#undef NTHREAD
+
 START_TEST(test_bucket)
 {
 #define m 0
@@ -224,6 +638,12 @@ metric_suite(void)
     tcase_add_test(tc_histogram, test_record);
     tcase_add_test(tc_histogram, test_report_sparse);
     tcase_add_test(tc_histogram, test_report_exact);
+    tcase_add_test(tc_histogram, test_report_blocks);
+    tcase_add_test(tc_histogram, test_window);
+    tcase_add_test(tc_histogram, test_serialize);
+    tcase_add_test(tc_histogram, test_overflow);
+    tcase_add_test(tc_histogram, test_record_atomic);
+    tcase_add_test(tc_histogram, test_record_atomic_overflow);
     tcase_add_test(tc_histogram, test_bucket);
     return s;
 }
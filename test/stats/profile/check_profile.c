@@ -0,0 +1,260 @@
+#include <cc_profile.h>
+
+#include <cc_stats_log.h>
+
+#include <check.h>
+
+#include <pthread.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#define SUITE_NAME "profile"
+#define DEBUG_LOG  SUITE_NAME ".log"
+#define STATS_LOG  SUITE_NAME "_stats.log"
+
+#define NSPAN 2
+
+static struct profile_span spans[NSPAN];
+
+/*
+ * utilities
+ */
+static void
+test_setup(void)
+{
+    spans[0] = (struct profile_span){.name = "parse", .desc = "parsing"};
+    spans[1] = (struct profile_span){.name = "write", .desc = "writing"};
+    profile_setup(NULL);
+    ck_assert_int_eq(profile_span_create_all(spans, NSPAN), CC_OK);
+}
+
+static void
+test_teardown(void)
+{
+    profile_span_destroy_all(spans, NSPAN);
+    profile_teardown();
+}
+
+static void
+test_reset(void)
+{
+    test_teardown();
+    test_setup();
+}
+
+/*
+ * tests
+ */
+START_TEST(test_create)
+{
+    test_reset();
+
+    ck_assert(spans[0].histo != NULL);
+    ck_assert_str_eq(spans[0].metrics[0].name, "parse_count");
+    ck_assert_str_eq(spans[1].metrics[PROFILE_NMETRIC - 1].name, "write_max");
+    ck_assert_int_eq(spans[1].metrics[0].type, METRIC_GAUGE);
+    ck_assert_int_eq(spans[1].metrics[1].type, METRIC_GAUGE);
+
+    profile_span_destroy_all(spans, NSPAN);
+    ck_assert(spans[0].histo == NULL);
+    ck_assert(spans[0].metrics[0].name == NULL);
+}
+END_TEST
+
+START_TEST(test_report)
+{
+    uint64_t start;
+
+    test_reset();
+
+    /* 100 records of ~1ms: tick-to-ns conversion must be roughly right */
+    for (int i = 0; i < 100; i++) {
+        start = profile_tick();
+        usleep(1000);
+        profile_span_record(&spans[0], profile_tick() - start);
+    }
+
+    profile_report(spans, NSPAN);
+    ck_assert_int_eq(spans[0].metrics[0].gauge, 100);
+    ck_assert_int_ge(spans[0].metrics[1].gauge, 1000000);
+    ck_assert_int_lt(spans[0].metrics[1].gauge, 100000000);
+    ck_assert_int_ge(spans[0].metrics[PROFILE_NMETRIC - 1].gauge,
+            spans[0].metrics[1].gauge);
+    ck_assert_int_eq(spans[1].metrics[0].gauge, 0);
+    ck_assert_int_eq(spans[1].metrics[1].gauge, 0);
+
+    /* histograms are reset after each report */
+    ck_assert_int_eq(spans[0].histo->nrecord, 0);
+    profile_report(spans, NSPAN);
+    ck_assert_int_eq(spans[0].metrics[0].gauge, 0);
+
+    /* out of range latencies are recorded as the max value */
+    profile_span_record(&spans[1], UINT64_MAX);
+    ck_assert_int_eq(spans[1].histo->nrecord, 1);
+}
+END_TEST
+
+#define NTHREAD 4
+#define NRECORD 20000
+
+static void *
+record_worker(void *arg)
+{
+    for (int i = 0; i < NRECORD; i++) {
+        profile_span_record(&spans[0], i);
+    }
+
+    return NULL;
+}
+
+START_TEST(test_report_concurrent)
+{
+    pthread_t thread[NTHREAD];
+    int64_t total = 0;
+    int i;
+
+    test_reset();
+
+    /* no record is lost or torn by reports running alongside */
+    for (i = 0; i < NTHREAD; i++) {
+        ck_assert_int_eq(pthread_create(&thread[i], NULL, record_worker, NULL),
+                0);
+    }
+    while (total < NTHREAD * NRECORD / 2) {
+        profile_report(spans, NSPAN);
+        total += spans[0].metrics[0].gauge;
+    }
+    for (i = 0; i < NTHREAD; i++) {
+        ck_assert_int_eq(pthread_join(thread[i], NULL), 0);
+    }
+    profile_report(spans, NSPAN);
+    total += spans[0].metrics[0].gauge;
+
+    ck_assert_int_eq(total, NTHREAD * NRECORD);
+    ck_assert_int_eq(spans[0].histo->nrecord, 0);
+    ck_assert_int_eq(spans[0].spare->nrecord, 0);
+}
+END_TEST
+#undef NRECORD
+#undef NTHREAD
+
+START_TEST(test_stats_log)
+{
+    stats_log_options_st options = { STATS_LOG_OPTION(OPTION_INIT) };
+    char line[1024];
+    FILE *fp;
+
+    test_reset();
+
+    option_load_default((struct option *)&options,
+            OPTION_CARDINALITY(options));
+    options.stats_log_file.val.vstr = STATS_LOG;
+    stats_log_setup(&options);
+
+    profile_span_record(&spans[1], 1);
+    profile_stats_log(spans, NSPAN);
+    stats_log_teardown();
+
+    fp = fopen(STATS_LOG, "r");
+    ck_assert(fp != NULL);
+    ck_assert(fgets(line, sizeof(line), fp) != NULL);
+    ck_assert(strstr(line, "parse_count: 0, ") != NULL);
+    ck_assert(strstr(line, "parse_p999: ") != NULL);
+    ck_assert(fgets(line, sizeof(line), fp) != NULL);
+    ck_assert(strstr(line, "write_count: 1, ") != NULL);
+    fclose(fp);
+    unlink(STATS_LOG);
+}
+END_TEST
+
+#if defined CC_PROFILE && CC_PROFILE == 1
+START_TEST(test_macro)
+{
+#define TEST_SPAN(ACTION)                   \
+    ACTION( stage_a,    "first stage"      )\
+    ACTION( stage_b,    "second stage"     )
+
+    typedef struct {
+        TEST_SPAN(PROFILE_SPAN_DECLARE)
+    } test_spans_st;
+
+    test_spans_st test_spans = { TEST_SPAN(PROFILE_SPAN_INIT) };
+    int ran = 0, i;
+
+    test_reset();
+    ck_assert_int_eq(profile_span_create_all((struct profile_span *)&test_spans,
+                PROFILE_SPAN_CARDINALITY(test_spans)), CC_OK);
+
+    PROFILE_SPAN_BEGIN(test_spans.stage_a);
+    ran++;
+    PROFILE_SPAN_END(test_spans.stage_a);
+    ck_assert_int_eq(ran, 1);
+    ck_assert_int_eq(test_spans.stage_a.histo->nrecord, 1);
+    ck_assert_int_eq(test_spans.stage_b.histo->nrecord, 0);
+
+    /* break leaves the enclosing loop and skips recording */
+    for (i = 0; i < 3; i++) {
+        PROFILE_SPAN_BEGIN(test_spans.stage_b);
+        ran++;
+        if (i == 1) {
+            break;
+        }
+        PROFILE_SPAN_END(test_spans.stage_b);
+    }
+    ck_assert_int_eq(ran, 3);
+    ck_assert_int_eq(test_spans.stage_b.histo->nrecord, 1);
+
+    profile_span_destroy_all((struct profile_span *)&test_spans,
+            PROFILE_SPAN_CARDINALITY(test_spans));
+#undef TEST_SPAN
+}
+END_TEST
+#endif
+
+/*
+ * test suite
+ */
+static Suite *
+profile_suite(void)
+{
+    Suite *s = suite_create(SUITE_NAME);
+
+    TCase *tc_profile = tcase_create("cc_profile test");
+    suite_add_tcase(s, tc_profile);
+
+    tcase_add_test(tc_profile, test_create);
+    tcase_add_test(tc_profile, test_report);
+    tcase_add_test(tc_profile, test_report_concurrent);
+    tcase_add_test(tc_profile, test_stats_log);
+#if defined CC_PROFILE && CC_PROFILE == 1
+    tcase_add_test(tc_profile, test_macro);
+#endif
+
+    return s;
+}
+/**************
+ * test cases *
+ **************/
+
+int
+main(void)
+{
+    int nfail;
+
+    /* setup */
+    test_setup();
+
+    Suite *suite = profile_suite();
+    SRunner *srunner = srunner_create(suite);
+    srunner_set_log(srunner, DEBUG_LOG);
+    srunner_run_all(srunner, CK_ENV); /* set CK_VEBOSITY in ENV to customize */
+    nfail = srunner_ntests_failed(srunner);
+    srunner_free(srunner);
+
+    /* teardown */
+    test_teardown();
+
+    return (nfail == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,483 @@
+#include <stream/cc_sockio.h>
+
+#include <buffer/cc_buf.h>
+#include <buffer/cc_dbuf.h>
+#include <cc_bstring.h>
+#include <channel/cc_channel.h>
+#include <channel/cc_tcp.h>
+
+#include <check.h>
+
+#include <stdlib.h>
+#include <string.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+
+#define SUITE_NAME "sockio"
+#define DEBUG_LOG  SUITE_NAME ".log"
+
+#define TEST_BUF_CAP    32
+#define TEST_BUF_SIZE   (TEST_BUF_CAP + BUF_HDR_SIZE)
+
+static buf_metrics_st bmetrics;
+static dbuf_metrics_st dmetrics;
+static sockio_metrics_st smetrics;
+
+static buf_options_st boptions;
+static sockio_options_st soptions;
+
+/* data a fake channel hands out on recv */
+static char *input;
+static size_t ninput;
+
+static ssize_t
+_recv(channel_p ch, void *buf, size_t nbyte)
+{
+    size_t n = MIN(nbyte, ninput);
+
+    (void)ch;
+
+    if (n == 0) {
+        return CC_EAGAIN;
+    }
+    cc_memcpy(buf, input, n);
+    input += n;
+    ninput -= n;
+
+    return n;
+}
+
+static ssize_t
+_send(channel_p ch, void *buf, size_t nbyte)
+{
+    (void)ch;
+    (void)buf;
+
+    return nbyte;
+}
+
+static channel_handler_st handler = {
+    .recv = _recv,
+    .send = _send,
+};
+
+/*
+ * utilities
+ */
+static void
+test_setup(bool lazy, bool scratch)
+{
+    bmetrics = (buf_metrics_st) { BUF_METRIC(METRIC_INIT) };
+    dmetrics = (dbuf_metrics_st) { DBUF_METRIC(METRIC_INIT) };
+    smetrics = (sockio_metrics_st) { SOCKIO_METRIC(METRIC_INIT) };
+
+    boptions = (buf_options_st) { BUF_OPTION(OPTION_INIT) };
+    option_load_default((struct option *)&boptions,
+            OPTION_CARDINALITY(boptions));
+    boptions.buf_init_size.val.vuint = TEST_BUF_SIZE;
+
+    soptions = (sockio_options_st) { SOCKIO_OPTION(OPTION_INIT) };
+    option_load_default((struct option *)&soptions,
+            OPTION_CARDINALITY(soptions));
+    soptions.buf_sock_lazy.val.vbool = lazy;
+    soptions.buf_sock_scratch.val.vbool = scratch;
+
+    buf_setup(&boptions, &bmetrics);
+    dbuf_setup(NULL, &dmetrics);
+    sockio_setup(&soptions, &smetrics);
+}
+
+static void
+test_teardown(void)
+{
+    sockio_teardown();
+    dbuf_teardown();
+    buf_teardown();
+}
+
+static void
+test_reset(bool lazy, bool scratch)
+{
+    test_teardown();
+    test_setup(lazy, scratch);
+}
+
+static struct buf_sock *
+_borrow(void)
+{
+    struct buf_sock *s = buf_sock_borrow();
+
+    ck_assert_ptr_ne(s, NULL);
+    s->hdl = &handler;
+
+    return s;
+}
+
+static void
+_input(char *str)
+{
+    input = str;
+    ninput = strlen(str);
+}
+
+/*
+ * tests
+ */
+START_TEST(test_eager)
+{
+    struct buf_sock *s;
+
+    test_reset(false, false);
+
+    s = _borrow();
+    ck_assert_ptr_ne(s->rbuf, NULL);
+    ck_assert_ptr_ne(s->wbuf, NULL);
+
+    /* detach is a no-op unless in lazy mode */
+    buf_sock_detach(s);
+    ck_assert_ptr_ne(s->rbuf, NULL);
+    ck_assert_ptr_ne(s->wbuf, NULL);
+    ck_assert_int_eq(buf_sock_attach(s), CC_OK);
+    ck_assert_int_eq(smetrics.buf_sock_attach.counter, 0);
+
+    buf_sock_return(&s);
+}
+END_TEST
+
+START_TEST(test_lazy)
+{
+#define MSG "get foo\r\n"
+    struct buf_sock *s;
+
+    test_reset(true, false);
+
+    /* idle buf_sock holds no buffer */
+    s = _borrow();
+    ck_assert_ptr_eq(s->rbuf, NULL);
+    ck_assert_ptr_eq(s->wbuf, NULL);
+    ck_assert_int_eq(buf_tcp_write(s), CC_EEMPTY);
+
+    /* read attaches rbuf, detach returns it once drained */
+    _input(MSG);
+    ck_assert_int_eq(buf_tcp_read(s), CC_OK);
+    ck_assert_ptr_ne(s->rbuf, NULL);
+    ck_assert_ptr_eq(s->wbuf, NULL);
+    ck_assert_int_eq(buf_rsize(s->rbuf), sizeof(MSG) - 1);
+    ck_assert_int_eq(bmetrics.buf_active.gauge, 1);
+
+    s->rbuf->rpos += 4; /* partially consumed */
+    buf_sock_detach(s);
+    ck_assert_ptr_ne(s->rbuf, NULL);
+
+    s->rbuf->rpos = s->rbuf->wpos;
+    ck_assert_int_eq(buf_sock_attach(s), CC_OK);
+    ck_assert_ptr_ne(s->wbuf, NULL);
+    ck_assert_int_eq(bmetrics.buf_active.gauge, 2);
+    buf_write(s->wbuf, "END\r\n", 5);
+    ck_assert_int_eq(buf_tcp_write(s), CC_OK);
+
+    buf_sock_detach(s);
+    ck_assert_ptr_eq(s->rbuf, NULL);
+    ck_assert_ptr_eq(s->wbuf, NULL);
+    ck_assert_int_eq(bmetrics.buf_active.gauge, 0);
+    ck_assert_int_eq(smetrics.buf_sock_attach.counter, 2);
+    ck_assert_int_eq(smetrics.buf_sock_detach.counter, 2);
+
+    /* buffers are given back on return regardless of content */
+    _input(MSG);
+    ck_assert_int_eq(buf_tcp_read(s), CC_OK);
+    buf_sock_return(&s);
+    ck_assert_int_eq(bmetrics.buf_active.gauge, 0);
+
+    s = _borrow();
+    ck_assert_ptr_eq(s->rbuf, NULL);
+    buf_sock_return(&s);
+#undef MSG
+}
+END_TEST
+
+START_TEST(test_lazy_dbuf)
+{
+#define MSG "0123456789012345678901234567890123456789"
+    struct buf_sock *s;
+
+    test_reset(true, false);
+
+    s = _borrow();
+    _input(MSG);
+    ck_assert_int_eq(dbuf_tcp_read(s), CC_OK);
+    ck_assert_int_eq(buf_rsize(s->rbuf), sizeof(MSG) - 1);
+    ck_assert_int_eq(buf_size(s->rbuf), 2 * TEST_BUF_SIZE);
+
+    /* doubled buffer goes back to the pool of its size class */
+    s->rbuf->rpos = s->rbuf->wpos;
+    buf_sock_detach(s);
+    ck_assert_ptr_eq(s->rbuf, NULL);
+    ck_assert_int_eq(bmetrics.buf_active.gauge, 0);
+    ck_assert_int_eq(bmetrics.buf_memory.gauge, TEST_BUF_SIZE * 3);
+
+    buf_sock_return(&s);
+#undef MSG
+}
+END_TEST
+
+START_TEST(test_scratch)
+{
+#define MSG "get foo\r\n"
+    struct buf_sock *s;
+
+    test_reset(true, true);
+
+    s = _borrow();
+
+    /* fully consumed reads never touch the buf pool */
+    _input(MSG);
+    ck_assert_int_eq(buf_tcp_read(s), CC_OK);
+    ck_assert_ptr_ne(s->rbuf, NULL);
+    ck_assert_int_eq(smetrics.buf_sock_scratch.counter, 1);
+    s->rbuf->rpos = s->rbuf->wpos;
+    buf_sock_detach(s);
+    ck_assert_ptr_eq(s->rbuf, NULL);
+    ck_assert_int_eq(bmetrics.buf_borrow.counter, 0);
+
+    /* partial request is moved to a buffer from the pool */
+    _input(MSG);
+    ck_assert_int_eq(buf_tcp_read(s), CC_OK);
+    s->rbuf->rpos += 4;
+    buf_sock_detach(s);
+    ck_assert_ptr_ne(s->rbuf, NULL);
+    ck_assert_int_eq(bmetrics.buf_borrow.counter, 1);
+    ck_assert_int_eq(smetrics.buf_sock_promote.counter, 1);
+    ck_assert_int_eq(buf_rsize(s->rbuf), sizeof(MSG) - 5);
+    ck_assert_int_eq(cc_memcmp(s->rbuf->rpos, MSG + 4, sizeof(MSG) - 5), 0);
+
+    /* the rest of the request is appended to the attached buffer */
+    _input(MSG);
+    ck_assert_int_eq(buf_tcp_read(s), CC_OK);
+    ck_assert_int_eq(buf_rsize(s->rbuf), 2 * sizeof(MSG) - 6);
+    ck_assert_int_eq(smetrics.buf_sock_scratch.counter, 2);
+
+    buf_sock_return(&s);
+    ck_assert_int_eq(bmetrics.buf_active.gauge, 0);
+#undef MSG
+}
+END_TEST
+
+START_TEST(test_scratch_shared)
+{
+#define MSG "0123456789012345678901234567890123456789"
+    struct buf_sock *s1, *s2;
+
+    test_reset(true, true);
+
+    s1 = _borrow();
+    s2 = _borrow();
+
+    /* s1 keeps the scratch buffer until s2 needs it */
+    _input("get ");
+    ck_assert_int_eq(buf_tcp_read(s1), CC_OK);
+    _input("set ");
+    ck_assert_int_eq(buf_tcp_read(s2), CC_OK);
+    ck_assert_ptr_ne(s1->rbuf, s2->rbuf);
+    ck_assert_int_eq(smetrics.buf_sock_promote.counter, 1);
+    ck_assert_int_eq(cc_memcmp(s1->rbuf->rpos, "get ", 4), 0);
+    ck_assert_int_eq(cc_memcmp(s2->rbuf->rpos, "set ", 4), 0);
+
+    /* doubling moves data out of the scratch buffer first */
+    _input(MSG);
+    ck_assert_int_eq(dbuf_tcp_read(s2), CC_OK);
+    ck_assert_int_eq(smetrics.buf_sock_promote.counter, 2);
+    ck_assert_int_eq(buf_rsize(s2->rbuf), sizeof(MSG) + 3);
+    ck_assert_int_eq(cc_memcmp(s2->rbuf->rpos, "set " MSG, sizeof(MSG) + 3),
+            0);
+
+    buf_sock_return(&s1);
+    buf_sock_return(&s2);
+    ck_assert_int_eq(bmetrics.buf_active.gauge, 0);
+#undef MSG
+}
+END_TEST
+
+START_TEST(test_dbuf_fit_pending)
+{
+#define NBYTE 1000
+    struct buf_sock *s;
+    tcp_metrics_st tmetrics = { TCP_METRIC(METRIC_INIT) };
+    channel_handler_st tcp_handler = {
+        .recv = (channel_recv_fn)tcp_recv,
+    };
+    char data[NBYTE];
+    int sv[2];
+
+    test_reset(false, false);
+    tcp_setup(NULL, &tmetrics);
+
+    ck_assert_int_eq(socketpair(AF_UNIX, SOCK_STREAM, 0, sv), 0);
+    memset(data, 'x', NBYTE);
+    ck_assert_int_eq(write(sv[1], data, NBYTE), NBYTE);
+
+    s = _borrow();
+    s->hdl = &tcp_handler;
+    s->ch->sd = sv[0];
+    ck_assert_int_eq(tcp_set_nonblocking(sv[0]), 0);
+    ck_assert_int_eq(tcp_get_nread(sv[0]), NBYTE);
+
+    /* the first full recv is followed by a single fit and recv */
+    ck_assert_int_eq(dbuf_tcp_read(s), CC_OK);
+    ck_assert_int_eq(buf_rsize(s->rbuf), NBYTE);
+    ck_assert_int_eq(tmetrics.tcp_recv.counter, 2);
+    ck_assert_int_eq(dmetrics.dbuf_fit.counter, 1);
+    ck_assert_int_eq(dmetrics.dbuf_double.counter, 0);
+
+    buf_sock_return(&s);
+    close(sv[0]);
+    close(sv[1]);
+    tcp_teardown();
+#undef NBYTE
+}
+END_TEST
+
+START_TEST(test_zerocopy)
+{
+#define MSG "0123456789012345678901234567890"
+    struct buf_sock *s;
+    struct buf *wbuf;
+    struct tcp_conn *lc;
+    tcp_options_st toptions = { TCP_OPTION(OPTION_INIT) };
+    tcp_metrics_st tmetrics = { TCP_METRIC(METRIC_INIT) };
+    channel_handler_st tcp_handler = {
+        .send = (channel_send_fn)tcp_send,
+    };
+    struct sockaddr_in addr;
+    socklen_t len = sizeof(addr);
+    struct timespec wait = {0, 1000000}; /* 1ms */
+    char data[sizeof(MSG)];
+    uint64_t ndestroy;
+    int sd, i;
+
+    test_reset(false, false);
+    option_load_default((struct option *)&toptions,
+            OPTION_CARDINALITY(toptions));
+    toptions.tcp_zerocopy.val.vbool = true;
+    tcp_setup(&toptions, &tmetrics);
+    soptions.buf_sock_zc_min.val.vuint = 16;
+    sockio_setup(&soptions, &smetrics);
+
+    /* loopback connection, the accepted end sends zerocopy if supported */
+    lc = tcp_conn_create();
+    lc->sd = socket(AF_INET, SOCK_STREAM, 0);
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    ck_assert_int_eq(bind(lc->sd, (struct sockaddr *)&addr, len), 0);
+    ck_assert_int_eq(listen(lc->sd, 1), 0);
+    ck_assert_int_eq(getsockname(lc->sd, (struct sockaddr *)&addr, &len), 0);
+    sd = socket(AF_INET, SOCK_STREAM, 0);
+    ck_assert_int_eq(connect(sd, (struct sockaddr *)&addr, len), 0);
+
+    s = _borrow();
+    s->hdl = &tcp_handler;
+    ck_assert(tcp_accept(lc, s->ch));
+    if (!s->ch->zerocopy) { /* kernel without SO_ZEROCOPY support */
+        goto done;
+    }
+
+    /* small writes are copied */
+    ck_assert_int_eq(buf_write(s->wbuf, "END\r\n", 5), 5);
+    ck_assert_int_eq(buf_tcp_write(s), CC_OK);
+    ck_assert_int_eq(tmetrics.tcp_send_zc.counter, 0);
+    ck_assert_uint_eq(s->npinned, 0);
+
+    /* a drained wbuf sent zerocopy is pinned and replaced */
+    buf_reset(s->wbuf);
+    wbuf = s->wbuf;
+    ck_assert_int_eq(buf_write(s->wbuf, MSG, sizeof(MSG)), sizeof(MSG));
+    ck_assert_int_eq(buf_tcp_write(s), CC_OK);
+    ck_assert_int_eq(tmetrics.tcp_send_zc.counter, 1);
+    ck_assert_int_eq(tmetrics.tcp_send_zc_byte.counter, sizeof(MSG));
+    ck_assert_uint_eq(s->npinned, 1);
+    ck_assert_ptr_eq(s->pinned[0], wbuf);
+    ck_assert_ptr_ne(s->wbuf, wbuf);
+    ck_assert_int_eq(buf_rsize(s->wbuf), 0);
+
+    /* and released once the completion arrives */
+    for (i = 0; i < 1000 && s->npinned > 0; i++) {
+        ck_assert_int_eq(buf_tcp_reap(s), CC_OK);
+        nanosleep(&wait, NULL);
+    }
+    ck_assert_uint_eq(s->npinned, 0);
+    ck_assert_int_eq(tmetrics.tcp_zc_complete.counter, 1);
+    ck_assert_int_eq(smetrics.buf_sock_unpin.counter, 1);
+    ck_assert(!tcp_zc_pending(s->ch));
+
+    ck_assert_int_eq(read(sd, data, 5), 5);
+    ck_assert_int_eq(read(sd, data, sizeof(MSG)), sizeof(MSG));
+    ck_assert_int_eq(cc_memcmp(data, MSG, sizeof(MSG)), 0);
+
+    /* bufs still pinned when the buf_sock goes are freed, not pooled */
+    ck_assert_int_eq(buf_write(s->wbuf, MSG, sizeof(MSG)), sizeof(MSG));
+    ck_assert_int_eq(buf_tcp_write(s), CC_OK);
+    ck_assert_uint_eq(s->npinned, 1);
+    ndestroy = bmetrics.buf_destroy.counter;
+    close(s->ch->sd);
+    buf_sock_return(&s);
+    ck_assert_int_eq(bmetrics.buf_destroy.counter, ndestroy + 1);
+    ck_assert_int_eq(smetrics.buf_sock_unpin_ex.counter, 1);
+
+done:
+    if (s != NULL) {
+        close(s->ch->sd);
+        buf_sock_return(&s);
+    }
+    close(sd);
+    close(lc->sd);
+    tcp_conn_destroy(&lc);
+    tcp_teardown();
+#undef MSG
+}
+END_TEST
+
+/*
+ * test suite
+ */
+static Suite *
+sockio_suite(void)
+{
+    Suite *s = suite_create(SUITE_NAME);
+
+    TCase *tc_sockio = tcase_create("sockio test");
+    suite_add_tcase(s, tc_sockio);
+
+    tcase_add_test(tc_sockio, test_eager);
+    tcase_add_test(tc_sockio, test_lazy);
+    tcase_add_test(tc_sockio, test_lazy_dbuf);
+    tcase_add_test(tc_sockio, test_scratch);
+    tcase_add_test(tc_sockio, test_scratch_shared);
+    tcase_add_test(tc_sockio, test_dbuf_fit_pending);
+    tcase_add_test(tc_sockio, test_zerocopy);
+
+    return s;
+}
+
+int
+main(void)
+{
+    int nfail;
+
+    /* setup */
+    test_setup(false, false);
+
+    Suite *suite = sockio_suite();
+    SRunner *srunner = srunner_create(suite);
+    srunner_set_log(srunner, DEBUG_LOG);
+    srunner_run_all(srunner, CK_ENV); /* set CK_VEBOSITY in ENV to customize */
+    nfail = srunner_ntests_failed(srunner);
+    srunner_free(srunner);
+
+    /* teardown */
+    test_teardown();
+
+    return (nfail == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}